@@ -10,8 +10,9 @@ from .compress import array_compress
 from .decompress import array_decompress_slice
 from .hdf5 import write_compressed as hdf5_write_compressed
 from .hdf5 import read_compressed as hdf5_read_compressed
+from .io_common import DatasetBytes
 from .mpi import global_bytes, global_array_properties
-from .utils import log, compressed_dtype
+from .utils import LRUCache, log, compressed_dtype, function_timer, keep_streams
 from .zarr import write_compressed as zarr_write_compressed
 from .zarr import read_compressed as zarr_read_compressed
 
@@ -68,6 +69,40 @@ class FlacArray:
     sequence of FLAC bytes, which is appended to the bytestream.  The offset in bytes
     for each stream is recorded.
 
+    If `segment_size` is given to `from_array()`, each stream is compressed as a
+    sequence of independent segments of this many samples.  The starting byte of each
+    segment within its stream is stored in the `stream_segments` array.  This allows
+    threads to work on pieces of long streams, and slicing a range of samples only
+    decodes the segments that overlap that range.
+
+    If `seek_table=True` is given to `from_array()`, the starting byte of every FLAC
+    frame within its stream is stored in the `stream_frames` array.  Every frame has
+    `frame_size` samples (except the last one in each segment), so slicing a range of
+    samples starts decoding directly at the frame containing the first sample.
+
+    If `checksums=True` is given to `from_array()`, a CRC32C checksum of the
+    compressed bytes of every stream (one per segment, when using segments) is stored
+    in the `stream_checksums` array.  It is written and read with the other arrays, and
+    decoding with `verify=True` checks the bytes of the decoded streams against it.
+
+    Code which repeatedly indexes overlapping slices of the same streams can enable a
+    cache of decoded samples with `set_decode_cache()`.  Each stream is then decoded
+    in blocks of samples, which are kept until the cache is full, and slicing the
+    array only decodes the blocks which are not already cached.
+
+    The compiled encoding, decoding, and type conversion functions release the Python
+    GIL while they run, so other Python threads (for example, doing I/O) can run at the
+    same time.  Each thread uses its own FLAC encoders and decoders, and it is safe to
+    create or decompress distinct FlacArrays from several threads at once.  A FlacArray
+    is never modified after construction, so one instance may also be shared between
+    threads which decompress (or write) it concurrently.  The input numpy array must
+    not be modified while it is being compressed, and the arrays returned by the
+    properties of a shared FlacArray must not be modified.  When using MPI, the usual
+    thread support level of the MPI library applies to the collective operations done
+    by `from_array()` and the I/O functions.  An array which is loaded lazily (see
+    `read_hdf5()`) updates its cache of compressed bytes when decompressing, which is
+    also safe to do from several threads.
+
     A FlacArray is only constructed directly when making a copy.  Use the class methods
     to create FlacArrays from numpy arrays or on-disk representations.
 
@@ -89,18 +124,21 @@ class FlacArray:
         stream_gains=None,
         mpi_comm=None,
         mpi_dist=None,
+        stream_aux=None,
     ):
         if other is not None:
             # We are copying an existing object, make sure we have an
             # independent copy.
             self._shape = copy.deepcopy(other._shape)
             self._global_shape = copy.deepcopy(other._global_shape)
-            self._compressed = copy.deepcopy(other._compressed)
+            # The copy of a lazily loaded array holds all of its bytes.
+            self._compressed = copy.deepcopy(other.compressed)
             self._dtype = np.dtype(other._dtype)
             self._stream_starts = copy.deepcopy(other._stream_starts)
             self._stream_nbytes = copy.deepcopy(other._stream_nbytes)
             self._stream_offsets = copy.deepcopy(other._stream_offsets)
             self._stream_gains = copy.deepcopy(other._stream_gains)
+            self._stream_aux = copy.deepcopy(other._stream_aux)
             self._mpi_dist = copy.deepcopy(other._mpi_dist)
             # MPI communicators can be limited in number and expensive to create.
             self._mpi_comm = other._mpi_comm
@@ -115,6 +153,10 @@ class FlacArray:
             self._stream_nbytes = stream_nbytes
             self._stream_offsets = stream_offsets
             self._stream_gains = stream_gains
+            if stream_aux is None:
+                self._stream_aux = dict()
+            else:
+                self._stream_aux = stream_aux
             self._mpi_comm = mpi_comm
             self._mpi_dist = mpi_dist
         self._init_params()
@@ -132,6 +174,9 @@ class FlacArray:
             self._flatten_single = False
             self._local_shape = self._shape
 
+        self._lazy = isinstance(self._compressed, DatasetBytes)
+        self._decode_cache = None
+        self._cache_block = None
         self._local_nbytes = self._compressed.nbytes
         (
             self._global_nbytes,
@@ -220,9 +265,26 @@ class FlacArray:
 
     @property
     def compressed(self):
-        """The concatenated raw bytes of all streams on the local process."""
+        """The concatenated raw bytes of all streams on the local process.
+
+        For an array which is loaded lazily, this reads all of the bytes.
+        """
+        if self._lazy:
+            return self._compressed.read()[0]
         return self._compressed
 
+    @property
+    def decode_cache(self):
+        """The cache of decoded blocks (see `set_decode_cache()`), or None."""
+        return self._decode_cache
+
+    @property
+    def byte_cache(self):
+        """The cache of stream bytes of a lazily loaded array, or None."""
+        if self._lazy:
+            return self._compressed.cache
+        return None
+
     @property
     def stream_starts(self):
         """The array of starting bytes for each stream on the local process."""
@@ -253,6 +315,41 @@ class FlacArray:
         """The gain factor for each stream during conversion to int32."""
         return self._stream_gains
 
+    @property
+    def stream_aux(self):
+        """The dictionary of optional per-stream arrays and their parameters."""
+        return self._stream_aux
+
+    @property
+    def segment_size(self):
+        """The number of samples in each independent segment, or None."""
+        return self._stream_aux.get("segment_size", None)
+
+    @property
+    def stream_segments(self):
+        """The starting bytes of each segment relative to the stream start, or None."""
+        return self._stream_aux.get("stream_segments", None)
+
+    @property
+    def frame_size(self):
+        """The number of samples in each FLAC frame, or None without a seek table."""
+        return self._stream_aux.get("frame_size", None)
+
+    @property
+    def stream_frames(self):
+        """The starting bytes of each frame relative to the stream start, or None."""
+        return self._stream_aux.get("stream_frames", None)
+
+    @property
+    def checksum_type(self):
+        """The type of the stream checksums, or None without checksums."""
+        return self._stream_aux.get("checksum_type", None)
+
+    @property
+    def stream_checksums(self):
+        """The CRC32C of the compressed bytes of each stream or segment, or None."""
+        return self._stream_aux.get("stream_checksums", None)
+
     @property
     def mpi_comm(self):
         """The MPI communicator over which the array is distributed."""
@@ -276,30 +373,21 @@ class FlacArray:
     # __getitem__ slicing / decompression on the fly and associated
     # helper functions.
 
-    def _slice_nelem(self, slc, dim):
-        """Get the number of elements in a slice."""
-        start, stop, step = slc.indices(dim)
-        nslc = (stop - start) // step
-        if nslc < 0:
-            nslc = 0
-        return nslc
-
-    def _keep_view(self, key):
-        """Convert leading-shape key to bool array."""
-        if len(key) != len(self._leading_shape):
-            msg = f"keep_view {key} does not match leading "
-            msg += f"dimensions {len(self._leading_shape)}"
-            raise ValueError(msg)
-        view = np.zeros(self._leading_shape, dtype=bool)
-        view[key] = True
-        return view
+    def _key_ndim(self, axkey):
+        """Get the number of dimensions selected by one element of a key."""
+        if isinstance(axkey, (np.ndarray, list)):
+            axkey = np.asarray(axkey)
+            if axkey.dtype == np.dtype(bool):
+                # A boolean mask selects over all of its dimensions
+                return max(axkey.ndim, 1)
+        return 1
 
     def _get_full_key(self, key):
         """Process the incoming key so that it covers all dimensions.
 
         Args:
             key (tuple):  The input key consisting of an integer or a tuple
-                of slices and / or integers.
+                of slices, integers and / or index arrays.
 
         Result:
             (tuple):  The full key.
@@ -327,55 +415,51 @@ class FlacArray:
             else:
                 full_key.append(key)
 
-        if len(full_key) > ndim:
+        filled = np.sum([self._key_ndim(x) for x in full_key], dtype=np.int64)
+        if filled > ndim:
             msg = f"Invalid slice key {key}, too many dimensions"
             raise ValueError(msg)
 
         # Fill in remaining dimensions
-        filled = len(full_key)
-        full_key.extend([slice(None) for x in range(len(self._local_shape) - filled)])
+        full_key.extend([slice(None) for x in range(ndim - filled)])
         return full_key
 
     def _get_leading_axes(self, full_key):
         """Process the leading axes.
 
+        The leading axes may be selected with integers, slices, or integer and
+        boolean index arrays, with the usual numpy semantics.  The selection is
+        applied to the array of flat stream indices, so that the selected streams
+        are found without any per-stream work in python.
+
         Args:
             full_key (tuple):  The full-rank selection key.
 
         Returns:
-            (tuple):  The (leading_shape, keep array).
+            (tuple):  The (leading_shape, stream indices).  The stream indices
+                have the leading shape of the result.
 
         """
-        leading_shape = list()
-        keep_slice = list()
-
         if self._flatten_single:
             # Our array is a single stream with flattened shape.
-            keep_slice = [0,]
-        else:
-            for axis, axkey in enumerate(full_key[:-1]):
-                if not isinstance(axkey, (int, np.integer)):
-                    # Some kind of slice, do not compress this dimension.
-                    nslc = self._slice_nelem(axkey, self._local_shape[axis])
-                    leading_shape.append(nslc)
-                else:
-                    # Check for validity
-                    if axkey < 0 or axkey >= self._local_shape[axis]:
-                        # Insert a zero-length dimension so that a zero-length
-                        # array is returned in the calling code.
-                        leading_shape.append(0)
-                    else:
-                        # This dimension is a single element and will be
-                        # compressed.
-                        pass
-                keep_slice.append(axkey)
-        leading_shape = tuple(leading_shape)
-        keep_slice = tuple(keep_slice)
-        if len(keep_slice) == 0:
-            keep = None
-        else:
-            keep = self._keep_view(keep_slice)
-        return leading_shape, keep
+            return (), np.zeros((), dtype=np.int64)
+
+        local_leading = self._local_shape[:-1]
+        lead_key = list()
+        axis = 0
+        for axkey in full_key[:-1]:
+            if isinstance(axkey, (int, np.integer)):
+                # Check for validity
+                if axkey < 0 or axkey >= local_leading[axis]:
+                    # Insert a zero-length dimension so that a zero-length
+                    # array is returned in the calling code.
+                    axkey = slice(0, 0)
+            lead_key.append(axkey)
+            axis += self._key_ndim(axkey)
+        n_stream = np.prod(local_leading, dtype=np.int64)
+        index = np.arange(n_stream, dtype=np.int64).reshape(local_leading)
+        streams = index[tuple(lead_key)]
+        return streams.shape, streams
 
     def _get_sample_axis(self, full_key):
         """Process any slicing of the stream axis.
@@ -406,21 +490,104 @@ class FlacArray:
             msg = "Stream dimension supports contiguous slices or single indices."
             raise ValueError(msg)
 
+    def set_decode_cache(self, max_bytes, block_size=None):
+        """Enable or disable the cache of decoded samples.
+
+        When enabled, indexing the array decodes each selected stream in blocks of
+        `block_size` samples, and the blocks are kept in a cache of at most
+        `max_bytes` of decoded data, evicting the least recently used blocks.  Only
+        the blocks of a slice which are not in the cache are decoded.  The number of
+        blocks found and not found is given by `decode_cache.stats()`.
+
+        By default the blocks are the frames of the seek table, if the array has one.
+        Otherwise they are the segments of each stream, or whole streams, since a
+        decode starting elsewhere must first search the stream.
+
+        Slices with `verify=True` are always decoded without using the cache.
+        Enabling the cache again replaces any cached blocks.
+
+        Args:
+            max_bytes (int):  The size of the cache in bytes, or None to disable it.
+            block_size (int):  The number of samples in each cached block.
+
+        Returns:
+            None
+
+        """
+        if max_bytes is None:
+            self._decode_cache = None
+            self._cache_block = None
+            return
+        if block_size is None:
+            if self.frame_size is not None:
+                block_size = self.frame_size
+            elif self.segment_size is not None:
+                block_size = self.segment_size
+            else:
+                block_size = self._stream_size
+        if block_size <= 0:
+            raise ValueError("The block size must be a positive number of samples")
+        self._cache_block = int(block_size)
+        self._decode_cache = LRUCache(max_bytes)
+
+    def _stream_bytes(self, streams):
+        """Get the compressed bytes and stream starts for decoding some streams.
+
+        For an array which is loaded lazily, only the selected streams are read (or
+        found in the cache), and the returned starts are only valid for them.
+
+        Args:
+            streams (array):  The flat indices of the streams, or None for all.
+
+        Returns:
+            (tuple):  The (compressed bytes, stream starts).
+
+        """
+        if self._lazy:
+            return self._compressed.read(streams)
+        return (self._compressed, self._stream_starts)
+
     def __getitem__(self, raw_key):
         """Decompress a slice of data on the fly.
 
+        The leading dimensions may also be indexed with integer or boolean arrays,
+        as with numpy arrays.  Only the selected streams are decoded.
+
         Args:
-            raw_key (tuple):  A tuple of slices or integers.
+            raw_key (tuple):  A tuple of slices, integers or index arrays.
 
         Returns:
             (array):  The decompressed array slice.
 
+        """
+        return self.get(raw_key)
+
+    @function_timer
+    def get(self, raw_key, out=None, use_threads=False, verify=False):
+        """Decompress a slice of data, optionally into an existing array.
+
+        This is the same as indexing the array with `raw_key`, but the slice may be
+        decoded directly into `out` instead of a new array.  The output must have
+        the shape and type of the slice, and the samples of each stream must be
+        contiguous, but it may otherwise be any view, such as a block of rows of a
+        larger preallocated array.
+
+        Args:
+            raw_key (tuple):  A tuple of slices, integers or index arrays.
+            out (array):  If not None, the array to decode into.
+            use_threads (bool):  If True, use OpenMP threads to parallelize decoding.
+            verify (bool):  If True, check the compressed bytes of the decoded
+                streams against their checksums (see `from_array()`).
+
+        Returns:
+            (array):  The decompressed array slice (`out` if given).
+
         """
         # Get the key for all dimensions
         key = self._get_full_key(raw_key)
 
-        # Compute the output leading shape and keep array
-        leading_shape, keep = self._get_leading_axes(key)
+        # Compute the output leading shape and selected streams
+        leading_shape, streams = self._get_leading_axes(key)
 
         # Compute sample axis slice
         first, last, sample_shape = self._get_sample_axis(key)
@@ -430,24 +597,141 @@ class FlacArray:
             n_total = 0
         else:
             n_total = np.prod(full_shape)
+        if out is not None:
+            if out.shape != full_shape:
+                msg = f"The output has shape {out.shape}, expected {full_shape}"
+                raise ValueError(msg)
         if n_total == 0:
             # At least one dimension was zero, return empty array
+            if out is not None:
+                return out
             return np.zeros(full_shape, dtype=self._dtype)
         else:
-            arr, strm_indices = array_decompress_slice(
-                self._compressed,
+            if self._decode_cache is not None and not verify:
+                arr = self._decode_cached(streams, first, last, use_threads)
+                if out is not None:
+                    out[...] = arr.reshape(full_shape)
+                    return out
+                return arr.reshape(full_shape)
+            dec_out = None
+            if out is not None:
+                dec_out = self._decode_view(out, sample_shape)
+            compressed, stream_starts = self._stream_bytes(streams)
+            arr, _ = array_decompress_slice(
+                compressed,
                 self._stream_size,
-                self._stream_starts,
+                stream_starts,
                 self._stream_nbytes,
                 stream_offsets=self._stream_offsets,
                 stream_gains=self._stream_gains,
-                keep=keep,
                 first_stream_sample=first,
                 last_stream_sample=last,
                 is_int64=self._is_int64,
+                use_threads=use_threads,
+                stream_aux=self._stream_aux,
+                out=dec_out,
+                verify=verify,
+                streams=streams,
             )
+            if out is not None:
+                return out
             return arr.reshape(full_shape)
 
+    def _decode_view(self, out, sample_shape):
+        """Get a view of an output slice with the shape produced by the decoder.
+
+        Args:
+            out (array):  The output array with the shape of the slice.
+            sample_shape (tuple):  The shape of the sample axis of the slice.
+
+        Returns:
+            (array):  A view of `out` with the decoded shape.
+
+        """
+        if len(sample_shape) == 0:
+            # A single sample is still decoded along the final dimension.
+            return out[..., np.newaxis]
+        return out
+
+    def _decode_cached(self, streams, first, last, use_threads):
+        """Decode a slice of samples using the cache of decoded blocks.
+
+        For each stream, the range from the first to the last missing block is
+        decoded, and streams with the same range are decoded together.
+
+        Args:
+            streams (array):  The flat indices of the selected streams.
+            first (int):  The first sample of the slice.
+            last (int):  The last sample (exclusive) of the slice.
+            use_threads (bool):  If True, use OpenMP threads to parallelize decoding.
+
+        Returns:
+            (array):  The slice, with the shape of `streams` plus the sample axis.
+
+        """
+        cache = self._decode_cache
+        bsize = self._cache_block
+        first_block = first // bsize
+        last_block = (last - 1) // bsize + 1
+
+        # Find the cached blocks and the range of missing blocks of each stream
+        blocks = dict()
+        missing = dict()
+        for stream in np.unique(streams).tolist():
+            lo = None
+            for blk in range(first_block, last_block):
+                data = cache.get((stream, blk))
+                if data is None:
+                    if lo is None:
+                        lo = blk
+                    hi = blk + 1
+                else:
+                    blocks[(stream, blk)] = data
+            if lo is not None:
+                missing.setdefault((lo, hi), list()).append(stream)
+
+        # Decode the missing ranges
+        for (lo, hi), group in missing.items():
+            dec_first = lo * bsize
+            dec_last = min(hi * bsize, self._stream_size)
+            group_streams = np.array(group, dtype=np.int64)
+            compressed, stream_starts = self._stream_bytes(group_streams)
+            arr, _ = array_decompress_slice(
+                compressed,
+                self._stream_size,
+                stream_starts,
+                self._stream_nbytes,
+                stream_offsets=self._stream_offsets,
+                stream_gains=self._stream_gains,
+                first_stream_sample=dec_first,
+                last_stream_sample=dec_last,
+                is_int64=self._is_int64,
+                use_threads=use_threads,
+                stream_aux=self._stream_aux,
+                streams=group_streams,
+            )
+            arr = arr.reshape((len(group), dec_last - dec_first))
+            for row, stream in enumerate(group):
+                for blk in range(lo, hi):
+                    blk_first = blk * bsize - dec_first
+                    blk_last = min((blk + 1) * bsize, self._stream_size) - dec_first
+                    data = arr[row, blk_first:blk_last].copy()
+                    blocks[(stream, blk)] = data
+                    cache.put((stream, blk), data)
+
+        # Copy the requested samples from the blocks
+        flat = streams.reshape((-1,)).tolist()
+        result = np.empty((len(flat), last - first), dtype=self._dtype)
+        for row, stream in enumerate(flat):
+            for blk in range(first_block, last_block):
+                data = blocks[(stream, blk)]
+                blk_first = blk * bsize
+                lo = max(first, blk_first)
+                hi = min(last, blk_first + len(data))
+                rows = result[row, lo - first : hi - first]
+                rows[:] = data[lo - blk_first : hi - blk_first]
+        return result.reshape(streams.shape + (last - first,))
+
     def __delitem__(self, key):
         raise RuntimeError("Cannot delete individual streams")
 
@@ -481,8 +765,8 @@ class FlacArray:
             msg = f"other starts {other._stream_starts} != {self._stream_starts}"
             log.debug(msg)
             return False
-        if not np.array_equal(self._compressed, other._compressed):
-            msg = f"other compressed {other._compressed} != {self._compressed}"
+        if not np.array_equal(self.compressed, other.compressed):
+            msg = f"other compressed {other.compressed} != {self.compressed}"
             log.debug(msg)
             return False
         if self._stream_offsets is None:
@@ -513,14 +797,44 @@ class FlacArray:
                     msg += f"{self._stream_gains}"
                     log.debug(msg)
                     return False
+        if self.segment_size != other.segment_size:
+            msg = f"other segment_size {other.segment_size} != {self.segment_size}"
+            log.debug(msg)
+            return False
+        if not np.array_equal(self.stream_segments, other.stream_segments):
+            msg = f"other stream_segments {other.stream_segments} != "
+            msg += f"{self.stream_segments}"
+            log.debug(msg)
+            return False
+        if self.frame_size != other.frame_size:
+            msg = f"other frame_size {other.frame_size} != {self.frame_size}"
+            log.debug(msg)
+            return False
+        if not np.array_equal(self.stream_frames, other.stream_frames):
+            msg = f"other stream_frames {other.stream_frames} != "
+            msg += f"{self.stream_frames}"
+            log.debug(msg)
+            return False
+        if self.checksum_type != other.checksum_type:
+            msg = f"other checksum_type {other.checksum_type} != {self.checksum_type}"
+            log.debug(msg)
+            return False
+        if not np.array_equal(self.stream_checksums, other.stream_checksums):
+            msg = f"other stream_checksums {other.stream_checksums} != "
+            msg += f"{self.stream_checksums}"
+            log.debug(msg)
+            return False
         return True
 
+    @function_timer
     def to_array(
         self,
         keep=None,
         stream_slice=None,
         keep_indices=False,
         use_threads=False,
+        out=None,
+        verify=False,
     ):
         """Decompress local data into a numpy array.
 
@@ -544,6 +858,10 @@ class FlacArray:
         a list of tuples, each of which specifies the indices of the stream in the
         original array.
 
+        If `out` is specified, the data is decoded directly into this array, which
+        must have the shape and type of the result.  The samples of each stream must
+        be contiguous, but `out` may be a strided view of a larger array.
+
         Args:
             keep (array):  Bool array of streams to keep in the decompression.
             stream_slice (slice):  A python slice with step size of one, indicating
@@ -552,6 +870,9 @@ class FlacArray:
                 streams.
             use_threads (bool):  If True, use OpenMP threads to parallelize decoding.
                 This is only beneficial for large arrays.
+            out (array):  If not None, the array to decode into.
+            verify (bool):  If True, check the compressed bytes of the decoded
+                streams against their checksums (see `from_array()`).
 
         """
         first_samp = None
@@ -564,10 +885,14 @@ class FlacArray:
             first_samp = stream_slice.start
             last_samp = stream_slice.stop
 
+        if keep is None:
+            compressed, stream_starts = self._stream_bytes(None)
+        else:
+            compressed, stream_starts = self._stream_bytes(keep_streams(keep))
         arr, indices = array_decompress_slice(
-            self._compressed,
+            compressed,
             self._stream_size,
-            self._stream_starts,
+            stream_starts,
             self._stream_nbytes,
             stream_offsets=self._stream_offsets,
             stream_gains=self._stream_gains,
@@ -577,6 +902,9 @@ class FlacArray:
             is_int64=self._is_int64,
             use_threads=use_threads,
             no_flatten=(not self._flatten_single),
+            stream_aux=self._stream_aux,
+            out=out,
+            verify=verify,
         )
         if keep is not None and keep_indices:
             return (arr, indices)
@@ -584,8 +912,21 @@ class FlacArray:
             return arr
 
     @classmethod
+    @function_timer
     def from_array(
-        cls, arr, level=5, quanta=None, precision=None, mpi_comm=None, use_threads=False
+        cls,
+        arr,
+        level=5,
+        quanta=None,
+        precision=None,
+        mpi_comm=None,
+        use_threads=False,
+        segment_size=None,
+        n_threads=None,
+        seek_table=False,
+        max_memory=None,
+        checksums=False,
+        md5=True,
     ):
         """Construct a FlacArray from a numpy ndarray.
 
@@ -603,6 +944,17 @@ class FlacArray:
                 local piece of the array is passed in on each process.
             use_threads (bool):  If True, use OpenMP threads to parallelize decoding.
                 This is only beneficial for large arrays.
+            segment_size (int):  If not None, compress each stream in independent
+                segments of this many samples.
+            n_threads (int):  If not None, the total number of threads to use.  See
+                `encode_flac()`.
+            seek_table (bool):  If True, record the starting byte of every FLAC
+                frame, so that slices of samples are decoded without seeking.
+            max_memory (int):  If not None, the limit in bytes on the memory used
+                for the streams being compressed when `use_threads` is True.
+            checksums (bool):  If True, record a checksum of the compressed bytes
+                of every stream (or segment), which can be checked when decoding.
+            md5 (bool):  If False, skip the unused MD5 signature of the input.
 
         Returns:
             (FlacArray):  A newly constructed FlacArray.
@@ -614,12 +966,19 @@ class FlacArray:
         mpi_dist = global_props["dist"]
 
         # Compress our local piece of the array
-        compressed, starts, nbytes, offsets, gains = array_compress(
+        compressed, starts, nbytes, offsets, gains, stream_aux = array_compress(
             arr,
             level=level,
             quanta=quanta,
             precision=precision,
             use_threads=use_threads,
+            segment_size=segment_size,
+            return_aux=True,
+            n_threads=n_threads,
+            seek_table=seek_table,
+            max_memory=max_memory,
+            checksums=checksums,
+            md5=md5,
         )
 
         return FlacArray(
@@ -634,8 +993,10 @@ class FlacArray:
             stream_gains=gains,
             mpi_comm=mpi_comm,
             mpi_dist=mpi_dist,
+            stream_aux=stream_aux,
         )
 
+    @function_timer
     def write_hdf5(self, hgrp):
         """Write data to an HDF5 Group.
 
@@ -660,6 +1021,7 @@ class FlacArray:
             n_channels = 2
         else:
             n_channels = 1
+        compressed = self.compressed
 
         hdf5_write_compressed(
             hgrp,
@@ -671,16 +1033,18 @@ class FlacArray:
             self._stream_nbytes,
             self._stream_offsets,
             self._stream_gains,
-            self._compressed,
+            compressed,
             n_channels,
-            self._compressed.nbytes,
+            compressed.nbytes,
             self._global_nbytes,
             self._global_proc_nbytes,
             self._mpi_comm,
             self._mpi_dist,
+            stream_aux=self._stream_aux,
         )
 
     @classmethod
+    @function_timer
     def read_hdf5(
         cls,
         hgrp,
@@ -688,6 +1052,10 @@ class FlacArray:
         mpi_comm=None,
         mpi_dist=None,
         no_flatten=False,
+        read_gap=None,
+        mmap=False,
+        lazy=False,
+        cache_bytes=None,
     ):
         """Construct a FlacArray from an HDF5 Group.
 
@@ -709,6 +1077,24 @@ class FlacArray:
         the original.  Instead it will be a 2D array of decompressed streams- the
         streams corresponding to True values in the `keep` mask.
 
+        If `mmap` is True and the compressed bytes are stored contiguously and without
+        filters in the file (the default when writing), the compressed bytes of the
+        array are a read-only memory map of the file rather than a copy in memory.
+        Opening the array is then nearly free, and the pages of the file are loaded
+        by the operating system only as streams are decompressed.  The file must
+        remain in place (but need not stay open) for the lifetime of the array.  If
+        `keep` selects streams which are not contiguous in the file, they are read
+        into memory as usual.
+
+        If `lazy` is True, only the per-stream arrays are loaded, and the compressed
+        bytes of streams are read from the file when they are decompressed by
+        indexing the array or calling `to_array()`.  The bytes of recently read
+        streams are kept in a cache of at most `cache_bytes` (see `byte_cache`), so
+        that opening even a very large array is fast and memory is only used for the
+        streams which are accessed.  The file must remain open for the lifetime of
+        the array.  Accessing the `compressed` property (for example when writing the
+        array) reads all of the bytes.
+
         Args:
             hgrp (h5py.Group):  The open Group for reading.
             keep (array):  Bool array of streams to keep in the decompression.
@@ -718,6 +1104,12 @@ class FlacArray:
                 when distributing the leading dimension.
             no_flatten (bool):  If True, for single-stream arrays, leave the leading
                 dimension of (1,) in the result.
+            read_gap (int):  The largest gap in bytes between kept streams which
+                are read together.  If None, the default in `io_common` is used.
+            mmap (bool):  If True, memory map the compressed bytes when possible.
+            lazy (bool):  If True, read the compressed bytes only when needed.
+            cache_bytes (int):  If `lazy` is True, the size of the cache of stream
+                bytes.  If None, the default in `io_common` is used.
 
         Returns:
             (FlacArray):  A newly constructed FlacArray.
@@ -734,13 +1126,21 @@ class FlacArray:
             stream_gains,
             mpi_dist,
             keep_indices,
+            stream_aux,
         ) = hdf5_read_compressed(
             hgrp,
             keep=keep,
             mpi_comm=mpi_comm,
             mpi_dist=mpi_dist,
+            return_aux=True,
+            read_gap=read_gap,
+            mmap=mmap,
+            lazy=lazy,
         )
 
+        if cache_bytes is not None and isinstance(compressed, DatasetBytes):
+            compressed.cache = LRUCache(cache_bytes)
+
         dt = compressed_dtype(n_channels, stream_offsets, stream_gains)
 
         if (len(local_shape) == 2 and local_shape[0] == 1) and not no_flatten:
@@ -761,9 +1161,11 @@ class FlacArray:
             stream_gains=stream_gains,
             mpi_comm=mpi_comm,
             mpi_dist=mpi_dist,
+            stream_aux=stream_aux,
         )
 
-    def write_zarr(self, zgrp):
+    @function_timer
+    def write_zarr(self, zgrp, chunk_bytes=None, shard_chunks=None):
         """Write data to an Zarr Group.
 
         The internal object properties are written to an open zarr group.
@@ -772,8 +1174,16 @@ class FlacArray:
         be communicated to the rank zero process for writing.  In this case, the `zgrp`
         argument should be None except on the root process.
 
+        If `chunk_bytes` is specified, the compressed bytes are written in chunks of
+        this size which each contain whole streams, so that reading a subset of
+        streams only fetches their chunks.  See `zarr.write_compressed()`.
+
         Args:
             zgrp (zarr.Group):  The open Group for writing.
+            chunk_bytes (int):  If not None, the target size in bytes of the chunks
+                of compressed bytes, aligned to whole streams.
+            shard_chunks (int):  If not None, the number of chunks in each shard.
+                This requires Zarr 3.
 
         Returns:
             None
@@ -783,6 +1193,7 @@ class FlacArray:
             n_channels = 2
         else:
             n_channels = 1
+        compressed = self.compressed
         zarr_write_compressed(
             zgrp,
             self._leading_shape,
@@ -793,16 +1204,20 @@ class FlacArray:
             self._stream_nbytes,
             self._stream_offsets,
             self._stream_gains,
-            self._compressed,
+            compressed,
             n_channels,
-            self._compressed.nbytes,
+            compressed.nbytes,
             self._global_nbytes,
             self._global_proc_nbytes,
             self._mpi_comm,
             self._mpi_dist,
+            stream_aux=self._stream_aux,
+            chunk_bytes=chunk_bytes,
+            shard_chunks=shard_chunks,
         )
 
     @classmethod
+    @function_timer
     def read_zarr(
         cls,
         zgrp,
@@ -810,6 +1225,9 @@ class FlacArray:
         mpi_comm=None,
         mpi_dist=None,
         no_flatten=False,
+        read_gap=None,
+        lazy=False,
+        cache_bytes=None,
     ):
         """Construct a FlacArray from a Zarr Group.
 
@@ -829,6 +1247,15 @@ class FlacArray:
         the original.  Instead it will be a 2D array of decompressed streams- the
         streams corresponding to True values in the `keep` mask.
 
+        If `lazy` is True, only the per-stream arrays are loaded, and the compressed
+        bytes of streams are read from the group when they are decompressed by
+        indexing the array or calling `to_array()`.  The bytes of recently read
+        streams are kept in a cache of at most `cache_bytes` (see `byte_cache`), so
+        that opening even a very large array is fast and memory is only used for the
+        streams which are accessed.  The group must remain open for the lifetime of
+        the array.  Accessing the `compressed` property (for example when writing the
+        array) reads all of the bytes.
+
         Args:
             zgrp (zarr.Group):  The open Group for reading.
             keep (array):  Bool array of streams to keep in the decompression.
@@ -838,6 +1265,11 @@ class FlacArray:
                 when distributing the leading dimension.
             no_flatten (bool):  If True, for single-stream arrays, leave the leading
                 dimension of (1,) in the result.
+            read_gap (int):  The largest gap in bytes between kept streams which
+                are read together.  If None, the default in `io_common` is used.
+            lazy (bool):  If True, read the compressed bytes only when needed.
+            cache_bytes (int):  If `lazy` is True, the size of the cache of stream
+                bytes.  If None, the default in `io_common` is used.
 
         Returns:
             (FlacArray):  A newly constructed FlacArray.
@@ -854,13 +1286,20 @@ class FlacArray:
             stream_gains,
             mpi_dist,
             keep_indices,
+            stream_aux,
         ) = zarr_read_compressed(
             zgrp,
             keep=keep,
             mpi_comm=mpi_comm,
             mpi_dist=mpi_dist,
+            return_aux=True,
+            read_gap=read_gap,
+            lazy=lazy,
         )
 
+        if cache_bytes is not None and isinstance(compressed, DatasetBytes):
+            compressed.cache = LRUCache(cache_bytes)
+
         dt = compressed_dtype(n_channels, stream_offsets, stream_gains)
 
         if (len(local_shape) == 2 and local_shape[0] == 1) and not no_flatten:
@@ -881,4 +1320,5 @@ class FlacArray:
             stream_gains=stream_gains,
             mpi_comm=mpi_comm,
             mpi_dist=mpi_dist,
+            stream_aux=stream_aux,
         )
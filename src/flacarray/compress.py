@@ -4,12 +4,25 @@
 
 import numpy as np
 
-from .libflacarray import encode_flac
-from .utils import float_to_int, function_timer
+from .libflacarray import encode_flac, encode_flac_float
+from .utils import function_timer, resolve_quanta
 
 
 @function_timer
-def array_compress(arr, level=5, quanta=None, precision=None, use_threads=False):
+def array_compress(
+    arr,
+    level=5,
+    quanta=None,
+    precision=None,
+    use_threads=False,
+    segment_size=None,
+    return_aux=False,
+    n_threads=None,
+    seek_table=False,
+    max_memory=None,
+    checksums=False,
+    md5=True,
+):
     """Compress a numpy array with optional floating point conversion.
 
     If `arr` is an int32 array, the returned stream offsets and gains will be None.
@@ -22,11 +35,30 @@ def array_compress(arr, level=5, quanta=None, precision=None, use_threads=False)
     and gain arrays returned.  See discussion in the `FlacArray` class documentation
     about how the offsets and gains are computed for a given quanta.
 
+    The input array may be any view, such as a slice or the transpose of a larger
+    array.  Views which are not C-contiguous are compressed in place, without making
+    a contiguous copy.
+
     The shape of the returned auxiliary arrays (starts, nbytes, etc) will have a shape
     corresponding to the leading shape of the input array.  If the input array is a
     single stream, the returned auxiliary information will be arrays with a single
     element.
 
+    If `segment_size` is specified, each stream is encoded as independent segments
+    of this many samples.  This allows a few long streams to be compressed and
+    decompressed with all threads, and allows decompressing a slice of samples
+    without decoding the segments outside that slice.  The starting byte of each
+    segment is needed for decompression, and is returned (along with any other
+    optional per-stream arrays) in a dictionary if `return_aux` is True.
+
+    If `seek_table` is True, the starting byte of every FLAC frame is also returned
+    in the auxiliary arrays.  Decompressing a slice of samples then starts directly
+    at the frame containing the first sample, rather than searching the stream.
+
+    If `checksums` is True, a CRC32C checksum of the compressed bytes of every
+    stream (or segment) is also returned in the auxiliary arrays.  These can be
+    checked when decompressing with `verify=True`.
+
     Args:
         arr (numpy.ndarray):  The input array data.
         level (int):  Compression level (0-8).
@@ -38,14 +70,36 @@ def array_compress(arr, level=5, quanta=None, precision=None, use_threads=False)
             iterable of values, one per stream.
         use_threads (bool):  If True, use OpenMP threads to parallelize decoding.
             This is only beneficial for large arrays.
+        segment_size (int):  If not None, encode each stream in independent
+            segments of this many samples.
+        return_aux (bool):  If True, also return the dictionary of auxiliary
+            per-stream arrays.  This is required when using segments.
+        n_threads (int):  If not None, the total number of threads to use.  See
+            `encode_flac()`.
+        seek_table (bool):  If True, record the starting byte of every frame in the
+            auxiliary arrays.  This requires `return_aux`.
+        max_memory (int):  If not None, the limit in bytes on the memory used for
+            the streams being compressed when `use_threads` is True, in addition to
+            the output.  See `encode_flac()`.
+        checksums (bool):  If True, compute the checksums of the compressed streams
+            in the auxiliary arrays.  This requires `return_aux`.
+        md5 (bool):  If False, skip the MD5 signature which libFLAC computes for
+            the input of each stream.  This is never stored, so disabling it only
+            saves time.
 
     Returns:
         (tuple): The (compressed bytes, stream starts, stream_nbytes, stream offsets,
-            stream gains)
+            stream gains) and the auxiliary arrays if requested.
 
     """
     if arr.size == 0:
         raise ValueError("Cannot compress a zero-sized array!")
+    if segment_size is not None and not return_aux:
+        raise RuntimeError("Compressing with segments requires return_aux=True")
+    if seek_table and not return_aux:
+        raise RuntimeError("Compressing with a seek table requires return_aux=True")
+    if checksums and not return_aux:
+        raise RuntimeError("Compressing with checksums requires return_aux=True")
     leading_shape = arr.shape[:-1]
 
     if arr.dtype == np.dtype(np.float32) or arr.dtype == np.dtype(np.float64):
@@ -71,14 +125,43 @@ def array_compress(arr, level=5, quanta=None, precision=None, use_threads=False)
         else:
             # We are using precision instead
             dquanta = None
-        idata, foff, gains = float_to_int(arr, quanta=dquanta, precision=precision)
-        (compressed, starts, nbytes) = encode_flac(
-            idata, level, use_threads=use_threads
+        if np.any(np.isnan(arr)):
+            raise RuntimeError("Cannot convert data with NaNs to integers")
+        # Quantize the data as it is encoded, rather than allocating the full
+        # integer array.
+        (compressed, starts, nbytes, foff, gains, stream_aux) = encode_flac_float(
+            arr,
+            level,
+            quanta=resolve_quanta(arr, quanta=dquanta, precision=precision),
+            use_threads=use_threads,
+            segment_size=segment_size,
+            return_aux=True,
+            n_threads=n_threads,
+            seek_table=seek_table,
+            max_memory=max_memory,
+            checksums=checksums,
+            md5=md5,
         )
-        return (compressed, starts, nbytes, foff, gains)
     elif arr.dtype == np.dtype(np.int32) or arr.dtype == np.dtype(np.int64):
         # Integer data
-        (compressed, starts, nbytes) = encode_flac(arr, level, use_threads=use_threads)
-        return (compressed, starts, nbytes, None, None)
+        foff = None
+        gains = None
+        (compressed, starts, nbytes, stream_aux) = encode_flac(
+            arr,
+            level,
+            use_threads=use_threads,
+            segment_size=segment_size,
+            return_aux=True,
+            n_threads=n_threads,
+            seek_table=seek_table,
+            max_memory=max_memory,
+            checksums=checksums,
+            md5=md5,
+        )
     else:
         raise ValueError(f"Unsupported data type '{arr.dtype}'")
+
+    if return_aux:
+        return (compressed, starts, nbytes, foff, gains, stream_aux)
+    else:
+        return (compressed, starts, nbytes, foff, gains)
@@ -4,12 +4,11 @@
 
 import numpy as np
 
-from .libflacarray import decode_flac
+from .libflacarray import decode_flac, decode_flac_float
 from .utils import (
-    int_to_float,
-    keep_select,
     function_timer,
-    select_keep_indices,
+    keep_streams,
+    stream_indices,
     ensure_one_element,
 )
 
@@ -28,6 +27,10 @@ def array_decompress_slice(
     is_int64=False,
     use_threads=False,
     no_flatten=False,
+    stream_aux=None,
+    out=None,
+    verify=False,
+    streams=None,
 ):
     """Decompress a slice of a FLAC encoded array and restore original data type.
 
@@ -53,6 +56,21 @@ def array_decompress_slice(
     tuple will contain an array with the original N-dimensional leading array shape
     and the trailing number of samples.  The second element of the tuple will be None.
 
+    Alternatively, an integer array of the flat (C order) indices of the streams to
+    decompress may be passed to the `streams` argument.  The leading shape of the
+    output is then the shape of this array, and the second element of the tuple is
+    None.  Streams may be selected in any order, or more than once.
+
+    In both cases the selected streams are decoded in parallel directly from the
+    full per-stream arrays, without first extracting the selected elements of
+    those arrays.
+
+    If `out` is specified, the streams are decoded directly into this array, which
+    must have the shape and type of the result described above.  The samples of each
+    stream must be contiguous in memory, but `out` may otherwise be any view, for
+    example a block of rows of a larger preallocated array.  The returned array is
+    then `out` itself.
+
     Args:
         compressed (array):  The array of compressed bytes.
         stream_size (int):  The length of the decompressed final dimension.
@@ -68,6 +86,14 @@ def array_decompress_slice(
             This is only beneficial for large arrays.
         no_flatten (bool):  If True, for single-stream arrays, leave the leading
             dimension of (1,) in the result.
+        stream_aux (dict):  The optional auxiliary per-stream arrays returned by
+            `array_compress`.  This is required if the data was compressed in
+            segments.
+        out (array):  If not None, the array to decode into.
+        verify (bool):  If True, check the compressed bytes against the checksums in
+            `stream_aux` before decoding.
+        streams (array):  Integer array of the flat indices of the streams to
+            decompress.  This cannot be used with `keep`.
 
     Returns:
         (tuple): The (output array, list of stream indices).
@@ -97,24 +123,47 @@ def array_decompress_slice(
                 stream_offsets = ensure_one_element(stream_offsets, np.float32)
                 stream_gains = ensure_one_element(stream_gains, np.float32)
 
-    starts, nbytes, indices = keep_select(keep, stream_starts, stream_nbytes)
-    offsets = select_keep_indices(stream_offsets, indices)
-    gains = select_keep_indices(stream_gains, indices)
+    indices = None
+    if keep is not None:
+        if streams is not None:
+            raise RuntimeError("Cannot select streams with both keep and streams")
+        if keep.shape != stream_starts.shape:
+            msg = "The keep array should have the same shape as stream_starts"
+            raise RuntimeError(msg)
+        streams = keep_streams(keep)
+        indices = stream_indices(streams, keep.shape)
+        out_shape = streams.shape
+    elif streams is not None:
+        streams = np.asarray(streams)
+        out_shape = streams.shape
+    else:
+        out_shape = stream_starts.shape
+
+    # The decoders always produce the leading stream dimension.
+    dec_out = out
+    if out is not None and out.ndim == 1 and out_shape == (1,):
+        dec_out = out[np.newaxis, :]
 
     if stream_offsets is not None:
         if stream_gains is not None:
-            # This is floating point data.
-            idata = decode_flac(
+            # This is floating point data.  The offsets and gains are applied as
+            # each frame is decoded.
+            fdtype = np.float64 if is_int64 else np.float32
+            arr = decode_flac_float(
                 compressed,
-                starts,
-                nbytes,
+                stream_starts,
+                stream_nbytes,
                 stream_size,
+                np.asarray(stream_offsets, dtype=fdtype),
+                np.asarray(stream_gains, dtype=fdtype),
                 first_sample=first_stream_sample,
                 last_sample=last_stream_sample,
                 use_threads=use_threads,
-                is_int64=is_int64,
+                stream_aux=stream_aux,
+                out=dec_out,
+                verify=verify,
+                streams=streams,
             )
-            arr = int_to_float(idata, offsets, gains)
         else:
             raise RuntimeError(
                 "When specifying offsets, you must also provide the gains"
@@ -127,14 +176,20 @@ def array_decompress_slice(
         # This is integer data
         arr = decode_flac(
             compressed,
-            starts,
-            nbytes,
+            stream_starts,
+            stream_nbytes,
             stream_size,
             first_sample=first_stream_sample,
             last_sample=last_stream_sample,
             use_threads=use_threads,
             is_int64=is_int64,
+            stream_aux=stream_aux,
+            out=dec_out,
+            verify=verify,
+            streams=streams,
         )
+    if out is not None:
+        return (out, indices)
     if is_scalar and not no_flatten:
         return (arr.reshape((-1)), indices)
     else:
@@ -154,6 +209,9 @@ def array_decompress(
     is_int64=False,
     use_threads=False,
     no_flatten=False,
+    stream_aux=None,
+    out=None,
+    verify=False,
 ):
     """Decompress a FLAC encoded array and restore original data type.
 
@@ -183,6 +241,13 @@ def array_decompress(
             This is only beneficial for large arrays.
         no_flatten (bool):  If True, for single-stream arrays, leave the leading
             dimension of (1,) in the result.
+        stream_aux (dict):  The optional auxiliary per-stream arrays returned by
+            `array_compress`.  This is required if the data was compressed in
+            segments.
+        out (array):  If not None, the array to decode into.  See
+            `array_decompress_slice()`.
+        verify (bool):  If True, check the compressed bytes against the checksums in
+            `stream_aux` before decoding.
 
     Returns:
         (array): The output array.
@@ -201,5 +266,8 @@ def array_decompress(
         is_int64=is_int64,
         use_threads=use_threads,
         no_flatten=no_flatten,
+        stream_aux=stream_aux,
+        out=out,
+        verify=verify,
     )
     return arr
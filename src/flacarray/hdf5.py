@@ -16,7 +16,13 @@ import numpy as np
 from . import __version__ as flacarray_version
 from .compress import array_compress
 from .hdf5_utils import have_hdf5, hdf5_use_serial, check_dataset_buffer_size
-from .io_common import receive_write_compressed
+from .io_common import (
+    receive_write_compressed,
+    split_stream_aux,
+    stream_aux_params,
+    streams_narrowed,
+    writer_format_version,
+)
 from .mpi import global_array_properties, global_bytes
 from .utils import function_timer, ensure_one_element
 
@@ -36,6 +42,8 @@ class WriterHDF5:
         dataset_comp,
         dataset_offsets,
         dataset_gains,
+        stream_aux=None,
+        dataset_aux=None,
     ):
         self._starts = global_stream_starts
         self._nbytes = stream_nbytes
@@ -47,6 +55,8 @@ class WriterHDF5:
         self._dcomp = dataset_comp
         self._doffsets = dataset_offsets
         self._dgains = dataset_gains
+        self._aux = stream_aux if stream_aux is not None else dict()
+        self._daux = dataset_aux if dataset_aux is not None else dict()
 
     @property
     def starts(self):
@@ -68,6 +78,10 @@ class WriterHDF5:
     def gains(self):
         return self._gains
 
+    @property
+    def aux(self):
+        return self._aux
+
     def save(self, dset, buf, mpi_comm, dslc, fslc):
         rank = 0
         if mpi_comm is not None:
@@ -88,6 +102,9 @@ class WriterHDF5:
     def save_gains(self, buf, mpi_comm, dslc, fslc):
         return self.save(self._dgains, buf, mpi_comm, dslc, fslc)
 
+    def save_aux(self, name, buf, mpi_comm, dslc, fslc):
+        return self.save(self._daux.get(name, None), buf, mpi_comm, dslc, fslc)
+
     def save_compressed(self, buf, mpi_comm, dslc, fslc):
         return self.save(self._dcomp, buf, mpi_comm, dslc, fslc)
 
@@ -110,6 +127,7 @@ def write_compressed(
     global_process_nbytes,
     mpi_comm,
     mpi_dist,
+    stream_aux=None,
 ):
     """Write compressed data to an HDF5 group.
 
@@ -126,6 +144,9 @@ def write_compressed(
     In the case of a single stream, all auxiliary datasets will still contain an
     array (of a single element).
 
+    Optional per-stream arrays (for example the segment starting bytes) are written
+    to their own datasets, with the describing parameter as an attribute.
+
     Args:
         hgrp (h5py.Group):  The Group to use.
         leading_shape (tuple):  Shape of the local leading dimensions.
@@ -143,6 +164,8 @@ def write_compressed(
         global_process_nbytes (list):  The number of compressed bytes on each process.
         mpi_comm (MPI.Comm):  The MPI communicator.
         mpi_dist (list):  The range of the leading dimension on each process.
+        stream_aux (dict):  The optional auxiliary per-stream arrays and their
+            parameters.
 
     Returns:
         None
@@ -151,7 +174,7 @@ def write_compressed(
     if not have_hdf5:
         raise RuntimeError("h5py is not importable, cannot write to HDF5")
 
-    # Writer is currently using version 1
+    # Versions 1 and 2 share the dataset and attribute names
     from .hdf5_load_v1 import hdf5_names as hnames
 
     comm = mpi_comm
@@ -170,6 +193,7 @@ def write_compressed(
     dcomp = None
     dsoff = None
     dsgain = None
+    daux = dict()
 
     aux_global_shape = global_leading_shape
     aux_local_shape = leading_shape
@@ -189,10 +213,23 @@ def write_compressed(
                 stream_offsets = ensure_one_element(stream_offsets, np.float32)
                 stream_gains = ensure_one_element(stream_gains, np.float32)
 
+    # Optional arrays keep any trailing dimensions after the leading shape
+    aux_arrays, aux_params = split_stream_aux(stream_aux)
+    aux_trailing = dict()
+    for name, arr in aux_arrays.items():
+        aux_trailing[name] = arr.shape[len(aux_local_shape) :]
+
+    # Every process takes part in checking for narrowed streams
+    narrowed = streams_narrowed(
+        compressed, stream_starts, stream_nbytes, n_channels, stream_aux, comm
+    )
+
     if rank == 0 or not use_serial:
         # This process is participating.  Write the format version string
         # to the top-level group.
-        hgrp.attrs["flacarray_format_version"] = "1"
+        hgrp.attrs["flacarray_format_version"] = writer_format_version(
+            stream_aux=stream_aux, narrowed=narrowed
+        )
         hgrp.attrs["flacarray_software_version"] = flacarray_version
         hgrp.attrs[hnames["flac_channels"]] = f"{n_channels}"
 
@@ -237,6 +274,16 @@ def write_compressed(
         else:
             dsgain = None
 
+        # Optional per-stream arrays
+        for name, arr in aux_arrays.items():
+            daux[name] = hgrp.create_dataset(
+                hnames[name],
+                aux_global_shape + aux_trailing[name],
+                dtype=arr.dtype,
+            )
+            param = stream_aux_params[name]
+            daux[name].attrs[hnames[param]] = aux_params[param]
+
         # Always have compressed bytes
         dcomp = hgrp.create_dataset(
             hnames["compressed"],
@@ -257,6 +304,8 @@ def write_compressed(
             dcomp,
             dsoff,
             dsgain,
+            stream_aux=aux_arrays,
+            dataset_aux=daux,
         )
         receive_write_compressed(
             writer,
@@ -299,6 +348,11 @@ def write_compressed(
             with dsgain.collective:
                 dsgain.write_direct(stream_gains, dslc, hslc)
 
+        for name, arr in aux_arrays.items():
+            tslc = tuple([slice(0, x) for x in aux_trailing[name]])
+            with daux[name].collective:
+                daux[name].write_direct(arr, dslc + tslc, hslc + tslc)
+
         dslc = (slice(0, global_process_nbytes[rank]),)
         hslc = (slice(comp_doff[rank], comp_doff[rank] + global_process_nbytes[rank]),)
         check_dataset_buffer_size(
@@ -310,7 +364,19 @@ def write_compressed(
 
 @function_timer
 def write_array(
-    arr, hgrp, level=5, quanta=None, precision=None, mpi_comm=None, use_threads=False
+    arr,
+    hgrp,
+    level=5,
+    quanta=None,
+    precision=None,
+    mpi_comm=None,
+    use_threads=False,
+    segment_size=None,
+    n_threads=None,
+    seek_table=False,
+    max_memory=None,
+    checksums=False,
+    md5=True,
 ):
     """Compress a numpy array and write to an HDF5 group.
 
@@ -340,6 +406,17 @@ def write_array(
             local piece of the array is passed in on each process.
         use_threads (bool):  If True, use OpenMP threads to parallelize decoding.
             This is only beneficial for large arrays.
+        segment_size (int):  If not None, compress each stream in independent
+            segments of this many samples.
+        n_threads (int):  If not None, the total number of threads to use.  See
+            `encode_flac()`.
+        seek_table (bool):  If True, also write the starting byte of every FLAC
+            frame, so that reading a slice of samples can decode it directly.
+        max_memory (int):  If not None, the limit in bytes on the memory used for
+            the streams being compressed when `use_threads` is True.
+        checksums (bool):  If True, also write a checksum of the compressed bytes of
+            every stream (or segment), which can be checked when reading.
+        md5 (bool):  If False, skip the unused MD5 signature of the input.
 
     Returns:
         None
@@ -360,8 +437,19 @@ def write_array(
         n_channels = 1
 
     # Compress our local piece of the array
-    compressed, starts, nbytes, offsets, gains = array_compress(
-        arr, level=level, quanta=quanta, precision=precision, use_threads=use_threads
+    compressed, starts, nbytes, offsets, gains, stream_aux = array_compress(
+        arr,
+        level=level,
+        quanta=quanta,
+        precision=precision,
+        use_threads=use_threads,
+        segment_size=segment_size,
+        return_aux=True,
+        n_threads=n_threads,
+        seek_table=seek_table,
+        max_memory=max_memory,
+        checksums=checksums,
+        md5=md5,
     )
 
     local_nbytes = compressed.nbytes
@@ -393,11 +481,21 @@ def write_array(
         global_proc_bytes,
         mpi_comm,
         mpi_dist,
+        stream_aux=stream_aux,
     )
 
 
 @function_timer
-def read_compressed(hgrp, keep=None, mpi_comm=None, mpi_dist=None):
+def read_compressed(
+    hgrp,
+    keep=None,
+    mpi_comm=None,
+    mpi_dist=None,
+    return_aux=False,
+    read_gap=None,
+    mmap=False,
+    lazy=False,
+):
     """Load compressed data from HDF5.
 
     This function acts as a dispatch to the correct version of the reading
@@ -419,6 +517,18 @@ def read_compressed(hgrp, keep=None, mpi_comm=None, mpi_dist=None):
             the leading dimension of the array.
         mpi_dist (list):  The optional list of tuples specifying the first / last
             element of the leading dimension to assign to each process.
+        return_aux (bool):  If True, also return the dictionary of optional
+            auxiliary per-stream arrays.  This is required if the data contains
+            segmented streams.  Otherwise the optional arrays are not loaded.
+        read_gap (int):  The largest gap in bytes between kept streams which are
+            read together.  If None, the default in `io_common` is used.
+        mmap (bool):  If True, the local compressed bytes are a read-only memory
+            map of the file when they are stored contiguously and without filters.
+            Otherwise they are read into memory.
+        lazy (bool):  If True, the local compressed bytes are not read.  Instead
+            an `io_common.DatasetBytes` instance is returned in their place, which
+            reads the bytes of streams as they are needed.  The group must remain
+            open while it is used.
 
     Returns:
         (tuple):  The compressed data and metadata.
@@ -444,6 +554,10 @@ def read_compressed(hgrp, keep=None, mpi_comm=None, mpi_dist=None):
         keep=keep,
         mpi_comm=mpi_comm,
         mpi_dist=mpi_dist,
+        return_aux=return_aux,
+        read_gap=read_gap,
+        mmap=mmap,
+        lazy=lazy,
     )
 
 
@@ -456,6 +570,9 @@ def read_array(
     mpi_comm=None,
     mpi_dist=None,
     use_threads=False,
+    verify=False,
+    read_gap=None,
+    mmap=False,
 ):
     """Load a numpy array from compressed HDF5.
 
@@ -493,6 +610,13 @@ def read_array(
             element of the leading dimension to assign to each process.
         use_threads (bool):  If True, use OpenMP threads to parallelize decoding.
             This is only beneficial for large arrays.
+        verify (bool):  If True, check the compressed bytes of each stream against
+            the checksums written with the data before decoding.
+        read_gap (int):  The largest gap in bytes between kept streams which are
+            read together.  If None, the default in `io_common` is used.
+        mmap (bool):  If True, the local compressed bytes are a read-only memory
+            map of the file when they are stored contiguously and without filters.
+            Otherwise they are read into memory.
 
     Returns:
         (array):  The loaded and decompressed data OR the array and the kept indices.
@@ -522,4 +646,7 @@ def read_array(
         mpi_dist=mpi_dist,
         use_threads=use_threads,
         no_flatten=False,
+        verify=verify,
+        read_gap=read_gap,
+        mmap=mmap,
     )
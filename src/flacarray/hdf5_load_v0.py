@@ -64,6 +64,11 @@ class ReaderHDF5:
     def stream_gain_dtype(self):
         return self._gains_dtype
 
+    @property
+    def aux_shapes(self):
+        # Version 0 data has no auxiliary arrays
+        return dict()
+
     def load(self, dset, mpi_comm, fslc, dslc):
         rank = 0
         if mpi_comm is not None:
@@ -87,9 +92,21 @@ class ReaderHDF5:
     def load_gains(self, mpi_comm, fslc, dslc):
         return self.load(self._gains, mpi_comm, fslc, dslc)
 
+    def load_aux(self, name, mpi_comm, fslc, dslc):
+        return None
+
 
 @function_timer
-def read_compressed(hgrp, keep=None, mpi_comm=None, mpi_dist=None):
+def read_compressed(
+    hgrp,
+    keep=None,
+    mpi_comm=None,
+    mpi_dist=None,
+    return_aux=False,
+    read_gap=None,
+    mmap=False,
+    lazy=False,
+):
     """Load compressed data from an HDF group.
 
     If `stream_slice` is specified, the returned array will have only that
@@ -110,6 +127,17 @@ def read_compressed(hgrp, keep=None, mpi_comm=None, mpi_dist=None):
             the leading dimension of the array.
         mpi_dist (list):  The optional list of tuples specifying the first / last
             element of the leading dimension to assign to each process.
+        return_aux (bool):  If True, also return the (always empty) dictionary of
+            auxiliary per-stream arrays.
+        read_gap (int):  The largest gap in bytes between kept streams which are
+            read together.  If None, the default in `io_common` is used.
+        mmap (bool):  If True, the local compressed bytes are a read-only memory
+            map of the file when they are stored contiguously and without filters.
+            Otherwise they are read into memory.
+        lazy (bool):  If True, the local compressed bytes are not read.  Instead
+            an `io_common.DatasetBytes` instance is returned in their place, which
+            reads the bytes of streams as they are needed.  The group must remain
+            open while it is used.
 
     Returns:
         (tuple):  The compressed data and metadata.
@@ -197,6 +225,7 @@ def read_compressed(hgrp, keep=None, mpi_comm=None, mpi_dist=None):
             stream_offsets,
             stream_gains,
             keep_indices,
+            _,
         ) = read_send_compressed(
             reader,
             global_shape,
@@ -204,6 +233,9 @@ def read_compressed(hgrp, keep=None, mpi_comm=None, mpi_dist=None):
             keep=keep,
             mpi_comm=mpi_comm,
             mpi_dist=mpi_dist,
+            read_gap=read_gap,
+            mmap=mmap,
+            lazy=lazy,
         )
     else:
         # We are using parallel HDF5.  All processes have a handle to the dataset
@@ -246,7 +278,13 @@ def read_compressed(hgrp, keep=None, mpi_comm=None, mpi_dist=None):
         # Compressed bytes.  Apply our stream selection and load just those
         # streams we are keeping for this process.
         compressed, local_starts, keep_indices = read_compressed_dataset_slice(
-            dcomp, proc_keep, raw_starts, raw_nbytes
+            dcomp,
+            proc_keep,
+            raw_starts,
+            raw_nbytes,
+            read_gap=read_gap,
+            mmap=mmap,
+            lazy=lazy,
         )
 
         # Cut our other arrays to only include the indices selected by the keep mask.
@@ -263,7 +301,7 @@ def read_compressed(hgrp, keep=None, mpi_comm=None, mpi_dist=None):
     # For version 0, the number of channels is always "1", since int64 flac encoding
     # was not yet supported.  We handle the int64 case in the read_array() function.
 
-    return (
+    result = (
         local_shape,
         global_shape,
         compressed,
@@ -275,6 +313,9 @@ def read_compressed(hgrp, keep=None, mpi_comm=None, mpi_dist=None):
         mpi_dist,
         keep_indices,
     )
+    if return_aux:
+        result += (dict(),)
+    return result
 
 
 @function_timer
@@ -287,6 +328,9 @@ def read_array(
     mpi_dist=None,
     use_threads=False,
     no_flatten=False,
+    verify=False,
+    read_gap=None,
+    mmap=False,
 ):
     """Read compressed data directly into an array.
 
@@ -323,11 +367,20 @@ def read_array(
             This is only beneficial for large arrays.
         no_flatten (bool):  If True, for single-stream arrays, leave the leading
             dimension of (1,) in the result.
+        verify (bool):  If True, check the compressed bytes of each stream against
+            the checksums written with the data before decoding.
+        read_gap (int):  The largest gap in bytes between kept streams which are
+            read together.  If None, the default in `io_common` is used.
+        mmap (bool):  If True, the local compressed bytes are a read-only memory
+            map of the file when they are stored contiguously and without filters.
+            Otherwise they are read into memory.
 
     Returns:
         (array):  The loaded and decompressed data.  Or the array and the kept indices.
 
     """
+    if verify:
+        raise RuntimeError("Format version 0 data does not contain checksums")
     (
         local_shape,
         global_shape,
@@ -344,6 +397,8 @@ def read_array(
         keep=keep,
         mpi_comm=mpi_comm,
         mpi_dist=mpi_dist,
+        read_gap=read_gap,
+        mmap=mmap,
     )
 
     first_samp = None
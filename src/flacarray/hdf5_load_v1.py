@@ -16,6 +16,7 @@ from .io_common import (
     read_send_compressed,
     select_keep_indices,
     read_compressed_dataset_slice,
+    stream_aux_params,
 )
 from .utils import function_timer
 
@@ -29,6 +30,12 @@ hdf5_names = {
     "stream_offsets": "stream_offsets",
     "stream_gains": "stream_gains",
     "flac_channels": "flac_channels",
+    "stream_segments": "stream_segments",
+    "segment_size": "segment_size",
+    "stream_frames": "stream_frames",
+    "frame_size": "frame_size",
+    "stream_checksums": "stream_checksums",
+    "checksum_type": "checksum_type",
 }
 
 
@@ -44,6 +51,8 @@ class ReaderHDF5:
         dataset_gains,
         offsets_dtype,
         gains_dtype,
+        aux_shapes=None,
+        dataset_aux=None,
     ):
         self._starts = dataset_starts
         self._nbytes = dataset_nbytes
@@ -52,6 +61,8 @@ class ReaderHDF5:
         self._gains = dataset_gains
         self._offsets_dtype = offsets_dtype
         self._gains_dtype = gains_dtype
+        self._aux_shapes = aux_shapes if aux_shapes is not None else dict()
+        self._aux = dataset_aux if dataset_aux is not None else dict()
 
     @property
     def compressed_dataset(self):
@@ -65,6 +76,10 @@ class ReaderHDF5:
     def stream_gain_dtype(self):
         return self._gains_dtype
 
+    @property
+    def aux_shapes(self):
+        return self._aux_shapes
+
     def load(self, dset, mpi_comm, fslc, dslc):
         rank = 0
         if mpi_comm is not None:
@@ -88,9 +103,21 @@ class ReaderHDF5:
     def load_gains(self, mpi_comm, fslc, dslc):
         return self.load(self._gains, mpi_comm, fslc, dslc)
 
+    def load_aux(self, name, mpi_comm, fslc, dslc):
+        return self.load(self._aux.get(name, None), mpi_comm, fslc, dslc)
+
 
 @function_timer
-def read_compressed(hgrp, keep=None, mpi_comm=None, mpi_dist=None):
+def read_compressed(
+    hgrp,
+    keep=None,
+    mpi_comm=None,
+    mpi_dist=None,
+    return_aux=False,
+    read_gap=None,
+    mmap=False,
+    lazy=False,
+):
     """Load compressed data from an HDF group.
 
     If `stream_slice` is specified, the returned array will have only that
@@ -111,6 +138,18 @@ def read_compressed(hgrp, keep=None, mpi_comm=None, mpi_dist=None):
             the leading dimension of the array.
         mpi_dist (list):  The optional list of tuples specifying the first / last
             element of the leading dimension to assign to each process.
+        return_aux (bool):  If True, also return the dictionary of optional
+            auxiliary per-stream arrays.  This is required if the data contains
+            segmented streams.  Otherwise the optional arrays are not loaded.
+        read_gap (int):  The largest gap in bytes between kept streams which are
+            read together.  If None, the default in `io_common` is used.
+        mmap (bool):  If True, the local compressed bytes are a read-only memory
+            map of the file when they are stored contiguously and without filters.
+            Otherwise they are read into memory.
+        lazy (bool):  If True, the local compressed bytes are not read.  Instead
+            an `io_common.DatasetBytes` instance is returned in their place, which
+            reads the bytes of streams as they are needed.  The group must remain
+            open while it is used.
 
     Returns:
         (tuple):  The compressed data and metadata.
@@ -132,6 +171,8 @@ def read_compressed(hgrp, keep=None, mpi_comm=None, mpi_dist=None):
     stream_off_dtype = None
     stream_gain_dtype = None
     n_channel = None
+    aux_shapes = dict()
+    aux_params = dict()
 
     # Dataset handles (only valding on reading processes)
     dstarts = None
@@ -139,12 +180,13 @@ def read_compressed(hgrp, keep=None, mpi_comm=None, mpi_dist=None):
     dsoff = None
     dsgain = None
     dcomp = None
+    daux = dict()
 
     if rank == 0 or not use_serial:
         # This process is participating.
         # Double check that we can load this format.
         ver = int(hgrp.attrs["flacarray_format_version"])
-        if ver != 1:
+        if ver not in (1, 2):
             msg = f"Version 1 loader called with version {ver} data"
             raise RuntimeError(msg)
 
@@ -164,6 +206,12 @@ def read_compressed(hgrp, keep=None, mpi_comm=None, mpi_dist=None):
             stream_gain_dtype = np.dtype(dsgain.dtype)
         dcomp = hgrp[hdf5_names["compressed"]]
         global_nbytes = dcomp.size
+        # Optional per-stream arrays and their parameters
+        for name, param in stream_aux_params.items():
+            if hdf5_names[name] in hgrp:
+                daux[name] = hgrp[hdf5_names[name]]
+                aux_shapes[name] = daux[name].shape[len(dstarts.shape) :]
+                aux_params[param] = int(daux[name].attrs[hdf5_names[param]])
 
     if nproc > 1 and use_serial:
         # Not every process is reading- communicate some of the metadata loaded
@@ -174,8 +222,20 @@ def read_compressed(hgrp, keep=None, mpi_comm=None, mpi_dist=None):
         stream_gain_dtype = mpi_comm.bcast(stream_gain_dtype, root=0)
         stream_off_dtype = mpi_comm.bcast(stream_off_dtype, root=0)
         n_channel = mpi_comm.bcast(n_channel, root=0)
+        aux_shapes = mpi_comm.bcast(aux_shapes, root=0)
+        aux_params = mpi_comm.bcast(aux_params, root=0)
     global_leading_shape = global_shape[:-1]
 
+    if not return_aux:
+        # The segments are needed to decode the streams.  The other arrays are
+        # optional hints, and are not loaded.
+        if "stream_segments" in aux_shapes:
+            msg = "Data contains segmented streams, use return_aux=True to load these."
+            raise RuntimeError(msg)
+        aux_shapes = dict()
+        aux_params = dict()
+        daux = dict()
+
     # Compute or verify the MPI distribution for the global leading dimension
     mpi_dist = distribute_and_verify(mpi_comm, global_shape[0], mpi_dist=mpi_dist)
 
@@ -187,11 +247,20 @@ def read_compressed(hgrp, keep=None, mpi_comm=None, mpi_dist=None):
     stream_offsets = None
     stream_gains = None
     keep_indices = None
+    stream_aux = dict()
 
     if use_serial:
         # Use the common function for reading data and communicating it.
         reader = ReaderHDF5(
-            dstarts, dbytes, dcomp, dsoff, dsgain, stream_off_dtype, stream_gain_dtype
+            dstarts,
+            dbytes,
+            dcomp,
+            dsoff,
+            dsgain,
+            stream_off_dtype,
+            stream_gain_dtype,
+            aux_shapes=aux_shapes,
+            dataset_aux=daux,
         )
         (
             local_shape,
@@ -201,6 +270,7 @@ def read_compressed(hgrp, keep=None, mpi_comm=None, mpi_dist=None):
             stream_offsets,
             stream_gains,
             keep_indices,
+            stream_aux,
         ) = read_send_compressed(
             reader,
             global_shape,
@@ -208,6 +278,9 @@ def read_compressed(hgrp, keep=None, mpi_comm=None, mpi_dist=None):
             keep=keep,
             mpi_comm=mpi_comm,
             mpi_dist=mpi_dist,
+            read_gap=read_gap,
+            mmap=mmap,
+            lazy=lazy,
         )
     else:
         # We are using parallel HDF5.  All processes have a handle to the dataset
@@ -247,16 +320,32 @@ def read_compressed(hgrp, keep=None, mpi_comm=None, mpi_dist=None):
             raw_gains = np.empty(leading_shape, dtype=stream_gain_dtype)
             dsgain.read_direct(raw_gains, hslc, dslc)
 
+        # Optional per-stream arrays
+        raw_aux = dict()
+        for name, trailing in aux_shapes.items():
+            tslc = tuple([slice(0, x) for x in trailing])
+            raw_aux[name] = np.empty(leading_shape + trailing, dtype=daux[name].dtype)
+            daux[name].read_direct(raw_aux[name], hslc + tslc, dslc + tslc)
+
         # Compressed bytes.  Apply our stream selection and load just those
         # streams we are keeping for this process.
         compressed, local_starts, keep_indices = read_compressed_dataset_slice(
-            dcomp, proc_keep, raw_starts, raw_nbytes
+            dcomp,
+            proc_keep,
+            raw_starts,
+            raw_nbytes,
+            read_gap=read_gap,
+            mmap=mmap,
+            lazy=lazy,
         )
 
         # Cut our other arrays to only include the indices selected by the keep mask.
         stream_nbytes = select_keep_indices(raw_nbytes, keep_indices)
         stream_offsets = select_keep_indices(raw_offsets, keep_indices)
         stream_gains = select_keep_indices(raw_gains, keep_indices)
+        stream_aux = {
+            x: select_keep_indices(y, keep_indices) for x, y in raw_aux.items()
+        }
 
         if local_starts is None:
             # This rank has no data after masking
@@ -264,7 +353,7 @@ def read_compressed(hgrp, keep=None, mpi_comm=None, mpi_dist=None):
         else:
             local_shape = local_starts.shape + (stream_size,)
 
-    return (
+    result = (
         local_shape,
         global_shape,
         compressed,
@@ -276,6 +365,11 @@ def read_compressed(hgrp, keep=None, mpi_comm=None, mpi_dist=None):
         mpi_dist,
         keep_indices,
     )
+    if return_aux:
+        if local_shape is not None:
+            stream_aux.update(aux_params)
+        result += (stream_aux,)
+    return result
 
 
 @function_timer
@@ -288,6 +382,9 @@ def read_array(
     mpi_dist=None,
     use_threads=False,
     no_flatten=False,
+    verify=False,
+    read_gap=None,
+    mmap=False,
 ):
     """Read compressed data directly into an array.
 
@@ -324,6 +421,13 @@ def read_array(
             This is only beneficial for large arrays.
         no_flatten (bool):  If True, for single-stream arrays, leave the leading
             dimension of (1,) in the result.
+        verify (bool):  If True, check the compressed bytes of each stream against
+            the checksums written with the data before decoding.
+        read_gap (int):  The largest gap in bytes between kept streams which are
+            read together.  If None, the default in `io_common` is used.
+        mmap (bool):  If True, the local compressed bytes are a read-only memory
+            map of the file when they are stored contiguously and without filters.
+            Otherwise they are read into memory.
 
 
     Returns:
@@ -341,11 +445,15 @@ def read_array(
         stream_gains,
         mpi_dist,
         indices,
+        stream_aux,
     ) = read_compressed(
         hgrp,
         keep=keep,
         mpi_comm=mpi_comm,
         mpi_dist=mpi_dist,
+        read_gap=read_gap,
+        mmap=mmap,
+        return_aux=True,
     )
 
     first_samp = None
@@ -368,6 +476,8 @@ def read_array(
         is_int64=(n_channel == 2),
         use_threads=use_threads,
         no_flatten=no_flatten,
+        stream_aux=stream_aux,
+        verify=verify,
     )
     if keep_indices:
         return arr, indices
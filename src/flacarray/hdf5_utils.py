@@ -166,3 +166,42 @@ def check_dataset_buffer_size(msg, slices, dtype, parallel):
         wmsg += "  HDF5 parallel I/O will likely fail."
         log.warning(wmsg)
 
+
+def hdf5_map_bytes(dset, start, nbytes):
+    """Memory map a range of bytes of an HDF5 dataset.
+
+    This is only possible for a 1D uint8 dataset which is stored contiguously and
+    without filters in a file opened read-only with a driver that places the
+    dataset at a fixed offset in a single file.  The returned array is a read-only
+    view of the file, and its pages are loaded by the operating system as they
+    are accessed.
+
+    Args:
+        dset (h5py.Dataset):  The open dataset.
+        start (int):  The first byte of the dataset to map.
+        nbytes (int):  The number of bytes to map.
+
+    Returns:
+        (numpy.memmap):  The mapped bytes, or None if the dataset cannot be mapped.
+
+    """
+    if not have_hdf5 or not isinstance(dset, h5py.Dataset):
+        return None
+    if dset.dtype != np.dtype(np.uint8) or len(dset.shape) != 1:
+        return None
+    if dset.file.mode != "r" or dset.file.driver not in ("sec2", "stdio", "mpio"):
+        return None
+    plist = dset.id.get_create_plist()
+    if plist.get_layout() != h5py.h5d.CONTIGUOUS or plist.get_nfilters() != 0:
+        return None
+    offset = dset.id.get_offset()
+    if offset is None:
+        # Storage is not allocated
+        return None
+    return np.memmap(
+        dset.file.filename,
+        dtype=np.uint8,
+        mode="r",
+        offset=offset + int(start),
+        shape=(int(nbytes),),
+    )
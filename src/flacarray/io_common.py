@@ -9,12 +9,251 @@ This module contains helper tools used by multiple I/O formats.
 
 import numpy as np
 
+from .hdf5_utils import hdf5_map_bytes
 from .mpi import MPI
-from .utils import keep_select, function_timer, select_keep_indices, log
+from .utils import (
+    LRUCache,
+    keep_select,
+    function_timer,
+    select_keep_indices,
+    log,
+)
+
+
+"""Optional per-stream auxiliary datasets.
+
+These arrays have the same leading shape as the stream starts and possibly trailing
+dimensions.  Each one is described by a scalar parameter which is stored as an
+attribute of the dataset.  The keys are used as the names of the datasets and in the
+dictionary of auxiliary data returned by `array_compress`.
+"""
+stream_aux_params = {
+    "stream_segments": "segment_size",
+    "stream_frames": "frame_size",
+    "stream_checksums": "checksum_type",
+}
+
+"""The default largest gap in bytes between streams merged into one read.
+
+When loading a subset of streams, the byte ranges of the kept streams are merged
+into larger reads when they are separated by at most this many bytes of other
+streams.  The bytes in the gaps are read and discarded.
+"""
+default_read_gap = 1048576
+
+"""The default largest number of bytes spanned by one merged read.
+
+Streams are not merged into a read which would span more than this many bytes of
+the dataset, however small the gaps between them are.  A single larger stream is
+still read on its own.
+"""
+default_max_read = 67108864
+
+"""The default size in bytes of the cache of streams read by `DatasetBytes`."""
+default_cache_bytes = 268435456
+
+
+def streams_narrowed(
+    compressed, stream_starts, stream_nbytes, n_channels, stream_aux=None, mpi_comm=None
+):
+    """Check whether any two channel stream was encoded as a single FLAC channel.
+
+    The encoder narrows 64bit streams whose values all fit in 32 bits to one channel.
+    The number of channels is read from the STREAMINFO block at the start of each
+    stream (or each segment, for segmented streams).  With MPI, the result is
+    combined across all processes.
+
+    Args:
+        compressed (array):  The local compressed bytes.
+        stream_starts (array):  The local starting byte offsets for each stream.
+        stream_nbytes (array):  The local number of bytes for each stream.
+        n_channels (int):  The number of FLAC channels used (1 or 2).
+        stream_aux (dict):  The auxiliary data or None.
+        mpi_comm (MPI.Comm):  The MPI communicator or None.
+
+    Returns:
+        (bool):  True if any stream on any process was narrowed.
+
+    """
+    # The byte holding the channel count, after the marker and metadata header.
+    channel_byte = 20
+    narrowed = False
+    if n_channels == 2:
+        starts = np.asarray(stream_starts, dtype=np.int64)
+        nbytes = np.asarray(stream_nbytes, dtype=np.int64)
+        if stream_aux is not None and "stream_segments" in stream_aux:
+            segs = np.asarray(stream_aux["stream_segments"], dtype=np.int64)
+            starts = starts[..., np.newaxis] + segs
+            nbytes = np.broadcast_to(nbytes[..., np.newaxis], segs.shape)
+        starts = starts[nbytes > channel_byte].reshape((-1,))
+        if len(starts) > 0:
+            channels = (compressed[starts + channel_byte] >> 1) & 7
+            narrowed = bool(np.any(channels == 0))
+    if mpi_comm is not None:
+        narrowed = mpi_comm.allreduce(narrowed, op=MPI.LOR)
+    return narrowed
+
+
+def writer_format_version(stream_aux=None, narrowed=False, chunk_bytes=None):
+    """Get the format version to write for some compressed data.
+
+    Version 2 uses the same datasets and attributes as version 1.  It is written
+    for data that the version 1 loader of an older release would silently decode
+    incorrectly, so that such readers refuse the file instead.  This is the case
+    for:
+
+    - Two channel (64bit) data with streams narrowed to one channel (see
+      `streams_narrowed`).
+    - Streams encoded in segments (the "stream_segments" auxiliary array).
+    - Streams aligned to Zarr chunks (`chunk_bytes`), with gaps between them.
+
+    All other data is written as version 1.
+
+    Args:
+        stream_aux (dict):  The auxiliary data or None.
+        narrowed (bool):  True if any stream was narrowed to one channel.
+        chunk_bytes (int):  The Zarr chunk size the streams are aligned to, or None.
+
+    Returns:
+        (str):  The format version.
+
+    """
+    if narrowed or chunk_bytes is not None:
+        return "2"
+    if stream_aux is not None and "stream_segments" in stream_aux:
+        return "2"
+    return "1"
+
+
+def split_stream_aux(stream_aux):
+    """Split the auxiliary data into the arrays and their parameters.
+
+    Args:
+        stream_aux (dict):  The auxiliary data or None.
+
+    Returns:
+        (tuple):  The (dictionary of arrays, dictionary of parameters).
+
+    """
+    arrays = dict()
+    params = dict()
+    if stream_aux is None:
+        return (arrays, params)
+    for name, param in stream_aux_params.items():
+        if name in stream_aux:
+            arrays[name] = stream_aux[name]
+            params[param] = stream_aux[param]
+    return (arrays, params)
+
+
+def coalesce_ranges(starts, nbytes, read_gap, max_read=None):
+    """Merge byte ranges into a smaller number of larger ranges.
+
+    The ranges are sorted by their first byte, and consecutive ranges are merged
+    when the bytes between them are no more than `read_gap` and the merged range
+    spans no more than `max_read` bytes.
+
+    Args:
+        starts (array):  The first byte of each range.
+        nbytes (array):  The number of bytes in each range.
+        read_gap (int):  The largest gap in bytes between merged ranges.
+        max_read (int):  The largest span in bytes of a merged range.  If None,
+            `default_max_read` is used.
+
+    Returns:
+        (tuple):  The (order, group_first, group_start, group_stop).  The order
+            sorts the input ranges, and the sorted ranges [group_first[i],
+            group_first[i + 1]) are read from bytes [group_start[i], group_stop[i]).
+
+    """
+    order = np.argsort(starts, kind="stable")
+    sorted_starts = starts[order]
+    sorted_stops = sorted_starts + nbytes[order]
+    # The end of all previous ranges, in case any of them overlap.
+    reach = np.maximum.accumulate(sorted_stops)
+    new_group = np.ones(len(order), dtype=bool)
+    new_group[1:] = sorted_starts[1:] - reach[:-1] > read_gap
+    if max_read is None:
+        max_read = default_max_read
+    group_first = np.flatnonzero(new_group)
+    group_last = np.append(group_first[1:], len(order)) - 1
+    if np.any(reach[group_last] - sorted_starts[group_first] > max_read):
+        # Split the large groups, starting a new one at each range which would
+        # extend the current group beyond the limit.
+        first_byte = 0
+        for irange, (start, stop) in enumerate(
+            zip(sorted_starts.tolist(), reach.tolist())
+        ):
+            if new_group[irange] or stop - first_byte > max_read:
+                new_group[irange] = True
+                first_byte = start
+    group_first = np.flatnonzero(new_group)
+    group_last = np.append(group_first[1:], len(order)) - 1
+    return (order, group_first, sorted_starts[group_first], reach[group_last])
+
+
+def aligned_stream_starts(stream_nbytes, chunk_bytes):
+    """Place streams in a dataset so that no stream straddles a chunk boundary.
+
+    The streams are kept in order, and consecutive streams are grouped so that each
+    group has at most `chunk_bytes` bytes.  Every group starts at a multiple of
+    `chunk_bytes`, and the bytes between the end of a group and the next chunk are
+    padding.  A stream larger than a chunk is a group by itself, which starts on a
+    chunk boundary and fills as many chunks as needed.
+
+    Args:
+        stream_nbytes (array):  The number of bytes of each stream, in order.
+        chunk_bytes (int):  The size of the chunks in bytes.
+
+    Returns:
+        (tuple):  The (starting byte of each stream, group index of each stream,
+            total bytes including padding).
+
+    """
+    chunk_bytes = int(chunk_bytes)
+    if chunk_bytes <= 0:
+        raise ValueError("The chunk size must be a positive number of bytes")
+    flat_nbytes = stream_nbytes.reshape((-1,)).tolist()
+    starts = np.empty(len(flat_nbytes), dtype=np.int64)
+    groups = np.empty(len(flat_nbytes), dtype=np.int64)
+    pos = 0
+    group = 0
+    group_start = 0
+    for istream, nb in enumerate(flat_nbytes):
+        if pos > group_start and pos + nb - group_start > chunk_bytes:
+            # Start a new group at the next chunk boundary
+            pos = -(-pos // chunk_bytes) * chunk_bytes
+            group_start = pos
+            group += 1
+        starts[istream] = pos
+        groups[istream] = group
+        pos += nb
+    return (starts, groups, pos)
+
+
+def _read_bytes(dcomp, data, offset, start, stop):
+    """Read bytes [start, stop) of a dataset into data[offset:]."""
+    dslc = (slice(offset, offset + stop - start),)
+    hslc = (slice(start, stop),)
+    if hasattr(dcomp, "read_direct"):
+        # HDF5
+        dcomp.read_direct(data, hslc, dslc)
+    else:
+        # Zarr
+        data[dslc] = dcomp[hslc]
 
 
 @function_timer
-def read_compressed_dataset_slice(dcomp, keep, stream_starts, stream_nbytes):
+def read_compressed_dataset_slice(
+    dcomp,
+    keep,
+    stream_starts,
+    stream_nbytes,
+    read_gap=None,
+    mmap=False,
+    lazy=False,
+    max_read=None,
+):
     """Read compressed bytes directly from an open dataset.
 
     This function works with zarr or h5py datasets.
@@ -22,11 +261,38 @@ def read_compressed_dataset_slice(dcomp, keep, stream_starts, stream_nbytes):
     The `keep` and `stream_starts` are relative to the full dataset (i.e. they are
     "global", not local to a process if using MPI).
 
+    If `keep` is specified, the byte ranges of the kept streams are merged into as
+    few reads as possible.  Streams which are separated by at most `read_gap` bytes
+    are read together, and the bytes of the kept streams are then packed into the
+    returned buffer.  A larger gap gives fewer reads of more unused bytes, and a
+    negative gap reads each stream separately.  No merged read spans more than
+    `max_read` bytes.
+
+    If `keep` is None, the streams are expected to be stored in order.  When there
+    are gaps between them (for example if they are aligned to the chunks of the
+    dataset, see `aligned_stream_starts()`), they are read like a selection of all
+    streams and packed into the returned buffer.
+
+    If `mmap` is True and the bytes of the selected streams are contiguous in an
+    HDF5 dataset which can be memory mapped (see `hdf5_map_bytes()`), the returned
+    data is a read-only map of those bytes in the file rather than a copy.
+    Otherwise the bytes are read as usual.
+
+    If `lazy` is True (and the bytes are not mapped), nothing is read and the
+    returned data is a `DatasetBytes` instance, which reads the bytes of selected
+    streams when they are needed.
+
     Args:
         dcomp (Dataset):  The open dataset with compressed bytes.
         keep (array):  Bool array of streams to keep in the decompression.
         stream_starts (array):  The array of starting bytes in the dataset.
         stream_nbytes (array):  The array of number of bytes in the dataset.
+        read_gap (int):  The largest gap in bytes between streams which are read
+            together.  If None, `default_read_gap` is used.
+        mmap (bool):  If True, map the bytes of the dataset when possible.
+        lazy (bool):  If True, defer reading the bytes.
+        max_read (int):  The largest number of bytes spanned by one merged read.  If
+            None, `default_max_read` is used.
 
     Returns:
         (tuple):  The (loaded data, rel_starts, indices).
@@ -37,8 +303,34 @@ def read_compressed_dataset_slice(dcomp, keep, stream_starts, stream_nbytes):
         total_bytes = np.sum(stream_nbytes)
         if total_bytes == 0:
             return (None, None, None)
-        start_byte = stream_starts.flatten()[0]
-        rel_starts = stream_starts - start_byte
+        flat_starts = stream_starts.reshape((-1,))
+        flat_nbytes = stream_nbytes.reshape((-1,))
+        start_byte = flat_starts[0]
+        contiguous = flat_starts[-1] + flat_nbytes[-1] - start_byte == total_bytes
+        if contiguous:
+            rel_starts = stream_starts - start_byte
+        else:
+            rel_starts = np.zeros(flat_starts.shape, dtype=np.int64)
+            rel_starts[1:] = np.cumsum(flat_nbytes)[:-1]
+            rel_starts = rel_starts.reshape(stream_starts.shape)
+        if mmap and contiguous:
+            data = hdf5_map_bytes(dcomp, start_byte, total_bytes)
+            if data is not None:
+                return (data, rel_starts, None)
+        if lazy:
+            data = DatasetBytes(dcomp, stream_starts, stream_nbytes, read_gap=read_gap)
+            return (data, rel_starts, None)
+        if not contiguous:
+            keep_all = np.ones(stream_starts.shape, dtype=bool)
+            data, _, _ = read_compressed_dataset_slice(
+                dcomp,
+                keep_all,
+                stream_starts,
+                stream_nbytes,
+                read_gap=read_gap,
+                max_read=max_read,
+            )
+            return (data, rel_starts, None)
         dslc = (slice(0, total_bytes),)
         hslc = (slice(start_byte, start_byte + total_bytes),)
         data = np.empty(total_bytes, dtype=np.uint8)
@@ -50,31 +342,161 @@ def read_compressed_dataset_slice(dcomp, keep, stream_starts, stream_nbytes):
             data[dslc] = dcomp[hslc]
         return (data, rel_starts, None)
     else:
-        # We are reading a subset of streams.  Preallocate the read buffer and then
-        # do multiple reads to fill sections of that buffer.
+        # We are reading a subset of streams.  The streams are packed into the
+        # buffer in the order of their bytes in the dataset, so that each merged
+        # read fills a contiguous section of the buffer.
+        if read_gap is None:
+            read_gap = default_read_gap
         starts, nbytes, indices = keep_select(keep, stream_starts, stream_nbytes)
         if len(starts) == 0:
             return (None, None, None)
+        order, group_first, group_start, group_stop = coalesce_ranges(
+            starts, nbytes, read_gap, max_read=max_read
+        )
+        sorted_starts = starts[order]
+        sorted_nbytes = nbytes[order]
+        packed = np.zeros_like(sorted_starts)
+        packed[1:] = np.cumsum(sorted_nbytes)[:-1]
+        rel_starts = np.empty_like(starts)
+        rel_starts[order] = packed
         total_bytes = np.sum(nbytes)
-        rel_starts = np.zeros_like(starts)
-        rel_starts[1:] = np.cumsum(nbytes)[:-1]
+        if mmap and group_stop[-1] - group_start[0] == total_bytes:
+            # The kept streams are one contiguous range of the dataset
+            data = hdf5_map_bytes(dcomp, group_start[0], total_bytes)
+            if data is not None:
+                return (data, rel_starts, indices)
+        if lazy:
+            data = DatasetBytes(dcomp, starts, nbytes, read_gap=read_gap)
+            return (data, rel_starts, indices)
         data = np.empty(total_bytes, dtype=np.uint8)
-        if hasattr(dcomp, "read_direct"):
-            # HDF5
-            for istr in range(len(starts)):
-                dslc = (slice(rel_starts[istr], rel_starts[istr] + nbytes[istr]),)
-                hslc = (slice(starts[istr], starts[istr] + nbytes[istr]),)
-                dcomp.read_direct(data, hslc, dslc)
-        else:
-            # Zarr
-            for istr in range(len(starts)):
-                dslc = (slice(rel_starts[istr], rel_starts[istr] + nbytes[istr]),)
-                hslc = (slice(starts[istr], starts[istr] + nbytes[istr]),)
-                data[dslc] = dcomp[hslc]
+
+        group_last = np.append(group_first[1:], len(order))
+        for first, last, start, stop in zip(
+            group_first.tolist(),
+            group_last.tolist(),
+            group_start.tolist(),
+            group_stop.tolist(),
+        ):
+            group_bytes = packed[last - 1] + sorted_nbytes[last - 1] - packed[first]
+            if stop - start == group_bytes:
+                # The streams are contiguous, read them directly into place
+                _read_bytes(dcomp, data, packed[first], start, stop)
+                continue
+            # Read the whole range and copy out the bytes of each of our streams.
+            block = np.empty(stop - start, dtype=np.uint8)
+            _read_bytes(dcomp, block, 0, start, stop)
+            for off, src, n in zip(
+                packed[first:last].tolist(),
+                (sorted_starts[first:last] - start).tolist(),
+                sorted_nbytes[first:last].tolist(),
+            ):
+                data[off : off + n] = block[src : src + n]
         return (data, rel_starts, indices)
 
 
-def extract_proc_buffers(reader, comm, dist, proc, global_leading_shape, keep):
+class DatasetBytes(object):
+    """Compressed bytes of streams which are read from an open dataset on demand.
+
+    This is used in place of the array of compressed bytes by a FlacArray which is
+    loaded lazily.  The bytes of a set of streams are read from the dataset only when
+    those streams are decoded, with the same merging of nearby reads as
+    `read_compressed_dataset_slice()`.  The bytes of recently read streams are kept
+    in a cache of bounded size, so that decoding the same streams again does not
+    read the dataset.
+
+    The dataset (and the file containing it) must remain open while this is used.
+
+    Args:
+        dataset (Dataset):  The open h5py or zarr dataset of compressed bytes.
+        dataset_starts (array):  The starting byte in the dataset of each stream.
+        stream_nbytes (array):  The number of bytes of each stream.
+        read_gap (int):  The largest gap in bytes between streams which are read
+            together.  If None, `default_read_gap` is used.
+        cache_bytes (int):  The size of the cache of stream bytes.  If None,
+            `default_cache_bytes` is used.
+
+    """
+
+    def __init__(
+        self, dataset, dataset_starts, stream_nbytes, read_gap=None, cache_bytes=None
+    ):
+        self.dataset = dataset
+        self.read_gap = read_gap
+        self._shape = dataset_starts.shape
+        self._starts = dataset_starts.reshape((-1,)).astype(np.int64)
+        self._nbytes = stream_nbytes.reshape((-1,)).astype(np.int64)
+        self.nbytes = int(np.sum(self._nbytes))
+        if cache_bytes is None:
+            cache_bytes = default_cache_bytes
+        self.cache = LRUCache(cache_bytes)
+
+    @function_timer
+    def read(self, streams=None):
+        """Get the compressed bytes of some streams.
+
+        The returned stream starts have the shape of the streams given to the
+        constructor, and are only valid for the requested streams.  The bytes of all
+        streams are read without using the cache, and have the same layout as the
+        starts returned by `read_compressed_dataset_slice()`.
+
+        Args:
+            streams (array):  The flat indices of the streams to read, or None to
+                read all streams.
+
+        Returns:
+            (tuple):  The (bytes, stream starts).
+
+        """
+        n_stream = len(self._starts)
+        if streams is None:
+            keep = np.ones(n_stream, dtype=bool)
+            data, rel_starts, _ = read_compressed_dataset_slice(
+                self.dataset, keep, self._starts, self._nbytes, read_gap=self.read_gap
+            )
+            return (data, rel_starts.reshape(self._shape))
+
+        wanted = np.unique(streams).tolist()
+        blocks = dict()
+        for stream in wanted:
+            block = self.cache.get(stream)
+            if block is not None:
+                blocks[stream] = block
+        missing = [x for x in wanted if x not in blocks]
+        if len(missing) > 0:
+            keep = np.zeros(n_stream, dtype=bool)
+            keep[missing] = True
+            data, rel_starts, _ = read_compressed_dataset_slice(
+                self.dataset, keep, self._starts, self._nbytes, read_gap=self.read_gap
+            )
+            # The streams are returned in the order of the keep mask.  Copy each
+            # one, so that the cache holds only the bytes it accounts for.
+            for stream, start in zip(missing, rel_starts.tolist()):
+                block = data[start : start + self._nbytes[stream]].copy()
+                blocks[stream] = block
+                self.cache.put(stream, block)
+
+        sizes = self._nbytes[wanted]
+        offsets = np.zeros(len(wanted), dtype=np.int64)
+        offsets[1:] = np.cumsum(sizes)[:-1]
+        data = np.empty(np.sum(sizes), dtype=np.uint8)
+        for stream, start, size in zip(wanted, offsets.tolist(), sizes.tolist()):
+            data[start : start + size] = blocks[stream]
+        stream_starts = np.zeros(n_stream, dtype=np.int64)
+        stream_starts[wanted] = offsets
+        return (data, stream_starts.reshape(self._shape))
+
+
+def extract_proc_buffers(
+    reader,
+    comm,
+    dist,
+    proc,
+    global_leading_shape,
+    keep,
+    read_gap=None,
+    mmap=False,
+    lazy=False,
+):
     """Helper function to extract the buffers for a single process."""
     # The range of the leading dimension on this process.
     send_range = dist[proc]
@@ -105,11 +527,23 @@ def extract_proc_buffers(reader, comm, dist, proc, global_leading_shape, keep):
     raw_offsets = reader.load_offsets(comm, fslc, dslc)
     raw_gains = reader.load_gains(comm, fslc, dslc)
 
+    # Optional auxiliary arrays, which may have trailing dimensions
+    raw_aux = dict()
+    for name, trailing in reader.aux_shapes.items():
+        tslc = tuple([slice(0, x) for x in trailing])
+        raw_aux[name] = reader.load_aux(name, comm, fslc + tslc, dslc + tslc)
+
     # Compressed bytes.  Apply our stream selection and load just those
     # streams we are keeping for this process.
     dcomp = reader.compressed_dataset
     proc_compressed, proc_starts, proc_keep_indices = read_compressed_dataset_slice(
-        dcomp, proc_keep, raw_starts, raw_nbytes
+        dcomp,
+        proc_keep,
+        raw_starts,
+        raw_nbytes,
+        read_gap=read_gap,
+        mmap=mmap,
+        lazy=lazy,
     )
 
     if proc_starts is None:
@@ -126,6 +560,9 @@ def extract_proc_buffers(reader, comm, dist, proc, global_leading_shape, keep):
     proc_nbytes = select_keep_indices(raw_nbytes, proc_keep_indices)
     proc_offsets = select_keep_indices(raw_offsets, proc_keep_indices)
     proc_gains = select_keep_indices(raw_gains, proc_keep_indices)
+    proc_aux = {
+        x: select_keep_indices(y, proc_keep_indices) for x, y in raw_aux.items()
+    }
 
     return (
         proc_shape,
@@ -136,6 +573,7 @@ def extract_proc_buffers(reader, comm, dist, proc, global_leading_shape, keep):
         proc_nbytes,
         proc_offsets,
         proc_gains,
+        proc_aux,
     )
 
 
@@ -149,6 +587,7 @@ def send_proc_buffers(
     proc_nbytes,
     proc_offsets,
     proc_gains,
+    proc_aux,
     is_64bit=False,
 ):
     """Helper function to send the buffers for one process's data."""
@@ -169,21 +608,21 @@ def send_proc_buffers(
         else:
             buffers.append((proc_gains, MPI.FLOAT))
 
-    # Send two pieces of information needed to receive further data: the
-    # local shape and the keep indices.  Since proc_shape is small and
-    # keep indices are a bool array, we send these with lower-case `isend`,
-    # which pickles under the hood.
-    max_n_send = 7
+    # Send three pieces of information needed to receive further data: the
+    # local shape, the keep indices, and the dictionary of auxiliary arrays.  Since
+    # these are small, we send them with lower-case `send`, which pickles under
+    # the hood.
+    max_n_send = 8
     tag_base = max_n_send * proc
 
-    for imsg, obj in enumerate([proc_shape, proc_keep_indices]):
+    for imsg, obj in enumerate([proc_shape, proc_keep_indices, proc_aux]):
         msg_tag = tag_base + imsg
         comm.send(obj, dest=proc, tag=msg_tag)
 
     if proc_shape is not None:
         # This process has some data
         for itag, (buf, buftype) in enumerate(buffers):
-            msg_tag = tag_base + 2 + itag
+            msg_tag = tag_base + 3 + itag
             comm.Send([buf, buftype], dest=proc, tag=msg_tag)
 
 
@@ -195,8 +634,8 @@ def receive_proc_buffers(
     offsetgain=False,
 ):
     """Helper function to receive the buffers for a single process."""
-    # First receive the shape and keep indices
-    max_n_recv = 7
+    # First receive the shape, keep indices, and auxiliary arrays
+    max_n_recv = 8
     tag_base = max_n_recv * proc
 
     msg_tag = tag_base
@@ -205,6 +644,9 @@ def receive_proc_buffers(
     msg_tag += 1
     proc_keep_indices = comm.recv(source=0, tag=msg_tag)
 
+    msg_tag += 1
+    proc_aux = comm.recv(source=0, tag=msg_tag)
+
     local_shape = None
     keep_indices = None
     local_starts = None
@@ -212,10 +654,12 @@ def receive_proc_buffers(
     compressed = None
     stream_offsets = None
     stream_gains = None
+    stream_aux = dict()
     if proc_shape is not None:
         # This process has some data
         local_shape = proc_shape + (stream_size,)
         keep_indices = proc_keep_indices
+        stream_aux = proc_aux
 
         msg_tag += 1
         local_starts = np.empty(proc_shape, dtype=np.int64)
@@ -255,12 +699,21 @@ def receive_proc_buffers(
         compressed,
         stream_offsets,
         stream_gains,
+        stream_aux,
     )
 
 
 @function_timer
 def read_send_compressed(
-    reader, global_shape, n_channel, keep=None, mpi_comm=None, mpi_dist=None
+    reader,
+    global_shape,
+    n_channel,
+    keep=None,
+    mpi_comm=None,
+    mpi_dist=None,
+    read_gap=None,
+    mmap=False,
+    lazy=False,
 ):
     """Read data on one process and distribute.
 
@@ -271,9 +724,16 @@ def read_send_compressed(
         keep (array):  Boolean array of streams to keep.
         mpi_comm (MPI.Comm):  The MPI communicator or None.
         mpi_dist (dict):  The distribution of the leading dimension over processes.
+        read_gap (int):  The largest gap in bytes between kept streams which are
+            read together.  See `read_compressed_dataset_slice()`.
+        mmap (bool):  If True, memory map the compressed bytes of the local process
+            when possible.  See `read_compressed_dataset_slice()`.
+        lazy (bool):  If True, defer reading the compressed bytes of the local
+            process.  See `read_compressed_dataset_slice()`.
 
     Returns:
-        (tuple):  The data and metadata
+        (tuple):  The data and metadata, including the dictionary of auxiliary
+            arrays present in the file.
 
     """
     if mpi_comm is None:
@@ -302,6 +762,7 @@ def read_send_compressed(
     compressed = None
     stream_offsets = None
     stream_gains = None
+    stream_aux = dict()
     keep_indices = None
 
     is_64bit = False
@@ -343,8 +804,17 @@ def read_send_compressed(
                 proc_nbytes,
                 proc_offsets,
                 proc_gains,
+                proc_aux,
             ) = extract_proc_buffers(
-                reader, comm, mpi_dist, proc, global_leading_shape, keep
+                reader,
+                comm,
+                mpi_dist,
+                proc,
+                global_leading_shape,
+                keep,
+                read_gap=read_gap,
+                mmap=(mmap and proc == 0),
+                lazy=(lazy and proc == 0),
             )
 
             if proc == 0:
@@ -355,6 +825,7 @@ def read_send_compressed(
                 stream_nbytes = proc_nbytes
                 stream_offsets = proc_offsets
                 stream_gains = proc_gains
+                stream_aux = proc_aux
                 compressed = proc_compressed
                 keep_indices = proc_keep_indices
             else:
@@ -368,6 +839,8 @@ def read_send_compressed(
                     proc_nbytes,
                     proc_offsets,
                     proc_gains,
+                    proc_aux,
+                    is_64bit=is_64bit,
                 )
         elif proc == rank:
             (
@@ -378,6 +851,7 @@ def read_send_compressed(
                 compressed,
                 stream_offsets,
                 stream_gains,
+                stream_aux,
             ) = receive_proc_buffers(
                 comm,
                 proc,
@@ -394,6 +868,7 @@ def read_send_compressed(
         stream_offsets,
         stream_gains,
         keep_indices,
+        stream_aux,
     )
 
 
@@ -469,12 +944,13 @@ def receive_write_compressed(
         # Set up communication tags for the buffers we will send / receive.  The
         # buffers are sent from unique processes, so we can re-use the same tags
         # for each sending process.
-        tag_nbuf = 5
+        tag_nbuf = 6
         tag_comp = tag_nbuf * proc + 0
         tag_starts = tag_nbuf * proc + 1
         tag_nbytes = tag_nbuf * proc + 2
         tag_stream_offsets = tag_nbuf * proc + 3
         tag_stream_gains = tag_nbuf * proc + 4
+        tag_stream_aux = tag_nbuf * proc + 5
         if rank == 0:
             # The rank zero process will receive data from the other processes
             # and write it into the global datasets.  For each dataset we build
@@ -555,6 +1031,18 @@ def receive_write_compressed(
                 writer.save_gains(recv, comm, dslc, fslc)
                 del recv
 
+            # Optional auxiliary arrays.  These are small, and are sent as a
+            # pickled dictionary.
+            if len(writer.aux) > 0:
+                if proc == 0:
+                    recv_aux = writer.aux
+                else:
+                    recv_aux = comm.recv(source=proc, tag=tag_stream_aux)
+                for name, recv in recv_aux.items():
+                    tslc = tuple([slice(0, x) for x in recv.shape[len(dslc):]])
+                    writer.save_aux(name, recv, comm, dslc + tslc, fslc + tslc)
+                del recv_aux
+
             # Compressed bytes
             if proc == 0:
                 recv = writer.compressed
@@ -592,4 +1080,6 @@ def receive_write_compressed(
                     comm.Send([writer.gains, MPI.DOUBLE], dest=0, tag=tag_stream_gains)
                 else:
                     comm.Send([writer.gains, MPI.FLOAT], dest=0, tag=tag_stream_gains)
+            if len(writer.aux) > 0:
+                comm.send(writer.aux, dest=0, tag=tag_stream_aux)
             comm.Send(writer.compressed, dest=0, tag=tag_comp)
@@ -0,0 +1,595 @@
+// Copyright (c) 2024-2025 by the parties listed in the AUTHORS file.
+// All rights reserved.  Use of this source code is governed by
+// a BSD-style license that can be found in the LICENSE file.
+
+// Stand-alone benchmark of the compiled encoder and decoder, without Python.
+//
+// For every combination of the swept parameters (compression level, integer type,
+// number of streams, stream length, threads and segment size), the synthetic
+// signals are encoded and decoded as a whole, and then one stream at a time, both
+// in full and as short slices.  The results are written to stdout as JSON, and
+// progress to stderr.  Each swept parameter takes a comma separated list:
+//
+//     flacarray_cbench levels=0,5,8 types=i32,i64 streams=1,64
+//         lengths=65536,1048576 threads=1,8 segments=0,65536 slice=1000 repeat=3
+//
+// The signals are meant to look like detector timestreams rather than random
+// bits:  1/f noise plus white noise, a slow drift, and occasional glitches (spikes
+// and steps).  The amplitude differs between streams, and for 64bit data some
+// streams are offset so that their values do not fit in 32 bits.
+
+#include <stdio.h>
+#include <math.h>
+
+#include <flacarray.h>
+
+
+#define MAX_SWEEP 16
+
+// The number of octaves of the 1/f noise.
+#define PINK_OCTAVES 16
+
+
+typedef struct {
+    int64_t values[MAX_SWEEP];
+    int n;
+} sweep;
+
+typedef struct {
+    sweep levels;
+    sweep types;
+    sweep streams;
+    sweep lengths;
+    sweep threads;
+    sweep segments;
+    int64_t slice;
+    int64_t repeat;
+    uint64_t seed;
+} bench_options;
+
+
+// Parse a comma separated list of values.  The types are given as i32 / i64 and
+// stored as the number of bits.
+static bool parse_sweep(char const * text, sweep * result) {
+    char const * pos = text;
+    char * end;
+    result->n = 0;
+    while (*pos != '\0') {
+        if (result->n >= MAX_SWEEP) {
+            return false;
+        }
+        if ((pos[0] == 'i') && ((pos[1] == '3') || (pos[1] == '6'))) {
+            pos++;
+        }
+        result->values[result->n] = strtoll(pos, &end, 10);
+        if (end == pos) {
+            return false;
+        }
+        result->n += 1;
+        pos = (*end == ',') ? end + 1 : end;
+    }
+    return (result->n > 0);
+}
+
+
+static bool parse_options(int argc, char * argv[], bench_options * opts) {
+    int max_threads = 1;
+    #ifdef _OPENMP
+    max_threads = omp_get_max_threads();
+    #endif
+    parse_sweep("0,5,8", &(opts->levels));
+    parse_sweep("i32,i64", &(opts->types));
+    parse_sweep("1,64", &(opts->streams));
+    parse_sweep("65536,1048576", &(opts->lengths));
+    opts->threads.values[0] = 1;
+    opts->threads.values[1] = max_threads;
+    opts->threads.n = (max_threads > 1) ? 2 : 1;
+    parse_sweep("0", &(opts->segments));
+    opts->slice = 1000;
+    opts->repeat = 3;
+    opts->seed = 123456;
+
+    char * value;
+    bool ok;
+    for (int iarg = 1; iarg < argc; ++iarg) {
+        value = strchr(argv[iarg], '=');
+        if (value == NULL) {
+            return false;
+        }
+        *value = '\0';
+        value++;
+        ok = true;
+        if (strcmp(argv[iarg], "levels") == 0) {
+            ok = parse_sweep(value, &(opts->levels));
+        } else if (strcmp(argv[iarg], "types") == 0) {
+            ok = parse_sweep(value, &(opts->types));
+        } else if (strcmp(argv[iarg], "streams") == 0) {
+            ok = parse_sweep(value, &(opts->streams));
+        } else if (strcmp(argv[iarg], "lengths") == 0) {
+            ok = parse_sweep(value, &(opts->lengths));
+        } else if (strcmp(argv[iarg], "threads") == 0) {
+            ok = parse_sweep(value, &(opts->threads));
+        } else if (strcmp(argv[iarg], "segments") == 0) {
+            ok = parse_sweep(value, &(opts->segments));
+        } else if (strcmp(argv[iarg], "slice") == 0) {
+            opts->slice = strtoll(value, NULL, 10);
+        } else if (strcmp(argv[iarg], "repeat") == 0) {
+            opts->repeat = strtoll(value, NULL, 10);
+        } else if (strcmp(argv[iarg], "seed") == 0) {
+            opts->seed = strtoull(value, NULL, 10);
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+    for (int ityp = 0; ityp < opts->types.n; ++ityp) {
+        if ((opts->types.values[ityp] != 32) && (opts->types.values[ityp] != 64)) {
+            return false;
+        }
+    }
+    return (opts->slice > 0) && (opts->repeat > 0);
+}
+
+
+// Random numbers (xorshift64*), so that the signals do not depend on the platform.
+static uint64_t rng_next(uint64_t * state) {
+    (*state) ^= (*state) >> 12;
+    (*state) ^= (*state) << 25;
+    (*state) ^= (*state) >> 27;
+    return (*state) * 0x2545F4914F6CDD1Dull;
+}
+
+// Uniform in [0, 1).
+static double rng_uniform(uint64_t * state) {
+    return (double)(rng_next(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Approximately unit variance Gaussian (sum of uniforms).
+static double rng_gauss(uint64_t * state) {
+    double sum = 0.0;
+    for (int k = 0; k < 12; ++k) {
+        sum += rng_uniform(state);
+    }
+    return sum - 6.0;
+}
+
+
+// Fill one stream with a synthetic signal.  The 1/f noise uses the Voss-McCartney
+// method:  octave k is redrawn every 2^k samples, and the octaves are summed.
+static void make_signal(
+    uint64_t * rng,
+    int64_t istream,
+    int64_t stream_size,
+    bool is_int64,
+    double * signal
+) {
+    double octaves[PINK_OCTAVES];
+    double pink = 0.0;
+    for (int k = 0; k < PINK_OCTAVES; ++k) {
+        octaves[k] = rng_gauss(rng);
+        pink += octaves[k];
+    }
+
+    // The noise amplitude in integer units, spread over streams between 2^6 and
+    // 2^18, and the drift over the stream.
+    double sigma = pow(2.0, 6.0 + 12.0 * rng_uniform(rng));
+    double drift = 20.0 * sigma * (rng_uniform(rng) - 0.5);
+    double wobble = 5.0 * sigma * rng_uniform(rng);
+    double period = (double)stream_size / (1.0 + 4.0 * rng_uniform(rng));
+    double step = 0.0;
+    double offset = 0.0;
+    if (is_int64 && (istream % 2 == 1)) {
+        // Odd 64bit streams need both channels.
+        offset = pow(2.0, 40.0);
+    }
+
+    for (int64_t isamp = 0; isamp < stream_size; ++isamp) {
+        // Redraw the octave of the lowest set bit of the sample index.
+        if (isamp > 0) {
+            int k = 0;
+            while ((k < PINK_OCTAVES - 1) && (((isamp >> k) & 1) == 0)) {
+                k++;
+            }
+            pink -= octaves[k];
+            octaves[k] = rng_gauss(rng);
+            pink += octaves[k];
+        }
+        double value = 0.25 * sigma * pink + sigma * rng_gauss(rng);
+        value += drift * (double)isamp / (double)stream_size;
+        value += wobble * sin(2.0 * 3.14159265358979323846 * (double)isamp / period);
+
+        // Glitches, about one per 10^4 samples.
+        double glitch = rng_uniform(rng);
+        if (glitch < 5.0e-5) {
+            value += 1000.0 * sigma * (rng_uniform(rng) - 0.5);
+        } else if (glitch < 1.0e-4) {
+            step += 50.0 * sigma * (rng_uniform(rng) - 0.5);
+        }
+        signal[isamp] = offset + step + value;
+    }
+    return;
+}
+
+
+static int cmp_double(void const * a, void const * b) {
+    double da = *(double const *)a;
+    double db = *(double const *)b;
+    return (da > db) - (da < db);
+}
+
+// The given percentile of the values, which are sorted in place.
+static double percentile(double * values, int64_t n, double pct) {
+    qsort(values, n, sizeof(double), cmp_double);
+    int64_t idx = (int64_t)(pct / 100.0 * (double)(n - 1) + 0.5);
+    return values[idx];
+}
+
+
+typedef struct {
+    bool is_int64;
+    uint32_t level;
+    int64_t n_stream;
+    int64_t stream_size;
+    int64_t segment_size;
+    uint32_t n_threads;
+    // Input data, one of these is set.
+    int32_t * i32;
+    int64_t * i64;
+    // Encoded outputs.
+    unsigned char * bytes;
+    int64_t n_bytes;
+    int64_t * starts;
+    int64_t * nbytes;
+    int64_t * segment_starts;
+    int64_t * frame_starts;
+    int64_t n_seg;
+    int64_t n_frames;
+} bench_case;
+
+
+// Encode the streams [first, first + n) of the case.  The outputs are only kept
+// when encoding all streams.
+static int run_encode(bench_case * bc, int64_t first, int64_t n, bool keep) {
+    int64_t seg_size = bc->segment_size;
+    int64_t * starts = bc->starts + first;
+    int64_t * seg_starts = NULL;
+    int64_t * frm_starts = bc->frame_starts + first * bc->n_frames;
+    if (seg_size > 0) {
+        seg_starts = bc->segment_starts + first * bc->n_seg;
+    }
+    int64_t n_bytes;
+    unsigned char * bytes = NULL;
+    int err;
+    bool threaded = (bc->n_threads > 1);
+    if (bc->is_int64) {
+        int64_t * data = bc->i64 + first * bc->stream_size;
+        if (threaded) {
+            err = encode_i64_threaded(
+                data, NULL, 0, n, bc->stream_size, seg_size, bc->level, false,
+                bc->n_threads, 0, &n_bytes, starts, seg_starts, frm_starts, NULL,
+                &bytes
+            );
+        } else {
+            err = encode_i64(
+                data, NULL, 0, n, bc->stream_size, seg_size, bc->level, false,
+                1, &n_bytes, starts, seg_starts, frm_starts, NULL, &bytes
+            );
+        }
+    } else {
+        int32_t * data = bc->i32 + first * bc->stream_size;
+        if (threaded) {
+            err = encode_i32_threaded(
+                data, NULL, 0, n, bc->stream_size, seg_size, bc->level, false,
+                bc->n_threads, 0, &n_bytes, starts, seg_starts, frm_starts, NULL,
+                &bytes
+            );
+        } else {
+            err = encode_i32(
+                data, NULL, 0, n, bc->stream_size, seg_size, bc->level, false,
+                1, &n_bytes, starts, seg_starts, frm_starts, NULL, &bytes
+            );
+        }
+    }
+    if (keep && (err == ERROR_NONE)) {
+        free(bc->bytes);
+        bc->bytes = bytes;
+        bc->n_bytes = n_bytes;
+        for (int64_t istream = 0; istream < n - 1; ++istream) {
+            bc->nbytes[istream] = starts[istream + 1] - starts[istream];
+        }
+        bc->nbytes[n - 1] = n_bytes - starts[n - 1];
+    } else {
+        free(bytes);
+    }
+    return err;
+}
+
+
+// Decode samples [first_sample, last_sample) of the streams [first, first + n) of
+// the case, which has been encoded.  Negative samples decode the whole streams.
+static int run_decode(
+    bench_case * bc,
+    int64_t first,
+    int64_t n,
+    int64_t first_sample,
+    int64_t last_sample,
+    void * output
+) {
+    int64_t * seg_starts = NULL;
+    if (bc->segment_size > 0) {
+        seg_starts = bc->segment_starts + first * bc->n_seg;
+    }
+    int64_t * frm_starts = bc->frame_starts + first * bc->n_frames;
+    int64_t frame_size = encode_frame_size(bc->level);
+    bool threaded = (bc->n_threads > 1);
+    if (bc->is_int64) {
+        return decode_i64(
+            bc->bytes, bc->starts + first, bc->nbytes + first, n, NULL,
+            bc->stream_size, bc->segment_size, seg_starts, frame_size, frm_starts,
+            first_sample, last_sample, NULL, (int64_t *)output, threaded
+        );
+    } else {
+        return decode_i32(
+            bc->bytes, bc->starts + first, bc->nbytes + first, n, NULL,
+            bc->stream_size, bc->segment_size, seg_starts, frame_size, frm_starts,
+            first_sample, last_sample, NULL, (int32_t *)output, threaded
+        );
+    }
+}
+
+
+// Run one case and write its JSON record.  Returns false on any error.
+static bool run_case(
+    bench_case * bc,
+    bench_options const * opts,
+    uint64_t * rng,
+    bool first_record
+) {
+    int64_t n_stream = bc->n_stream;
+    int64_t stream_size = bc->stream_size;
+    int64_t n_samp = n_stream * stream_size;
+    int64_t elem_size = bc->is_int64 ? sizeof(int64_t) : sizeof(int32_t);
+    double input_mb = (double)(n_samp * elem_size) / 1.0e6;
+    int64_t repeat = opts->repeat;
+
+    int64_t slice = (opts->slice < stream_size) ? opts->slice : stream_size;
+    int64_t n_lat = n_stream * repeat;
+    double * times = (double *)malloc(repeat * sizeof(double));
+    double * enc_lat = (double *)malloc(n_lat * sizeof(double));
+    double * dec_lat = (double *)malloc(n_lat * sizeof(double));
+    double * slc_lat = (double *)malloc(n_lat * sizeof(double));
+    void * output = malloc(n_samp * elem_size);
+    if (
+        (times == NULL) || (enc_lat == NULL) || (dec_lat == NULL)
+        || (slc_lat == NULL) || (output == NULL)
+    ) {
+        free(times);
+        free(enc_lat);
+        free(dec_lat);
+        free(slc_lat);
+        free(output);
+        return false;
+    }
+
+    #ifdef _OPENMP
+    omp_set_num_threads(bc->n_threads);
+    #endif
+
+    int err = ERROR_NONE;
+    double start;
+
+    // Encode and decode all streams at once.
+    for (int64_t irep = 0; irep < repeat; ++irep) {
+        start = sched_time();
+        err |= run_encode(bc, 0, n_stream, true);
+        times[irep] = sched_time() - start;
+    }
+    double encode_mbps = input_mb / percentile(times, repeat, 50.0);
+
+    for (int64_t irep = 0; irep < repeat; ++irep) {
+        start = sched_time();
+        err |= run_decode(bc, 0, n_stream, -1, -1, output);
+        times[irep] = sched_time() - start;
+    }
+    double decode_mbps = input_mb / percentile(times, repeat, 50.0);
+    void const * input = bc->is_int64 ? (void *)bc->i64 : (void *)bc->i32;
+    bool valid = (err == ERROR_NONE) && (memcmp(output, input, n_samp * elem_size) == 0);
+
+    // One stream at a time.  The streams of the full encode are kept for decoding,
+    // and the single stream encodes only give the timing.
+    int64_t ilat;
+    int64_t first_sample;
+    for (int64_t irep = 0; irep < repeat; ++irep) {
+        for (int64_t istream = 0; istream < n_stream; ++istream) {
+            ilat = irep * n_stream + istream;
+            start = sched_time();
+            err |= run_decode(bc, istream, 1, -1, -1, output);
+            dec_lat[ilat] = sched_time() - start;
+
+            first_sample = (int64_t)(rng_uniform(rng) * (double)(stream_size - slice));
+            start = sched_time();
+            err |= run_decode(bc, istream, 1, first_sample, first_sample + slice, output);
+            slc_lat[ilat] = sched_time() - start;
+        }
+    }
+    int64_t * keep_starts = (int64_t *)malloc(n_stream * sizeof(int64_t));
+    if (keep_starts != NULL) {
+        memcpy(keep_starts, bc->starts, n_stream * sizeof(int64_t));
+        for (int64_t irep = 0; irep < repeat; ++irep) {
+            for (int64_t istream = 0; istream < n_stream; ++istream) {
+                start = sched_time();
+                err |= run_encode(bc, istream, 1, false);
+                enc_lat[irep * n_stream + istream] = sched_time() - start;
+            }
+        }
+        memcpy(bc->starts, keep_starts, n_stream * sizeof(int64_t));
+        free(keep_starts);
+    } else {
+        err |= ERROR_ALLOC;
+    }
+
+    printf("%s\n    {", (first_record) ? "" : ",");
+    printf("\"type\": \"i%d\", ", bc->is_int64 ? 64 : 32);
+    printf("\"level\": %u, ", bc->level);
+    printf("\"n_stream\": %ld, ", (long)n_stream);
+    printf("\"stream_size\": %ld, ", (long)stream_size);
+    printf("\"segment_size\": %ld, ", (long)bc->segment_size);
+    printf("\"n_threads\": %u, ", bc->n_threads);
+    printf("\"slice\": %ld, ", (long)slice);
+    printf("\"status\": %d, ", err);
+    printf("\"valid\": %s, ", valid ? "true" : "false");
+    printf("\"input_bytes\": %ld, ", (long)(n_samp * elem_size));
+    printf("\"compressed_bytes\": %ld, ", (long)bc->n_bytes);
+    printf("\"ratio\": %.4f, ", (double)(n_samp * elem_size) / (double)bc->n_bytes);
+    printf("\"encode_mbps\": %.2f, ", encode_mbps);
+    printf("\"decode_mbps\": %.2f, ", decode_mbps);
+    printf("\"encode_stream_p50_ms\": %.4f, ", 1.0e3 * percentile(enc_lat, n_lat, 50.0));
+    printf("\"encode_stream_p99_ms\": %.4f, ", 1.0e3 * percentile(enc_lat, n_lat, 99.0));
+    printf("\"decode_stream_p50_ms\": %.4f, ", 1.0e3 * percentile(dec_lat, n_lat, 50.0));
+    printf("\"decode_stream_p99_ms\": %.4f, ", 1.0e3 * percentile(dec_lat, n_lat, 99.0));
+    printf("\"decode_slice_p50_ms\": %.4f, ", 1.0e3 * percentile(slc_lat, n_lat, 50.0));
+    printf("\"decode_slice_p99_ms\": %.4f}", 1.0e3 * percentile(slc_lat, n_lat, 99.0));
+    fflush(stdout);
+
+    fprintf(
+        stderr,
+        "i%d level %u, %ld x %ld, segments %ld, threads %u:  ratio %.3f, "
+        "encode %.1f MB/s, decode %.1f MB/s, status %d%s\n",
+        bc->is_int64 ? 64 : 32, bc->level, (long)n_stream, (long)stream_size,
+        (long)bc->segment_size, bc->n_threads,
+        (double)(n_samp * elem_size) / (double)bc->n_bytes, encode_mbps, decode_mbps,
+        err, valid ? "" : " (FAILED ROUNDTRIP)"
+    );
+
+    free(times);
+    free(enc_lat);
+    free(dec_lat);
+    free(slc_lat);
+    free(output);
+    return (err == ERROR_NONE) && valid;
+}
+
+
+int main(int argc, char * argv[]) {
+    bench_options opts;
+    if (!parse_options(argc, argv, &opts)) {
+        fprintf(
+            stderr,
+            "Usage:  %s [levels=L,..] [types=i32,i64] [streams=N,..] [lengths=N,..]\n"
+            "    [threads=N,..] [segments=N,..] [slice=N] [repeat=N] [seed=N]\n",
+            argv[0]
+        );
+        return 1;
+    }
+    int max_threads = 1;
+    #ifdef _OPENMP
+    max_threads = omp_get_max_threads();
+    #endif
+
+    printf("{\n  \"benchmark\": \"flacarray_cbench\",\n");
+    printf("  \"flac_native_threads\": %s,\n", flac_native_threads() ? "true" : "false");
+    printf("  \"max_threads\": %d,\n", max_threads);
+    printf("  \"repeat\": %ld,\n", (long)opts.repeat);
+    printf("  \"results\": [");
+
+    uint64_t rng = (opts.seed == 0) ? 1 : opts.seed;
+    bool all_ok = true;
+    bool first_record = true;
+    bench_case bc;
+
+    for (int ityp = 0; ityp < opts.types.n; ++ityp) {
+        bc.is_int64 = (opts.types.values[ityp] == 64);
+        for (int istr = 0; istr < opts.streams.n; ++istr) {
+            for (int ilen = 0; ilen < opts.lengths.n; ++ilen) {
+                bc.n_stream = opts.streams.values[istr];
+                bc.stream_size = opts.lengths.values[ilen];
+                if ((bc.n_stream <= 0) || (bc.stream_size <= 0)) {
+                    continue;
+                }
+                int64_t n_samp = bc.n_stream * bc.stream_size;
+
+                // Generate the signals once for all levels, threads and segments.
+                double * signal = (double *)malloc(bc.stream_size * sizeof(double));
+                bc.i32 = NULL;
+                bc.i64 = NULL;
+                if (bc.is_int64) {
+                    bc.i64 = (int64_t *)malloc(n_samp * sizeof(int64_t));
+                } else {
+                    bc.i32 = (int32_t *)malloc(n_samp * sizeof(int32_t));
+                }
+                bc.starts = (int64_t *)malloc(bc.n_stream * sizeof(int64_t));
+                bc.nbytes = (int64_t *)malloc(bc.n_stream * sizeof(int64_t));
+                if (
+                    (signal == NULL) || ((bc.i32 == NULL) && (bc.i64 == NULL))
+                    || (bc.starts == NULL) || (bc.nbytes == NULL)
+                ) {
+                    fprintf(stderr, "Failed to allocate the input data\n");
+                    return 1;
+                }
+                for (int64_t istream = 0; istream < bc.n_stream; ++istream) {
+                    make_signal(&rng, istream, bc.stream_size, bc.is_int64, signal);
+                    for (int64_t isamp = 0; isamp < bc.stream_size; ++isamp) {
+                        int64_t elem = istream * bc.stream_size + isamp;
+                        if (bc.is_int64) {
+                            bc.i64[elem] = (int64_t)llround(signal[isamp]);
+                        } else {
+                            bc.i32[elem] = (int32_t)lround(signal[isamp]);
+                        }
+                    }
+                }
+                free(signal);
+
+                for (int ilev = 0; ilev < opts.levels.n; ++ilev) {
+                    for (int iseg = 0; iseg < opts.segments.n; ++iseg) {
+                        for (int ithr = 0; ithr < opts.threads.n; ++ithr) {
+                            bc.level = (uint32_t)opts.levels.values[ilev];
+                            bc.n_threads = (uint32_t)opts.threads.values[ithr];
+                            bc.segment_size = opts.segments.values[iseg];
+                            if (
+                                (bc.segment_size <= 0)
+                                || (bc.segment_size >= bc.stream_size)
+                            ) {
+                                bc.segment_size = 0;
+                            }
+                            bc.n_seg = n_segments(bc.stream_size, bc.segment_size);
+                            bc.n_frames = n_stream_frames(
+                                bc.stream_size,
+                                bc.segment_size,
+                                encode_frame_size(bc.level)
+                            );
+                            bc.segment_starts = (int64_t *)malloc(
+                                bc.n_stream * bc.n_seg * sizeof(int64_t)
+                            );
+                            bc.frame_starts = (int64_t *)malloc(
+                                bc.n_stream * bc.n_frames * sizeof(int64_t)
+                            );
+                            bc.bytes = NULL;
+                            bc.n_bytes = 0;
+                            if (
+                                (bc.segment_starts == NULL)
+                                || (bc.frame_starts == NULL)
+                                || !run_case(&bc, &opts, &rng, first_record)
+                            ) {
+                                all_ok = false;
+                            }
+                            first_record = false;
+                            free(bc.bytes);
+                            free(bc.segment_starts);
+                            free(bc.frame_starts);
+                        }
+                    }
+                }
+                free(bc.i32);
+                free(bc.i64);
+                free(bc.starts);
+                free(bc.nbytes);
+            }
+        }
+    }
+    printf("\n  ]\n}\n");
+
+    pool_clear(true);
+    return all_ok ? 0 : 1;
+}
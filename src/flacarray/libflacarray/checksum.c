@@ -0,0 +1,197 @@
+// Copyright (c) 2024-2025 by the parties listed in the AUTHORS file.
+// All rights reserved.  Use of this source code is governed by
+// a BSD-style license that can be found in the LICENSE file.
+
+#include <flacarray.h>
+
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+# include <arm_acle.h>
+#endif // if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+
+
+// CRC32C (Castagnoli) checksums of the compressed bytes.  These are computed by the
+// encoder as each item is written, and can be checked before decoding.  On x86_64
+// the SSE 4.2 crc32 instruction is used when the CPU supports it, and on aarch64
+// when the library is built for a target with the CRC extension.  Otherwise a
+// table driven implementation (8 bytes at a time) is used.  All of these give the
+// same result.
+
+#define CRC32C_POLY 0x82F63B78u
+
+#if (defined(__x86_64__) || defined(_M_X64)) && (defined(__GNUC__) || defined(__clang__))
+# define HAVE_CRC32C_SSE42 1
+#else
+# define HAVE_CRC32C_SSE42 0
+#endif
+
+static uint32_t crc32c_table[8][256];
+static bool crc32c_ready = false;
+static bool crc32c_hardware = false;
+
+
+// Build the lookup tables and check for hardware support.  This is called by each
+// function which computes checksums before any threads are started.  The critical
+// section makes the tables visible to every thread which calls this.
+void crc32c_init() {
+    #pragma omp critical (crc32c_init)
+    {
+        if (!crc32c_ready) {
+            uint32_t crc;
+            for (uint32_t n = 0; n < 256; ++n) {
+                crc = n;
+                for (int k = 0; k < 8; ++k) {
+                    crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : (crc >> 1);
+                }
+                crc32c_table[0][n] = crc;
+            }
+            for (uint32_t n = 0; n < 256; ++n) {
+                crc = crc32c_table[0][n];
+                for (int k = 1; k < 8; ++k) {
+                    crc = crc32c_table[0][crc & 0xFF] ^ (crc >> 8);
+                    crc32c_table[k][n] = crc;
+                }
+            }
+            #if HAVE_CRC32C_SSE42
+            __builtin_cpu_init();
+            crc32c_hardware = __builtin_cpu_supports("sse4.2");
+            #endif
+            crc32c_ready = true;
+        }
+    }
+    return;
+}
+
+
+#if HAVE_CRC32C_SSE42
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, unsigned char const * data, int64_t n) {
+    uint64_t crc64 = crc;
+    uint64_t word;
+    while ((n > 0) && (((uintptr_t)data & 7) != 0)) {
+        crc64 = __builtin_ia32_crc32qi((uint32_t)crc64, *data);
+        data++;
+        n--;
+    }
+    while (n >= 8) {
+        memcpy(&word, data, 8);
+        crc64 = __builtin_ia32_crc32di(crc64, word);
+        data += 8;
+        n -= 8;
+    }
+    while (n > 0) {
+        crc64 = __builtin_ia32_crc32qi((uint32_t)crc64, *data);
+        data++;
+        n--;
+    }
+    return (uint32_t)crc64;
+}
+#endif // if HAVE_CRC32C_SSE42
+
+
+// The table driven version reads 8 bytes at a time in little-endian order.
+static uint32_t crc32c_table8(uint32_t crc, unsigned char const * data, int64_t n) {
+    while (n >= 8) {
+        crc ^= (uint32_t)data[0] | ((uint32_t)data[1] << 8)
+            | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+        crc = crc32c_table[7][crc & 0xFF] ^ crc32c_table[6][(crc >> 8) & 0xFF]
+            ^ crc32c_table[5][(crc >> 16) & 0xFF] ^ crc32c_table[4][crc >> 24]
+            ^ crc32c_table[3][data[4]] ^ crc32c_table[2][data[5]]
+            ^ crc32c_table[1][data[6]] ^ crc32c_table[0][data[7]];
+        data += 8;
+        n -= 8;
+    }
+    while (n > 0) {
+        crc = crc32c_table[0][(crc ^ *data) & 0xFF] ^ (crc >> 8);
+        data++;
+        n--;
+    }
+    return crc;
+}
+
+
+// Update the checksum `crc` of the preceding bytes with n more bytes.  The checksum
+// of zero bytes is zero, so a checksum is started from zero and can be updated a
+// piece at a time.  crc32c_init() must have been called.
+uint32_t crc32c(uint32_t crc, unsigned char const * data, int64_t n) {
+    crc = ~crc;
+    #if HAVE_CRC32C_SSE42
+    if (crc32c_hardware) {
+        return ~crc32c_sse42(crc, data, n);
+    }
+    #elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+    uint64_t word;
+    while (n >= 8) {
+        memcpy(&word, data, 8);
+        crc = __crc32cd(crc, word);
+        data += 8;
+        n -= 8;
+    }
+    while (n > 0) {
+        crc = __crc32cb(crc, *data);
+        data++;
+        n--;
+    }
+    return ~crc;
+    #endif
+    return ~crc32c_table8(crc, data, n);
+}
+
+
+// Check the checksums of the compressed items (streams, or the segments of each
+// stream) against the bytes.  The checksums have n_seg values for each stream, and
+// segment_starts (NULL without segments) gives the offset of each segment from the
+// start of its stream.  Only the segments [seg_first, seg_last) of each stream are
+// checked.  If streams is not NULL, only the n_stream streams with these indices
+// are checked.  The items are spread over threads if use_threads is true.  Returns
+// ERROR_CHECKSUM if any item does not match.
+int verify_checksums(
+    unsigned char const * bytes,
+    int64_t const * starts,
+    int64_t const * nbytes,
+    int64_t n_stream,
+    int64_t const * streams,
+    int64_t n_seg,
+    int64_t const * segment_starts,
+    uint32_t const * checksums,
+    int64_t seg_first,
+    int64_t seg_last,
+    bool use_threads
+) {
+    if ((n_seg > 1) && (segment_starts == NULL)) {
+        return ERROR_CHECKSUM;
+    }
+    crc32c_init();
+    int64_t n_check = seg_last - seg_first;
+    int64_t n_item = n_stream * n_check;
+
+    int n_thread = 1;
+    #ifdef _OPENMP
+    if (use_threads) {
+        n_thread = omp_get_max_threads();
+    }
+    #endif
+
+    int errors = ERROR_NONE;
+
+    #pragma omp parallel for schedule(dynamic, 1) reduction(|:errors) num_threads(n_thread)
+    for (int64_t icheck = 0; icheck < n_item; ++icheck) {
+        int64_t istream = icheck / n_check;
+        if (streams != NULL) {
+            istream = streams[istream];
+        }
+        int64_t iseg = seg_first + icheck % n_check;
+        int64_t item = istream * n_seg + iseg;
+        int64_t first = 0;
+        int64_t last = nbytes[istream];
+        if (n_seg > 1) {
+            first = segment_starts[item];
+            if (iseg < n_seg - 1) {
+                last = segment_starts[item + 1];
+            }
+        }
+        if (crc32c(0, bytes + starts[istream] + first, last - first) != checksums[item]) {
+            errors |= ERROR_CHECKSUM;
+        }
+    }
+    return errors;
+}
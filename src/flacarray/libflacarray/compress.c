@@ -8,6 +8,44 @@
 #include <flacarray.h>
 
 
+// The number of samples of floating point data which are quantized at once while
+// encoding.  This is a multiple of the frame sizes, and small enough that the
+// per-thread block stays in cache.
+#define ENCODE_BLOCK 32768
+
+// The sampling used to estimate the cost of encoding each item in the threaded
+// encoder: the number of windows spread through the item, and their length.
+#define COST_WINDOWS 16
+#define COST_WINDOW_LEN 32
+
+// The safety margin applied to the estimated size of each item when sizing the
+// regions of the arena in the batched threaded encoder.
+#define BATCH_MARGIN 1.25
+
+
+// Record the starting byte (relative to the start of the current item) of an
+// audio frame in the optional frame table.  Metadata blocks are written with zero
+// samples and are not recorded.  Returns false if the frame does not fit in the
+// table.
+static bool record_frame(
+    int64_t * frame_starts,
+    int64_t frame_first,
+    int64_t frame_count,
+    uint32_t samples,
+    uint32_t current_frame,
+    int64_t pos
+) {
+    if ((frame_starts == NULL) || (samples == 0)) {
+        return true;
+    }
+    if ((int64_t)current_frame >= frame_count) {
+        return false;
+    }
+    frame_starts[frame_first + current_frame] = pos;
+    return true;
+}
+
+
 // Callback function, called by the encoder for each chunk
 // of data.
 FLAC__StreamEncoderWriteStatus enc_write_callback(
@@ -37,19 +75,37 @@ FLAC__StreamEncoderWriteStatus enc_write_callback(
         data->last_stream = cur;
     }
 
+    int64_t pos = (comp == NULL) ? 0 : comp->n_elem;
+    if (!record_frame(
+        data->frame_starts,
+        data->frame_first,
+        data->frame_count,
+        samples,
+        current_frame,
+        pos - stream_offsets[cur]
+    )) {
+        return FLAC__STREAM_ENCODER_WRITE_STATUS_FATAL_ERROR;
+    }
+
     // Initialize the buffer for this stream if it is the first call.  Otherwise
     // resize as needed.
     int64_t elems;
-    int64_t new_elems;
     if (comp == NULL) {
         elems = 0;
         data->compressed = create_array_uint8(bytes);
         comp = data->compressed;
-        new_elems = bytes;
+        if (comp == NULL) {
+            return FLAC__STREAM_ENCODER_WRITE_STATUS_FATAL_ERROR;
+        }
     } else {
         elems = comp->n_elem;
-        new_elems = elems + bytes;
-        resize_array_uint8(comp, new_elems);
+        int64_t capacity = comp->size;
+        if (resize_array_uint8(comp, elems + bytes) != ERROR_NONE) {
+            return FLAC__STREAM_ENCODER_WRITE_STATUS_FATAL_ERROR;
+        }
+        if ((data->perf != NULL) && (comp->size != capacity)) {
+            data->perf->enc_resizes += 1;
+        }
     }
 
     // Copy bytes into place
@@ -58,13 +114,24 @@ FLAC__StreamEncoderWriteStatus enc_write_callback(
         (void*)buffer,
         bytes
     );
+    if (data->checksums != NULL) {
+        data->checksums[cur] = crc32c(data->checksums[cur], buffer, bytes);
+    }
+    if (data->perf != NULL) {
+        data->perf->enc_writes += 1;
+        data->perf->enc_bytes += bytes;
+    }
 
     return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
 }
 
 
 // Callback function, called by the encoder for each chunk
-// of data.
+// of data.  Each stream is written to its reserved region of the shared output
+// buffer, or to a separate buffer if there is no shared buffer.  Once a stream
+// overflows its reserved region, the rest of its bytes are only counted.  The
+// caller then encodes it again directly into the output, where its final size is
+// known (see encode_overflowed()).
 FLAC__StreamEncoderWriteStatus enc_threaded_write_callback(
     const FLAC__StreamEncoder * encoder,
     const FLAC__byte buffer[],
@@ -76,21 +143,56 @@ FLAC__StreamEncoderWriteStatus enc_threaded_write_callback(
     enc_threaded_callback_data * data = (enc_threaded_callback_data *)client_data;
 
     int64_t cur = data->cur_stream;
+    int64_t elems = data->stream_nbytes[cur];
     ArrayUint8 * comp = data->compressed[cur];
 
-    // Initialize the buffer for this stream if it is the first call.  Otherwise
-    // resize as needed.
-    int64_t elems;
-    int64_t new_elems;
-    if (comp == NULL) {
-        elems = 0;
+    if (!record_frame(
+        data->frame_starts,
+        data->frame_first,
+        data->frame_count,
+        samples,
+        current_frame,
+        elems
+    )) {
+        return FLAC__STREAM_ENCODER_WRITE_STATUS_FATAL_ERROR;
+    }
+    if (data->checksums != NULL) {
+        data->checksums[cur] = crc32c(data->checksums[cur], buffer, bytes);
+    }
+    if (data->perf != NULL) {
+        data->perf->enc_writes += 1;
+        data->perf->enc_bytes += bytes;
+    }
+
+    if (data->reserved != NULL) {
+        unsigned char * region = (
+            data->reserved + (cur - data->first_stream) * data->reserved_bytes
+        );
+        if (elems + (int64_t)bytes <= data->reserved_bytes) {
+            // Common case, copy directly into the reserved region.
+            memcpy(
+                (void*)(region + elems),
+                (void*)buffer,
+                bytes
+            );
+        }
+        data->stream_nbytes[cur] += bytes;
+        return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
+    } else if (comp == NULL) {
+        // First call for this stream, and we are not using a shared buffer.
         data->compressed[cur] = create_array_uint8(bytes);
         comp = data->compressed[cur];
-        new_elems = bytes;
+        if (comp == NULL) {
+            return FLAC__STREAM_ENCODER_WRITE_STATUS_FATAL_ERROR;
+        }
     } else {
-        elems = comp->n_elem;
-        new_elems = elems + bytes;
-        resize_array_uint8(comp, new_elems);
+        int64_t capacity = comp->size;
+        if (resize_array_uint8(comp, elems + bytes) != ERROR_NONE) {
+            return FLAC__STREAM_ENCODER_WRITE_STATUS_FATAL_ERROR;
+        }
+        if ((data->perf != NULL) && (comp->size != capacity)) {
+            data->perf->enc_resizes += 1;
+        }
     }
 
     // Copy bytes into place
@@ -99,6 +201,7 @@ FLAC__StreamEncoderWriteStatus enc_threaded_write_callback(
         (void*)buffer,
         bytes
     );
+    data->stream_nbytes[cur] += bytes;
 
     return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
 }
@@ -118,26 +221,929 @@ void free_compressed_buffers(ArrayUint8 ** buffers, int64_t n_stream) {
 }
 
 
-// Main encode functions.  A newly allocated buffer of bytes is returned along
-// with the starting byte in this buffer for each of the streams.  This function
-// requires that the N-dimensional array is contiguous in memory and is treated
-// as a flat-packed array.  If any errors occur, the processing stops, an
-// attempt is made to free any buffers that were allocated, and an error code is
-// returned which is a bitwise OR of the errors on all threads.
+// Upper limit on the number of encoded bytes for one stream.  When the data
+// cannot be compressed, libFLAC falls back to storing verbatim subframes.  Each
+// channel then uses at most 33 bits per sample (the side channel of stereo
+// decorrelation needs one extra bit), plus the frame and subframe headers,
+// CRC, and padding.  The frame count assumes the smallest block size used by
+// the compression level presets.  The metadata blocks at the start of the stream
+// (STREAMINFO and the vendor string) are well below the fixed allowance.
+int64_t encode_bound(int64_t stream_size, uint32_t n_channels) {
+    int64_t n_frame = stream_size / 1152 + 1;
+    int64_t frame_bytes = 32 + 8 * n_channels;
+    int64_t sample_bits = 33 * stream_size * n_channels;
+    return 1024 + n_frame * frame_bytes + (sample_bits + 7) / 8;
+}
+
+
+// The number of independently encoded segments in each stream.  A segment_size
+// which is not positive or which is at least the stream size means that each stream
+// is a single segment.
+int64_t n_segments(int64_t stream_size, int64_t segment_size) {
+    if ((segment_size <= 0) || (segment_size >= stream_size)) {
+        return 1;
+    }
+    return (stream_size + segment_size - 1) / segment_size;
+}
+
+
+// The number of samples in each FLAC frame.  This is the block size which libFLAC
+// chooses for the compression level presets:  levels 0-2 do not use LPC and have
+// 1152 samples, the others have 4096.  The encoder sets this block size explicitly,
+// so that the first sample of every frame is known when building a frame table.
+int64_t encode_frame_size(uint32_t level) {
+    return (level < 3) ? 1152 : 4096;
+}
+
+
+// The number of frames in each stream.  Every segment is a separate FLAC stream, so
+// the frames of each segment are counted separately.  The segment_size should be
+// zero if the streams are not split into segments.
+int64_t n_stream_frames(int64_t stream_size, int64_t segment_size, int64_t frame_size) {
+    int64_t n_seg = n_segments(stream_size, segment_size);
+    if (n_seg == 1) {
+        return (stream_size + frame_size - 1) / frame_size;
+    }
+    int64_t seg_frames = (segment_size + frame_size - 1) / frame_size;
+    int64_t last_size = stream_size - (n_seg - 1) * segment_size;
+    return (n_seg - 1) * seg_frames + (last_size + frame_size - 1) / frame_size;
+}
+
+
+// The distance (in samples) between consecutive samples of a stream in the input.
+static int64_t input_stride(enc_input const * input) {
+    return (input->stream_offsets == NULL) ? 1 : input->sample_stride;
+}
+
+
+// The encoders process a flat list of work items, one per segment of each stream.
+// For item `item`, compute the offset (in samples) of its first sample in the input
+// data and the number of samples in the segment.  The last segment of a stream may
+// be shorter than the others.
+static void segment_samples(
+    enc_input const * input,
+    int64_t item,
+    int64_t n_seg,
+    int64_t stream_size,
+    int64_t segment_size,
+    int64_t * first,
+    int64_t * n_samp
+) {
+    int64_t istream = item / n_seg;
+    int64_t iseg = item % n_seg;
+    if (n_seg == 1) {
+        segment_size = stream_size;
+    }
+    int64_t seg_first = iseg * segment_size;
+    if (input->stream_offsets == NULL) {
+        (*first) = istream * stream_size + seg_first;
+    } else {
+        (*first) = input->stream_offsets[istream] + seg_first * input->sample_stride;
+    }
+    (*n_samp) = segment_size;
+    if (seg_first + segment_size > stream_size) {
+        (*n_samp) = stream_size - seg_first;
+    }
+    return;
+}
+
+
+// Given the starting byte of every segment in the output buffer, compute the
+// starting byte of each stream and (if segmented) the byte offset of each segment
+// relative to the start of its stream.  Segment offsets are relative so that they
+// remain valid when streams are extracted or moved to a different buffer.
+static void split_segment_starts(
+    int64_t n_stream,
+    int64_t n_seg,
+    int64_t const * item_starts,
+    int64_t * starts,
+    int64_t * segment_starts
+) {
+    for (int64_t istream = 0; istream < n_stream; ++istream) {
+        starts[istream] = item_starts[istream * n_seg];
+        if (segment_starts != NULL) {
+            for (int64_t iseg = 0; iseg < n_seg; ++iseg) {
+                segment_starts[istream * n_seg + iseg] = (
+                    item_starts[istream * n_seg + iseg] - starts[istream]
+                );
+            }
+        }
+    }
+    return;
+}
+
+
+// The frame table entries of one item.  The frames of each stream are stored
+// contiguously, with the frames of each segment in order.
+static void item_frames(
+    int64_t item,
+    int64_t n_seg,
+    int64_t n_frames,
+    int64_t seg_frames,
+    int64_t n_samp,
+    int64_t frame_size,
+    int64_t * frame_first,
+    int64_t * frame_count
+) {
+    int64_t istream = item / n_seg;
+    int64_t iseg = item % n_seg;
+    (*frame_first) = istream * n_frames + iseg * seg_frames;
+    (*frame_count) = (n_samp + frame_size - 1) / frame_size;
+    return;
+}
+
+
+// The frame table is built with byte offsets relative to the start of each item.
+// For segmented streams, add the segment starts so that the offsets are relative
+// to the start of the stream.
+static void offset_segment_frames(
+    int64_t n_stream,
+    int64_t n_seg,
+    int64_t n_frames,
+    int64_t seg_frames,
+    int64_t const * segment_starts,
+    int64_t * frame_starts
+) {
+    for (int64_t istream = 0; istream < n_stream; ++istream) {
+        for (int64_t iframe = 0; iframe < n_frames; ++iframe) {
+            frame_starts[istream * n_frames + iframe] += segment_starts[
+                istream * n_seg + iframe / seg_frames
+            ];
+        }
+    }
+    return;
+}
+
+
+// Whether this build uses the native multithreaded encoding of libFLAC.
+bool flac_native_threads() {
+    return (HAVE_FLAC_NUM_THREADS != 0);
+}
+
+
+// Split a budget of n_threads total threads (zero means the OpenMP default)
+// between OpenMP threads working on separate items and the native libFLAC threads
+// used by each encoder.  Items are always preferred, since they have no
+// synchronization overhead.  Threads that cannot be given an item (when there are
+// fewer items than threads) are handed to the libFLAC encoders instead, so that the
+// product of the two never exceeds the budget.  Returns the number of OpenMP
+// threads.
+static uint32_t split_threads(
+    int64_t n_item,
+    uint32_t n_threads,
+    uint32_t * n_flac_threads
+) {
+    uint32_t total = n_threads;
+    if (total == 0) {
+        #ifdef _OPENMP
+        total = omp_get_max_threads();
+        #else
+        total = 1;
+        #endif
+    }
+    uint32_t n_team = total;
+    if ((int64_t)n_team > n_item) {
+        n_team = (uint32_t)n_item;
+    }
+    (*n_flac_threads) = 1;
+    if (HAVE_FLAC_NUM_THREADS) {
+        (*n_flac_threads) = total / n_team;
+    }
+    return n_team;
+}
+
+
+// Check whether every high word of a 64bit stream (stored as interleaved low and
+// high 32bit channels) is just the sign extension of the low word.  In that case
+// the stream fits in a single 32bit channel.  The low words are `stride` 32bit
+// values apart.
+static bool high_is_sign(int32_t const * data, int64_t stride, int64_t stream_size) {
+    for (int64_t isamp = 0; isamp < stream_size; ++isamp) {
+        if (data[stride * isamp + 1] != ((data[stride * isamp] < 0) ? -1 : 0)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+// The smallest bits per sample which can hold every value in the range
+// [vmin, vmax].  Only the sample sizes in the FLAC "streamable subset" are used, so
+// that the output can be read by any decoder.  Streams with at most 24 bits let
+// libFLAC use 32bit integers for its residual calculations, which is much faster.
+static uint32_t range_bps(int64_t vmin, int64_t vmax) {
+    static uint32_t const subset_bps[5] = {8, 12, 16, 20, 24};
+    for (int ibps = 0; ibps < 5; ++ibps) {
+        int64_t lim = ((int64_t)1) << (subset_bps[ibps] - 1);
+        if ((vmin >= -lim) && (vmax < lim)) {
+            return subset_bps[ibps];
+        }
+    }
+    return 32;
+}
+
+
+// The smallest bits per sample which can hold every value of a single channel
+// stream, whose values are `stride` 32bit values apart.
+static uint32_t stream_bps(int32_t const * data, int64_t stride, int64_t stream_size) {
+    int32_t vmin = 0;
+    int32_t vmax = 0;
+    int32_t val;
+    for (int64_t isamp = 0; isamp < stream_size; ++isamp) {
+        val = data[stride * isamp];
+        vmin = (val < vmin) ? val : vmin;
+        vmax = (val > vmax) ? val : vmax;
+    }
+    return range_bps(vmin, vmax);
+}
+
+
+// The value of one sample of the input (for floating point input, in units of the
+// quantization), used to estimate the cost of encoding.  The sample index is the
+// offset into the input data (see segment_samples()).
+static double sample_value(
+    enc_input const * input,
+    int64_t istream,
+    int64_t isamp,
+    uint32_t n_channels
+) {
+    if (input->ints != NULL) {
+        if (n_channels == 1) {
+            return (double)input->ints[isamp];
+        }
+        return (double)(int64_t)(
+            ((uint64_t)(uint32_t)input->ints[2 * isamp + 1] << 32)
+            | (uint64_t)(uint32_t)input->ints[2 * isamp]
+        );
+    } else if (input->f32 != NULL) {
+        return (
+            ((double)input->f32[isamp] - (double)input->f32_offsets[istream])
+            * (double)input->f32_gains[istream]
+        );
+    } else {
+        return (input->f64[isamp] - input->f64_offsets[istream]) * input->f64_gains[istream];
+    }
+}
+
+
+// Estimate the relative cost of encoding an item from a sample of its values.  The
+// work grows with the number of samples and channels, and the residual coding with
+// the number of bits in the sample to sample differences.  These are measured over
+// a few short windows spread through the item, so the estimate is cheap compared to
+// encoding.  For floating point input, the offsets and gains must be known.
+static double item_cost(
+    enc_input const * input,
+    int64_t istream,
+    int64_t first,
+    int64_t n_samp,
+    uint32_t n_channels
+) {
+    int64_t n_win = COST_WINDOWS;
+    int64_t win_len = COST_WINDOW_LEN;
+    if (n_samp < n_win * win_len) {
+        n_win = 1;
+        win_len = n_samp;
+    }
+    int64_t stride = n_samp / n_win;
+    int64_t step = input_stride(input);
+    double sum = 0.0;
+    double amax = 0.0;
+    double prev;
+    double cur;
+    for (int64_t iwin = 0; iwin < n_win; ++iwin) {
+        int64_t off = first + iwin * stride * step;
+        prev = sample_value(input, istream, off, n_channels);
+        for (int64_t isamp = 1; isamp < win_len; ++isamp) {
+            cur = sample_value(input, istream, off + isamp * step, n_channels);
+            sum += (cur > prev) ? (cur - prev) : (prev - cur);
+            amax = (cur > amax) ? cur : ((-cur > amax) ? -cur : amax);
+            prev = cur;
+        }
+    }
+    double diff = (win_len > 1) ? sum / (double)(n_win * (win_len - 1)) : 0.0;
+
+    // A few bits worth of fixed work per sample, plus the bits of the differences.
+    double bits = 4.0;
+    while (diff >= 1.0) {
+        diff *= 0.5;
+        bits += 1.0;
+    }
+    // 64bit streams are narrowed to one channel when their values fit in 32 bits.
+    double chans = ((n_channels == 2) && (amax >= 2147483648.0)) ? 2.0 : 1.0;
+    return (double)n_samp * chans * bits;
+}
+
+
+// The range of n_samp floating point values of the input, starting at offset `first`
+// and `step` samples apart.
+static void strided_range(
+    enc_input const * input,
+    int64_t first,
+    int64_t n_samp,
+    int64_t step,
+    double * vmin,
+    double * vmax
+) {
+    double val;
+    if (input->f32 != NULL) {
+        (*vmin) = (double)input->f32[first];
+    } else {
+        (*vmin) = input->f64[first];
+    }
+    (*vmax) = (*vmin);
+    for (int64_t isamp = 1; isamp < n_samp; ++isamp) {
+        if (input->f32 != NULL) {
+            val = (double)input->f32[first + isamp * step];
+        } else {
+            val = input->f64[first + isamp * step];
+        }
+        (*vmin) = (val < (*vmin)) ? val : (*vmin);
+        (*vmax) = (val > (*vmax)) ? val : (*vmax);
+    }
+    return;
+}
+
+
+// For floating point input, compute the range of the values in each item, the offset
+// and gain of each stream from the combined range of its items, and the range of
+// the quantized values of each item (used to choose its sample width).  This is the
+// same conversion as float32_to_int32() and float64_to_int64().  The loops are
+// shared among the threads when called inside a parallel region.
+static void quantize_params(
+    enc_input const * input,
+    int64_t n_stream,
+    int64_t n_seg,
+    int64_t stream_size,
+    int64_t segment_size,
+    double * item_range,
+    int64_t * item_qrange
+) {
+    int64_t n_item = n_stream * n_seg;
+    int64_t step = input_stride(input);
+    int64_t first;
+    int64_t n_samp;
+
+    #pragma omp for schedule(static)
+    for (int64_t item = 0; item < n_item; ++item) {
+        segment_samples(input, item, n_seg, stream_size, segment_size, &first, &n_samp);
+        if (step != 1) {
+            strided_range(
+                input, first, n_samp, step, &(item_range[2 * item]),
+                &(item_range[2 * item + 1])
+            );
+        } else if (input->f32 != NULL) {
+            float fmin;
+            float fmax;
+            float32_range(input->f32 + first, n_samp, &fmin, &fmax);
+            item_range[2 * item] = fmin;
+            item_range[2 * item + 1] = fmax;
+        } else {
+            float64_range(
+                input->f64 + first, n_samp, &(item_range[2 * item]),
+                &(item_range[2 * item + 1])
+            );
+        }
+    }
+
+    #pragma omp for schedule(static)
+    for (int64_t istream = 0; istream < n_stream; ++istream) {
+        double smin = item_range[2 * istream * n_seg];
+        double smax = item_range[2 * istream * n_seg + 1];
+        for (int64_t iseg = 1; iseg < n_seg; ++iseg) {
+            int64_t item = istream * n_seg + iseg;
+            smin = (item_range[2 * item] < smin) ? item_range[2 * item] : smin;
+            smax = (item_range[2 * item + 1] > smax) ? item_range[2 * item + 1] : smax;
+        }
+        if (input->f32 != NULL) {
+            float32_params(
+                (float)smin,
+                (float)smax,
+                (input->f32_quanta == NULL) ? NULL : &(input->f32_quanta[istream]),
+                &(input->f32_offsets[istream]),
+                &(input->f32_gains[istream])
+            );
+        } else {
+            float64_params(
+                smin,
+                smax,
+                (input->f64_quanta == NULL) ? NULL : &(input->f64_quanta[istream]),
+                &(input->f64_offsets[istream]),
+                &(input->f64_gains[istream])
+            );
+        }
+    }
+
+    // Quantization is monotonic, so the quantized range of each item comes from
+    // the quantized extremes.
+    #pragma omp for schedule(static)
+    for (int64_t item = 0; item < n_item; ++item) {
+        int64_t istream = item / n_seg;
+        int64_t qlow;
+        int64_t qhigh;
+        if (input->f32 != NULL) {
+            float offset = input->f32_offsets[istream];
+            float gain = input->f32_gains[istream];
+            qlow = float32_quantize_value((float)item_range[2 * item], offset, gain);
+            qhigh = float32_quantize_value((float)item_range[2 * item + 1], offset, gain);
+        } else {
+            double offset = input->f64_offsets[istream];
+            double gain = input->f64_gains[istream];
+            qlow = float64_quantize_value(item_range[2 * item], offset, gain);
+            qhigh = float64_quantize_value(item_range[2 * item + 1], offset, gain);
+        }
+        // If the requested quanta is too small, the values overflow and the
+        // order is not preserved.
+        item_qrange[2 * item] = (qlow < qhigh) ? qlow : qhigh;
+        item_qrange[2 * item + 1] = (qlow < qhigh) ? qhigh : qlow;
+    }
+    return;
+}
+
+
+// Allocate the per-item ranges used for floating point input.  For integer input,
+// these are not needed and are set to NULL.
+static int alloc_quantize_ranges(
+    enc_input const * input,
+    int64_t n_item,
+    double ** item_range,
+    int64_t ** item_qrange
+) {
+    (*item_range) = NULL;
+    (*item_qrange) = NULL;
+    if (input->ints != NULL) {
+        return ERROR_NONE;
+    }
+    (*item_range) = (double *)malloc(2 * n_item * sizeof(double));
+    (*item_qrange) = (int64_t *)malloc(2 * n_item * sizeof(int64_t));
+    if (((*item_range) == NULL) || ((*item_qrange) == NULL)) {
+        free(*item_range);
+        free(*item_qrange);
+        return ERROR_ALLOC;
+    }
+    return ERROR_NONE;
+}
+
+
+// Gather strided integer data one block at a time into the scratch buffer and pass
+// each block to the encoder.  Samples are `stride` 32bit values apart, and for a
+// single channel only the first (low) value of each sample is used.
+static bool process_gathered(
+    FLAC__StreamEncoder * encoder,
+    int32_t * block,
+    int32_t const * data,
+    int64_t stride,
+    int64_t stream_size,
+    uint32_t n_channels
+) {
+    int64_t n_block;
+    int32_t const * src;
+    for (int64_t off = 0; off < stream_size; off += ENCODE_BLOCK) {
+        n_block = stream_size - off;
+        if (n_block > ENCODE_BLOCK) {
+            n_block = ENCODE_BLOCK;
+        }
+        src = data + off * stride;
+        if (n_channels == 1) {
+            for (int64_t isamp = 0; isamp < n_block; ++isamp) {
+                block[isamp] = src[isamp * stride];
+            }
+        } else {
+            for (int64_t isamp = 0; isamp < n_block; ++isamp) {
+                block[2 * isamp] = src[isamp * stride];
+                block[2 * isamp + 1] = src[isamp * stride + 1];
+            }
+        }
+        if (!FLAC__stream_encoder_process_interleaved(encoder, block, n_block)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+// Quantize floating point data one block at a time into the scratch buffer and
+// pass each block to the encoder.  Strided input is first gathered into the
+// separate `gather` buffer, which has space for a block of values.  If perf is not
+// NULL, the time spent quantizing is added to it.
+static bool process_quantized(
+    FLAC__StreamEncoder * encoder,
+    int32_t * block,
+    void * gather,
+    enc_input const * input,
+    int64_t istream,
+    int64_t first,
+    int64_t stream_size,
+    uint32_t n_channels,
+    perf_counters * perf
+) {
+    int64_t step = input_stride(input);
+    int64_t n_block;
+    double convert_start = 0.0;
+    for (int64_t off = 0; off < stream_size; off += ENCODE_BLOCK) {
+        n_block = stream_size - off;
+        if (n_block > ENCODE_BLOCK) {
+            n_block = ENCODE_BLOCK;
+        }
+        if (perf != NULL) {
+            convert_start = sched_time();
+        }
+        if (input->f32 != NULL) {
+            float const * src = input->f32 + first + off * step;
+            if (step != 1) {
+                float * buf = (float *)gather;
+                for (int64_t isamp = 0; isamp < n_block; ++isamp) {
+                    buf[isamp] = src[isamp * step];
+                }
+                src = buf;
+            }
+            float32_quantize(
+                src,
+                n_block,
+                input->f32_offsets[istream],
+                input->f32_gains[istream],
+                block
+            );
+        } else {
+            double const * src = input->f64 + first + off * step;
+            if (step != 1) {
+                double * buf = (double *)gather;
+                for (int64_t isamp = 0; isamp < n_block; ++isamp) {
+                    buf[isamp] = src[isamp * step];
+                }
+                src = buf;
+            }
+            float64_quantize(
+                src,
+                n_block,
+                input->f64_offsets[istream],
+                input->f64_gains[istream],
+                n_channels,
+                block
+            );
+        }
+        if (perf != NULL) {
+            perf->convert += sched_time() - convert_start;
+        }
+        if (!FLAC__stream_encoder_process_interleaved(encoder, block, n_block)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+// Encode a single stream with the encoder from the thread pool.  The encoder
+// should already exist and be in the uninitialized state, and it is always returned
+// to that state (ready for reuse) on exit, even if an error occurs.  If
+// n_flac_threads is greater than one and libFLAC supports it, the encoder uses that
+// many threads internally.
+//
+// Each stream is encoded with its narrowest representation.  Two channel (64bit)
+// streams whose high words only hold the sign of the low words are encoded as a
+// single channel, and single channel streams use the smallest bits per sample
+// which holds their range.  Both are recorded in the STREAMINFO metadata of the
+// stream, and the decoder widens the samples again on output.
+//
+// The stream is item `istream` of the input, starting at offset `first` of the
+// input data (see segment_samples()).  For floating point input, qrange is the range
+// of its quantized values.  Flat-packed integer input is passed to libFLAC in place,
+// while strided input is gathered a block at a time.
+//
+// If the performance counters are enabled, the time spent is added to those of the
+// pool.
+static int encode_stream(
+    flac_pool * pool,
+    enc_input const * input,
+    int64_t istream,
+    int64_t first,
+    int64_t stream_size,
+    int64_t const * qrange,
+    uint32_t n_channels,
+    uint32_t level,
+    bool do_md5,
+    uint32_t n_flac_threads,
+    FLAC__StreamEncoderWriteCallback write_callback,
+    void * callback_data
+) {
+    bool success;
+    FLAC__StreamEncoderInitStatus status;
+    FLAC__StreamEncoder * encoder = pool->encoder;
+    perf_counters * perf = pool_perf(pool);
+    double setup_start = 0.0;
+    double process_start = 0.0;
+    if (perf != NULL) {
+        setup_start = sched_time();
+    }
+
+    int32_t const * data = NULL;
+    int32_t const * gathered = NULL;
+    int32_t * block = NULL;
+    void * gather = NULL;
+    uint32_t bps = 32;
+    int64_t step = input_stride(input);
+    int64_t stride = step * n_channels;
+    if ((input->ints != NULL) && (step != 1)) {
+        gathered = input->ints + first * n_channels;
+        if ((n_channels == 2) && high_is_sign(gathered, stride, stream_size)) {
+            n_channels = 1;
+        }
+        if (n_channels == 1) {
+            bps = stream_bps(gathered, stride, stream_size);
+        }
+        block = pool_scratch(pool, 2 * ENCODE_BLOCK);
+        if (block == NULL) {
+            return ERROR_ALLOC;
+        }
+    } else if (input->ints != NULL) {
+        data = input->ints + first * n_channels;
+        if ((n_channels == 2) && high_is_sign(data, 2, stream_size)) {
+            // Gather the low words a block at a time as they are encoded.
+            gathered = data;
+            data = NULL;
+            n_channels = 1;
+            bps = stream_bps(gathered, stride, stream_size);
+            block = pool_scratch(pool, 2 * ENCODE_BLOCK);
+            if (block == NULL) {
+                return ERROR_ALLOC;
+            }
+        } else if (n_channels == 1) {
+            bps = stream_bps(data, 1, stream_size);
+        }
+    } else {
+        // The quantized values are not known until they are encoded, but their
+        // range is.
+        if ((n_channels == 2) && (qrange[0] >= INT32_MIN) && (qrange[1] <= INT32_MAX)) {
+            n_channels = 1;
+        }
+        if (n_channels == 1) {
+            bps = range_bps(qrange[0], qrange[1]);
+        }
+        if (step != 1) {
+            // The second half of the buffer holds the gathered values.
+            block = pool_scratch(pool, 4 * ENCODE_BLOCK);
+            gather = (void *)(block + 2 * ENCODE_BLOCK);
+        } else {
+            block = pool_scratch(pool, 2 * ENCODE_BLOCK);
+        }
+        if (block == NULL) {
+            return ERROR_ALLOC;
+        }
+    }
+
+    // Set parameters.  These are reset to their defaults each time the encoder
+    // is finished.
+    success = FLAC__stream_encoder_set_compression_level(encoder, level);
+    if (! success) {
+        return ERROR_ENCODE_SET_COMP_LEVEL;
+    }
+    success = FLAC__stream_encoder_set_do_md5(encoder, do_md5);
+    if (! success) {
+        return ERROR_ENCODE_INIT;
+    }
+    success = FLAC__stream_encoder_set_blocksize(encoder, encode_frame_size(level));
+    if (! success) {
+        return ERROR_ENCODE_SET_BLOCK_SIZE;
+    }
+    success = FLAC__stream_encoder_set_channels(encoder, n_channels);
+    if (!success) {
+        return ERROR_ENCODE_SET_CHANNELS;
+    }
+    success = FLAC__stream_encoder_set_bits_per_sample(encoder, bps);
+    if (!success) {
+        return ERROR_ENCODE_SET_BPS;
+    }
+#if HAVE_FLAC_NUM_THREADS
+    if (n_flac_threads > 1) {
+        // If libFLAC was built without thread support or rejects this number of
+        // threads, just encode with a single thread.
+        if (
+            FLAC__stream_encoder_set_num_threads(encoder, n_flac_threads)
+            != FLAC__STREAM_ENCODER_SET_NUM_THREADS_OK
+        ) {
+            FLAC__stream_encoder_set_num_threads(encoder, 1);
+        }
+    }
+#endif
+
+    // Initialize our encoder with our callback function and data.
+    status = FLAC__stream_encoder_init_stream(
+        encoder,
+        write_callback,
+        NULL,
+        NULL,
+        NULL,
+        callback_data
+    );
+    if (status != FLAC__STREAM_ENCODER_INIT_STATUS_OK) {
+        FLAC__stream_encoder_finish(encoder);
+        return ERROR_ENCODE_INIT;
+    }
+    if (perf != NULL) {
+        process_start = sched_time();
+        perf->enc_setup += process_start - setup_start;
+    }
+
+    // Encode this stream.
+    if (data != NULL) {
+        success = FLAC__stream_encoder_process_interleaved(
+            encoder,
+            data,
+            stream_size
+        );
+    } else if (gathered != NULL) {
+        success = process_gathered(
+            encoder,
+            block,
+            gathered,
+            stride,
+            stream_size,
+            n_channels
+        );
+    } else {
+        success = process_quantized(
+            encoder,
+            block,
+            gather,
+            input,
+            istream,
+            first,
+            stream_size,
+            n_channels,
+            perf
+        );
+    }
+    if (!success) {
+        FLAC__stream_encoder_finish(encoder);
+        return ERROR_ENCODE_PROCESS;
+    }
+
+    // Flush the last frame and return the encoder to the uninitialized state.
+    success = FLAC__stream_encoder_finish(encoder);
+    if (!success) {
+        return ERROR_ENCODE_FINISH;
+    }
+    if (perf != NULL) {
+        perf->enc_process += sched_time() - process_start;
+        perf->enc_items += 1;
+    }
+    return ERROR_NONE;
+}
+
+
+// Gather the encoded streams into the final output buffer.  If there is a reserved
+// buffer, the streams in their regions are compacted in place and the buffer is
+// resized to the output size, leaving gaps for any streams which overflowed their
+// regions (see encode_overflowed()).  The reserved buffer is then returned in
+// `bytes` (or freed on error).
+// Otherwise a new buffer is allocated and the streams are copied into it.
+static int collect_streams(
+    int64_t n_stream,
+    unsigned char * reserved,
+    int64_t reserved_bytes,
+    int64_t const * stream_nbytes,
+    ArrayUint8 ** buffers,
+    int64_t * n_bytes,
+    int64_t * starts,
+    unsigned char ** bytes
+) {
+    // Compute the starts of each stream in the final bytes buffer
+    // and the total number of output bytes.
+    (*n_bytes) = 0;
+    for (int64_t istream = 0; istream < n_stream; ++istream) {
+        if ((buffers[istream] == NULL) && (reserved == NULL)) {
+            // One of the streams was never processed.  This is an error.
+            return ERROR_ENCODE_COLLECT;
+        }
+        starts[istream] = (*n_bytes);
+        (*n_bytes) += stream_nbytes[istream];
+    }
+
+    unsigned char * temp_ptr;
+    if (reserved != NULL) {
+        // Pack the streams which fit in their regions at the front of the buffer.
+        // Each one only moves towards the start, so moving them in order is safe.
+        int64_t packed = 0;
+        for (int64_t istream = 0; istream < n_stream; ++istream) {
+            if (stream_nbytes[istream] <= reserved_bytes) {
+                memmove(
+                    (void*)(reserved + packed),
+                    (void*)(reserved + istream * reserved_bytes),
+                    stream_nbytes[istream] * sizeof(unsigned char)
+                );
+                packed += stream_nbytes[istream];
+            }
+        }
+        // Resize the reservation to the output.  This only grows if some streams
+        // overflowed their regions.
+        temp_ptr = (unsigned char *)realloc(
+            (void*)reserved,
+            (*n_bytes) * sizeof(unsigned char)
+        );
+        if (temp_ptr == NULL) {
+            if ((*n_bytes) > packed) {
+                free(reserved);
+                return ERROR_ALLOC;
+            }
+            temp_ptr = reserved;
+        }
+        if ((*n_bytes) > packed) {
+            // Move the packed streams to their final starts in reverse order (each
+            // one only moves towards the end).  This leaves gaps for the streams
+            // which overflowed, which the caller encodes again into place.
+            for (int64_t istream = n_stream - 1; istream >= 0; --istream) {
+                if (stream_nbytes[istream] <= reserved_bytes) {
+                    packed -= stream_nbytes[istream];
+                    memmove(
+                        (void*)(temp_ptr + starts[istream]),
+                        (void*)(temp_ptr + packed),
+                        stream_nbytes[istream] * sizeof(unsigned char)
+                    );
+                }
+            }
+        }
+        (*bytes) = temp_ptr;
+        return ERROR_NONE;
+    }
 
-// NOTE:  libFLAC >= 1.5.0 natively supports threaded compression, but this is not
-// enabled by default.  We could evaluate the performance of that, but would require
-// a check on the version being used.
+    // Allocate the output bytes
+    (*bytes) = (unsigned char *)malloc((*n_bytes));
+    if ((*bytes) == NULL) {
+        // Allocation failed.
+        return ERROR_ALLOC;
+    }
+
+    // Copy the streams into the output.
+    for (int64_t istream = 0; istream < n_stream; ++istream) {
+        memcpy(
+            (void*)((*bytes) + starts[istream]),
+            (void*)(buffers[istream]->data),
+            stream_nbytes[istream] * sizeof(unsigned char)
+        );
+    }
+    return ERROR_NONE;
+}
+
+
+// Main encode functions.  A newly allocated buffer of bytes is returned along
+// with the starting byte in this buffer for each of the streams.  The input (see
+// enc_input) is either a flat-packed array of n_stream * stream_size samples, or a
+// strided view where stream_offsets gives the first sample of each stream and
+// consecutive samples are sample_stride samples apart.  Strided samples are read in
+// place, without checking that they are within the array.  For floating point
+// input, the offset and gain of each stream are also returned.  If any errors
+// occur, the processing stops, an attempt is made to free any buffers that were
+// allocated, and an error code is returned which is a bitwise OR of the errors on
+// all threads.
+//
+// If segment_starts is not NULL and segment_size is smaller than the stream size,
+// each stream is split into segments of segment_size samples (the last one may be
+// shorter) which are encoded as independent FLAC streams.  The segments of a stream
+// are stored contiguously, and the byte offset of each segment relative to the
+// start of its stream is returned in segment_starts, which must have space for
+// n_stream * n_segments(stream_size, segment_size) values.  Segments can be decoded
+// independently, which allows decoding a sample slice to skip the segments outside
+// that range, and allows a small number of long streams to use all threads.
+//
+// If frame_starts is not NULL, it is filled with the starting byte of every FLAC
+// frame relative to the start of its stream.  It must have space for n_stream *
+// n_stream_frames(stream_size, segment_size, encode_frame_size(level)) values
+// (with segment_size zero if segment_starts is NULL).  Every frame except the last
+// one in each segment has encode_frame_size(level) samples, so the decoder can
+// start directly at the frame containing the first requested sample.
+//
+// With libFLAC >= 1.5.0, each encoder can also use several threads internally.
+// The n_threads argument is the total thread budget (zero means the OpenMP
+// default).  The unthreaded encoder gives all of these to libFLAC.  The threaded
+// encoder first uses OpenMP threads for separate items and only gives the
+// leftover threads to libFLAC, which helps when there are fewer items than threads.
+//
+// The threaded encoder also takes a max_memory limit (zero for no limit) on the
+// bytes used for the items in progress, in addition to the output.  If the items
+// would need more, they are encoded in batches which fit in a reused arena of this
+// size, and each finished batch is appended to the output.
+//
+// If checksums is not NULL, the CRC32C of the encoded bytes of every item (see
+// crc32c()) is computed as they are written, and returned with one value per item
+// (n_stream * n_segments(stream_size, segment_size) values, or n_stream without
+// segments).  If do_md5 is false, libFLAC skips the MD5 signature of the input
+// samples.  The streams are written without seeking back to the STREAMINFO block,
+// so this signature is never stored and computing it only costs time.
 
 // Unthreaded version.  No need for thread-local buffers, so this is often faster.
 int encode(
-    int32_t * const data,
+    enc_input const * input,
     int64_t n_stream,
     int64_t stream_size,
+    int64_t segment_size,
     uint32_t n_channels,
     uint32_t level,
+    bool do_md5,
+    uint32_t n_threads,
     int64_t * n_bytes,
     int64_t * starts,
+    int64_t * segment_starts,
+    int64_t * frame_starts,
+    uint32_t * checksums,
     unsigned char ** bytes
 ) {
     // Check input parameters
@@ -158,127 +1164,537 @@ int encode(
         starts[istream] = 0;
     }
 
-    // This tracks the failures.
-    int errors = ERROR_NONE;
+    // Each segment of each stream is a separate work item.
+    int64_t n_seg = 1;
+    if (segment_starts != NULL) {
+        n_seg = n_segments(stream_size, segment_size);
+    }
+    int64_t n_item = n_stream * n_seg;
+    int64_t seg_size = (n_seg > 1) ? segment_size : stream_size;
+
+    // Layout of the optional frame table.
+    int64_t frame_size = encode_frame_size(level);
+    int64_t seg_frames = (seg_size + frame_size - 1) / frame_size;
+    int64_t n_frames = n_stream_frames(stream_size, seg_size, frame_size);
+
+    // All threads are used by libFLAC, one item at a time.
+    uint32_t n_flac_threads = 1;
+    split_threads(1, n_threads, &n_flac_threads);
+
+    // The starting byte of each item.  Without segments, this is just the stream
+    // starts.
+    int64_t * item_starts = starts;
+    if (n_seg > 1) {
+        item_starts = (int64_t *)malloc(n_item * sizeof(int64_t));
+        if (item_starts == NULL) {
+            return ERROR_ALLOC;
+        }
+    }
+
+    // This tracks the failures.
+    int errors = ERROR_NONE;
+
+    // Floating point input is quantized while encoding.
+    double * item_range;
+    int64_t * item_qrange;
+    errors |= alloc_quantize_ranges(input, n_item, &item_range, &item_qrange);
+    if ((errors == ERROR_NONE) && (input->ints == NULL)) {
+        quantize_params(
+            input, n_stream, n_seg, stream_size, segment_size, item_range, item_qrange
+        );
+    }
+
+    // Encoder from the pool for this thread.
+    FLAC__StreamEncoder * encoder = NULL;
+    flac_pool * pool = pool_get();
+    if (pool != NULL) {
+        encoder = pool_encoder(pool);
+    }
+    if ((encoder == NULL) || (errors != ERROR_NONE)) {
+        if (n_seg > 1) {
+            free(item_starts);
+        }
+        free(item_range);
+        free(item_qrange);
+        return ERROR_ALLOC;
+    }
+
+    // Create callback data
+    enc_callback_data callback_data;
+    callback_data.last_stream = -1;
+    callback_data.stream_offsets = item_starts;
+    callback_data.compressed = NULL;
+    callback_data.frame_starts = frame_starts;
+    callback_data.checksums = checksums;
+    callback_data.perf = pool_perf(pool);
+    if (checksums != NULL) {
+        crc32c_init();
+        for (int64_t item = 0; item < n_item; ++item) {
+            checksums[item] = 0;
+        }
+    }
+
+    int64_t first;
+    int64_t n_samp;
+    for (int64_t item = 0; item < n_item; ++item) {
+        if (errors != ERROR_NONE) {
+            // We already had a failure, skip over remaining loop iterations
+            continue;
+        }
+        // Set the current item in the callback data
+        callback_data.cur_stream = item;
+
+        segment_samples(input, item, n_seg, stream_size, segment_size, &first, &n_samp);
+        item_frames(
+            item,
+            n_seg,
+            n_frames,
+            seg_frames,
+            n_samp,
+            frame_size,
+            &(callback_data.frame_first),
+            &(callback_data.frame_count)
+        );
+        errors |= encode_stream(
+            pool,
+            input,
+            item / n_seg,
+            first,
+            n_samp,
+            (item_qrange == NULL) ? NULL : &(item_qrange[2 * item]),
+            n_channels,
+            level,
+            do_md5,
+            n_flac_threads,
+            enc_write_callback,
+            (void *)&callback_data
+        );
+    }
+
+    free(item_range);
+    free(item_qrange);
+
+    if (errors != ERROR_NONE) {
+        // Clean up and exit
+        destroy_array_uint8(callback_data.compressed);
+        if (n_seg > 1) {
+            free(item_starts);
+        }
+        return errors;
+    }
+
+    // Total number of bytes.  The starting offsets were computed on the
+    // fly during the encode whenever switching to the next item.
+    (*n_bytes) = callback_data.compressed->n_elem;
+    if (n_seg > 1) {
+        split_segment_starts(n_stream, n_seg, item_starts, starts, segment_starts);
+        free(item_starts);
+        if (frame_starts != NULL) {
+            offset_segment_frames(
+                n_stream, n_seg, n_frames, seg_frames, segment_starts, frame_starts
+            );
+        }
+    }
+
+    // Hand the accumulated buffer to the caller, releasing any excess capacity.
+    // This avoids a copy of the full output.
+    unsigned char * temp_ptr = (unsigned char *)realloc(
+        (void*)(callback_data.compressed->data),
+        (*n_bytes) * sizeof(unsigned char)
+    );
+    if (temp_ptr == NULL) {
+        // Shrinking failed, just keep the original allocation.
+        temp_ptr = callback_data.compressed->data;
+    }
+    (*bytes) = temp_ptr;
+
+    // Cleanup callback structure
+    callback_data.compressed->data = NULL;
+    destroy_array_uint8(callback_data.compressed);
+
+    return errors;
+}
+
+
+// Encode the items [item_first, item_last) with a team of threads, using the
+// threaded write callback.  The items are handed out dynamically in the given order
+// (relative to item_first), or in item order if this is NULL, so that threads which
+// finish their items early take more of the remaining ones.  The busy time and the
+// number of items of each thread are added to the scheduling statistics, if not NULL.
+static int encode_items(
+    enc_input const * input,
+    int64_t stream_size,
+    int64_t segment_size,
+    int64_t n_seg,
+    int64_t n_frames,
+    int64_t seg_frames,
+    int64_t const * item_qrange,
+    uint32_t n_channels,
+    uint32_t level,
+    bool do_md5,
+    uint32_t n_team,
+    uint32_t n_flac_threads,
+    int64_t item_first,
+    int64_t item_last,
+    int64_t const * order,
+    enc_threaded_callback_data const * shared,
+    sched_stats * stats
+) {
+    int64_t frame_size = encode_frame_size(level);
+    int64_t n_batch = item_last - item_first;
+
+    // This tracks the failures across all threads.
+    int errors = ERROR_NONE;
+
+    #pragma omp parallel reduction(|:errors) num_threads(n_team)
+    {
+        // Thread-local encoder from the pool.
+        FLAC__StreamEncoder * encoder = NULL;
+        flac_pool * pool = pool_get();
+        if (pool != NULL) {
+            encoder = pool_encoder(pool);
+        }
+        if (encoder == NULL) {
+            errors |= ERROR_ALLOC;
+        }
+
+        // Create thread-local callback data
+        enc_threaded_callback_data callback_data = (*shared);
+        callback_data.perf = pool_perf(pool);
+
+        int64_t first;
+        int64_t n_samp;
+        int64_t item;
+        double busy = 0.0;
+        int64_t n_done = 0;
+        double item_start;
+
+        #pragma omp for schedule(dynamic, 1)
+        for (int64_t iorder = 0; iorder < n_batch; ++iorder) {
+            if (errors != ERROR_NONE) {
+                // We already had a failure, skip over remaining loop iterations
+                continue;
+            }
+            item = item_first + ((order == NULL) ? iorder : order[iorder]);
+            item_start = sched_time();
+
+            // Set the current item in the callback data
+            callback_data.cur_stream = item;
+
+            segment_samples(input, item, n_seg, stream_size, segment_size, &first, &n_samp);
+            item_frames(
+                item,
+                n_seg,
+                n_frames,
+                seg_frames,
+                n_samp,
+                frame_size,
+                &(callback_data.frame_first),
+                &(callback_data.frame_count)
+            );
+            errors |= encode_stream(
+                pool,
+                input,
+                item / n_seg,
+                first,
+                n_samp,
+                (item_qrange == NULL) ? NULL : &(item_qrange[2 * item]),
+                n_channels,
+                level,
+                do_md5,
+                n_flac_threads,
+                enc_threaded_write_callback,
+                (void *)&callback_data
+            );
+            busy += sched_time() - item_start;
+            n_done += 1;
+        }
+
+        if (stats != NULL) {
+            #ifdef _OPENMP
+            int ithread = omp_get_thread_num();
+            #else
+            int ithread = 0;
+            #endif
+            stats->busy[ithread] += busy;
+            stats->items[ithread] += n_done;
+        }
+    }
+    return errors;
+}
+
+
+// Encode again the items from item_first to item_last which overflowed their
+// reserved region of `region` bytes.  The first pass counted the final size of
+// these items, and the output has a gap of this size at item_starts[item] for each
+// one.  Each item is written directly into its gap, one at a time, with the whole
+// thread budget given to libFLAC.  The frame starts and checksums of the item are
+// written again.
+static int encode_overflowed(
+    enc_input const * input,
+    int64_t stream_size,
+    int64_t segment_size,
+    int64_t n_seg,
+    int64_t n_frames,
+    int64_t seg_frames,
+    int64_t const * item_qrange,
+    uint32_t n_channels,
+    uint32_t level,
+    bool do_md5,
+    uint32_t n_threads,
+    int64_t item_first,
+    int64_t item_last,
+    int64_t region,
+    unsigned char * output,
+    int64_t const * item_starts,
+    enc_threaded_callback_data const * shared,
+    sched_stats * stats
+) {
+    uint32_t n_flac_threads = 1;
+    split_threads(1, n_threads, &n_flac_threads);
+    perf_counters * perf = pool_perf(pool_get());
+
+    enc_threaded_callback_data callback_data = (*shared);
+    int errors = ERROR_NONE;
+    int64_t nbytes;
+    for (int64_t item = item_first; item < item_last; ++item) {
+        nbytes = shared->stream_nbytes[item];
+        if (nbytes <= region) {
+            continue;
+        }
+        callback_data.reserved = output + item_starts[item];
+        callback_data.reserved_bytes = nbytes;
+        callback_data.first_stream = item;
+        shared->stream_nbytes[item] = 0;
+        if (shared->checksums != NULL) {
+            shared->checksums[item] = 0;
+        }
+        errors |= encode_items(
+            input,
+            stream_size,
+            segment_size,
+            n_seg,
+            n_frames,
+            seg_frames,
+            item_qrange,
+            n_channels,
+            level,
+            do_md5,
+            1,
+            n_flac_threads,
+            item,
+            item + 1,
+            NULL,
+            &callback_data,
+            stats
+        );
+        if ((errors == ERROR_NONE) && (shared->stream_nbytes[item] != nbytes)) {
+            // The encoder did not reproduce the same bytes.
+            errors |= ERROR_ENCODE_COLLECT;
+        }
+        if (errors != ERROR_NONE) {
+            break;
+        }
+        if (perf != NULL) {
+            perf->enc_overflows += 1;
+        }
+    }
+    return errors;
+}
+
 
-    // Encoder variables.
-    bool success;
-    FLAC__StreamEncoderInitStatus status;
-    FLAC__StreamEncoder * encoder;
+// The estimated number of encoded bytes of an item, from its estimated cost (see
+// item_cost()) in bits and an allowance for the metadata blocks.
+static double batch_estimate(double cost) {
+    return cost / 8.0 + 256.0;
+}
 
-    // Create callback data
-    enc_callback_data callback_data;
-    callback_data.last_stream = -1;
-    callback_data.stream_offsets = starts;
-    callback_data.compressed = NULL;
 
-    for (int64_t istream = 0; istream < n_stream; ++istream) {
-        if (errors != ERROR_NONE) {
-            // We already had a failure, skip over remaining loop iterations
-            continue;
-        }
-        // Set the current stream in the callback data
-        callback_data.cur_stream = istream;
+// Encode the items in consecutive batches which fit in the arena buffer, appending
+// each finished batch to the output.  The items of a batch get equal regions of the
+// arena, sized from their estimated cost and the ratio of actual to estimated bytes
+// of the previous batches, with a safety margin.  The size of every item of a
+// finished batch is known, so the output grows exactly once per batch.  Items which
+// did not fit in their region are then encoded again directly into the output (see
+// encode_overflowed()), so only the arena and the output are allocated.  Each batch
+// has at least one item.
+static int encode_batches(
+    enc_input const * input,
+    int64_t stream_size,
+    int64_t segment_size,
+    int64_t n_seg,
+    int64_t n_frames,
+    int64_t seg_frames,
+    int64_t const * item_qrange,
+    uint32_t n_channels,
+    uint32_t level,
+    bool do_md5,
+    uint32_t n_team,
+    uint32_t n_flac_threads,
+    int64_t n_item,
+    double const * cost,
+    int64_t bound,
+    int64_t arena_bytes,
+    enc_threaded_callback_data * callback_data,
+    sched_stats * stats,
+    int64_t * n_bytes,
+    int64_t * item_starts,
+    unsigned char ** bytes
+) {
+    int errors = ERROR_NONE;
+    perf_counters * perf = pool_perf(pool_get());
 
-        // Create encoder and set parameters.
-        encoder = FLAC__stream_encoder_new();
-        success = FLAC__stream_encoder_set_compression_level(encoder, level);
-        if (! success) {
-            errors |= ERROR_ENCODE_SET_COMP_LEVEL;
-            continue;
-        }
-        success = FLAC__stream_encoder_set_blocksize(encoder, 0);
-        if (! success) {
-            errors |= ERROR_ENCODE_SET_BLOCK_SIZE;
-            continue;
-        }
-        success = FLAC__stream_encoder_set_channels(encoder, n_channels);
-        if (!success) {
-            errors |= ERROR_ENCODE_SET_CHANNELS;
-            continue;
+    unsigned char * output = NULL;
+    int64_t out_bytes = 0;
+
+    // The running ratio of actual to estimated bytes.
+    double scale = 1.0;
+    double est_done = 0.0;
+
+    int64_t next = 0;
+    int64_t last;
+    double est;
+    double max_est;
+    int64_t region;
+    int64_t try_region;
+    int64_t * order;
+    int64_t batch_bytes;
+    unsigned char * temp_ptr;
+    while ((next < n_item) && (errors == ERROR_NONE)) {
+        // Add items to the batch while their regions fit in the arena.
+        last = next;
+        max_est = 0.0;
+        region = 0;
+        while (last < n_item) {
+            est = batch_estimate(cost[last]);
+            est = (est > max_est) ? est : max_est;
+            try_region = (int64_t)(BATCH_MARGIN * scale * est) + 1;
+            if (try_region > bound) {
+                try_region = bound;
+            }
+            if ((last > next) && ((last - next + 1) * try_region > arena_bytes)) {
+                break;
+            }
+            max_est = est;
+            region = try_region;
+            last += 1;
         }
-        success = FLAC__stream_encoder_set_bits_per_sample(encoder, 32);
-        if (!success) {
-            errors |= ERROR_ENCODE_SET_BPS;
-            continue;
+        if (region > arena_bytes) {
+            // A single item larger than the arena.
+            region = arena_bytes;
         }
+        callback_data->first_stream = next;
+        callback_data->reserved_bytes = region;
 
-        // Initialize our encoder with our callback function and data.
-        status = FLAC__stream_encoder_init_stream(
-            encoder,
-            enc_write_callback,
-            NULL,
-            NULL,
-            NULL,
-            (void *)&callback_data
+        order = NULL;
+        if (n_team > 1) {
+            order = sched_order(last - next, cost + next);
+        }
+        errors |= encode_items(
+            input,
+            stream_size,
+            segment_size,
+            n_seg,
+            n_frames,
+            seg_frames,
+            item_qrange,
+            n_channels,
+            level,
+            do_md5,
+            n_team,
+            n_flac_threads,
+            next,
+            last,
+            order,
+            callback_data,
+            stats
         );
-        if (status != FLAC__STREAM_ENCODER_INIT_STATUS_OK) {
-            errors |= ERROR_ENCODE_INIT;
-            continue;
+        free(order);
+        if (errors != ERROR_NONE) {
+            break;
         }
 
-        // Encode this stream.
-        success = FLAC__stream_encoder_process_interleaved(
-            encoder,
-            &(data[istream * stream_size * n_channels]),
-            stream_size
+        // Grow the output to hold the whole batch.
+        batch_bytes = 0;
+        for (int64_t item = next; item < last; ++item) {
+            batch_bytes += callback_data->stream_nbytes[item];
+        }
+        temp_ptr = (unsigned char *)realloc(
+            (void*)output,
+            (out_bytes + batch_bytes) * sizeof(unsigned char)
         );
-        if (!success) {
-            errors |= ERROR_ENCODE_PROCESS;
-            continue;
+        if (temp_ptr == NULL) {
+            errors |= ERROR_ALLOC;
+            break;
+        }
+        output = temp_ptr;
+        if (perf != NULL) {
+            perf->enc_resizes += 1;
         }
 
-        // Encoder cleanup.
-        success = FLAC__stream_encoder_finish(encoder);
-        if (!success) {
-            errors |= ERROR_ENCODE_FINISH;
-            continue;
+        // Append the items which fit in their regions, leaving gaps for the others.
+        for (int64_t item = next; item < last; ++item) {
+            item_starts[item] = out_bytes;
+            if (callback_data->stream_nbytes[item] <= region) {
+                memcpy(
+                    (void*)(output + out_bytes),
+                    (void*)(callback_data->reserved + (item - next) * region),
+                    callback_data->stream_nbytes[item] * sizeof(unsigned char)
+                );
+            }
+            out_bytes += callback_data->stream_nbytes[item];
+            est_done += batch_estimate(cost[item]);
         }
-        FLAC__stream_encoder_delete(encoder);
+        errors |= encode_overflowed(
+            input,
+            stream_size,
+            segment_size,
+            n_seg,
+            n_frames,
+            seg_frames,
+            item_qrange,
+            n_channels,
+            level,
+            do_md5,
+            n_team * n_flac_threads,
+            next,
+            last,
+            region,
+            output,
+            item_starts,
+            callback_data,
+            stats
+        );
+        scale = (double)out_bytes / est_done;
+        next = last;
     }
 
     if (errors != ERROR_NONE) {
-        // Clean up and exit
-        destroy_array_uint8(callback_data.compressed);
-        return errors;
-    }
-
-    // Total number of bytes.  The starting offsets were computed on the
-    // fly during the encode whenever switching to the next stream.
-    (*n_bytes) = callback_data.compressed->n_elem;
-
-    // Allocate the output bytes
-    (*bytes) = (unsigned char *)malloc((*n_bytes));
-    if ((*bytes) == NULL) {
-        // Allocation failed.
-        destroy_array_uint8(callback_data.compressed);
-        errors |= ERROR_ALLOC;
+        free(output);
         return errors;
     }
-
-    // Copy the accumulated byte buffer into the output.
-    memcpy(
-        (void*)(*bytes),
-        (void*)(callback_data.compressed->data),
-        (*n_bytes) * sizeof(unsigned char)
-    );
-
-    // Cleanup callback structure
-    destroy_array_uint8(callback_data.compressed);
-
-    return errors;
+    (*n_bytes) = out_bytes;
+    (*bytes) = output;
+    return ERROR_NONE;
 }
 
 
 // Threaded version
 int encode_threaded(
-    int32_t * const data,
+    enc_input const * input,
     int64_t n_stream,
     int64_t stream_size,
+    int64_t segment_size,
     uint32_t n_channels,
     uint32_t level,
+    bool do_md5,
+    uint32_t n_threads,
+    int64_t max_memory,
     int64_t * n_bytes,
     int64_t * starts,
+    int64_t * segment_starts,
+    int64_t * frame_starts,
+    uint32_t * checksums,
     unsigned char ** bytes
 ) {
     // Check input parameters
@@ -296,213 +1712,448 @@ int encode_threaded(
     (*n_bytes) = 0;
     (*bytes) = NULL;
 
-    // Allocate an array of buffer pointers, one per stream.  This will be
-    // populated by individual threads and then copied into the final output
-    // buffer at the end.
-    ArrayUint8 ** buffers = (ArrayUint8 **)malloc(n_stream * sizeof(ArrayUint8 *));
-    if (buffers == NULL) {
+    // Each segment of each stream is a separate work item.
+    int64_t n_seg = 1;
+    if (segment_starts != NULL) {
+        n_seg = n_segments(stream_size, segment_size);
+    }
+    int64_t n_item = n_stream * n_seg;
+    int64_t seg_size = (n_seg > 1) ? segment_size : stream_size;
+
+    // Layout of the optional frame table.
+    int64_t frame_size = encode_frame_size(level);
+    int64_t seg_frames = (seg_size + frame_size - 1) / frame_size;
+    int64_t n_frames = n_stream_frames(stream_size, seg_size, frame_size);
+
+    // The number of OpenMP threads and the libFLAC threads used by each one.
+    uint32_t n_flac_threads = 1;
+    uint32_t n_team = split_threads(n_item, n_threads, &n_flac_threads);
+
+    // The largest possible encoded size of one item.
+    int64_t bound = encode_bound(seg_size, n_channels);
+    unsigned char * reserved = NULL;
+
+    // The number of bytes written for each item.
+    int64_t * stream_nbytes = (int64_t *)malloc(n_item * sizeof(int64_t));
+
+    // Array of separate buffer pointers, one per item.  These are only used if
+    // an item does not fit in the reserved buffer.
+    ArrayUint8 ** buffers = (ArrayUint8 **)malloc(n_item * sizeof(ArrayUint8 *));
+
+    // The starting byte of each item.  Without segments, this is just the stream
+    // starts.
+    int64_t * item_starts = starts;
+    if (n_seg > 1) {
+        item_starts = (int64_t *)malloc(n_item * sizeof(int64_t));
+    }
+
+    // Floating point input is quantized while encoding.
+    double * item_range;
+    int64_t * item_qrange;
+    int range_err = alloc_quantize_ranges(input, n_item, &item_range, &item_qrange);
+
+    // The estimated cost of each item, used to size the output reservation and to
+    // order the work when there is more than one thread.
+    double * cost = (double *)malloc(n_item * sizeof(double));
+    int64_t * order = NULL;
+
+    if (
+        (buffers == NULL) || (stream_nbytes == NULL) || (item_starts == NULL)
+        || (range_err != ERROR_NONE) || (cost == NULL)
+    ) {
         // Allocation failed
+        free(buffers);
+        free(stream_nbytes);
+        free(item_range);
+        free(item_qrange);
+        free(cost);
+        if (n_seg > 1) {
+            free(item_starts);
+        }
         return ERROR_ALLOC;
     } else {
-        for (int64_t istream = 0; istream < n_stream; ++istream) {
-            buffers[istream] = NULL;
+        for (int64_t item = 0; item < n_item; ++item) {
+            buffers[item] = NULL;
+            stream_nbytes[item] = 0;
         }
     }
 
     // This tracks the failures across all threads.
     int errors = ERROR_NONE;
 
-    #pragma omp parallel reduction(|:errors)
-    {
-        // Thread-local encoder variables.
-        bool success;
-        FLAC__StreamEncoderInitStatus status;
-        FLAC__StreamEncoder * encoder;
-
-        // Create thread-local callback data
-        enc_threaded_callback_data callback_data;
-        callback_data.n_stream = n_stream;
-        callback_data.compressed = buffers;
-
-        #pragma omp for schedule(static)
-        for (int64_t istream = 0; istream < n_stream; ++istream) {
-            if (errors != ERROR_NONE) {
-                // We already had a failure, skip over remaining loop iterations
-                continue;
-            }
-            // Set the current stream in the callback data
-            callback_data.cur_stream = istream;
-
-            // Create encoder and set parameters.
-            encoder = FLAC__stream_encoder_new();
-            success = FLAC__stream_encoder_set_compression_level(encoder, level);
-            if (! success) {
-                errors |= ERROR_ENCODE_SET_COMP_LEVEL;
-                continue;
-            }
-            success = FLAC__stream_encoder_set_blocksize(encoder, 0);
-            if (! success) {
-                errors |= ERROR_ENCODE_SET_BLOCK_SIZE;
-                continue;
-            }
-            success = FLAC__stream_encoder_set_channels(encoder, n_channels);
-            if (!success) {
-                errors |= ERROR_ENCODE_SET_CHANNELS;
-                continue;
-            }
-            success = FLAC__stream_encoder_set_bits_per_sample(encoder, 32);
-            if (!success) {
-                errors |= ERROR_ENCODE_SET_BPS;
-                continue;
-            }
-
-            // Initialize our encoder with our callback function and data.
-            status = FLAC__stream_encoder_init_stream(
-                encoder,
-                enc_threaded_write_callback,
-                NULL,
-                NULL,
-                NULL,
-                (void *)&callback_data
-            );
-            if (status != FLAC__STREAM_ENCODER_INIT_STATUS_OK) {
-                errors |= ERROR_ENCODE_INIT;
-                continue;
-            }
+    // Scheduling statistics are kept in the pool of the calling thread.
+    flac_pool * caller = pool_get();
+    sched_stats * stats = NULL;
+    if (caller != NULL) {
+        stats = pool_stats(caller, n_team, n_item);
+    }
+    double wall_start = sched_time();
 
-            // Encode this stream.
-            success = FLAC__stream_encoder_process_interleaved(
-                encoder,
-                &(data[istream * stream_size * n_channels]),
-                stream_size
+    // For floating point data, compute the offsets and gains, then estimate the
+    // cost of each item.
+    #pragma omp parallel num_threads(n_team)
+    {
+        if (input->ints == NULL) {
+            quantize_params(
+                input,
+                n_stream,
+                n_seg,
+                stream_size,
+                segment_size,
+                item_range,
+                item_qrange
             );
-            if (!success) {
-                errors |= ERROR_ENCODE_PROCESS;
-                continue;
-            }
-
-            // Encoder cleanup.
-            success = FLAC__stream_encoder_finish(encoder);
-            if (!success) {
-                errors |= ERROR_ENCODE_FINISH;
-                continue;
-            }
-            FLAC__stream_encoder_delete(encoder);
+        }
+        int64_t first;
+        int64_t n_samp;
+        #pragma omp for schedule(static)
+        for (int64_t icost = 0; icost < n_item; ++icost) {
+            segment_samples(input, icost, n_seg, stream_size, segment_size, &first, &n_samp);
+            cost[icost] = item_cost(input, icost / n_seg, first, n_samp, n_channels);
         }
     }
 
-    if (errors != ERROR_NONE) {
-        // Clean up and exit
-        free_compressed_buffers(buffers, n_stream);
-        return errors;
+    // Reserve one output buffer with an equal region for every item, sized from the
+    // largest estimated item with the same margin as the batches (see
+    // encode_batches()).  Each thread writes its items directly into their regions,
+    // and the items are then compacted in place.  An item which does not fit in its
+    // region only has its size counted.  The reservation is resized to the final
+    // size, and the item is encoded again into its gap (see encode_overflowed()).
+    // So the memory used is the larger of the reservation and the compressed size,
+    // without reserving the largest possible size (the bound) of every item or
+    // allocating any separate buffers.  Items which overflow are counted as
+    // "enc_overflows" by the performance counters.  If the reservation fails, every
+    // item is written to a separate buffer and these are copied into the output at
+    // the end, which needs twice the memory.  This is counted as "enc_unreserved".
+    //
+    // With a memory limit smaller than this reservation, an arena of max_memory
+    // bytes is used instead, and the items are encoded in batches which fit in it
+    // (see encode_batches()).
+    double max_est = 0.0;
+    for (int64_t item = 0; item < n_item; ++item) {
+        double est = batch_estimate(cost[item]);
+        max_est = (est > max_est) ? est : max_est;
     }
-
-    // Compute the starts of each stream in the final bytes buffer
-    // and the total number of output bytes.
-    for (int64_t istream = 0; istream < n_stream; ++istream) {
-        if (buffers[istream] == NULL) {
-            // One of the streams was never processed.  This is an error.
-            errors |= ERROR_ENCODE_COLLECT;
-            free_compressed_buffers(buffers, n_stream);
-            return errors;
+    int64_t region = (int64_t)(BATCH_MARGIN * max_est) + 1;
+    if (region > bound) {
+        region = bound;
+    }
+    bool batched = (max_memory > 0) && (max_memory < n_item * region);
+    if (batched) {
+        reserved = (unsigned char *)malloc(max_memory);
+        if (reserved == NULL) {
+            errors |= ERROR_ALLOC;
+        }
+    } else {
+        reserved = (unsigned char *)malloc(n_item * region);
+        perf_counters * perf = pool_perf(caller);
+        if ((reserved == NULL) && (perf != NULL)) {
+            perf->enc_unreserved += 1;
         }
-        starts[istream] = (*n_bytes);
-        (*n_bytes) += buffers[istream]->n_elem;
     }
 
-    // Allocate the output bytes
-    (*bytes) = (unsigned char *)malloc((*n_bytes));
-    if ((*bytes) == NULL) {
-        // Allocation failed.
-        free_compressed_buffers(buffers, n_stream);
-        errors |= ERROR_ALLOC;
-        return errors;
+    // Shared callback data, copied by each thread.
+    enc_threaded_callback_data callback_data;
+    callback_data.n_stream = n_item;
+    callback_data.first_stream = 0;
+    callback_data.reserved = reserved;
+    callback_data.reserved_bytes = region;
+    callback_data.stream_nbytes = stream_nbytes;
+    callback_data.compressed = buffers;
+    callback_data.frame_starts = frame_starts;
+    callback_data.checksums = checksums;
+    callback_data.perf = NULL;
+    if (checksums != NULL) {
+        crc32c_init();
+        for (int64_t item = 0; item < n_item; ++item) {
+            checksums[item] = 0;
+        }
     }
 
-    // Copy the per-stream buffers into the output.
-    for (int64_t istream = 0; istream < n_stream; ++istream) {
-        memcpy(
-            (void*)((*bytes) + starts[istream]),
-            (void*)(buffers[istream]->data),
-            buffers[istream]->n_elem * sizeof(unsigned char)
+    if (errors != ERROR_NONE) {
+        // The arena allocation failed.
+    } else if (batched) {
+        errors |= encode_batches(
+            input,
+            stream_size,
+            segment_size,
+            n_seg,
+            n_frames,
+            seg_frames,
+            item_qrange,
+            n_channels,
+            level,
+            do_md5,
+            n_team,
+            n_flac_threads,
+            n_item,
+            cost,
+            bound,
+            max_memory,
+            &callback_data,
+            stats,
+            n_bytes,
+            item_starts,
+            bytes
         );
+        free(reserved);
+    } else {
+        // Order the items by their estimated cost.  If this fails, the items are
+        // simply processed in order.
+        if (n_team > 1) {
+            order = sched_order(n_item, cost);
+        }
+        errors |= encode_items(
+            input,
+            stream_size,
+            segment_size,
+            n_seg,
+            n_frames,
+            seg_frames,
+            item_qrange,
+            n_channels,
+            level,
+            do_md5,
+            n_team,
+            n_flac_threads,
+            0,
+            n_item,
+            order,
+            &callback_data,
+            stats
+        );
+        if (errors == ERROR_NONE) {
+            errors |= collect_streams(
+                n_item,
+                reserved,
+                region,
+                stream_nbytes,
+                buffers,
+                n_bytes,
+                item_starts,
+                bytes
+            );
+        } else {
+            free(reserved);
+        }
+        if ((errors == ERROR_NONE) && (reserved != NULL)) {
+            errors |= encode_overflowed(
+                input,
+                stream_size,
+                segment_size,
+                n_seg,
+                n_frames,
+                seg_frames,
+                item_qrange,
+                n_channels,
+                level,
+                do_md5,
+                n_team * n_flac_threads,
+                0,
+                n_item,
+                region,
+                (*bytes),
+                item_starts,
+                &callback_data,
+                stats
+            );
+            if (errors != ERROR_NONE) {
+                free(*bytes);
+                (*bytes) = NULL;
+                (*n_bytes) = 0;
+            }
+        }
+    }
+    if (stats != NULL) {
+        stats->wall = sched_time() - wall_start;
+    }
+
+    if ((errors == ERROR_NONE) && (n_seg > 1)) {
+        split_segment_starts(n_stream, n_seg, item_starts, starts, segment_starts);
+        if (frame_starts != NULL) {
+            offset_segment_frames(
+                n_stream, n_seg, n_frames, seg_frames, segment_starts, frame_starts
+            );
+        }
     }
 
     // Cleanup
-    free_compressed_buffers(buffers, n_stream);
+    free_compressed_buffers(buffers, n_item);
+    free(stream_nbytes);
+    free(item_range);
+    free(item_qrange);
+    free(cost);
+    free(order);
+    if (n_seg > 1) {
+        free(item_starts);
+    }
 
     return errors;
 }
 
 
-// Helper wrappers for 32bit and 64bit integers.
+// Helper wrappers for 32bit and 64bit integers.  The data may be flat-packed, or
+// strided if stream_offsets is not NULL (see enc_input).
+
+// Set up 64bit integer input as interleaved 32bit channels.  On little-endian
+// systems the data is used in place, with any strides.  Otherwise the swapped values
+// are copied into a new flat-packed buffer.  The returned buffer must be released
+// with free_interleaved().
+static int interleave_input(
+    int64_t * const data,
+    int64_t const * stream_offsets,
+    int64_t sample_stride,
+    int64_t n_stream,
+    int64_t stream_size,
+    enc_input * input,
+    int32_t ** interleaved
+) {
+    int64_t n_elem = n_stream * stream_size;
+    int err = get_interleaved(n_elem, data, interleaved);
+    if (err != ERROR_NONE) {
+        return err;
+    }
+    input->ints = (*interleaved);
+    if (is_little_endian()) {
+        input->stream_offsets = stream_offsets;
+        input->sample_stride = sample_stride;
+    } else if (stream_offsets == NULL) {
+        copy_interleaved_64_to_32(n_elem, data, (*interleaved));
+    } else {
+        for (int64_t istream = 0; istream < n_stream; ++istream) {
+            for (int64_t isamp = 0; isamp < stream_size; ++isamp) {
+                copy_interleaved_64_to_32(
+                    1,
+                    data + stream_offsets[istream] + isamp * sample_stride,
+                    (*interleaved) + 2 * (istream * stream_size + isamp)
+                );
+            }
+        }
+    }
+    return ERROR_NONE;
+}
 
 int encode_i32(
     int32_t * const data,
+    int64_t const * stream_offsets,
+    int64_t sample_stride,
     int64_t n_stream,
     int64_t stream_size,
+    int64_t segment_size,
     uint32_t level,
+    bool do_md5,
+    uint32_t n_threads,
     int64_t * n_bytes,
     int64_t * starts,
+    int64_t * segment_starts,
+    int64_t * frame_starts,
+    uint32_t * checksums,
     unsigned char ** bytes
 ) {
+    enc_input input = {
+        .stream_offsets = stream_offsets,
+        .sample_stride = sample_stride,
+        .ints = data
+    };
     return encode(
-        data,
+        &input,
         n_stream,
         stream_size,
+        segment_size,
         1,
         level,
+        do_md5,
+        n_threads,
         n_bytes,
         starts,
+        segment_starts,
+        frame_starts,
+        checksums,
         bytes
     );
 }
 
 int encode_i32_threaded(
     int32_t * const data,
+    int64_t const * stream_offsets,
+    int64_t sample_stride,
     int64_t n_stream,
     int64_t stream_size,
+    int64_t segment_size,
     uint32_t level,
+    bool do_md5,
+    uint32_t n_threads,
+    int64_t max_memory,
     int64_t * n_bytes,
     int64_t * starts,
+    int64_t * segment_starts,
+    int64_t * frame_starts,
+    uint32_t * checksums,
     unsigned char ** bytes
 ) {
+    enc_input input = {
+        .stream_offsets = stream_offsets,
+        .sample_stride = sample_stride,
+        .ints = data
+    };
     return encode_threaded(
-        data,
+        &input,
         n_stream,
         stream_size,
+        segment_size,
         1,
         level,
+        do_md5,
+        n_threads,
+        max_memory,
         n_bytes,
         starts,
+        segment_starts,
+        frame_starts,
+        checksums,
         bytes
     );
 }
 
 int encode_i64(
     int64_t * const data,
+    int64_t const * stream_offsets,
+    int64_t sample_stride,
     int64_t n_stream,
     int64_t stream_size,
+    int64_t segment_size,
     uint32_t level,
+    bool do_md5,
+    uint32_t n_threads,
     int64_t * n_bytes,
     int64_t * starts,
+    int64_t * segment_starts,
+    int64_t * frame_starts,
+    uint32_t * checksums,
     unsigned char ** bytes
 ) {
-    int64_t n_elem = n_stream * stream_size;
+    enc_input input = {.stream_offsets = NULL};
     int32_t * interleaved;
-    int err = get_interleaved(n_elem, data, &interleaved);
+    int err = interleave_input(
+        data, stream_offsets, sample_stride, n_stream, stream_size, &input, &interleaved
+    );
     if (err != ERROR_NONE) {
         return err;
     }
-    copy_interleaved_64_to_32(n_elem, data, interleaved);
     err = encode(
-        interleaved,
+        &input,
         n_stream,
         stream_size,
+        segment_size,
         2,
         level,
+        do_md5,
+        n_threads,
         n_bytes,
         starts,
+        segment_starts,
+        frame_starts,
+        checksums,
         bytes
     );
     free_interleaved(interleaved);
@@ -511,30 +2162,241 @@ int encode_i64(
 
 int encode_i64_threaded(
     int64_t * const data,
+    int64_t const * stream_offsets,
+    int64_t sample_stride,
     int64_t n_stream,
     int64_t stream_size,
+    int64_t segment_size,
     uint32_t level,
+    bool do_md5,
+    uint32_t n_threads,
+    int64_t max_memory,
     int64_t * n_bytes,
     int64_t * starts,
+    int64_t * segment_starts,
+    int64_t * frame_starts,
+    uint32_t * checksums,
     unsigned char ** bytes
 ) {
-    int64_t n_elem = n_stream * stream_size;
+    enc_input input = {.stream_offsets = NULL};
     int32_t * interleaved;
-    int err = get_interleaved(n_elem, data, &interleaved);
+    int err = interleave_input(
+        data, stream_offsets, sample_stride, n_stream, stream_size, &input, &interleaved
+    );
     if (err != ERROR_NONE) {
         return err;
     }
-    copy_interleaved_64_to_32(n_elem, data, interleaved);
     err = encode_threaded(
-        interleaved,
+        &input,
         n_stream,
         stream_size,
+        segment_size,
         2,
         level,
+        do_md5,
+        n_threads,
+        max_memory,
         n_bytes,
         starts,
+        segment_starts,
+        frame_starts,
+        checksums,
         bytes
     );
     free_interleaved(interleaved);
     return err;
 }
+
+
+// Helper wrappers for 32bit and 64bit floating point data.
+
+int encode_f32(
+    float * const data,
+    int64_t const * stream_offsets,
+    int64_t sample_stride,
+    int64_t n_stream,
+    int64_t stream_size,
+    int64_t segment_size,
+    float * const quanta,
+    uint32_t level,
+    bool do_md5,
+    uint32_t n_threads,
+    float * offsets,
+    float * gains,
+    int64_t * n_bytes,
+    int64_t * starts,
+    int64_t * segment_starts,
+    int64_t * frame_starts,
+    uint32_t * checksums,
+    unsigned char ** bytes
+) {
+    enc_input input = {
+        .stream_offsets = stream_offsets,
+        .sample_stride = sample_stride,
+        .f32 = data,
+        .f32_quanta = quanta,
+        .f32_offsets = offsets,
+        .f32_gains = gains
+    };
+    return encode(
+        &input,
+        n_stream,
+        stream_size,
+        segment_size,
+        1,
+        level,
+        do_md5,
+        n_threads,
+        n_bytes,
+        starts,
+        segment_starts,
+        frame_starts,
+        checksums,
+        bytes
+    );
+}
+
+
+int encode_f32_threaded(
+    float * const data,
+    int64_t const * stream_offsets,
+    int64_t sample_stride,
+    int64_t n_stream,
+    int64_t stream_size,
+    int64_t segment_size,
+    float * const quanta,
+    uint32_t level,
+    bool do_md5,
+    uint32_t n_threads,
+    int64_t max_memory,
+    float * offsets,
+    float * gains,
+    int64_t * n_bytes,
+    int64_t * starts,
+    int64_t * segment_starts,
+    int64_t * frame_starts,
+    uint32_t * checksums,
+    unsigned char ** bytes
+) {
+    enc_input input = {
+        .stream_offsets = stream_offsets,
+        .sample_stride = sample_stride,
+        .f32 = data,
+        .f32_quanta = quanta,
+        .f32_offsets = offsets,
+        .f32_gains = gains
+    };
+    return encode_threaded(
+        &input,
+        n_stream,
+        stream_size,
+        segment_size,
+        1,
+        level,
+        do_md5,
+        n_threads,
+        max_memory,
+        n_bytes,
+        starts,
+        segment_starts,
+        frame_starts,
+        checksums,
+        bytes
+    );
+}
+
+
+int encode_f64(
+    double * const data,
+    int64_t const * stream_offsets,
+    int64_t sample_stride,
+    int64_t n_stream,
+    int64_t stream_size,
+    int64_t segment_size,
+    double * const quanta,
+    uint32_t level,
+    bool do_md5,
+    uint32_t n_threads,
+    double * offsets,
+    double * gains,
+    int64_t * n_bytes,
+    int64_t * starts,
+    int64_t * segment_starts,
+    int64_t * frame_starts,
+    uint32_t * checksums,
+    unsigned char ** bytes
+) {
+    enc_input input = {
+        .stream_offsets = stream_offsets,
+        .sample_stride = sample_stride,
+        .f64 = data,
+        .f64_quanta = quanta,
+        .f64_offsets = offsets,
+        .f64_gains = gains
+    };
+    return encode(
+        &input,
+        n_stream,
+        stream_size,
+        segment_size,
+        2,
+        level,
+        do_md5,
+        n_threads,
+        n_bytes,
+        starts,
+        segment_starts,
+        frame_starts,
+        checksums,
+        bytes
+    );
+}
+
+
+int encode_f64_threaded(
+    double * const data,
+    int64_t const * stream_offsets,
+    int64_t sample_stride,
+    int64_t n_stream,
+    int64_t stream_size,
+    int64_t segment_size,
+    double * const quanta,
+    uint32_t level,
+    bool do_md5,
+    uint32_t n_threads,
+    int64_t max_memory,
+    double * offsets,
+    double * gains,
+    int64_t * n_bytes,
+    int64_t * starts,
+    int64_t * segment_starts,
+    int64_t * frame_starts,
+    uint32_t * checksums,
+    unsigned char ** bytes
+) {
+    enc_input input = {
+        .stream_offsets = stream_offsets,
+        .sample_stride = sample_stride,
+        .f64 = data,
+        .f64_quanta = quanta,
+        .f64_offsets = offsets,
+        .f64_gains = gains
+    };
+    return encode_threaded(
+        &input,
+        n_stream,
+        stream_size,
+        segment_size,
+        2,
+        level,
+        do_md5,
+        n_threads,
+        max_memory,
+        n_bytes,
+        starts,
+        segment_starts,
+        frame_starts,
+        checksums,
+        bytes
+    );
+}
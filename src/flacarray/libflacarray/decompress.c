@@ -21,6 +21,7 @@ FLAC__StreamDecoderReadStatus dec_read_callback(
 
     // The bytes requested by the decoder
     int64_t n_buffer = (*bytes);
+    perf_counters * perf = callback_data->perf;
 
     if (remaining == 0) {
         // No data left
@@ -40,6 +41,10 @@ FLAC__StreamDecoderReadStatus dec_read_callback(
                     n_buffer
                 );
                 callback_data->stream_pos += n_buffer;
+                if (perf != NULL) {
+                    perf->dec_reads += 1;
+                    perf->dec_bytes += n_buffer;
+                }
                 return FLAC__STREAM_DECODER_READ_STATUS_CONTINUE;
             } else {
                 memcpy(
@@ -49,6 +54,10 @@ FLAC__StreamDecoderReadStatus dec_read_callback(
                 );
                 callback_data->stream_pos += remaining;
                 (*bytes) = remaining;
+                if (perf != NULL) {
+                    perf->dec_reads += 1;
+                    perf->dec_bytes += remaining;
+                }
                 return FLAC__STREAM_DECODER_READ_STATUS_CONTINUE;
             }
         }
@@ -78,20 +87,96 @@ FLAC__StreamDecoderWriteStatus dec_write_callback(
     // The maximum number of samples in each channel
     uint32_t blocksize = frame->header.blocksize;
 
+    // Discard any leading samples before the requested range.
+    int64_t skip = callback_data->skip;
+    if (skip >= blocksize) {
+        callback_data->skip -= blocksize;
+        return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+    }
+    callback_data->skip = 0;
+
     // The number of samples to copy might be smaller than blocksize, if we are on the
     // last block.
-    int64_t n_copy = blocksize;
-    if (nelem + blocksize > n_decode) {
+    int64_t n_copy = blocksize - skip;
+    if (nelem + n_copy > n_decode) {
         n_copy = n_decode - nelem;
     }
 
+    // Convert floating point streams directly into the output, using the same
+    // arithmetic as int32_to_float32() and int64_to_float64().
+    FLAC__int32 const * chan0 = buffer[0] + skip;
+    perf_counters * perf = callback_data->perf;
+    double convert_start = (perf == NULL) ? 0.0 : sched_time();
+    if (callback_data->f32 != NULL) {
+        if (frame->header.channels != 1) {
+            callback_data->err = ERROR_DECODE_CHANNELS;
+            return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+        }
+        float * fout = callback_data->f32 + nelem;
+        float foffset = callback_data->f32_offset;
+        float fcoeff = callback_data->f32_coeff;
+        #pragma omp simd
+        for (int32_t isamp = 0; isamp < n_copy; ++isamp) {
+            fout[isamp] = foffset + fcoeff * (float)chan0[isamp];
+        }
+        callback_data->decomp_nelem += n_copy;
+        if (perf != NULL) {
+            perf->convert += sched_time() - convert_start;
+        }
+        return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+    }
+    if (callback_data->f64 != NULL) {
+        double * dout = callback_data->f64 + nelem;
+        double doffset = callback_data->f64_offset;
+        double dcoeff = callback_data->f64_coeff;
+        if (frame->header.channels == 1) {
+            #pragma omp simd
+            for (int32_t isamp = 0; isamp < n_copy; ++isamp) {
+                dout[isamp] = doffset + dcoeff * (double)chan0[isamp];
+            }
+        } else if (frame->header.channels == 2) {
+            // Reassemble each value from the low and high words.
+            FLAC__int32 const * chan1 = buffer[1] + skip;
+            int64_t value;
+            #pragma omp simd private(value)
+            for (int32_t isamp = 0; isamp < n_copy; ++isamp) {
+                value = (int64_t)(
+                    ((uint64_t)(uint32_t)chan1[isamp] << 32)
+                    | (uint64_t)(uint32_t)chan0[isamp]
+                );
+                dout[isamp] = doffset + dcoeff * (double)value;
+            }
+        } else {
+            callback_data->err = ERROR_DECODE_CHANNELS;
+            return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+        }
+        callback_data->decomp_nelem += n_copy;
+        if (perf != NULL) {
+            perf->convert += sched_time() - convert_start;
+        }
+        return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+    }
+
     // Copy data from all channels into our interleaved output buffer.
     int64_t offset;
-    for (uint32_t chan = 0; chan < n_chan; ++chan) {
+    if (frame->header.channels == n_chan) {
+        for (uint32_t chan = 0; chan < n_chan; ++chan) {
+            for (int32_t isamp = 0; isamp < n_copy; ++isamp) {
+                offset = n_chan * (nelem + isamp);
+                decomp[offset + chan] = buffer[chan][skip + isamp];
+            }
+        }
+    } else if ((frame->header.channels == 1) && (n_chan == 2)) {
+        // A 64bit stream which was encoded as a single channel.  The high word
+        // is the sign extension of the low word.
         for (int32_t isamp = 0; isamp < n_copy; ++isamp) {
-            offset = n_chan * (nelem + isamp);
-            decomp[offset + chan] = buffer[chan][isamp];
+            offset = 2 * (nelem + isamp);
+            decomp[offset] = buffer[0][skip + isamp];
+            decomp[offset + 1] = (buffer[0][skip + isamp] < 0) ? -1 : 0;
         }
+    } else {
+        callback_data->err = ERROR_DECODE_CHANNELS;
+        return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
     }
 
     // Increment our number of decoded samples
@@ -134,6 +219,9 @@ FLAC__StreamDecoderSeekStatus dec_seek_callback(
     int64_t stream_end = callback_data->stream_end;
     // Convert the requested stream offset into absolute position.
     int64_t abs_request = absolute_byte_offset + stream_start;
+    if (callback_data->perf != NULL) {
+        callback_data->perf->dec_seeks += 1;
+    }
 
     if (abs_request > stream_end) {
         // Position beyond the end of the stream
@@ -179,6 +267,111 @@ FLAC__bool dec_eof_callback(const FLAC__StreamDecoder * decoder, void * client_d
 }
 
 
+// Decode samples [first, first + n_decode) of one independently encoded FLAC
+// stream of n_samp samples.  The caller should set the input byte range, the
+// channels, and the output location in the callback data.  The decoder is reset to
+// the start of the stream before decoding.
+//
+// If frame_pos is not negative, it is the absolute byte position in the input of the
+// frame which contains the first sample, and skip is the number of samples in that
+// frame before the first sample.  Decoding then starts directly at that frame.
+// Otherwise the decoder seeks to the first sample by searching the stream.
+//
+// If the performance counters are enabled, the time spent resetting the decoder
+// and moving to the first frame is counted as setup, and the rest as processing.
+static int decode_samples(
+    FLAC__StreamDecoder * decoder,
+    dec_callback_data * callback_data,
+    int64_t n_samp,
+    int64_t first,
+    int64_t n_decode,
+    int64_t frame_pos,
+    int64_t skip
+) {
+    bool success;
+    callback_data->n_decode = n_decode;
+    callback_data->decomp_nelem = 0;
+    callback_data->skip = 0;
+    callback_data->err = ERROR_NONE;
+    perf_counters * perf = callback_data->perf;
+    double setup_start = 0.0;
+    double process_start = 0.0;
+    if (perf != NULL) {
+        setup_start = sched_time();
+    }
+
+    // Reset the decoder to the beginning of this stream.
+    success = FLAC__stream_decoder_reset(decoder);
+    if (!success) {
+        return ERROR_DECODE_INIT;
+    }
+    if (n_decode == n_samp) {
+        // We are decoding all samples
+        if (perf != NULL) {
+            process_start = sched_time();
+            perf->dec_setup += process_start - setup_start;
+        }
+        success = FLAC__stream_decoder_process_until_end_of_stream(decoder);
+        if (!success) {
+            return ERROR_DECODE_PROCESS;
+        }
+    } else {
+        if (frame_pos >= 0) {
+            // We are decoding a slice of samples and know where its first frame is.
+            // Read the metadata so that the decoder has the stream parameters, then
+            // move the input to that frame and drop anything already buffered.
+            success = FLAC__stream_decoder_process_until_end_of_metadata(decoder);
+            if (!success) {
+                return ERROR_DECODE_PROCESS;
+            }
+            callback_data->stream_pos = frame_pos;
+            success = FLAC__stream_decoder_flush(decoder);
+            if (!success) {
+                return ERROR_DECODE_SEEK;
+            }
+            callback_data->skip = skip;
+        } else {
+            // We are decoding a slice of samples.  Seek to the start.
+            success = FLAC__stream_decoder_seek_absolute(decoder, first);
+            if (!success) {
+                return ERROR_DECODE_SEEK;
+            }
+        }
+        if (perf != NULL) {
+            process_start = sched_time();
+            perf->dec_setup += process_start - setup_start;
+        }
+        // Process single frames until we have accumulated at least the desired
+        // number of output samples.
+        while (
+            callback_data->decomp_nelem < n_decode
+        ) {
+            success = FLAC__stream_decoder_process_single(decoder);
+            if (!success) {
+                break;
+            }
+            if (
+                FLAC__stream_decoder_get_state(decoder)
+                == FLAC__STREAM_DECODER_END_OF_STREAM
+            ) {
+                break;
+            }
+        }
+        if (callback_data->decomp_nelem < n_decode) {
+            return ERROR_DECODE_PROCESS;
+        }
+    }
+
+    if (perf != NULL) {
+        perf->dec_process += sched_time() - process_start;
+        perf->dec_items += 1;
+    }
+
+    // Return any errors from the decoder callback
+    return callback_data->err;
+}
+
+
 // Main decode function.  The input bytes buffer is passed along with the start byte
 // and number of bytes in this buffer for each of the streams.  For performance
 // reasons, the calling code should pass in the pre-allocated output data buffer to
@@ -190,17 +383,48 @@ FLAC__bool dec_eof_callback(const FLAC__StreamDecoder * decoder, void * client_d
 // "exclusive", similar to python slice notation.  If any errors occur, the processing
 // stops, an attempt is made to free any buffers that were allocated, and an error code
 // is returned which is a bitwise OR of the errors on all threads.
+//
+// If the streams were encoded in segments, segment_size and the segment_starts
+// returned by the encoder must be passed.  Only the segments which overlap the
+// requested sample range are decoded, and each segment is a separate work item
+// for the threads.  If segment_starts is NULL, each stream is a single segment.
+//
+// If the encoder also returned the frame_starts table, passing it along with the
+// frame_size (see encode_frame_size()) allows decoding a slice to start directly at
+// the frame containing its first sample, rather than searching for it.  If
+// frame_starts is NULL, the decoder seeks within the stream instead.
+//
+// The output is either interleaved integer channels, or floating point values which
+// are converted from each decoded frame (see dec_output).  The output of each
+// stream is either packed or placed at the per-stream offsets of the output.
+//
+// If streams is not NULL, it contains the indices of the n_stream streams to decode,
+// and output stream i is decoded from input stream streams[i].  The starts, nbytes,
+// segment and frame tables and the float offsets and gains are then indexed by the
+// input stream, while the output (and its stream_offsets) has only the selected
+// streams.  This decodes any subset of the streams, in any order, without first
+// gathering their per-stream arrays.
+//
+// When using threads, the work items are handed out dynamically in order of
+// decreasing compressed size, so that a few large items do not leave the other
+// threads idle at the end.  The time spent by each thread is recorded in the
+// scheduling statistics of the calling thread (see pool_last_stats()).
 
 int decode(
     unsigned char * const bytes,
     int64_t * const starts,
     int64_t * const nbytes,
     int64_t n_stream,
+    int64_t const * streams,
     int64_t stream_size,
+    int64_t segment_size,
+    int64_t * const segment_starts,
+    int64_t frame_size,
+    int64_t * const frame_starts,
     uint32_t n_channels,
     int64_t first_sample,
     int64_t last_sample,
-    int32_t * data,
+    dec_output const * output,
     bool use_threads
 ) {
     // Verify the requested sample range.
@@ -221,121 +445,261 @@ int decode(
         n_decode = last_sample - first_sample;
     }
 
+    // The range of segments touched by the requested samples.  Each of these
+    // segments in each stream is a work item.
+    int64_t n_seg = 1;
+    if (segment_starts != NULL) {
+        n_seg = n_segments(stream_size, segment_size);
+    }
+    int64_t seg_size = (n_seg > 1) ? segment_size : stream_size;
+    int64_t seg_first = first_decode / seg_size;
+    int64_t n_touch = (first_decode + n_decode - 1) / seg_size - seg_first + 1;
+    int64_t n_item = n_stream * n_touch;
+
+    // Layout of the optional frame table.
+    int64_t seg_frames = 0;
+    int64_t n_frames = 0;
+    if (frame_starts != NULL) {
+        if (frame_size <= 0) {
+            return ERROR_DECODE_SEEK;
+        }
+        seg_frames = (seg_size + frame_size - 1) / frame_size;
+        n_frames = n_stream_frames(stream_size, seg_size, frame_size);
+    }
+
+    // The byte range of each item is known, so its size is used as the estimated
+    // cost of decoding it.
+    int32_t n_team = 1;
+    #ifdef _OPENMP
+    if (use_threads) {
+        n_team = omp_get_max_threads();
+    }
+    #endif
+    double * cost = NULL;
+    int64_t * order = NULL;
+    if ((n_team > 1) && (n_item > 1)) {
+        cost = (double *)malloc(n_item * sizeof(double));
+        if (cost == NULL) {
+            return ERROR_ALLOC;
+        }
+    }
+
+    // Scheduling statistics are kept in the pool of the calling thread.
+    flac_pool * caller = pool_get();
+    sched_stats * stats = NULL;
+    if (caller != NULL) {
+        stats = pool_stats(caller, n_team, n_item);
+    }
+    double wall_start = sched_time();
+
     // This tracks the failures across all threads.
     int errors = ERROR_NONE;
 
     #pragma omp parallel reduction(|:errors) if(use_threads)
     {
-        // Thread-local decoder
-        FLAC__StreamDecoder * decoder;
-        bool success;
-        FLAC__StreamDecoderInitStatus status;
-
-        // Thread-local decode buffers
-        dec_callback_data callback_data;
-        callback_data.input = bytes;
-        callback_data.n_stream = n_stream;
-        callback_data.n_decode = n_decode;
-        callback_data.n_channels = n_channels;
-        callback_data.err = ERROR_NONE;
-
-        #pragma omp for schedule(static)
-        for (int64_t istream = 0; istream < n_stream; ++istream) {
+        // Thread-local decoder from the pool.  This decoder is already initialized
+        // with the callback data stored in the pool.
+        FLAC__StreamDecoder * decoder = NULL;
+        dec_callback_data * callback_data = NULL;
+        flac_pool * pool = pool_get();
+        if (pool != NULL) {
+            decoder = pool_decoder(pool);
+            callback_data = &(pool->dec_data);
+            callback_data->perf = pool_perf(pool);
+        }
+        if (decoder == NULL) {
+            errors |= ERROR_DECODE_INIT;
+        }
+
+        int64_t ostream;
+        int64_t istream;
+        int64_t iseg;
+        int64_t samp_start;
+        int64_t samp_stop;
+        int64_t first;
+        int64_t last;
+        int64_t frame_pos;
+        int64_t skip;
+        int64_t out_offset;
+        int64_t item;
+        double busy = 0.0;
+        int64_t n_done = 0;
+        double item_start;
+
+        if (cost != NULL) {
+            #pragma omp for schedule(static)
+            for (int64_t icost = 0; icost < n_item; ++icost) {
+                int64_t cstream = icost / n_touch;
+                if (streams != NULL) {
+                    cstream = streams[cstream];
+                }
+                int64_t cseg = seg_first + icost % n_touch;
+                cost[icost] = (double)nbytes[cstream];
+                if (n_seg > 1) {
+                    int64_t seg_end = (cseg + 1 < n_seg)
+                        ? segment_starts[cstream * n_seg + cseg + 1]
+                        : nbytes[cstream];
+                    cost[icost] = (double)(
+                        seg_end - segment_starts[cstream * n_seg + cseg]
+                    );
+                }
+            }
+            #pragma omp single
+            {
+                order = sched_order(n_item, cost);
+            }
+        }
+
+        #pragma omp for schedule(dynamic, 1)
+        for (int64_t iorder = 0; iorder < n_item; ++iorder) {
             if (errors != ERROR_NONE) {
                 // We already had a failure, skip over remaining loop iterations
                 continue;
             }
-            callback_data.cur_stream = istream;
-            callback_data.stream_start = starts[istream];
-            callback_data.stream_end = starts[istream] + nbytes[istream];
-            callback_data.stream_pos = starts[istream];
-            callback_data.decomp_nelem = 0;
-            // Set the output buffer to the address of the beginning of this stream.
-            callback_data.decompressed = data + istream * n_decode * n_channels;
-
-            decoder = FLAC__stream_decoder_new();
-
-            status = FLAC__stream_decoder_init_stream(
-                decoder,
-                dec_read_callback,
-                dec_seek_callback,
-                dec_tell_callback,
-                dec_length_callback,
-                dec_eof_callback,
-                dec_write_callback,
-                NULL,
-                dec_err_callback,
-                (void *)&callback_data
-            );
-            if (status != FLAC__STREAM_DECODER_INIT_STATUS_OK) {
-                errors |= ERROR_DECODE_INIT;
-                continue;
+            item = (order == NULL) ? iorder : order[iorder];
+            item_start = sched_time();
+            ostream = item / n_touch;
+            istream = (streams == NULL) ? ostream : streams[ostream];
+            iseg = seg_first + item % n_touch;
+
+            // The samples in this segment, and the part of those we need.
+            samp_start = iseg * seg_size;
+            samp_stop = samp_start + seg_size;
+            if (samp_stop > stream_size) {
+                samp_stop = stream_size;
+            }
+            first = (first_decode > samp_start) ? first_decode : samp_start;
+            last = first_decode + n_decode;
+            if (last > samp_stop) {
+                last = samp_stop;
             }
-            if (n_decode == stream_size) {
-                // We are decoding all samples
-                success = FLAC__stream_decoder_process_until_end_of_stream(decoder);
-                if (!success) {
-                    errors |= ERROR_DECODE_PROCESS;
-                    continue;
+
+            // The bytes of this segment.
+            callback_data->stream_start = starts[istream];
+            callback_data->stream_end = starts[istream] + nbytes[istream];
+            if (n_seg > 1) {
+                callback_data->stream_start += segment_starts[istream * n_seg + iseg];
+                if (iseg + 1 < n_seg) {
+                    callback_data->stream_end = (
+                        starts[istream] + segment_starts[istream * n_seg + iseg + 1]
+                    );
                 }
+            }
+            callback_data->stream_pos = callback_data->stream_start;
+            callback_data->input = bytes;
+            callback_data->n_stream = n_stream;
+            callback_data->n_channels = n_channels;
+            callback_data->cur_stream = istream;
+            // Set the output buffer to the address of the first sample of this
+            // segment within the output stream.
+            if (output->stream_offsets != NULL) {
+                out_offset = output->stream_offsets[ostream];
             } else {
-                // We are decoding a slice of samples.  Seek to the start.
-                success = FLAC__stream_decoder_seek_absolute(decoder, first_decode);
-                if (!success) {
-                    errors |= ERROR_DECODE_SEEK;
-                    continue;
-                }
-                // Process single frames until we have accumulated at least the desired
-                // number of output samples.
-                while (
-                    callback_data.decomp_nelem < n_decode
-                ) {
-                    success = FLAC__stream_decoder_process_single(decoder);
-                    if (!success) {
-                        errors |= ERROR_DECODE_PROCESS;
-                        continue;
-                    }
-                }
+                out_offset = ostream * n_decode;
             }
-            success = FLAC__stream_decoder_finish(decoder);
-            if (!success) {
-                errors |= ERROR_DECODE_FINISH;
-                continue;
+            out_offset += first - first_decode;
+            callback_data->decompressed = NULL;
+            callback_data->f32 = NULL;
+            callback_data->f64 = NULL;
+            if (output->f32 != NULL) {
+                callback_data->f32 = output->f32 + out_offset;
+                callback_data->f32_offset = output->f32_offsets[istream];
+                callback_data->f32_coeff = 1.0 / output->f32_gains[istream];
+            } else if (output->f64 != NULL) {
+                callback_data->f64 = output->f64 + out_offset;
+                callback_data->f64_offset = output->f64_offsets[istream];
+                callback_data->f64_coeff = 1.0 / output->f64_gains[istream];
+            } else {
+                callback_data->decompressed = output->ints + out_offset * n_channels;
+            }
+
+            // The frame containing the first sample, if we have the table.
+            frame_pos = -1;
+            skip = 0;
+            if (frame_starts != NULL) {
+                frame_pos = starts[istream] + frame_starts[
+                    istream * n_frames + iseg * seg_frames
+                    + (first - samp_start) / frame_size
+                ];
+                skip = (first - samp_start) % frame_size;
             }
-            FLAC__stream_decoder_delete(decoder);
 
-            // Merge any errors from the decoder callback
-            errors |= callback_data.err;
+            errors |= decode_samples(
+                decoder,
+                callback_data,
+                samp_stop - samp_start,
+                first - samp_start,
+                last - first,
+                frame_pos,
+                skip
+            );
+            busy += sched_time() - item_start;
+            n_done += 1;
+        }
+        // Do not keep a decoder in an unknown state for the next call.
+        if ((pool != NULL) && (errors != ERROR_NONE)) {
+            pool_decoder_discard(pool);
+        }
+
+        if (stats != NULL) {
+            #ifdef _OPENMP
+            int ithread = omp_get_thread_num();
+            #pragma omp single nowait
+            {
+                stats->n_thread = omp_get_num_threads();
+            }
+            #else
+            int ithread = 0;
+            #endif
+            stats->busy[ithread] = busy;
+            stats->items[ithread] = n_done;
         }
     }
+    if (stats != NULL) {
+        stats->wall = sched_time() - wall_start;
+    }
 
+    free(cost);
+    free(order);
     return errors;
 }
 
 
-// Helper functions for int32 and int64
+// Helper functions for int32, int64, float32 and float64
 
 int decode_i32 (
     unsigned char * const bytes,
     int64_t * const starts,
     int64_t * const nbytes,
     int64_t n_stream,
+    int64_t const * streams,
     int64_t stream_size,
+    int64_t segment_size,
+    int64_t * const segment_starts,
+    int64_t frame_size,
+    int64_t * const frame_starts,
     int64_t first_sample,
     int64_t last_sample,
+    int64_t const * stream_offsets,
     int32_t * data,
     bool use_threads
 ) {
+    dec_output output = {.stream_offsets = stream_offsets, .ints = data};
     return decode(
         bytes,
         starts,
         nbytes,
         n_stream,
+        streams,
         stream_size,
+        segment_size,
+        segment_starts,
+        frame_size,
+        frame_starts,
         1,
         first_sample,
         last_sample,
-        data,
+        &output,
         use_threads
     );
 }
@@ -345,31 +709,171 @@ int decode_i64 (
     int64_t * const starts,
     int64_t * const nbytes,
     int64_t n_stream,
+    int64_t const * streams,
     int64_t stream_size,
+    int64_t segment_size,
+    int64_t * const segment_starts,
+    int64_t frame_size,
+    int64_t * const frame_starts,
     int64_t first_sample,
     int64_t last_sample,
+    int64_t const * stream_offsets,
     int64_t * data,
     bool use_threads
 ) {
-    int64_t n_elem = n_stream * stream_size;
+    // The number of output samples in each stream
+    int64_t n_decode = stream_size;
+    if ((first_sample >= 0) && (last_sample > first_sample)) {
+        n_decode = last_sample - first_sample;
+    }
+    int64_t n_elem = n_stream * n_decode;
     int32_t * interleaved;
-    int err = get_interleaved(n_elem, data, &interleaved);
+    int err;
+    dec_output output = {.stream_offsets = NULL};
+    if (is_little_endian()) {
+        // Decode the channels directly into the output, at any stream offsets.
+        output.stream_offsets = stream_offsets;
+        output.ints = (int32_t *)data;
+        return decode(
+            bytes,
+            starts,
+            nbytes,
+            n_stream,
+            streams,
+            stream_size,
+            segment_size,
+            segment_starts,
+            frame_size,
+            frame_starts,
+            2,
+            first_sample,
+            last_sample,
+            &output,
+            use_threads
+        );
+    }
+    // Decode into a packed buffer and swap the values into each output stream.
+    err = get_interleaved(n_elem, data, &interleaved);
     if (err != ERROR_NONE) {
         return err;
     }
+    output.ints = interleaved;
     err = decode(
         bytes,
         starts,
         nbytes,
         n_stream,
+        streams,
         stream_size,
+        segment_size,
+        segment_starts,
+        frame_size,
+        frame_starts,
         2,
         first_sample,
         last_sample,
-        interleaved,
+        &output,
         use_threads
     );
-    copy_interleaved_32_to_64(n_elem, interleaved, data);
+    if (stream_offsets == NULL) {
+        copy_interleaved_32_to_64(n_elem, interleaved, data);
+    } else {
+        for (int64_t istream = 0; istream < n_stream; ++istream) {
+            copy_interleaved_32_to_64(
+                n_decode,
+                interleaved + 2 * istream * n_decode,
+                data + stream_offsets[istream]
+            );
+        }
+    }
     free_interleaved(interleaved);
     return err;
 }
+
+int decode_f32 (
+    unsigned char * const bytes,
+    int64_t * const starts,
+    int64_t * const nbytes,
+    int64_t n_stream,
+    int64_t const * streams,
+    int64_t stream_size,
+    int64_t segment_size,
+    int64_t * const segment_starts,
+    int64_t frame_size,
+    int64_t * const frame_starts,
+    int64_t first_sample,
+    int64_t last_sample,
+    float const * offsets,
+    float const * gains,
+    int64_t const * stream_offsets,
+    float * data,
+    bool use_threads
+) {
+    dec_output output = {
+        .stream_offsets = stream_offsets,
+        .f32 = data,
+        .f32_offsets = offsets,
+        .f32_gains = gains
+    };
+    return decode(
+        bytes,
+        starts,
+        nbytes,
+        n_stream,
+        streams,
+        stream_size,
+        segment_size,
+        segment_starts,
+        frame_size,
+        frame_starts,
+        1,
+        first_sample,
+        last_sample,
+        &output,
+        use_threads
+    );
+}
+
+int decode_f64 (
+    unsigned char * const bytes,
+    int64_t * const starts,
+    int64_t * const nbytes,
+    int64_t n_stream,
+    int64_t const * streams,
+    int64_t stream_size,
+    int64_t segment_size,
+    int64_t * const segment_starts,
+    int64_t frame_size,
+    int64_t * const frame_starts,
+    int64_t first_sample,
+    int64_t last_sample,
+    double const * offsets,
+    double const * gains,
+    int64_t const * stream_offsets,
+    double * data,
+    bool use_threads
+) {
+    dec_output output = {
+        .stream_offsets = stream_offsets,
+        .f64 = data,
+        .f64_offsets = offsets,
+        .f64_gains = gains
+    };
+    return decode(
+        bytes,
+        starts,
+        nbytes,
+        n_stream,
+        streams,
+        stream_size,
+        segment_size,
+        segment_starts,
+        frame_size,
+        frame_starts,
+        2,
+        first_sample,
+        last_sample,
+        &output,
+        use_threads
+    );
+}
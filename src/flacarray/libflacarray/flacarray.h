@@ -14,6 +14,17 @@
 #include <FLAC/stream_encoder.h>
 #include <FLAC/stream_decoder.h>
 
+// Native multithreaded encoding was added in libFLAC 1.5.0 (API version 14).  The
+// meson build defines this from the library version.  Other builds use the API
+// version of the headers.
+#ifndef HAVE_FLAC_NUM_THREADS
+# if defined(FLAC_API_VERSION_CURRENT) && (FLAC_API_VERSION_CURRENT >= 14)
+#  define HAVE_FLAC_NUM_THREADS 1
+# else // if defined(FLAC_API_VERSION_CURRENT) && (FLAC_API_VERSION_CURRENT >= 14)
+#  define HAVE_FLAC_NUM_THREADS 0
+# endif // if defined(FLAC_API_VERSION_CURRENT) && (FLAC_API_VERSION_CURRENT >= 14)
+#endif // ifndef HAVE_FLAC_NUM_THREADS
+
 
 // Error codes
 
@@ -38,6 +49,8 @@
 #define ERROR_DECODE_SAMPLE_RANGE (1 << 17)
 #define ERROR_DECODE_SEEK (1 << 18)
 #define ERROR_CONVERT_TYPE (1 << 19)
+#define ERROR_DECODE_CHANNELS (1 << 20)
+#define ERROR_CHECKSUM (1 << 21)
 
 // C-language arrays with a few STL-like features.
 
@@ -51,6 +64,44 @@ ArrayUint8 * create_array_uint8(int64_t start_size);
 void destroy_array_uint8(ArrayUint8 * obj);
 int resize_array_uint8(ArrayUint8 * obj, int64_t new_size);
 
+// Optional counters of where the time goes in the encoder and decoder.  When
+// enabled, each thread accumulates these in its pool (see below), and the callbacks
+// find them through their client data.  When disabled, that pointer is NULL and
+// nothing is recorded.  The times are wall clock seconds.
+
+typedef struct {
+    // Configuring and initializing the encoder, and encoding (including finish).
+    double enc_setup;
+    double enc_process;
+    // The number of streams (or segments) encoded.
+    int64_t enc_items;
+    // The number of write callbacks and the bytes they emitted.
+    int64_t enc_writes;
+    int64_t enc_bytes;
+    // The number of times an output buffer was reallocated to grow.
+    int64_t enc_resizes;
+    // The number of threaded encodes which could not reserve their shared output
+    // buffer, and wrote every item to a separate buffer instead.
+    int64_t enc_unreserved;
+    // The number of items encoded a second time by the threaded encoder, after
+    // overflowing their reserved region.
+    int64_t enc_overflows;
+    // Resetting the decoder and positioning it at the first requested frame, and
+    // decoding frames.
+    double dec_setup;
+    double dec_process;
+    // The number of streams (or segments) decoded.
+    int64_t dec_items;
+    // The number of read callbacks and the compressed bytes they returned.
+    int64_t dec_reads;
+    int64_t dec_bytes;
+    // The number of seek callbacks.
+    int64_t dec_seeks;
+    // Conversion between floating point and integer values while encoding and
+    // decoding.  This time is included in enc_process and dec_process.
+    double convert;
+} perf_counters;
+
 // Encoding
 
 // Callback structure to store the output encoded bytes.
@@ -59,12 +110,41 @@ typedef struct {
     int64_t cur_stream;
     int64_t * stream_offsets;
     ArrayUint8 * compressed;
+    // The optional table of frame starting bytes (or NULL), and the first entry
+    // and number of entries for the current stream.
+    int64_t * frame_starts;
+    int64_t frame_first;
+    int64_t frame_count;
+    // The optional checksum of each stream (or NULL), updated as it is written.
+    uint32_t * checksums;
+    // The counters of this thread, or NULL if disabled.
+    perf_counters * perf;
 } enc_callback_data;
 
+// Callback structure for the threaded encoder.  Each stream is written to its
+// own region of a shared, reserved output buffer.  A stream which overflows its
+// region is only counted in stream_nbytes.  If there is no reserved buffer, the
+// per-stream buffers in `compressed` are used.
 typedef struct {
     int64_t n_stream;
     int64_t cur_stream;
+    // The reserved output buffer (or NULL) with reserved_bytes for each stream,
+    // starting with the region of stream first_stream.
+    unsigned char * reserved;
+    int64_t reserved_bytes;
+    int64_t first_stream;
+    // The number of bytes written so far for each stream.
+    int64_t * stream_nbytes;
     ArrayUint8 ** compressed;
+    // The optional table of frame starting bytes (or NULL), and the first entry
+    // and number of entries for the current stream.
+    int64_t * frame_starts;
+    int64_t frame_first;
+    int64_t frame_count;
+    // The optional checksum of each stream (or NULL), updated as it is written.
+    uint32_t * checksums;
+    // The counters of this thread, or NULL if disabled.
+    perf_counters * perf;
 } enc_threaded_callback_data;
 
 FLAC__StreamEncoderWriteStatus enc_write_callback(
@@ -87,25 +167,74 @@ FLAC__StreamEncoderWriteStatus enc_threaded_write_callback(
 
 void free_compressed_buffers(ArrayUint8 ** buffers, int64_t n_stream);
 
+int64_t encode_bound(int64_t stream_size, uint32_t n_channels);
+
+int64_t n_segments(int64_t stream_size, int64_t segment_size);
+
+int64_t encode_frame_size(uint32_t level);
+
+int64_t n_stream_frames(int64_t stream_size, int64_t segment_size, int64_t frame_size);
+
+bool flac_native_threads();
+
+// The input samples for the encoders.  Exactly one of the data pointers is set.
+// Integer data is passed as interleaved 32bit channels and is encoded in place.
+// Floating point data is quantized while encoding, a small block at a time, so that
+// no integer copy of the full array is needed.  The offset and gain of each stream
+// are computed by the encoder and returned in the offsets and gains arrays.  The
+// quanta may be NULL, in which case it is computed from the range of each stream.
+//
+// If stream_offsets is not NULL, the input is a strided view rather than
+// flat-packed: it gives the offset (in samples) from the data pointer to the first
+// sample of each stream, and consecutive samples of a stream are sample_stride
+// samples apart.  Strided samples are gathered a block at a time while encoding.
+
+typedef struct {
+    int64_t const * stream_offsets;
+    int64_t sample_stride;
+    int32_t const * ints;
+    float const * f32;
+    double const * f64;
+    float const * f32_quanta;
+    float * f32_offsets;
+    float * f32_gains;
+    double const * f64_quanta;
+    double * f64_offsets;
+    double * f64_gains;
+} enc_input;
+
 int encode(
-    int32_t * const data,
+    enc_input const * input,
     int64_t n_stream,
     int64_t stream_size,
+    int64_t segment_size,
     uint32_t n_channels,
     uint32_t level,
+    bool do_md5,
+    uint32_t n_threads,
     int64_t * n_bytes,
     int64_t * starts,
+    int64_t * segment_starts,
+    int64_t * frame_starts,
+    uint32_t * checksums,
     unsigned char ** bytes
 );
 
 int encode_threaded(
-    int32_t * const data,
+    enc_input const * input,
     int64_t n_stream,
     int64_t stream_size,
+    int64_t segment_size,
     uint32_t n_channels,
     uint32_t level,
+    bool do_md5,
+    uint32_t n_threads,
+    int64_t max_memory,
     int64_t * n_bytes,
     int64_t * starts,
+    int64_t * segment_starts,
+    int64_t * frame_starts,
+    uint32_t * checksums,
     unsigned char ** bytes
 );
 
@@ -132,12 +261,26 @@ typedef struct {
     int64_t stream_pos;
     // The number of decompressed samples processed so far in this stream
     int64_t decomp_nelem;
+    // The number of leading samples to discard before the output starts.  This
+    // is used when decoding starts at a frame before the first requested sample.
+    int64_t skip;
     // The decompressed and interleaved output for the current stream.  This
     // points to the beginning of the output stream in the larger output
     // buffer, and each stream has n_decode * n_channels int32 values.
     int32_t * decompressed;
+    // Optional floating point output for the current stream.  If one of these is
+    // not NULL, the decoded integers are converted with the offset and coefficient
+    // (inverse gain) of the stream and written here, instead of to decompressed.
+    float * f32;
+    float f32_offset;
+    float f32_coeff;
+    double * f64;
+    double f64_offset;
+    double f64_coeff;
     // The current error state
     int32_t err;
+    // The counters of this thread, or NULL if disabled.
+    perf_counters * perf;
 } dec_callback_data;
 
 FLAC__StreamDecoderReadStatus dec_read_callback(
@@ -180,21 +323,131 @@ FLAC__StreamDecoderLengthStatus dec_length_callback(
 
 FLAC__bool dec_eof_callback(const FLAC__StreamDecoder * decoder, void * client_data);
 
+// The output samples for the decoders.  Exactly one of the data pointers is set.
+// Integer data is written as interleaved 32bit channels.  Floating point data is
+// converted from the decoded integers of each frame using the offset and gain of
+// each stream, so that no integer copy of the full array is needed.
+//
+// If stream_offsets is not NULL, it gives the element offset (in samples) from the
+// data pointer to the first output sample of each stream.  This allows decoding
+// directly into a strided view of a larger array.  If NULL, the streams are packed
+// contiguously, one after another.
+
+typedef struct {
+    int64_t const * stream_offsets;
+    int32_t * ints;
+    float * f32;
+    double * f64;
+    float const * f32_offsets;
+    float const * f32_gains;
+    double const * f64_offsets;
+    double const * f64_gains;
+} dec_output;
+
 int decode(
     unsigned char * const bytes,
     int64_t * const starts,
     int64_t * const nbytes,
     int64_t n_stream,
+    int64_t const * streams,
     int64_t stream_size,
+    int64_t segment_size,
+    int64_t * const segment_starts,
+    int64_t frame_size,
+    int64_t * const frame_starts,
     uint32_t n_channels,
     int64_t first_sample,
     int64_t last_sample,
-    int32_t * data,
+    dec_output const * output,
     bool use_threads
 );
 
+// Checksums of the compressed bytes.
+
+void crc32c_init();
+
+uint32_t crc32c(uint32_t crc, unsigned char const * data, int64_t n);
+
+int verify_checksums(
+    unsigned char const * bytes,
+    int64_t const * starts,
+    int64_t const * nbytes,
+    int64_t n_stream,
+    int64_t const * streams,
+    int64_t n_seg,
+    int64_t const * segment_starts,
+    uint32_t const * checksums,
+    int64_t seg_first,
+    int64_t seg_last,
+    bool use_threads
+);
+
+// Scheduling of work items over threads.  The threaded encoder and the decoder hand
+// out their items in order of decreasing estimated cost, dynamically, and record
+// the time each thread spends working in the statistics of the calling thread.
+
+typedef struct {
+    // The number of threads and work items of the last call.
+    int32_t n_thread;
+    int64_t n_item;
+    // The wall clock seconds of the parallel region.
+    double wall;
+    // The seconds spent on items and the number of items done by each thread.
+    double * busy;
+    int64_t * items;
+    // The allocated length of busy and items.
+    int32_t size;
+} sched_stats;
+
+double sched_time();
+
+int64_t * sched_order(int64_t n_item, double const * cost);
+
+// Per-thread pool of reusable encoder / decoder objects.
+
+typedef struct {
+    FLAC__StreamEncoder * encoder;
+    FLAC__StreamDecoder * decoder;
+    // Whether the decoder has been initialized with dec_data as the client data.
+    bool decoder_init;
+    // The callback data used by the pooled decoder.
+    dec_callback_data dec_data;
+    // Scratch block used by the encoder to gather or quantize its input.
+    int32_t * scratch;
+    int64_t scratch_size;
+    // Statistics of the last threaded encode or decode called from this thread.
+    sched_stats stats;
+    // Counters accumulated by this thread while they are enabled.
+    perf_counters perf;
+} flac_pool;
+
+flac_pool * pool_get();
+
+FLAC__StreamEncoder * pool_encoder(flac_pool * pool);
+
+FLAC__StreamDecoder * pool_decoder(flac_pool * pool);
+
+int32_t * pool_scratch(flac_pool * pool, int64_t n_elem);
+
+void pool_decoder_discard(flac_pool * pool);
+
+sched_stats * pool_stats(flac_pool * pool, int32_t n_thread, int64_t n_item);
+
+sched_stats const * pool_last_stats();
+
+void perf_enable(bool enable);
+
+bool perf_enabled();
+
+perf_counters * pool_perf(flac_pool * pool);
+
+void perf_collect(bool use_threads, bool reset, perf_counters * total);
+
+void pool_clear(bool use_threads);
+
 // Helper wrappers for int32 and int64 encode / decode.  int64 data is encoded
-// as 2 interleaved channels.
+// as 2 interleaved channels, or as a single channel for streams whose values all
+// fit in 32 bits.
 
 bool is_little_endian();
 
@@ -208,41 +461,165 @@ void free_interleaved(int32_t * interleaved);
 
 int encode_i32(
     int32_t * const data,
+    int64_t const * stream_offsets,
+    int64_t sample_stride,
     int64_t n_stream,
     int64_t stream_size,
+    int64_t segment_size,
     uint32_t level,
+    bool do_md5,
+    uint32_t n_threads,
     int64_t * n_bytes,
     int64_t * starts,
+    int64_t * segment_starts,
+    int64_t * frame_starts,
+    uint32_t * checksums,
     unsigned char ** bytes
 );
 
 int encode_i32_threaded(
     int32_t * const data,
+    int64_t const * stream_offsets,
+    int64_t sample_stride,
     int64_t n_stream,
     int64_t stream_size,
+    int64_t segment_size,
     uint32_t level,
+    bool do_md5,
+    uint32_t n_threads,
+    int64_t max_memory,
     int64_t * n_bytes,
     int64_t * starts,
+    int64_t * segment_starts,
+    int64_t * frame_starts,
+    uint32_t * checksums,
     unsigned char ** bytes
 );
 
 int encode_i64(
     int64_t * const data,
+    int64_t const * stream_offsets,
+    int64_t sample_stride,
     int64_t n_stream,
     int64_t stream_size,
+    int64_t segment_size,
     uint32_t level,
+    bool do_md5,
+    uint32_t n_threads,
     int64_t * n_bytes,
     int64_t * starts,
+    int64_t * segment_starts,
+    int64_t * frame_starts,
+    uint32_t * checksums,
     unsigned char ** bytes
 );
 
 int encode_i64_threaded(
     int64_t * const data,
+    int64_t const * stream_offsets,
+    int64_t sample_stride,
+    int64_t n_stream,
+    int64_t stream_size,
+    int64_t segment_size,
+    uint32_t level,
+    bool do_md5,
+    uint32_t n_threads,
+    int64_t max_memory,
+    int64_t * n_bytes,
+    int64_t * starts,
+    int64_t * segment_starts,
+    int64_t * frame_starts,
+    uint32_t * checksums,
+    unsigned char ** bytes
+);
+
+// Encode floating point data, quantizing each stream while encoding.  float32 data
+// is converted to 32bit integers and float64 data to 64bit integers (2 channels),
+// exactly as done by float32_to_int32() and float64_to_int64().
+
+int encode_f32(
+    float * const data,
+    int64_t const * stream_offsets,
+    int64_t sample_stride,
+    int64_t n_stream,
+    int64_t stream_size,
+    int64_t segment_size,
+    float * const quanta,
+    uint32_t level,
+    bool do_md5,
+    uint32_t n_threads,
+    float * offsets,
+    float * gains,
+    int64_t * n_bytes,
+    int64_t * starts,
+    int64_t * segment_starts,
+    int64_t * frame_starts,
+    uint32_t * checksums,
+    unsigned char ** bytes
+);
+
+int encode_f32_threaded(
+    float * const data,
+    int64_t const * stream_offsets,
+    int64_t sample_stride,
+    int64_t n_stream,
+    int64_t stream_size,
+    int64_t segment_size,
+    float * const quanta,
+    uint32_t level,
+    bool do_md5,
+    uint32_t n_threads,
+    int64_t max_memory,
+    float * offsets,
+    float * gains,
+    int64_t * n_bytes,
+    int64_t * starts,
+    int64_t * segment_starts,
+    int64_t * frame_starts,
+    uint32_t * checksums,
+    unsigned char ** bytes
+);
+
+int encode_f64(
+    double * const data,
+    int64_t const * stream_offsets,
+    int64_t sample_stride,
     int64_t n_stream,
     int64_t stream_size,
+    int64_t segment_size,
+    double * const quanta,
     uint32_t level,
+    bool do_md5,
+    uint32_t n_threads,
+    double * offsets,
+    double * gains,
     int64_t * n_bytes,
     int64_t * starts,
+    int64_t * segment_starts,
+    int64_t * frame_starts,
+    uint32_t * checksums,
+    unsigned char ** bytes
+);
+
+int encode_f64_threaded(
+    double * const data,
+    int64_t const * stream_offsets,
+    int64_t sample_stride,
+    int64_t n_stream,
+    int64_t stream_size,
+    int64_t segment_size,
+    double * const quanta,
+    uint32_t level,
+    bool do_md5,
+    uint32_t n_threads,
+    int64_t max_memory,
+    double * offsets,
+    double * gains,
+    int64_t * n_bytes,
+    int64_t * starts,
+    int64_t * segment_starts,
+    int64_t * frame_starts,
+    uint32_t * checksums,
     unsigned char ** bytes
 );
 
@@ -251,9 +628,15 @@ int decode_i32(
     int64_t * const starts,
     int64_t * const nbytes,
     int64_t n_stream,
+    int64_t const * streams,
     int64_t stream_size,
+    int64_t segment_size,
+    int64_t * const segment_starts,
+    int64_t frame_size,
+    int64_t * const frame_starts,
     int64_t first_sample,
     int64_t last_sample,
+    int64_t const * stream_offsets,
     int32_t * data,
     bool use_threads
 );
@@ -263,15 +646,105 @@ int decode_i64(
     int64_t * const starts,
     int64_t * const nbytes,
     int64_t n_stream,
+    int64_t const * streams,
     int64_t stream_size,
+    int64_t segment_size,
+    int64_t * const segment_starts,
+    int64_t frame_size,
+    int64_t * const frame_starts,
     int64_t first_sample,
     int64_t last_sample,
+    int64_t const * stream_offsets,
     int64_t * data,
     bool use_threads
 );
 
+int decode_f32(
+    unsigned char * const bytes,
+    int64_t * const starts,
+    int64_t * const nbytes,
+    int64_t n_stream,
+    int64_t const * streams,
+    int64_t stream_size,
+    int64_t segment_size,
+    int64_t * const segment_starts,
+    int64_t frame_size,
+    int64_t * const frame_starts,
+    int64_t first_sample,
+    int64_t last_sample,
+    float const * offsets,
+    float const * gains,
+    int64_t const * stream_offsets,
+    float * data,
+    bool use_threads
+);
+
+int decode_f64(
+    unsigned char * const bytes,
+    int64_t * const starts,
+    int64_t * const nbytes,
+    int64_t n_stream,
+    int64_t const * streams,
+    int64_t stream_size,
+    int64_t segment_size,
+    int64_t * const segment_starts,
+    int64_t frame_size,
+    int64_t * const frame_starts,
+    int64_t first_sample,
+    int64_t last_sample,
+    double const * offsets,
+    double const * gains,
+    int64_t const * stream_offsets,
+    double * data,
+    bool use_threads
+);
+
 // Type conversion
 
+void float32_range(float const * input, int64_t n_samp, float * smin, float * smax);
+
+void float32_params(
+    float smin,
+    float smax,
+    float const * quanta,
+    float * offset,
+    float * gain
+);
+
+int32_t float32_quantize_value(float value, float offset, float gain);
+
+void float32_quantize(
+    float const * input,
+    int64_t n_samp,
+    float offset,
+    float gain,
+    int32_t * output
+);
+
+void float64_range(double const * input, int64_t n_samp, double * smin, double * smax);
+
+void float64_params(
+    double smin,
+    double smax,
+    double const * quanta,
+    double * offset,
+    double * gain
+);
+
+int64_t float64_quantize_value(double value, double offset, double gain);
+
+void float64_quantize(
+    double const * input,
+    int64_t n_samp,
+    double offset,
+    double gain,
+    uint32_t n_channels,
+    int32_t * output
+);
+
+// Full array conversions.  Streams are split into blocks which are spread over the
+// default number of OpenMP threads.
+
 int float32_to_int32(
     float const * input,
     int64_t n_stream,
@@ -1,6 +1,5 @@
 
 from libc.stdint cimport uint32_t, int32_t, int64_t
-from cpython cimport bool
 
 from cython.view cimport array as cvarray
 
@@ -11,45 +10,193 @@ cnp.import_array()
 
 flac_i32_dtype = np.dtype(np.int32)
 flac_i64_dtype = np.dtype(np.int64)
+flac_f32_dtype = np.dtype(np.float32)
+flac_f64_dtype = np.dtype(np.float64)
 compressed_dtype = np.dtype(np.uint8)
 offset_dtype = np.dtype(np.int64)
-
-
-cdef extern from "flacarray.h":
+checksum_dtype = np.dtype(np.uint32)
+
+# The value of the "checksum_type" auxiliary parameter for CRC32C checksums.
+checksum_crc32c = 1
+
+
+cdef extern from "flacarray.h" nogil:
+    ctypedef struct sched_stats:
+        int32_t n_thread
+        int64_t n_item
+        double wall
+        double * busy
+        int64_t * items
+    sched_stats * pool_last_stats()
+    ctypedef struct perf_counters:
+        double enc_setup
+        double enc_process
+        int64_t enc_items
+        int64_t enc_writes
+        int64_t enc_bytes
+        int64_t enc_resizes
+        int64_t enc_unreserved
+        int64_t enc_overflows
+        double dec_setup
+        double dec_process
+        int64_t dec_items
+        int64_t dec_reads
+        int64_t dec_bytes
+        int64_t dec_seeks
+        double convert
+    void perf_enable(bint enable)
+    bint perf_enabled()
+    void perf_collect(bint use_threads, bint reset, perf_counters * total)
     int encode_i32(
         int32_t * data,
+        int64_t * stream_offsets,
+        int64_t sample_stride,
         int64_t n_stream,
         int64_t stream_size,
+        int64_t segment_size,
         uint32_t level,
+        bint do_md5,
+        uint32_t n_threads,
         int64_t * n_bytes,
         int64_t * starts,
+        int64_t * segment_starts,
+        int64_t * frame_starts,
+        uint32_t * checksums,
         unsigned char ** rawbytes
     )
     int encode_i32_threaded(
         int32_t * data,
+        int64_t * stream_offsets,
+        int64_t sample_stride,
         int64_t n_stream,
         int64_t stream_size,
+        int64_t segment_size,
         uint32_t level,
+        bint do_md5,
+        uint32_t n_threads,
+        int64_t max_memory,
         int64_t * n_bytes,
         int64_t * starts,
+        int64_t * segment_starts,
+        int64_t * frame_starts,
+        uint32_t * checksums,
         unsigned char ** rawbytes
     )
     int encode_i64(
         int64_t * data,
+        int64_t * stream_offsets,
+        int64_t sample_stride,
         int64_t n_stream,
         int64_t stream_size,
+        int64_t segment_size,
         uint32_t level,
+        bint do_md5,
+        uint32_t n_threads,
         int64_t * n_bytes,
         int64_t * starts,
+        int64_t * segment_starts,
+        int64_t * frame_starts,
+        uint32_t * checksums,
         unsigned char ** rawbytes
     )
     int encode_i64_threaded(
         int64_t * data,
+        int64_t * stream_offsets,
+        int64_t sample_stride,
+        int64_t n_stream,
+        int64_t stream_size,
+        int64_t segment_size,
+        uint32_t level,
+        bint do_md5,
+        uint32_t n_threads,
+        int64_t max_memory,
+        int64_t * n_bytes,
+        int64_t * starts,
+        int64_t * segment_starts,
+        int64_t * frame_starts,
+        uint32_t * checksums,
+        unsigned char ** rawbytes
+    )
+    int encode_f32(
+        float * data,
+        int64_t * stream_offsets,
+        int64_t sample_stride,
+        int64_t n_stream,
+        int64_t stream_size,
+        int64_t segment_size,
+        float * quanta,
+        uint32_t level,
+        bint do_md5,
+        uint32_t n_threads,
+        float * offsets,
+        float * gains,
+        int64_t * n_bytes,
+        int64_t * starts,
+        int64_t * segment_starts,
+        int64_t * frame_starts,
+        uint32_t * checksums,
+        unsigned char ** rawbytes
+    )
+    int encode_f32_threaded(
+        float * data,
+        int64_t * stream_offsets,
+        int64_t sample_stride,
+        int64_t n_stream,
+        int64_t stream_size,
+        int64_t segment_size,
+        float * quanta,
+        uint32_t level,
+        bint do_md5,
+        uint32_t n_threads,
+        int64_t max_memory,
+        float * offsets,
+        float * gains,
+        int64_t * n_bytes,
+        int64_t * starts,
+        int64_t * segment_starts,
+        int64_t * frame_starts,
+        uint32_t * checksums,
+        unsigned char ** rawbytes
+    )
+    int encode_f64(
+        double * data,
+        int64_t * stream_offsets,
+        int64_t sample_stride,
+        int64_t n_stream,
+        int64_t stream_size,
+        int64_t segment_size,
+        double * quanta,
+        uint32_t level,
+        bint do_md5,
+        uint32_t n_threads,
+        double * offsets,
+        double * gains,
+        int64_t * n_bytes,
+        int64_t * starts,
+        int64_t * segment_starts,
+        int64_t * frame_starts,
+        uint32_t * checksums,
+        unsigned char ** rawbytes
+    )
+    int encode_f64_threaded(
+        double * data,
+        int64_t * stream_offsets,
+        int64_t sample_stride,
         int64_t n_stream,
         int64_t stream_size,
+        int64_t segment_size,
+        double * quanta,
         uint32_t level,
+        bint do_md5,
+        uint32_t n_threads,
+        int64_t max_memory,
+        double * offsets,
+        double * gains,
         int64_t * n_bytes,
         int64_t * starts,
+        int64_t * segment_starts,
+        int64_t * frame_starts,
+        uint32_t * checksums,
         unsigned char ** rawbytes
     )
     int decode_i32(
@@ -57,22 +204,72 @@ cdef extern from "flacarray.h":
         int64_t * starts,
         int64_t * nbytes,
         int64_t n_stream,
+        int64_t * streams,
         int64_t stream_size,
+        int64_t segment_size,
+        int64_t * segment_starts,
+        int64_t frame_size,
+        int64_t * frame_starts,
         int64_t first_sample,
         int64_t last_sample,
+        int64_t * stream_offsets,
         int32_t * data,
-        bool use_threads
+        bint use_threads
     )
     int decode_i64(
         unsigned char * rawbytes,
         int64_t * starts,
         int64_t * nbytes,
         int64_t n_stream,
+        int64_t * streams,
         int64_t stream_size,
+        int64_t segment_size,
+        int64_t * segment_starts,
+        int64_t frame_size,
+        int64_t * frame_starts,
         int64_t first_sample,
         int64_t last_sample,
+        int64_t * stream_offsets,
         int64_t * data,
-        bool use_threads
+        bint use_threads
+    )
+    int decode_f32(
+        unsigned char * rawbytes,
+        int64_t * starts,
+        int64_t * nbytes,
+        int64_t n_stream,
+        int64_t * streams,
+        int64_t stream_size,
+        int64_t segment_size,
+        int64_t * segment_starts,
+        int64_t frame_size,
+        int64_t * frame_starts,
+        int64_t first_sample,
+        int64_t last_sample,
+        float * offsets,
+        float * gains,
+        int64_t * stream_offsets,
+        float * data,
+        bint use_threads
+    )
+    int decode_f64(
+        unsigned char * rawbytes,
+        int64_t * starts,
+        int64_t * nbytes,
+        int64_t n_stream,
+        int64_t * streams,
+        int64_t stream_size,
+        int64_t segment_size,
+        int64_t * segment_starts,
+        int64_t frame_size,
+        int64_t * frame_starts,
+        int64_t first_sample,
+        int64_t last_sample,
+        double * offsets,
+        double * gains,
+        int64_t * stream_offsets,
+        double * data,
+        bint use_threads
     )
     int float32_to_int32(
         float * input,
@@ -108,6 +305,175 @@ cdef extern from "flacarray.h":
         float * gains,
         float * output
     )
+    int64_t n_segments(int64_t stream_size, int64_t segment_size)
+    int64_t encode_frame_size(uint32_t level)
+    int64_t n_stream_frames(
+        int64_t stream_size, int64_t segment_size, int64_t frame_size
+    )
+    bint flac_native_threads()
+    int verify_checksums(
+        unsigned char * bytes,
+        int64_t * starts,
+        int64_t * nbytes,
+        int64_t n_stream,
+        int64_t * streams,
+        int64_t n_seg,
+        int64_t * segment_starts,
+        uint32_t * checksums,
+        int64_t seg_first,
+        int64_t seg_last,
+        bint use_threads
+    )
+    void pool_clear(bint use_threads)
+
+
+def have_flac_threads():
+    """Whether libFLAC supports multithreaded encoding of a single stream.
+
+    This is True if flacarray was built with libFLAC >= 1.5.0.  In that case the
+    threaded encoder uses any threads which are not needed for separate streams
+    inside each FLAC encoder.
+
+    Returns:
+        (bool):  True if native FLAC threads are used.
+
+    """
+    return flac_native_threads()
+
+
+def clear_pools(bint use_threads=True):
+    """Free the per-thread pools of FLAC encoders and decoders.
+
+    Every thread that encodes or decodes data keeps one FLAC encoder and one
+    decoder, which are reused across streams and across calls.  These are freed
+    automatically when the thread exits.  This function can be used to release
+    that memory earlier, for example after processing a large dataset.
+
+    Only the pools of the calling thread (and its OpenMP threads) are freed, so this
+    is safe to call while other Python threads are encoding or decoding.
+
+    Args:
+        use_threads (bool):  If True, also clear the pools of all OpenMP threads.
+
+    Returns:
+        None
+
+    """
+    with nogil:
+        pool_clear(use_threads)
+
+
+def thread_stats():
+    """Load balance statistics of the last threaded encode or decode.
+
+    The threaded encoders and the decoders hand out their work items (streams or
+    segments of streams) to threads dynamically, starting with the most expensive
+    ones.  The cost of encoding is estimated from a small sample of each item, and
+    the cost of decoding from its compressed size.  The time spent working by each
+    thread is recorded for the last such call made from the calling Python thread.
+
+    The "imbalance" is the maximum busy time of a thread divided by the mean.  A
+    value of 1 means that the work was perfectly balanced.
+
+    Returns:
+        (dict):  The "n_thread", "n_item", "wall" seconds, per-thread "busy" seconds
+            and "items" arrays, and the "imbalance", or None if there was no call.
+
+    """
+    cdef const sched_stats * stats = pool_last_stats()
+    if stats == NULL:
+        return None
+    n_thread = stats.n_thread
+    busy = np.array([stats.busy[i] for i in range(n_thread)], dtype=np.float64)
+    items = np.array([stats.items[i] for i in range(n_thread)], dtype=np.int64)
+    mean_busy = np.mean(busy)
+    return {
+        "n_thread": n_thread,
+        "n_item": stats.n_item,
+        "wall": stats.wall,
+        "busy": busy,
+        "items": items,
+        "imbalance": float(np.amax(busy) / mean_busy) if mean_busy > 0 else 1.0,
+    }
+
+
+def enable_counters(bint enable=True):
+    """Enable or disable the native performance counters.
+
+    When enabled, every thread which encodes or decodes data accumulates counters
+    of the time spent setting up and running the FLAC encoder and decoder, the
+    bytes written and read by the callbacks, output buffer reallocations, seeks,
+    and floating point conversion.  These are disabled by default.  See
+    `get_counters()`.
+
+    Args:
+        enable (bool):  If True, enable the counters.
+
+    Returns:
+        None
+
+    """
+    perf_enable(enable)
+
+
+def counters_enabled():
+    """Whether the native performance counters are enabled.
+
+    Returns:
+        (bool):  True if the counters are enabled.
+
+    """
+    return perf_enabled()
+
+
+def get_counters(bint use_threads=True, bint reset=False):
+    """Get the native performance counters.
+
+    The counters are summed over the calling thread and, if `use_threads` is True,
+    all OpenMP threads.  The times are the sums of the wall clock seconds of each
+    thread, so with several threads they may exceed the elapsed time.  The counters
+    of a thread are lost when its pools are freed (see `clear_pools()`).
+
+    The "enc_setup" and "dec_setup" times cover configuring the encoder and
+    resetting the decoder and moving it to the first requested frame, while
+    "enc_process" and "dec_process" cover encoding and decoding.  The "convert"
+    time is the part of the processing spent converting between floating point and
+    integer values.  The "enc_writes" and "enc_bytes" are the write callbacks and
+    bytes emitted by the encoder, "enc_resizes" the number of times an output buffer
+    was reallocated, and "enc_unreserved" the number of threaded encodes which could
+    not reserve their shared output buffer and used a separate buffer per item (with
+    a final copy of all the bytes).  The "enc_overflows" are items which compressed
+    worse than estimated and were encoded a second time by the threaded encoder.  The "dec_reads", "dec_bytes" and "dec_seeks"
+    are the read and seek callbacks of the decoder.
+
+    Args:
+        use_threads (bool):  If True, include the counters of all OpenMP threads.
+        reset (bool):  If True, zero the counters after reading them.
+
+    Returns:
+        (dict):  The counters.
+
+    """
+    cdef perf_counters total
+    with nogil:
+        perf_collect(use_threads, reset, &total)
+    return {
+        "enc_setup": total.enc_setup,
+        "enc_process": total.enc_process,
+        "enc_items": total.enc_items,
+        "enc_writes": total.enc_writes,
+        "enc_bytes": total.enc_bytes,
+        "enc_resizes": total.enc_resizes,
+        "enc_unreserved": total.enc_unreserved,
+        "enc_overflows": total.enc_overflows,
+        "dec_setup": total.dec_setup,
+        "dec_process": total.dec_process,
+        "dec_items": total.dec_items,
+        "dec_reads": total.dec_reads,
+        "dec_bytes": total.dec_bytes,
+        "dec_seeks": total.dec_seeks,
+        "convert": total.convert,
+    }
 
 
 def wrap_float32_to_int32(
@@ -143,15 +509,16 @@ def wrap_float32_to_int32(
     if len(quanta) == n_stream:
         fquanta = <float *>quanta.data
 
-    errcode = float32_to_int32(
-        <float *>flatdata.data,
-        n_stream,
-        stream_size,
-        fquanta,
-        <cnp.int32_t *>output.data,
-        <float *>offsets.data,
-        <float *>gains.data,
-    )
+    with nogil:
+        errcode = float32_to_int32(
+            <float *>flatdata.data,
+            n_stream,
+            stream_size,
+            fquanta,
+            <cnp.int32_t *>output.data,
+            <float *>offsets.data,
+            <float *>gains.data,
+        )
 
     if errcode != 0:
         # FIXME: change error codes so we can print a message here
@@ -194,15 +561,16 @@ def wrap_float64_to_int64(
     if len(quanta) == n_stream:
         fquanta = <double *>quanta.data
 
-    errcode = float64_to_int64(
-        <double *>flatdata.data,
-        n_stream,
-        stream_size,
-        fquanta,
-        <cnp.int64_t *>output.data,
-        <double *>offsets.data,
-        <double *>gains.data,
-    )
+    with nogil:
+        errcode = float64_to_int64(
+            <double *>flatdata.data,
+            n_stream,
+            stream_size,
+            fquanta,
+            <cnp.int64_t *>output.data,
+            <double *>offsets.data,
+            <double *>gains.data,
+        )
 
     if errcode != 0:
         # FIXME: change error codes so we can print a message here
@@ -236,14 +604,15 @@ def wrap_int32_to_float32(
     cdef int64_t size = n_stream * stream_size
     cdef cnp.ndarray output = np.empty(size, dtype=np.float32, order="C")
 
-    int32_to_float32(
-        <cnp.int32_t *>idata.data,
-        n_stream,
-        stream_size,
-        <float *>offsets.data,
-        <float *>gains.data,
-        <float *>output.data,
-    )
+    with nogil:
+        int32_to_float32(
+            <cnp.int32_t *>idata.data,
+            n_stream,
+            stream_size,
+            <float *>offsets.data,
+            <float *>gains.data,
+            <float *>output.data,
+        )
     return output
 
 
@@ -271,22 +640,171 @@ def wrap_int64_to_float64(
     cdef int64_t size = n_stream * stream_size
     cdef cnp.ndarray output = np.empty(size, dtype=np.float64, order="C")
 
-    int64_to_float64(
-        <cnp.int64_t *>idata.data,
-        n_stream,
-        stream_size,
-        <double *>offsets.data,
-        <double *>gains.data,
-        <double *>output.data,
-    )
+    with nogil:
+        int64_to_float64(
+            <cnp.int64_t *>idata.data,
+            n_stream,
+            stream_size,
+            <double *>offsets.data,
+            <double *>gains.data,
+            <double *>output.data,
+        )
     return output
 
 
+def _stream_offsets(arr):
+    """Find the offset of the first sample of each stream of an array.
+
+    The streams are along the final dimension, and are ordered as the C order of the
+    leading dimensions.  The array may be any view.
+
+    Args:
+        arr (numpy.ndarray):  The array.
+
+    Returns:
+        (array):  The offset (in elements) of the first sample of each stream,
+            relative to the first element of `arr`, or None if the strides are not
+            a whole number of elements.
+
+    """
+    itemsize = arr.dtype.itemsize
+    if any((x % itemsize) != 0 for x in arr.strides):
+        return None
+    if arr.ndim <= 1:
+        return np.zeros(1, dtype=offset_dtype)
+    lead_strides = np.array(arr.strides[:-1], dtype=offset_dtype) // itemsize
+    indices = np.indices(arr.shape[:-1], dtype=offset_dtype).reshape(
+        (arr.ndim - 1, -1)
+    )
+    return np.ascontiguousarray(np.dot(lead_strides, indices), dtype=offset_dtype)
+
+
+cdef struct encode_pointers:
+    int64_t * seg_starts
+    int64_t * frm_starts
+    uint32_t * cksums
+    int64_t * strm_offsets
+
+
+cdef encode_pointers _encode_pointers(
+    flatdata,
+    dtype,
+    int64_t n_stream,
+    int64_t stream_size,
+    uint32_t level,
+    int64_t segment_size,
+    cnp.ndarray segment_starts,
+    cnp.ndarray frame_starts,
+    cnp.ndarray stream_offsets,
+    int64_t sample_stride,
+    cnp.ndarray checksums,
+) except *:
+    """Check the arrays passed to the encode wrappers and get their pointers.
+
+    The optional output arrays must have one element per segment, frame, or stream
+    (or segment) respectively.  The encoder reads the samples of strided data
+    without any checks, so every sample addressed by the stream offsets and sample
+    stride must lie within the memory spanned by the view.
+
+    Args:
+        flatdata (numpy.ndarray):  The flat-packed data, or a strided view.
+        dtype (numpy.dtype):  The required type of the data.
+        n_stream (int64_t):  The number of streams.
+        stream_size (int64_t):  The length of each stream.
+        level (uint32_t):  The compression level, which sets the frame size.
+        segment_size (int64_t):  The number of samples in each segment, if
+            segment_starts is not None.
+        segment_starts (array):  The segment starts to fill, or None.
+        frame_starts (array):  The frame starts to fill, or None.
+        stream_offsets (array):  The offset of each stream in a strided view, or
+            None for flat-packed data.
+        sample_stride (int64_t):  The distance in elements between the samples of a
+            stream in a strided view.
+        checksums (array):  The checksums to fill, or None.
+
+    Returns:
+        (encode_pointers):  The data pointers of the optional arrays (NULL for
+            those which are None).
+
+    """
+    cdef encode_pointers ptrs
+    ptrs.seg_starts = NULL
+    ptrs.frm_starts = NULL
+    ptrs.cksums = NULL
+    ptrs.strm_offsets = NULL
+
+    if segment_starts is not None:
+        if len(segment_starts) != n_stream * n_segments(stream_size, segment_size):
+            msg = "segment_starts does not have one element per segment"
+            raise RuntimeError(msg)
+        ptrs.seg_starts = <cnp.int64_t *>segment_starts.data
+
+    if frame_starts is not None:
+        if len(frame_starts) != n_stream * n_stream_frames(
+            stream_size,
+            segment_size if segment_starts is not None else 0,
+            encode_frame_size(level),
+        ):
+            msg = "frame_starts does not have one element per frame"
+            raise RuntimeError(msg)
+        ptrs.frm_starts = <cnp.int64_t *>frame_starts.data
+
+    if checksums is not None:
+        if len(checksums) != n_stream * (
+            n_segments(stream_size, segment_size) if segment_starts is not None else 1
+        ):
+            msg = "checksums does not have one element per stream or segment"
+            raise RuntimeError(msg)
+        ptrs.cksums = <cnp.uint32_t *>checksums.data
+
+    if flatdata.dtype != dtype:
+        msg = f"The data has type '{flatdata.dtype}', expected '{np.dtype(dtype)}'"
+        raise RuntimeError(msg)
+    if stream_offsets is None:
+        if not flatdata.flags.c_contiguous or flatdata.size != n_stream * stream_size:
+            msg = "Flat-packed data must be C-contiguous, with n_stream * stream_size "
+            msg += "elements"
+            raise RuntimeError(msg)
+        return ptrs
+    if len(stream_offsets) != n_stream:
+        msg = "stream_offsets must have one element per stream"
+        raise RuntimeError(msg)
+    ptrs.strm_offsets = <cnp.int64_t *>stream_offsets.data
+    if n_stream == 0 or stream_size == 0:
+        return ptrs
+    # The range of elements spanned by the view, relative to its first element.
+    itemsize = flatdata.dtype.itemsize
+    low = 0
+    high = 0
+    for dim, stride in zip(flatdata.shape, flatdata.strides):
+        span = (dim - 1) * stride
+        low += min(span, 0)
+        high += max(span, 0)
+    low = -((-low) // itemsize)
+    high = high // itemsize
+    span = (stream_size - 1) * sample_stride
+    first = int(np.min(stream_offsets)) + min(span, 0)
+    last = int(np.max(stream_offsets)) + max(span, 0)
+    if flatdata.size == 0 or first < low or last > high:
+        msg = f"stream_offsets and sample_stride address elements {first} to {last}, "
+        msg += f"outside of the data ({low} to {high})"
+        raise RuntimeError(msg)
+    return ptrs
+
+
 def wrap_encode_i32(
-    cnp.ndarray[cnp.int32_t, ndim=1, mode="c"] flatdata,
+    cnp.ndarray flatdata,
     cnp.int64_t n_stream,
     cnp.int64_t stream_size,
     cnp.uint32_t level,
+    cnp.int64_t segment_size=0,
+    cnp.ndarray[cnp.int64_t, ndim=1, mode="c"] segment_starts=None,
+    cnp.uint32_t n_threads=0,
+    cnp.ndarray[cnp.int64_t, ndim=1, mode="c"] frame_starts=None,
+    cnp.ndarray[cnp.int64_t, ndim=1, mode="c"] stream_offsets=None,
+    cnp.int64_t sample_stride=0,
+    cnp.ndarray[cnp.uint32_t, ndim=1, mode="c"] checksums=None,
+    bint do_md5=True,
 ):
     """Wrapper around the C int32 encode function.
 
@@ -294,10 +812,30 @@ def wrap_encode_i32(
     the input array.
 
     Args:
-        flatdata (array):  The 1D reshaped view of the data.
+        flatdata (array):  The 1D reshaped view of the data, or any view of the
+            data if stream_offsets is given.
         n_stream (int64_t):  The number of streams.
         stream_size (int64_t):  The length of each stream.
         level (uint32_t):  The compression level (0-8).
+        segment_size (int64_t):  If segment_starts is not None, the number of
+            samples in each independently encoded segment of a stream.
+        segment_starts (array):  If not None, the flat-packed array of
+            n_stream * n_segments values which is filled with the starting byte
+            of each segment relative to the start of its stream.
+        n_threads (uint32_t):  The total number of threads to use (0 means the
+            OpenMP default).
+        frame_starts (array):  If not None, the flat-packed array of
+            n_stream * n_stream_frames values which is filled with the starting
+            byte of each FLAC frame relative to the start of its stream.
+        stream_offsets (array):  If not None, the offset (in samples) of the first
+            sample of each stream relative to the start of flatdata, which is
+            then a strided view.
+        sample_stride (int64_t):  The distance (in samples) between consecutive
+            samples of a stream, if stream_offsets is given.
+        checksums (array):  If not None, the flat-packed array of n_stream values
+            (or n_stream * n_segments with segments) which is filled with the
+            CRC32C of the compressed bytes of each stream (or segment).
+        do_md5 (bool):  If False, libFLAC skips the MD5 signature of the input.
 
     Returns:
         (tuple): The (compressed bytes, flat-packed starting bytes,
@@ -312,16 +850,39 @@ def wrap_encode_i32(
     cdef unsigned char * rawbytes
     cdef int errcode = 0
 
-    errcode = encode_i32(
-        <cnp.int32_t *>flatdata.data,
+    cdef encode_pointers ptrs = _encode_pointers(
+        flatdata,
+        flac_i32_dtype,
         n_stream,
         stream_size,
         level,
-        &n_bytes,
-        <cnp.int64_t *>flat_starts.data,
-        &rawbytes,
+        segment_size,
+        segment_starts,
+        frame_starts,
+        stream_offsets,
+        sample_stride,
+        checksums,
     )
 
+    with nogil:
+        errcode = encode_i32(
+            <cnp.int32_t *>flatdata.data,
+            ptrs.strm_offsets,
+            sample_stride,
+            n_stream,
+            stream_size,
+            segment_size,
+            level,
+            do_md5,
+            n_threads,
+            &n_bytes,
+            <cnp.int64_t *>flat_starts.data,
+            ptrs.seg_starts,
+            ptrs.frm_starts,
+            ptrs.cksums,
+            &rawbytes,
+        )
+
     if errcode != 0:
         # FIXME: change error codes so we can print a message here
         msg = f"Encoding failed, return code = {errcode}"
@@ -344,10 +905,19 @@ def wrap_encode_i32(
 
 
 def wrap_encode_i32_threaded(
-    cnp.ndarray[cnp.int32_t, ndim=1, mode="c"] flatdata,
+    cnp.ndarray flatdata,
     cnp.int64_t n_stream,
     cnp.int64_t stream_size,
     cnp.uint32_t level,
+    cnp.int64_t segment_size=0,
+    cnp.ndarray[cnp.int64_t, ndim=1, mode="c"] segment_starts=None,
+    cnp.uint32_t n_threads=0,
+    cnp.ndarray[cnp.int64_t, ndim=1, mode="c"] frame_starts=None,
+    cnp.ndarray[cnp.int64_t, ndim=1, mode="c"] stream_offsets=None,
+    cnp.int64_t sample_stride=0,
+    cnp.int64_t max_memory=0,
+    cnp.ndarray[cnp.uint32_t, ndim=1, mode="c"] checksums=None,
+    bint do_md5=True,
 ):
     """Wrapper around the C int32 encode function (threaded version).
 
@@ -355,10 +925,32 @@ def wrap_encode_i32_threaded(
     the input array.
 
     Args:
-        flatdata (array):  The 1D reshaped view of the data.
+        flatdata (array):  The 1D reshaped view of the data, or any view of the
+            data if stream_offsets is given.
         n_stream (int64_t):  The number of streams.
         stream_size (int64_t):  The length of each stream.
         level (uint32_t):  The compression level (0-8).
+        segment_size (int64_t):  If segment_starts is not None, the number of
+            samples in each independently encoded segment of a stream.
+        segment_starts (array):  If not None, the flat-packed array of
+            n_stream * n_segments values which is filled with the starting byte
+            of each segment relative to the start of its stream.
+        n_threads (uint32_t):  The total number of threads to use (0 means the
+            OpenMP default).
+        frame_starts (array):  If not None, the flat-packed array of
+            n_stream * n_stream_frames values which is filled with the starting
+            byte of each FLAC frame relative to the start of its stream.
+        stream_offsets (array):  If not None, the offset (in samples) of the first
+            sample of each stream relative to the start of flatdata, which is
+            then a strided view.
+        sample_stride (int64_t):  The distance (in samples) between consecutive
+            samples of a stream, if stream_offsets is given.
+        max_memory (int64_t):  If positive, the limit on the bytes used for the
+            streams in progress.  Larger inputs are encoded in batches.
+        checksums (array):  If not None, the flat-packed array of n_stream values
+            (or n_stream * n_segments with segments) which is filled with the
+            CRC32C of the compressed bytes of each stream (or segment).
+        do_md5 (bool):  If False, libFLAC skips the MD5 signature of the input.
 
     Returns:
         (tuple): The (compressed bytes, flat-packed starting bytes,
@@ -373,16 +965,40 @@ def wrap_encode_i32_threaded(
     cdef unsigned char * rawbytes
     cdef int errcode = 0
 
-    errcode = encode_i32_threaded(
-        <cnp.int32_t *>flatdata.data,
+    cdef encode_pointers ptrs = _encode_pointers(
+        flatdata,
+        flac_i32_dtype,
         n_stream,
         stream_size,
         level,
-        &n_bytes,
-        <cnp.int64_t *>flat_starts.data,
-        &rawbytes,
+        segment_size,
+        segment_starts,
+        frame_starts,
+        stream_offsets,
+        sample_stride,
+        checksums,
     )
 
+    with nogil:
+        errcode = encode_i32_threaded(
+            <cnp.int32_t *>flatdata.data,
+            ptrs.strm_offsets,
+            sample_stride,
+            n_stream,
+            stream_size,
+            segment_size,
+            level,
+            do_md5,
+            n_threads,
+            max_memory,
+            &n_bytes,
+            <cnp.int64_t *>flat_starts.data,
+            ptrs.seg_starts,
+            ptrs.frm_starts,
+            ptrs.cksums,
+            &rawbytes,
+        )
+
     if errcode != 0:
         # FIXME: change error codes so we can print a message here
         msg = f"Encoding failed, return code = {errcode}"
@@ -405,10 +1021,18 @@ def wrap_encode_i32_threaded(
 
 
 def wrap_encode_i64(
-    cnp.ndarray[cnp.int64_t, ndim=1, mode="c"] flatdata,
+    cnp.ndarray flatdata,
     cnp.int64_t n_stream,
     cnp.int64_t stream_size,
     cnp.uint32_t level,
+    cnp.int64_t segment_size=0,
+    cnp.ndarray[cnp.int64_t, ndim=1, mode="c"] segment_starts=None,
+    cnp.uint32_t n_threads=0,
+    cnp.ndarray[cnp.int64_t, ndim=1, mode="c"] frame_starts=None,
+    cnp.ndarray[cnp.int64_t, ndim=1, mode="c"] stream_offsets=None,
+    cnp.int64_t sample_stride=0,
+    cnp.ndarray[cnp.uint32_t, ndim=1, mode="c"] checksums=None,
+    bint do_md5=True,
 ):
     """Wrapper around the C int64 encode function.
 
@@ -416,10 +1040,30 @@ def wrap_encode_i64(
     the input array.
 
     Args:
-        flatdata (array):  The 1D reshaped view of the data.
+        flatdata (array):  The 1D reshaped view of the data, or any view of the
+            data if stream_offsets is given.
         n_stream (int64_t):  The number of streams.
         stream_size (int64_t):  The length of each stream.
         level (uint32_t):  The compression level (0-8).
+        segment_size (int64_t):  If segment_starts is not None, the number of
+            samples in each independently encoded segment of a stream.
+        segment_starts (array):  If not None, the flat-packed array of
+            n_stream * n_segments values which is filled with the starting byte
+            of each segment relative to the start of its stream.
+        n_threads (uint32_t):  The total number of threads to use (0 means the
+            OpenMP default).
+        frame_starts (array):  If not None, the flat-packed array of
+            n_stream * n_stream_frames values which is filled with the starting
+            byte of each FLAC frame relative to the start of its stream.
+        stream_offsets (array):  If not None, the offset (in samples) of the first
+            sample of each stream relative to the start of flatdata, which is
+            then a strided view.
+        sample_stride (int64_t):  The distance (in samples) between consecutive
+            samples of a stream, if stream_offsets is given.
+        checksums (array):  If not None, the flat-packed array of n_stream values
+            (or n_stream * n_segments with segments) which is filled with the
+            CRC32C of the compressed bytes of each stream (or segment).
+        do_md5 (bool):  If False, libFLAC skips the MD5 signature of the input.
 
     Returns:
         (tuple): The (compressed bytes, flat-packed starting bytes,
@@ -434,16 +1078,39 @@ def wrap_encode_i64(
     cdef unsigned char * rawbytes
     cdef int errcode = 0
 
-    errcode = encode_i64(
-        <cnp.int64_t *>flatdata.data,
+    cdef encode_pointers ptrs = _encode_pointers(
+        flatdata,
+        flac_i64_dtype,
         n_stream,
         stream_size,
         level,
-        &n_bytes,
-        <cnp.int64_t *>flat_starts.data,
-        &rawbytes,
+        segment_size,
+        segment_starts,
+        frame_starts,
+        stream_offsets,
+        sample_stride,
+        checksums,
     )
 
+    with nogil:
+        errcode = encode_i64(
+            <cnp.int64_t *>flatdata.data,
+            ptrs.strm_offsets,
+            sample_stride,
+            n_stream,
+            stream_size,
+            segment_size,
+            level,
+            do_md5,
+            n_threads,
+            &n_bytes,
+            <cnp.int64_t *>flat_starts.data,
+            ptrs.seg_starts,
+            ptrs.frm_starts,
+            ptrs.cksums,
+            &rawbytes,
+        )
+
     if errcode != 0:
         # FIXME: change error codes so we can print a message here
         msg = f"Encoding failed, return code = {errcode}"
@@ -466,10 +1133,19 @@ def wrap_encode_i64(
 
 
 def wrap_encode_i64_threaded(
-    cnp.ndarray[cnp.int64_t, ndim=1, mode="c"] flatdata,
+    cnp.ndarray flatdata,
     cnp.int64_t n_stream,
     cnp.int64_t stream_size,
     cnp.uint32_t level,
+    cnp.int64_t segment_size=0,
+    cnp.ndarray[cnp.int64_t, ndim=1, mode="c"] segment_starts=None,
+    cnp.uint32_t n_threads=0,
+    cnp.ndarray[cnp.int64_t, ndim=1, mode="c"] frame_starts=None,
+    cnp.ndarray[cnp.int64_t, ndim=1, mode="c"] stream_offsets=None,
+    cnp.int64_t sample_stride=0,
+    cnp.int64_t max_memory=0,
+    cnp.ndarray[cnp.uint32_t, ndim=1, mode="c"] checksums=None,
+    bint do_md5=True,
 ):
     """Wrapper around the C int64 encode function (threaded version).
 
@@ -477,10 +1153,32 @@ def wrap_encode_i64_threaded(
     the input array.
 
     Args:
-        flatdata (array):  The 1D reshaped view of the data.
+        flatdata (array):  The 1D reshaped view of the data, or any view of the
+            data if stream_offsets is given.
         n_stream (int64_t):  The number of streams.
         stream_size (int64_t):  The length of each stream.
         level (uint32_t):  The compression level (0-8).
+        segment_size (int64_t):  If segment_starts is not None, the number of
+            samples in each independently encoded segment of a stream.
+        segment_starts (array):  If not None, the flat-packed array of
+            n_stream * n_segments values which is filled with the starting byte
+            of each segment relative to the start of its stream.
+        n_threads (uint32_t):  The total number of threads to use (0 means the
+            OpenMP default).
+        frame_starts (array):  If not None, the flat-packed array of
+            n_stream * n_stream_frames values which is filled with the starting
+            byte of each FLAC frame relative to the start of its stream.
+        stream_offsets (array):  If not None, the offset (in samples) of the first
+            sample of each stream relative to the start of flatdata, which is
+            then a strided view.
+        sample_stride (int64_t):  The distance (in samples) between consecutive
+            samples of a stream, if stream_offsets is given.
+        max_memory (int64_t):  If positive, the limit on the bytes used for the
+            streams in progress.  Larger inputs are encoded in batches.
+        checksums (array):  If not None, the flat-packed array of n_stream values
+            (or n_stream * n_segments with segments) which is filled with the
+            CRC32C of the compressed bytes of each stream (or segment).
+        do_md5 (bool):  If False, libFLAC skips the MD5 signature of the input.
 
     Returns:
         (tuple): The (compressed bytes, flat-packed starting bytes,
@@ -495,16 +1193,40 @@ def wrap_encode_i64_threaded(
     cdef unsigned char * rawbytes
     cdef int errcode = 0
 
-    errcode = encode_i64_threaded(
-        <cnp.int64_t *>flatdata.data,
+    cdef encode_pointers ptrs = _encode_pointers(
+        flatdata,
+        flac_i64_dtype,
         n_stream,
         stream_size,
         level,
-        &n_bytes,
-        <cnp.int64_t *>flat_starts.data,
-        &rawbytes,
+        segment_size,
+        segment_starts,
+        frame_starts,
+        stream_offsets,
+        sample_stride,
+        checksums,
     )
 
+    with nogil:
+        errcode = encode_i64_threaded(
+            <cnp.int64_t *>flatdata.data,
+            ptrs.strm_offsets,
+            sample_stride,
+            n_stream,
+            stream_size,
+            segment_size,
+            level,
+            do_md5,
+            n_threads,
+            max_memory,
+            &n_bytes,
+            <cnp.int64_t *>flat_starts.data,
+            ptrs.seg_starts,
+            ptrs.frm_starts,
+            ptrs.cksums,
+            &rawbytes,
+        )
+
     if errcode != 0:
         # FIXME: change error codes so we can print a message here
         msg = f"Encoding failed, return code = {errcode}"
@@ -526,75 +1248,842 @@ def wrap_encode_i64_threaded(
     )
 
 
-def encode_flac(data, int level, bool use_threads=False):
-    """Compress an integer array to a FLAC representation.
-
-    The input array must be C-contiguous in memory.  The last dimension is the one
-    which will be compressed.  The returned array of starting bytes will have the same
-    shape as the leading (uncompressed) dimensions of `data`.  The array of number of
-    bytes per stream is returned as a convenience to allow easier extraction of
-    subsets of streams within the larger compressed blob.
+def wrap_encode_f32(
+    cnp.ndarray flatdata,
+    cnp.int64_t n_stream,
+    cnp.int64_t stream_size,
+    cnp.uint32_t level,
+    cnp.ndarray[float, ndim=1, mode="c"] quanta,
+    bint use_threads,
+    cnp.int64_t segment_size=0,
+    cnp.ndarray[cnp.int64_t, ndim=1, mode="c"] segment_starts=None,
+    cnp.uint32_t n_threads=0,
+    cnp.ndarray[cnp.int64_t, ndim=1, mode="c"] frame_starts=None,
+    cnp.ndarray[cnp.int64_t, ndim=1, mode="c"] stream_offsets=None,
+    cnp.int64_t sample_stride=0,
+    cnp.int64_t max_memory=0,
+    cnp.ndarray[cnp.uint32_t, ndim=1, mode="c"] checksums=None,
+    bint do_md5=True,
+):
+    """Wrapper around the C 32bit float encode functions.
 
-    The returned starts and nbytes arrays are always at least a 1D array, even if
-    the data consists of a single stream.
+    The data is quantized while it is encoded, without allocating the full
+    integer array.  The offsets, gains, and compressed bytes are identical to
+    converting with `wrap_float32_to_int32` and then encoding the integers.
 
     Args:
-        data (numpy.ndarray):  The array of 32bit or 64bit integers.
-        level (int):  The FLAC compression level (0-8).
-        use_threads (bool):  If True, use OpenMP threads to parallelize decoding.
-            This is only beneficial for large arrays.
+        flatdata (array):  The 1D reshaped view of the data, or any view of the
+            data if stream_offsets is given.
+        n_stream (int64_t):  The number of streams.
+        stream_size (int64_t):  The length of each stream.
+        level (uint32_t):  The compression level (0-8).
+        quanta (array):  Array of values for each stream.  If the length does not
+            equal the number of streams, then it will be ignored and computed from
+            the data range.
+        use_threads (bool):  If True, use OpenMP threads to parallelize encoding.
+        segment_size (int64_t):  If segment_starts is not None, the number of
+            samples in each independently encoded segment of a stream.
+        segment_starts (array):  If not None, the flat-packed array of
+            n_stream * n_segments values which is filled with the starting byte
+            of each segment relative to the start of its stream.
+        n_threads (uint32_t):  The total number of threads to use (0 means the
+            OpenMP default).
+        frame_starts (array):  If not None, the flat-packed array of
+            n_stream * n_stream_frames values which is filled with the starting
+            byte of each FLAC frame relative to the start of its stream.
+        stream_offsets (array):  If not None, the offset (in samples) of the first
+            sample of each stream relative to the start of flatdata, which is
+            then a strided view.
+        sample_stride (int64_t):  The distance (in samples) between consecutive
+            samples of a stream, if stream_offsets is given.
+        max_memory (int64_t):  If positive, the limit on the bytes used for the
+            streams in progress.  Larger inputs are encoded in batches.
+        checksums (array):  If not None, the flat-packed array of n_stream values
+            (or n_stream * n_segments with segments) which is filled with the
+            CRC32C of the compressed bytes of each stream (or segment).
+        do_md5 (bool):  If False, libFLAC skips the MD5 signature of the input.
 
     Returns:
-        (tuple):  The (compressed bytestream, stream starting bytes, stream nbytes).
+        (tuple): The (compressed bytes, flat-packed starting bytes,
+            flat-packed stream bytes, offset array, gain array).
 
     """
-    if data.dtype != flac_i32_dtype and data.dtype != flac_i64_dtype:
-        msg = "Only 32bit or 64bit integer data is supported"
-        raise RuntimeError(msg)
-    if not data.data.c_contiguous:
-        msg = "Only C-contiguous arrays are supported"
-        raise RuntimeError(msg)
-    if level < 0 or level > 8:
-        msg = "FLAC only supports compression levels 0-8"
-        raise RuntimeError(msg)
+    # Allocate the outputs
+    cdef cnp.ndarray flat_starts = np.empty(n_stream, dtype=np.int64, order="C")
+    cdef cnp.ndarray flat_nbytes = np.empty(n_stream, dtype=np.int64, order="C")
+    cdef cnp.ndarray offsets = np.empty(n_stream, dtype=np.float32, order="C")
+    cdef cnp.ndarray gains = np.empty(n_stream, dtype=np.float32, order="C")
 
-    stream_size = data.shape[-1]
-    if len(data.shape[:-1]) == 0:
-        n_stream = 1
-        starts_shape = (1,)
-    else:
-        n_stream = np.prod(data.shape[:-1])
-        starts_shape = data.shape[:-1]
-    flatdata = data.reshape((-1,))
+    cdef int64_t n_bytes
+    cdef unsigned char * rawbytes
+    cdef int errcode = 0
 
-    if use_threads:
-        if data.dtype == flac_i32_dtype:
-            compressed, flatstarts, flatnbytes = wrap_encode_i32_threaded(
-                flatdata, n_stream, stream_size, level
-            )
-        else:
-            compressed, flatstarts, flatnbytes = wrap_encode_i64_threaded(
-                flatdata, n_stream, stream_size, level
-            )
-    else:
-        if data.dtype == flac_i32_dtype:
-            compressed, flatstarts, flatnbytes = wrap_encode_i32(
-                flatdata, n_stream, stream_size, level
+    cdef float * fquanta = NULL
+    if len(quanta) == n_stream:
+        fquanta = <float *>quanta.data
+
+    cdef encode_pointers ptrs = _encode_pointers(
+        flatdata,
+        flac_f32_dtype,
+        n_stream,
+        stream_size,
+        level,
+        segment_size,
+        segment_starts,
+        frame_starts,
+        stream_offsets,
+        sample_stride,
+        checksums,
+    )
+
+    with nogil:
+        if use_threads:
+            errcode = encode_f32_threaded(
+                <float *>flatdata.data,
+                ptrs.strm_offsets,
+                sample_stride,
+                n_stream,
+                stream_size,
+                segment_size,
+                fquanta,
+                level,
+                do_md5,
+                n_threads,
+                max_memory,
+                <float *>offsets.data,
+                <float *>gains.data,
+                &n_bytes,
+                <cnp.int64_t *>flat_starts.data,
+                ptrs.seg_starts,
+                ptrs.frm_starts,
+                ptrs.cksums,
+                &rawbytes,
             )
         else:
-            compressed, flatstarts, flatnbytes = wrap_encode_i64(
-                flatdata, n_stream, stream_size, level
+            errcode = encode_f32(
+                <float *>flatdata.data,
+                ptrs.strm_offsets,
+                sample_stride,
+                n_stream,
+                stream_size,
+                segment_size,
+                fquanta,
+                level,
+                do_md5,
+                n_threads,
+                <float *>offsets.data,
+                <float *>gains.data,
+                &n_bytes,
+                <cnp.int64_t *>flat_starts.data,
+                ptrs.seg_starts,
+                ptrs.frm_starts,
+                ptrs.cksums,
+                &rawbytes,
             )
 
-    # Reshape and return
+    if errcode != 0:
+        # FIXME: change error codes so we can print a message here
+        msg = f"Encoding failed, return code = {errcode}"
+        raise RuntimeError(msg)
+
+    # Compute the bytes per stream
+    flat_nbytes[:-1] = np.diff(flat_starts)
+    flat_nbytes[-1] = n_bytes - flat_starts[-1]
+
+    # Wrap the returned C-allocated buffers so that they are properly garbage
+    # collected.
+    cdef cvarray compressed = <cnp.uint8_t[:n_bytes]> rawbytes
+    compressed.free_data = True
+
     return (
-        compressed,
-        flatstarts.reshape(starts_shape),
-        flatnbytes.reshape(starts_shape)
+        np.asarray(compressed),
+        flat_starts,
+        flat_nbytes,
+        offsets,
+        gains,
     )
 
 
-def wrap_decode_i32(
+def wrap_encode_f64(
+    cnp.ndarray flatdata,
+    cnp.int64_t n_stream,
+    cnp.int64_t stream_size,
+    cnp.uint32_t level,
+    cnp.ndarray[double, ndim=1, mode="c"] quanta,
+    bint use_threads,
+    cnp.int64_t segment_size=0,
+    cnp.ndarray[cnp.int64_t, ndim=1, mode="c"] segment_starts=None,
+    cnp.uint32_t n_threads=0,
+    cnp.ndarray[cnp.int64_t, ndim=1, mode="c"] frame_starts=None,
+    cnp.ndarray[cnp.int64_t, ndim=1, mode="c"] stream_offsets=None,
+    cnp.int64_t sample_stride=0,
+    cnp.int64_t max_memory=0,
+    cnp.ndarray[cnp.uint32_t, ndim=1, mode="c"] checksums=None,
+    bint do_md5=True,
+):
+    """Wrapper around the C 64bit float encode functions.
+
+    The data is quantized while it is encoded, without allocating the full
+    integer array.  The offsets, gains, and compressed bytes are identical to
+    converting with `wrap_float64_to_int64` and then encoding the integers.
+
+    Args:
+        flatdata (array):  The 1D reshaped view of the data, or any view of the
+            data if stream_offsets is given.
+        n_stream (int64_t):  The number of streams.
+        stream_size (int64_t):  The length of each stream.
+        level (uint32_t):  The compression level (0-8).
+        quanta (array):  Array of values for each stream.  If the length does not
+            equal the number of streams, then it will be ignored and computed from
+            the data range.
+        use_threads (bool):  If True, use OpenMP threads to parallelize encoding.
+        segment_size (int64_t):  If segment_starts is not None, the number of
+            samples in each independently encoded segment of a stream.
+        segment_starts (array):  If not None, the flat-packed array of
+            n_stream * n_segments values which is filled with the starting byte
+            of each segment relative to the start of its stream.
+        n_threads (uint32_t):  The total number of threads to use (0 means the
+            OpenMP default).
+        frame_starts (array):  If not None, the flat-packed array of
+            n_stream * n_stream_frames values which is filled with the starting
+            byte of each FLAC frame relative to the start of its stream.
+        stream_offsets (array):  If not None, the offset (in samples) of the first
+            sample of each stream relative to the start of flatdata, which is
+            then a strided view.
+        sample_stride (int64_t):  The distance (in samples) between consecutive
+            samples of a stream, if stream_offsets is given.
+        max_memory (int64_t):  If positive, the limit on the bytes used for the
+            streams in progress.  Larger inputs are encoded in batches.
+        checksums (array):  If not None, the flat-packed array of n_stream values
+            (or n_stream * n_segments with segments) which is filled with the
+            CRC32C of the compressed bytes of each stream (or segment).
+        do_md5 (bool):  If False, libFLAC skips the MD5 signature of the input.
+
+    Returns:
+        (tuple): The (compressed bytes, flat-packed starting bytes,
+            flat-packed stream bytes, offset array, gain array).
+
+    """
+    # Allocate the outputs
+    cdef cnp.ndarray flat_starts = np.empty(n_stream, dtype=np.int64, order="C")
+    cdef cnp.ndarray flat_nbytes = np.empty(n_stream, dtype=np.int64, order="C")
+    cdef cnp.ndarray offsets = np.empty(n_stream, dtype=np.float64, order="C")
+    cdef cnp.ndarray gains = np.empty(n_stream, dtype=np.float64, order="C")
+
+    cdef int64_t n_bytes
+    cdef unsigned char * rawbytes
+    cdef int errcode = 0
+
+    cdef double * fquanta = NULL
+    if len(quanta) == n_stream:
+        fquanta = <double *>quanta.data
+
+    cdef encode_pointers ptrs = _encode_pointers(
+        flatdata,
+        flac_f64_dtype,
+        n_stream,
+        stream_size,
+        level,
+        segment_size,
+        segment_starts,
+        frame_starts,
+        stream_offsets,
+        sample_stride,
+        checksums,
+    )
+
+    with nogil:
+        if use_threads:
+            errcode = encode_f64_threaded(
+                <double *>flatdata.data,
+                ptrs.strm_offsets,
+                sample_stride,
+                n_stream,
+                stream_size,
+                segment_size,
+                fquanta,
+                level,
+                do_md5,
+                n_threads,
+                max_memory,
+                <double *>offsets.data,
+                <double *>gains.data,
+                &n_bytes,
+                <cnp.int64_t *>flat_starts.data,
+                ptrs.seg_starts,
+                ptrs.frm_starts,
+                ptrs.cksums,
+                &rawbytes,
+            )
+        else:
+            errcode = encode_f64(
+                <double *>flatdata.data,
+                ptrs.strm_offsets,
+                sample_stride,
+                n_stream,
+                stream_size,
+                segment_size,
+                fquanta,
+                level,
+                do_md5,
+                n_threads,
+                <double *>offsets.data,
+                <double *>gains.data,
+                &n_bytes,
+                <cnp.int64_t *>flat_starts.data,
+                ptrs.seg_starts,
+                ptrs.frm_starts,
+                ptrs.cksums,
+                &rawbytes,
+            )
+
+    if errcode != 0:
+        # FIXME: change error codes so we can print a message here
+        msg = f"Encoding failed, return code = {errcode}"
+        raise RuntimeError(msg)
+
+    # Compute the bytes per stream
+    flat_nbytes[:-1] = np.diff(flat_starts)
+    flat_nbytes[-1] = n_bytes - flat_starts[-1]
+
+    # Wrap the returned C-allocated buffers so that they are properly garbage
+    # collected.
+    cdef cvarray compressed = <cnp.uint8_t[:n_bytes]> rawbytes
+    compressed.free_data = True
+
+    return (
+        np.asarray(compressed),
+        flat_starts,
+        flat_nbytes,
+        offsets,
+        gains,
+    )
+
+
+def _encode_layout(
+    data, level, segment_size, return_aux, use_threads, n_threads, seek_table,
+    max_memory, checksums
+):
+    """Check the encoding options and allocate the optional outputs.
+
+    This is shared by `encode_flac` and `encode_flac_float`.
+
+    Returns:
+        (tuple):  The (stream size, number of streams, shape of the starts, flat
+            view of the data, stream offsets or None, sample stride, segment size,
+            flat segment starts or None, frame size, flat frame starts or None,
+            total number of threads, memory limit, flat checksums or None).
+
+    """
+    if level < 0 or level > 8:
+        msg = "FLAC only supports compression levels 0-8"
+        raise RuntimeError(msg)
+    if segment_size is not None:
+        if segment_size <= 0:
+            msg = "segment_size must be a positive number of samples"
+            raise RuntimeError(msg)
+        if not return_aux:
+            msg = "Encoding with segments requires return_aux=True"
+            raise RuntimeError(msg)
+    if n_threads is not None and n_threads <= 0:
+        msg = "n_threads must be a positive number of threads"
+        raise RuntimeError(msg)
+    if seek_table and not return_aux:
+        msg = "Encoding with a seek table requires return_aux=True"
+        raise RuntimeError(msg)
+    if max_memory is not None and max_memory <= 0:
+        msg = "max_memory must be a positive number of bytes"
+        raise RuntimeError(msg)
+    if checksums and not return_aux:
+        msg = "Encoding with checksums requires return_aux=True"
+        raise RuntimeError(msg)
+
+    stream_size = data.shape[-1]
+    if len(data.shape[:-1]) == 0:
+        n_stream = 1
+        starts_shape = (1,)
+    else:
+        n_stream = np.prod(data.shape[:-1])
+        starts_shape = data.shape[:-1]
+    flatdata = data
+    data_offsets = None
+    sample_stride = 0
+    if data.flags.c_contiguous:
+        flatdata = data.reshape((-1,))
+    else:
+        # Encode the view in place.  The samples of each stream are gathered a
+        # block at a time as they are passed to the encoder.
+        data_offsets = _stream_offsets(data)
+        if data_offsets is None:
+            # The strides are not whole elements, so make a contiguous copy.
+            flatdata = np.ascontiguousarray(data).reshape((-1,))
+        else:
+            sample_stride = data.strides[-1] // data.dtype.itemsize
+
+    seg_size = 0
+    flat_segments = None
+    if segment_size is not None:
+        seg_size = segment_size
+        flat_segments = np.empty(
+            n_stream * n_segments(stream_size, seg_size), dtype=np.int64
+        )
+
+    frame_size = 0
+    flat_frames = None
+    if seek_table:
+        frame_size = encode_frame_size(level)
+        flat_frames = np.empty(
+            n_stream * n_stream_frames(stream_size, seg_size, frame_size),
+            dtype=np.int64,
+        )
+
+    # By default the threaded encoder uses the OpenMP maximum, and the unthreaded
+    # one a single thread.
+    n_thr = 0 if use_threads else 1
+    if n_threads is not None:
+        n_thr = n_threads
+
+    max_mem = 0
+    if max_memory is not None:
+        max_mem = max_memory
+
+    flat_checksums = None
+    if checksums:
+        n_item = n_stream
+        if segment_size is not None:
+            n_item *= n_segments(stream_size, seg_size)
+        flat_checksums = np.empty(n_item, dtype=checksum_dtype)
+
+    return (
+        stream_size, n_stream, starts_shape, flatdata, data_offsets, sample_stride,
+        seg_size, flat_segments, frame_size, flat_frames, n_thr, max_mem,
+        flat_checksums
+    )
+
+
+def _encode_result(
+    result, starts_shape, return_aux, segment_size, flat_segments, frame_size,
+    flat_frames, flat_checksums
+):
+    """Reshape the encoder outputs and build the auxiliary arrays.
+
+    The first, second, and third elements of `result` are the compressed bytes and
+    the flat stream starts and nbytes.  Any further elements are returned unchanged.
+
+    Returns:
+        (tuple):  The outputs, with the auxiliary arrays if requested.
+
+    """
+    # Reshape and return
+    result = (
+        result[0],
+        result[1].reshape(starts_shape),
+        result[2].reshape(starts_shape),
+    ) + tuple(result[3:])
+    if not return_aux:
+        return result
+    stream_aux = dict()
+    if flat_segments is not None:
+        stream_aux["segment_size"] = int(segment_size)
+        stream_aux["stream_segments"] = flat_segments.reshape(starts_shape + (-1,))
+    if flat_frames is not None:
+        stream_aux["frame_size"] = int(frame_size)
+        stream_aux["stream_frames"] = flat_frames.reshape(starts_shape + (-1,))
+    if flat_checksums is not None:
+        stream_aux["checksum_type"] = checksum_crc32c
+        stream_aux["stream_checksums"] = flat_checksums.reshape(starts_shape + (-1,))
+    return result + (stream_aux,)
+
+
+def encode_flac(
+    data,
+    int level,
+    bint use_threads=False,
+    segment_size=None,
+    bint return_aux=False,
+    n_threads=None,
+    bint seek_table=False,
+    max_memory=None,
+    bint checksums=False,
+    bint md5=True,
+):
+    """Compress an integer array to a FLAC representation.
+
+    The last dimension of the input array is the one which will be compressed.  The
+    array may be any view, such as a slice or the transpose of a larger array.  Views
+    which are not C-contiguous are encoded in place, by gathering a block of samples
+    at a time as they are fed to the encoder, rather than making a contiguous copy.
+    The returned array of starting bytes will have the same shape as the leading
+    (uncompressed) dimensions of `data`.  The array of number of bytes per stream is
+    returned as a convenience to allow easier extraction of subsets of streams within
+    the larger compressed blob.
+
+    The returned starts and nbytes arrays are always at least a 1D array, even if
+    the data consists of a single stream.
+
+    Each stream is encoded with the smallest bits per sample (from the FLAC
+    "streamable subset" sizes) which can hold its values.  For 64bit data, streams
+    whose values all fit in 32 bits are encoded as a single channel rather than the
+    low and high words.  This is recorded in the FLAC stream itself and is handled
+    transparently by `decode_flac`.
+
+    If `segment_size` is specified, each stream is split into segments of this many
+    samples (the last segment may be shorter), which are encoded as independent FLAC
+    streams.  The segments of a stream are stored contiguously, so the stream starts
+    and nbytes have the same meaning as before.  The segments are spread over all
+    threads even when there are fewer streams than threads, and decoding a slice of
+    samples only needs to decode the segments overlapping that slice.  The starting
+    byte of each segment is needed to decode the data, and is returned in a
+    dictionary of auxiliary per-stream arrays if `return_aux` is True.  This
+    dictionary contains the "segment_size" and the "stream_segments" array, which
+    has the shape of the leading dimensions plus one dimension for the segments.
+    The segment starting bytes are relative to the start of the stream.
+
+    If `use_threads` is True, `n_threads` is the total number of threads used (by
+    default, the OpenMP maximum).  Streams (or segments) are first spread over
+    OpenMP threads.  If there are fewer of these than threads and libFLAC is at
+    least version 1.5 (see `flac_native_threads()`), each FLAC encoder uses the
+    remaining threads internally.  The total never exceeds `n_threads`.  If
+    `use_threads` is False, the streams are encoded one at a time, and the FLAC
+    encoder uses `n_threads` threads internally (by default, only one).
+
+    If `seek_table` is True, the encoder also records the starting byte of every FLAC
+    frame, relative to the start of its stream.  All frames (except the last one of
+    each segment) have the same number of samples, so decoding a slice of samples can
+    start directly at the frame containing the first sample instead of searching the
+    stream.  The auxiliary dictionary then contains the "frame_size" and the
+    "stream_frames" array, which has the shape of the leading dimensions plus one
+    dimension for the frames.
+
+    The threaded encoder normally writes each stream into its own region of an
+    output reservation, sized from estimates of the compressed size with a safety
+    margin, and compacts them in place.  Streams which compress worse than estimated
+    are moved to separate buffers and copied into the output after it is resized.
+    If the reservation cannot be allocated, every stream uses a separate buffer and
+    the output is a final copy of these, which needs about twice the compressed size
+    (see "enc_unreserved" in `get_counters()`).
+
+    If `max_memory` is given, the memory for the streams in progress is limited to
+    this many bytes (in addition to the output).  Larger inputs are encoded in
+    batches which fit in a reused buffer of this size, sized from running estimates
+    of the compression ratio, and each finished batch is appended to the output.  At
+    least one stream (or segment) is always encoded at a time, so the limit should
+    allow several of them for good thread usage.
+
+    If `checksums` is True, the CRC32C of the compressed bytes of every stream (or of
+    every segment, when using segments) is computed as the bytes are written.  The
+    auxiliary dictionary then contains the "checksum_type" (`checksum_crc32c`) and
+    the "stream_checksums" array, which has the shape of the leading dimensions plus
+    one dimension for the segments (of length one without segments).  These can be
+    checked before decoding with `verify_flac()`.
+
+    libFLAC normally computes an MD5 signature of the input samples of each stream.
+    The streams are written without seeking back to their header, so this signature
+    is never stored, and `md5=False` skips computing it.
+
+    Args:
+        data (numpy.ndarray):  The array of 32bit or 64bit integers.
+        level (int):  The FLAC compression level (0-8).
+        use_threads (bool):  If True, use OpenMP threads to parallelize decoding.
+            This is only beneficial for large arrays.
+        segment_size (int):  If not None, encode each stream in independent segments
+            of this many samples.
+        return_aux (bool):  If True, return the dictionary of auxiliary arrays as
+            a fourth element.  This is required when using segments.
+        n_threads (int):  If not None, the total number of threads to use.
+            Without `use_threads`, these are only used inside libFLAC.
+        seek_table (bool):  If True, record the starting byte of every frame in the
+            auxiliary arrays.  This requires `return_aux`.
+        max_memory (int):  If not None, the limit in bytes on the memory used for
+            the streams in progress when `use_threads` is True.
+        checksums (bool):  If True, compute the checksum of every stream (or
+            segment) in the auxiliary arrays.  This requires `return_aux`.
+        md5 (bool):  If False, skip the MD5 signature of the input samples.
+
+    Returns:
+        (tuple):  The (compressed bytestream, stream starting bytes, stream nbytes)
+            and the auxiliary arrays if requested.
+
+    """
+    if data.dtype != flac_i32_dtype and data.dtype != flac_i64_dtype:
+        msg = "Only 32bit or 64bit integer data is supported"
+        raise RuntimeError(msg)
+    (
+        stream_size, n_stream, starts_shape, flatdata, data_offsets, sample_stride,
+        seg_size, flat_segments, frame_size, flat_frames, n_thr, max_mem,
+        flat_checksums
+    ) = _encode_layout(
+        data, level, segment_size, return_aux, use_threads, n_threads, seek_table,
+        max_memory, checksums
+    )
+
+    if use_threads:
+        if data.dtype == flac_i32_dtype:
+            compressed, flatstarts, flatnbytes = wrap_encode_i32_threaded(
+                flatdata,
+                n_stream,
+                stream_size,
+                level,
+                seg_size,
+                flat_segments,
+                n_thr,
+                flat_frames,
+                data_offsets,
+                sample_stride,
+                max_mem,
+                flat_checksums,
+                md5,
+            )
+        else:
+            compressed, flatstarts, flatnbytes = wrap_encode_i64_threaded(
+                flatdata,
+                n_stream,
+                stream_size,
+                level,
+                seg_size,
+                flat_segments,
+                n_thr,
+                flat_frames,
+                data_offsets,
+                sample_stride,
+                max_mem,
+                flat_checksums,
+                md5,
+            )
+    else:
+        if data.dtype == flac_i32_dtype:
+            compressed, flatstarts, flatnbytes = wrap_encode_i32(
+                flatdata,
+                n_stream,
+                stream_size,
+                level,
+                seg_size,
+                flat_segments,
+                n_thr,
+                flat_frames,
+                data_offsets,
+                sample_stride,
+                flat_checksums,
+                md5,
+            )
+        else:
+            compressed, flatstarts, flatnbytes = wrap_encode_i64(
+                flatdata,
+                n_stream,
+                stream_size,
+                level,
+                seg_size,
+                flat_segments,
+                n_thr,
+                flat_frames,
+                data_offsets,
+                sample_stride,
+                flat_checksums,
+                md5,
+            )
+
+    return _encode_result(
+        (compressed, flatstarts, flatnbytes),
+        starts_shape,
+        return_aux,
+        segment_size,
+        flat_segments,
+        frame_size,
+        flat_frames,
+        flat_checksums,
+    )
+
+
+def encode_flac_float(
+    data,
+    int level,
+    quanta=None,
+    bint use_threads=False,
+    segment_size=None,
+    bint return_aux=False,
+    n_threads=None,
+    bint seek_table=False,
+    max_memory=None,
+    bint checksums=False,
+    bint md5=True,
+):
+    """Quantize and compress a floating point array to a FLAC representation.
+
+    This is equivalent to converting the data with `float_to_int()` and passing the
+    result to `encode_flac()`, and produces identical bytes, offsets, and gains.
+    However, the data is quantized in small blocks as it is fed to the encoder, so
+    the full array of integers is never allocated.  32bit floats are quantized to
+    32bit integers and 64bit floats to 64bit integers.
+
+    See `encode_flac()` for the description of the other arguments, the stream
+    starts, and the auxiliary arrays.
+
+    Args:
+        data (numpy.ndarray):  The array of 32bit or 64bit floats.
+        level (int):  The FLAC compression level (0-8).
+        quanta (numpy.ndarray):  The flat-packed quanta for each stream.  If None
+            or empty, the quanta are computed from the range of each stream.
+        use_threads (bool):  If True, use OpenMP threads to parallelize encoding.
+        segment_size (int):  If not None, encode each stream in independent segments
+            of this many samples.
+        return_aux (bool):  If True, return the dictionary of auxiliary arrays as
+            a sixth element.  This is required when using segments.
+        n_threads (int):  If not None, the total number of threads to use.
+            Without `use_threads`, these are only used inside libFLAC.
+        seek_table (bool):  If True, record the starting byte of every frame in the
+            auxiliary arrays.  This requires `return_aux`.
+        max_memory (int):  If not None, the limit in bytes on the memory used for
+            the streams in progress when `use_threads` is True.
+        checksums (bool):  If True, compute the checksum of every stream (or
+            segment) in the auxiliary arrays.  This requires `return_aux`.
+        md5 (bool):  If False, skip the MD5 signature of the input samples.
+
+    Returns:
+        (tuple):  The (compressed bytestream, stream starting bytes, stream nbytes,
+            stream offsets, stream gains) and the auxiliary arrays if requested.
+
+    """
+    if data.dtype != flac_f32_dtype and data.dtype != flac_f64_dtype:
+        msg = "Only 32bit or 64bit floating point data is supported"
+        raise RuntimeError(msg)
+    (
+        stream_size, n_stream, starts_shape, flatdata, data_offsets, sample_stride,
+        seg_size, flat_segments, frame_size, flat_frames, n_thr, max_mem,
+        flat_checksums
+    ) = _encode_layout(
+        data, level, segment_size, return_aux, use_threads, n_threads, seek_table,
+        max_memory, checksums
+    )
+
+    if quanta is None:
+        quanta = np.zeros(0, dtype=data.dtype)
+    else:
+        quanta = np.ascontiguousarray(quanta, dtype=data.dtype).reshape((-1,))
+
+    if data.dtype == flac_f32_dtype:
+        result = wrap_encode_f32(
+            flatdata,
+            n_stream,
+            stream_size,
+            level,
+            quanta,
+            use_threads,
+            seg_size,
+            flat_segments,
+            n_thr,
+            flat_frames,
+            data_offsets,
+            sample_stride,
+            max_mem,
+            flat_checksums,
+            md5,
+        )
+    else:
+        result = wrap_encode_f64(
+            flatdata,
+            n_stream,
+            stream_size,
+            level,
+            quanta,
+            use_threads,
+            seg_size,
+            flat_segments,
+            n_thr,
+            flat_frames,
+            data_offsets,
+            sample_stride,
+            max_mem,
+            flat_checksums,
+            md5,
+        )
+    compressed, flatstarts, flatnbytes, offsets, gains = result
+
+    return _encode_result(
+        (
+            compressed,
+            flatstarts,
+            flatnbytes,
+            offsets.reshape(starts_shape),
+            gains.reshape(starts_shape),
+        ),
+        starts_shape,
+        return_aux,
+        segment_size,
+        flat_segments,
+        frame_size,
+        flat_frames,
+        flat_checksums,
+    )
+
+
+def _out_offsets(out, n_stream, n_decode, dtype):
+    """Check a caller-provided output array and find the start of each stream.
+
+    The output may be any view with the required type, whose final dimension is the
+    samples of each stream and whose leading dimensions have one element per stream.
+    The samples of each stream must be contiguous, but the streams themselves may
+    be anywhere in memory, for example the rows of a block of a larger array.
+
+    Args:
+        out (numpy.ndarray):  The output array.
+        n_stream (int):  The number of streams.
+        n_decode (int):  The number of samples decoded from each stream.
+        dtype (numpy.dtype):  The required type of the output.
+
+    Returns:
+        (array):  The element offset of the first sample of each stream, relative
+            to the first element of `out`, in C order of the leading dimensions.
+
+    """
+    if not isinstance(out, np.ndarray):
+        raise RuntimeError("The output must be a numpy array")
+    if out.dtype != dtype:
+        msg = f"The output has type '{out.dtype}', expected '{np.dtype(dtype)}'"
+        raise RuntimeError(msg)
+    if not out.flags.writeable:
+        raise RuntimeError("The output array is not writeable")
+    if out.ndim == 0 or out.shape[-1] != n_decode:
+        msg = f"The output final dimension must have {n_decode} samples"
+        raise RuntimeError(msg)
+    if np.prod(out.shape[:-1], dtype=np.int64) != n_stream:
+        msg = f"The output leading dimensions must have {n_stream} streams"
+        raise RuntimeError(msg)
+    itemsize = out.dtype.itemsize
+    if n_decode > 1 and out.strides[-1] != itemsize:
+        raise RuntimeError("The samples of each output stream must be contiguous")
+    offsets = _stream_offsets(out)
+    if offsets is None:
+        raise RuntimeError("The output strides must be a multiple of the item size")
+    return offsets
+
+
+def _check_streams(streams, n_stream, n_input):
+    """Check the indices of the streams selected for decoding.
+
+    The decoders can decode any subset of the input streams, in any order.  Output
+    stream `i` is then decoded from input stream `streams[i]`, and all of the other
+    per-stream inputs (starts, nbytes, offsets, gains and the auxiliary tables)
+    still have one element for every input stream.  The same input stream may be
+    selected more than once.
+
+    Args:
+        streams (array):  The flat indices of the selected input streams.
+        n_stream (int):  The number of output streams.
+        n_input (int):  The number of input streams.
+
+    Returns:
+        None
+
+    """
+    if len(streams) != n_stream:
+        msg = f"The stream selection has {len(streams)} elements, expected {n_stream}"
+        raise RuntimeError(msg)
+    if n_stream > 0 and (streams.min() < 0 or streams.max() >= n_input):
+        msg = f"The stream selection is out of range for {n_input} streams"
+        raise RuntimeError(msg)
+
+
+def wrap_decode_i32(
     cnp.ndarray[cnp.uint8_t, ndim=1, mode="c"] compressed,
     cnp.ndarray[cnp.int64_t, ndim=1, mode="c"] starts,
     cnp.ndarray[cnp.int64_t, ndim=1, mode="c"] nbytes,
@@ -602,7 +2091,13 @@ def wrap_decode_i32(
     cnp.int64_t stream_size,
     cnp.int64_t first_sample,
     cnp.int64_t last_sample,
-    bool use_threads,
+    bint use_threads,
+    cnp.int64_t segment_size=0,
+    cnp.ndarray[cnp.int64_t, ndim=1, mode="c"] segment_starts=None,
+    cnp.int64_t frame_size=0,
+    cnp.ndarray[cnp.int64_t, ndim=1, mode="c"] frame_starts=None,
+    out=None,
+    cnp.ndarray[cnp.int64_t, ndim=1, mode="c"] streams=None,
 ):
     """Wrapper around the C int32 decode function.
 
@@ -619,32 +2114,86 @@ def wrap_decode_i32(
             indicates this parameter is unused and the whole stream should be decoded.
         use_threads (bool):  If True, use OpenMP threads to parallelize decoding.
             This is only beneficial for large arrays.
+        segment_size (int64_t):  The segment size used when encoding, if the
+            streams were encoded in segments.
+        segment_starts (array):  The flat-packed starting byte of each segment
+            relative to the start of its stream, or None.
+        frame_size (int64_t):  The number of samples in each FLAC frame, if
+            frame_starts is given.
+        frame_starts (array):  The flat-packed starting byte of each FLAC frame
+            relative to the start of its stream, or None.
+        out (array):  If not None, decode into this array rather than allocating
+            a new one.  See `_out_offsets()` for the supported layouts.
+        streams (array):  If not None, the indices of the `n_stream` streams to
+            decode, into the per-stream input arrays.  See `_check_streams()`.
 
     Returns:
-        (array):  The flat-packed int32 decompressed array.
+        (array):  The `out` array if given, or the flat-packed int32 decompressed array.
 
     """
+    cdef int64_t n_input = len(starts)
+    cdef int64_t * sel = NULL
+    if streams is not None:
+        _check_streams(streams, n_stream, n_input)
+        sel = <cnp.int64_t *>streams.data
+
     cdef int64_t n_decode = stream_size
     if first_sample >= 0 and last_sample >= 0:
         n_decode = last_sample - first_sample
 
     cdef int64_t flat_size = n_stream * n_decode
 
-    # Pre-allocate the output
-    cdef cnp.ndarray output = np.empty(flat_size, dtype=flac_i32_dtype, order="C")
+    # Pre-allocate the output, or find the start of each stream in the given array
+    cdef cnp.ndarray output
+    cdef cnp.ndarray stream_offsets
+    cdef int64_t * out_offsets = NULL
+    if out is None:
+        output = np.empty(flat_size, dtype=flac_i32_dtype, order="C")
+    else:
+        stream_offsets = _out_offsets(out, n_stream, n_decode, flac_i32_dtype)
+        output = out
+        out_offsets = <cnp.int64_t *>stream_offsets.data
+
+    cdef int64_t * seg_starts = NULL
+    if segment_starts is not None:
+        if len(segment_starts) != n_input * n_segments(stream_size, segment_size):
+            msg = "segment_starts does not have one element per segment"
+            raise RuntimeError(msg)
+        seg_starts = <cnp.int64_t *>segment_starts.data
+
+    cdef int64_t * frm_starts = NULL
+    if frame_starts is not None:
+        if frame_size <= 0:
+            msg = "frame_size must be positive when using frame_starts"
+            raise RuntimeError(msg)
+        if len(frame_starts) != n_input * n_stream_frames(
+            stream_size,
+            segment_size if segment_starts is not None else 0,
+            frame_size,
+        ):
+            msg = "frame_starts does not have one element per frame"
+            raise RuntimeError(msg)
+        frm_starts = <cnp.int64_t *>frame_starts.data
 
     cdef int errcode = 0
-    errcode = decode_i32(
-        <cnp.uint8_t *>compressed.data,
-        <cnp.int64_t *>starts.data,
-        <cnp.int64_t *>nbytes.data,
-        n_stream,
-        stream_size,
-        first_sample,
-        last_sample,
-        <cnp.int32_t *>output.data,
-        use_threads,
-    )
+    with nogil:
+        errcode = decode_i32(
+            <cnp.uint8_t *>compressed.data,
+            <cnp.int64_t *>starts.data,
+            <cnp.int64_t *>nbytes.data,
+            n_stream,
+            sel,
+            stream_size,
+            segment_size,
+            seg_starts,
+            frame_size,
+            frm_starts,
+            first_sample,
+            last_sample,
+            out_offsets,
+            <cnp.int32_t *>output.data,
+            use_threads,
+        )
 
     if errcode != 0:
         # FIXME: change error codes so we can print a message here
@@ -660,7 +2209,13 @@ def wrap_decode_i64(
     cnp.int64_t stream_size,
     cnp.int64_t first_sample,
     cnp.int64_t last_sample,
-    bool use_threads,
+    bint use_threads,
+    cnp.int64_t segment_size=0,
+    cnp.ndarray[cnp.int64_t, ndim=1, mode="c"] segment_starts=None,
+    cnp.int64_t frame_size=0,
+    cnp.ndarray[cnp.int64_t, ndim=1, mode="c"] frame_starts=None,
+    out=None,
+    cnp.ndarray[cnp.int64_t, ndim=1, mode="c"] streams=None,
 ):
     """Wrapper around the C int64 decode function.
 
@@ -677,32 +2232,86 @@ def wrap_decode_i64(
             indicates this parameter is unused and the whole stream should be decoded.
         use_threads (bool):  If True, use OpenMP threads to parallelize decoding.
             This is only beneficial for large arrays.
+        segment_size (int64_t):  The segment size used when encoding, if the
+            streams were encoded in segments.
+        segment_starts (array):  The flat-packed starting byte of each segment
+            relative to the start of its stream, or None.
+        frame_size (int64_t):  The number of samples in each FLAC frame, if
+            frame_starts is given.
+        frame_starts (array):  The flat-packed starting byte of each FLAC frame
+            relative to the start of its stream, or None.
+        out (array):  If not None, decode into this array rather than allocating
+            a new one.  See `_out_offsets()` for the supported layouts.
+        streams (array):  If not None, the indices of the `n_stream` streams to
+            decode, into the per-stream input arrays.  See `_check_streams()`.
 
     Returns:
-        (array):  The flat-packed int64 decompressed array.
+        (array):  The `out` array if given, or the flat-packed int64 decompressed array.
 
     """
+    cdef int64_t n_input = len(starts)
+    cdef int64_t * sel = NULL
+    if streams is not None:
+        _check_streams(streams, n_stream, n_input)
+        sel = <cnp.int64_t *>streams.data
+
     cdef int64_t n_decode = stream_size
     if first_sample >= 0 and last_sample >= 0:
         n_decode = last_sample - first_sample
 
     cdef int64_t flat_size = n_stream * n_decode
 
-    # Pre-allocate the output
-    cdef cnp.ndarray output = np.empty(flat_size, dtype=flac_i64_dtype, order="C")
+    # Pre-allocate the output, or find the start of each stream in the given array
+    cdef cnp.ndarray output
+    cdef cnp.ndarray stream_offsets
+    cdef int64_t * out_offsets = NULL
+    if out is None:
+        output = np.empty(flat_size, dtype=flac_i64_dtype, order="C")
+    else:
+        stream_offsets = _out_offsets(out, n_stream, n_decode, flac_i64_dtype)
+        output = out
+        out_offsets = <cnp.int64_t *>stream_offsets.data
+
+    cdef int64_t * seg_starts = NULL
+    if segment_starts is not None:
+        if len(segment_starts) != n_input * n_segments(stream_size, segment_size):
+            msg = "segment_starts does not have one element per segment"
+            raise RuntimeError(msg)
+        seg_starts = <cnp.int64_t *>segment_starts.data
+
+    cdef int64_t * frm_starts = NULL
+    if frame_starts is not None:
+        if frame_size <= 0:
+            msg = "frame_size must be positive when using frame_starts"
+            raise RuntimeError(msg)
+        if len(frame_starts) != n_input * n_stream_frames(
+            stream_size,
+            segment_size if segment_starts is not None else 0,
+            frame_size,
+        ):
+            msg = "frame_starts does not have one element per frame"
+            raise RuntimeError(msg)
+        frm_starts = <cnp.int64_t *>frame_starts.data
 
     cdef int errcode = 0
-    errcode = decode_i64(
-        <cnp.uint8_t *>compressed.data,
-        <cnp.int64_t *>starts.data,
-        <cnp.int64_t *>nbytes.data,
-        n_stream,
-        stream_size,
-        first_sample,
-        last_sample,
-        <cnp.int64_t *>output.data,
-        use_threads,
-    )
+    with nogil:
+        errcode = decode_i64(
+            <cnp.uint8_t *>compressed.data,
+            <cnp.int64_t *>starts.data,
+            <cnp.int64_t *>nbytes.data,
+            n_stream,
+            sel,
+            stream_size,
+            segment_size,
+            seg_starts,
+            frame_size,
+            frm_starts,
+            first_sample,
+            last_sample,
+            out_offsets,
+            <cnp.int64_t *>output.data,
+            use_threads,
+        )
 
     if errcode != 0:
         # FIXME: change error codes so we can print a message here
@@ -710,42 +2319,287 @@ def wrap_decode_i64(
         raise RuntimeError(msg)
     return output
 
-def decode_flac(
-    compressed,
-    starts,
-    nbytes,
-    int stream_size,
-    int first_sample=-1,
-    int last_sample=-1,
-    bool use_threads=False,
-    bool is_int64=False,
+def wrap_decode_f32(
+    cnp.ndarray[cnp.uint8_t, ndim=1, mode="c"] compressed,
+    cnp.ndarray[cnp.int64_t, ndim=1, mode="c"] starts,
+    cnp.ndarray[cnp.int64_t, ndim=1, mode="c"] nbytes,
+    cnp.ndarray[float, ndim=1, mode="c"] offsets,
+    cnp.ndarray[float, ndim=1, mode="c"] gains,
+    cnp.int64_t n_stream,
+    cnp.int64_t stream_size,
+    cnp.int64_t first_sample,
+    cnp.int64_t last_sample,
+    bint use_threads,
+    cnp.int64_t segment_size=0,
+    cnp.ndarray[cnp.int64_t, ndim=1, mode="c"] segment_starts=None,
+    cnp.int64_t frame_size=0,
+    cnp.ndarray[cnp.int64_t, ndim=1, mode="c"] frame_starts=None,
+    out=None,
+    cnp.ndarray[cnp.int64_t, ndim=1, mode="c"] streams=None,
 ):
-    """Decompress a FLAC compressed bytestream.
+    """Wrapper around the C 32bit float decode function.
 
-    The shape of the input `starts` is used to determine the leading dimensions of
-    the output array.  The `stream_size` is the decompressed size of the final
-    dimension.
+    The offset and gain of each stream are applied to every decoded frame, so the
+    32bit float output is written directly without an integer copy.  This works
+    with flat-packed versions of the arrays.
 
-    Even if there is only one stream, the starts and nbytes arrays should be 1D.
+    Args:
+        compressed (array):  The array of compressed bytes.
+        starts (array):  The array of starting bytes.
+        nbytes (array):  The array of bytes in each stream.
+        offsets (array):  The offset of each stream.
+        gains (array):  The gain of each stream.
+        n_stream (int64_t):  The number of streams.
+        stream_size (int64_t):  The length of each stream.
+        first_sample (int64_t):  The first sample to decode.  Negative value indicates
+            this parameter is unused and the whole stream should be decoded.
+        last_sample (int64_t):  The last sample to decode (exclusive).  Negative value
+            indicates this parameter is unused and the whole stream should be decoded.
+        use_threads (bool):  If True, use OpenMP threads to parallelize decoding.
+            This is only beneficial for large arrays.
+        segment_size (int64_t):  The segment size used when encoding, if the
+            segment_starts are given.
+        segment_starts (array):  The flat-packed starting byte of each segment
+            relative to the start of its stream, or None.
+        frame_size (int64_t):  The number of samples in each FLAC frame, if
+            frame_starts is given.
+        frame_starts (array):  The flat-packed starting byte of each FLAC frame
+            relative to the start of its stream, or None.
+        out (array):  If not None, decode into this array rather than allocating
+            a new one.  See `_out_offsets()` for the supported layouts.
+        streams (array):  If not None, the indices of the `n_stream` streams to
+            decode, into the per-stream input arrays.  See `_check_streams()`.
+
+    Returns:
+        (array):  The `out` array if given, or the flat-packed float32 decompressed array.
+
+    """
+    cdef int64_t n_input = len(starts)
+    cdef int64_t * sel = NULL
+    if streams is not None:
+        _check_streams(streams, n_stream, n_input)
+        sel = <cnp.int64_t *>streams.data
+    if len(offsets) != n_input or len(gains) != n_input:
+        msg = "offsets and gains must have one element per stream"
+        raise RuntimeError(msg)
+
+    cdef int64_t n_decode = stream_size
+    if first_sample >= 0 and last_sample >= 0:
+        n_decode = last_sample - first_sample
+
+    cdef int64_t flat_size = n_stream * n_decode
+
+    # Pre-allocate the output, or find the start of each stream in the given array
+    cdef cnp.ndarray output
+    cdef cnp.ndarray stream_offsets
+    cdef int64_t * out_offsets = NULL
+    if out is None:
+        output = np.empty(flat_size, dtype=flac_f32_dtype, order="C")
+    else:
+        stream_offsets = _out_offsets(out, n_stream, n_decode, flac_f32_dtype)
+        output = out
+        out_offsets = <cnp.int64_t *>stream_offsets.data
+
+    cdef int64_t * seg_starts = NULL
+    if segment_starts is not None:
+        if len(segment_starts) != n_input * n_segments(stream_size, segment_size):
+            msg = "segment_starts does not have one element per segment"
+            raise RuntimeError(msg)
+        seg_starts = <cnp.int64_t *>segment_starts.data
+
+    cdef int64_t * frm_starts = NULL
+    if frame_starts is not None:
+        if frame_size <= 0:
+            msg = "frame_size must be positive when using frame_starts"
+            raise RuntimeError(msg)
+        if len(frame_starts) != n_input * n_stream_frames(
+            stream_size,
+            segment_size if segment_starts is not None else 0,
+            frame_size,
+        ):
+            msg = "frame_starts does not have one element per frame"
+            raise RuntimeError(msg)
+        frm_starts = <cnp.int64_t *>frame_starts.data
+
+    cdef int errcode = 0
+    with nogil:
+        errcode = decode_f32(
+            <cnp.uint8_t *>compressed.data,
+            <cnp.int64_t *>starts.data,
+            <cnp.int64_t *>nbytes.data,
+            n_stream,
+            sel,
+            stream_size,
+            segment_size,
+            seg_starts,
+            frame_size,
+            frm_starts,
+            first_sample,
+            last_sample,
+            <float *>offsets.data,
+            <float *>gains.data,
+            out_offsets,
+            <float *>output.data,
+            use_threads,
+        )
+
+    if errcode != 0:
+        # FIXME: change error codes so we can print a message here
+        msg = f"Decoding failed, return code = {errcode}"
+        raise RuntimeError(msg)
+    return output
+
+
+def wrap_decode_f64(
+    cnp.ndarray[cnp.uint8_t, ndim=1, mode="c"] compressed,
+    cnp.ndarray[cnp.int64_t, ndim=1, mode="c"] starts,
+    cnp.ndarray[cnp.int64_t, ndim=1, mode="c"] nbytes,
+    cnp.ndarray[double, ndim=1, mode="c"] offsets,
+    cnp.ndarray[double, ndim=1, mode="c"] gains,
+    cnp.int64_t n_stream,
+    cnp.int64_t stream_size,
+    cnp.int64_t first_sample,
+    cnp.int64_t last_sample,
+    bint use_threads,
+    cnp.int64_t segment_size=0,
+    cnp.ndarray[cnp.int64_t, ndim=1, mode="c"] segment_starts=None,
+    cnp.int64_t frame_size=0,
+    cnp.ndarray[cnp.int64_t, ndim=1, mode="c"] frame_starts=None,
+    out=None,
+    cnp.ndarray[cnp.int64_t, ndim=1, mode="c"] streams=None,
+):
+    """Wrapper around the C 64bit float decode function.
+
+    The offset and gain of each stream are applied to every decoded frame, so the
+    64bit float output is written directly without an integer copy.  This works
+    with flat-packed versions of the arrays.
 
     Args:
-        compressed (numpy.ndarray):  The array of compressed bytes.
-        starts (numpy.ndarray):  The array of starting bytes in the bytestream.
-        nbytes (numpy.ndarray):  The array of number of bytes in the bytestream.
-        stream_size (int):  The length of the decompressed final dimension.
-        first_sample (int):  The first sample to decode along the final dimension.
-            Negative value indicates this parameter is unused and the whole stream
-            should be decoded.
-        last_sample (int):  The last sample to decode along the final dimension
-            (exclusive).  Negative value indicates this parameter is unused and the
-            whole stream should be decoded.
+        compressed (array):  The array of compressed bytes.
+        starts (array):  The array of starting bytes.
+        nbytes (array):  The array of bytes in each stream.
+        offsets (array):  The offset of each stream.
+        gains (array):  The gain of each stream.
+        n_stream (int64_t):  The number of streams.
+        stream_size (int64_t):  The length of each stream.
+        first_sample (int64_t):  The first sample to decode.  Negative value indicates
+            this parameter is unused and the whole stream should be decoded.
+        last_sample (int64_t):  The last sample to decode (exclusive).  Negative value
+            indicates this parameter is unused and the whole stream should be decoded.
         use_threads (bool):  If True, use OpenMP threads to parallelize decoding.
             This is only beneficial for large arrays.
-        is_int64 (bool):  If True, the compressed stream contains 64bit integers
-            encoded as 2 channels.
+        segment_size (int64_t):  The segment size used when encoding, if the
+            segment_starts are given.
+        segment_starts (array):  The flat-packed starting byte of each segment
+            relative to the start of its stream, or None.
+        frame_size (int64_t):  The number of samples in each FLAC frame, if
+            frame_starts is given.
+        frame_starts (array):  The flat-packed starting byte of each FLAC frame
+            relative to the start of its stream, or None.
+        out (array):  If not None, decode into this array rather than allocating
+            a new one.  See `_out_offsets()` for the supported layouts.
+        streams (array):  If not None, the indices of the `n_stream` streams to
+            decode, into the per-stream input arrays.  See `_check_streams()`.
 
     Returns:
-        (array):  The decompressed array of int32 or int64 data.
+        (array):  The `out` array if given, or the flat-packed float64 decompressed array.
+
+    """
+    cdef int64_t n_input = len(starts)
+    cdef int64_t * sel = NULL
+    if streams is not None:
+        _check_streams(streams, n_stream, n_input)
+        sel = <cnp.int64_t *>streams.data
+    if len(offsets) != n_input or len(gains) != n_input:
+        msg = "offsets and gains must have one element per stream"
+        raise RuntimeError(msg)
+
+    cdef int64_t n_decode = stream_size
+    if first_sample >= 0 and last_sample >= 0:
+        n_decode = last_sample - first_sample
+
+    cdef int64_t flat_size = n_stream * n_decode
+
+    # Pre-allocate the output, or find the start of each stream in the given array
+    cdef cnp.ndarray output
+    cdef cnp.ndarray stream_offsets
+    cdef int64_t * out_offsets = NULL
+    if out is None:
+        output = np.empty(flat_size, dtype=flac_f64_dtype, order="C")
+    else:
+        stream_offsets = _out_offsets(out, n_stream, n_decode, flac_f64_dtype)
+        output = out
+        out_offsets = <cnp.int64_t *>stream_offsets.data
+
+    cdef int64_t * seg_starts = NULL
+    if segment_starts is not None:
+        if len(segment_starts) != n_input * n_segments(stream_size, segment_size):
+            msg = "segment_starts does not have one element per segment"
+            raise RuntimeError(msg)
+        seg_starts = <cnp.int64_t *>segment_starts.data
+
+    cdef int64_t * frm_starts = NULL
+    if frame_starts is not None:
+        if frame_size <= 0:
+            msg = "frame_size must be positive when using frame_starts"
+            raise RuntimeError(msg)
+        if len(frame_starts) != n_input * n_stream_frames(
+            stream_size,
+            segment_size if segment_starts is not None else 0,
+            frame_size,
+        ):
+            msg = "frame_starts does not have one element per frame"
+            raise RuntimeError(msg)
+        frm_starts = <cnp.int64_t *>frame_starts.data
+
+    cdef int errcode = 0
+    with nogil:
+        errcode = decode_f64(
+            <cnp.uint8_t *>compressed.data,
+            <cnp.int64_t *>starts.data,
+            <cnp.int64_t *>nbytes.data,
+            n_stream,
+            sel,
+            stream_size,
+            segment_size,
+            seg_starts,
+            frame_size,
+            frm_starts,
+            first_sample,
+            last_sample,
+            <double *>offsets.data,
+            <double *>gains.data,
+            out_offsets,
+            <double *>output.data,
+            use_threads,
+        )
+
+    if errcode != 0:
+        # FIXME: change error codes so we can print a message here
+        msg = f"Decoding failed, return code = {errcode}"
+        raise RuntimeError(msg)
+    return output
+
+
+def _decode_layout(
+    compressed,
+    starts,
+    nbytes,
+    stream_size,
+    first_sample,
+    last_sample,
+    stream_aux,
+    streams=None,
+):
+    """Check the decoding inputs and flatten the per-stream arrays.
+
+    This is shared by `decode_flac` and `decode_flac_float`.  If `streams` is not
+    None, the output has its shape, with one stream for each of its elements.
+
+    Returns:
+        (tuple):  The (output shape, number of output streams, flat starts, flat
+            nbytes, segment size, flat segment starts or None, frame size, flat
+            frame starts or None, flat stream selection or None).
 
     """
     if compressed.dtype != compressed_dtype:
@@ -788,24 +2642,262 @@ def decode_flac(
             raise RuntimeError(msg)
         n_decode = last_sample - first_sample
 
-    output_shape = starts.shape + (n_decode,)
-    cdef int64_t cstream_size = stream_size
-    cdef int64_t cfirst_sample = first_sample
-    cdef int64_t clast_sample = last_sample
-    cdef int64_t n_stream = np.prod(starts.shape)
+    flat_streams = None
+    if streams is None:
+        output_shape = starts.shape + (n_decode,)
+        n_stream = np.prod(starts.shape)
+    else:
+        streams = np.asarray(streams)
+        if streams.dtype.kind not in "iu":
+            msg = "The stream selection should be an array of integer indices"
+            raise RuntimeError(msg)
+        output_shape = streams.shape + (n_decode,)
+        flat_streams = np.ascontiguousarray(streams, dtype=offset_dtype).reshape((-1,))
+        n_stream = len(flat_streams)
     flat_starts = starts.reshape((-1,))
     flat_nbytes = nbytes.reshape((-1,))
 
+    seg_size = 0
+    flat_segments = None
+    if stream_aux is not None and "stream_segments" in stream_aux:
+        seg_size = stream_aux["segment_size"]
+        segments = stream_aux["stream_segments"]
+        if segments.shape[:-1] != starts.shape:
+            msg = "stream_segments leading dimensions do not match starts"
+            raise RuntimeError(msg)
+        if segments.dtype != offset_dtype:
+            msg = "stream_segments should be of type int64"
+            raise RuntimeError(msg)
+        flat_segments = np.ascontiguousarray(segments).reshape((-1,))
+
+    frame_size = 0
+    flat_frames = None
+    if stream_aux is not None and "stream_frames" in stream_aux:
+        frame_size = stream_aux["frame_size"]
+        frames = stream_aux["stream_frames"]
+        if frames.shape[:-1] != starts.shape:
+            msg = "stream_frames leading dimensions do not match starts"
+            raise RuntimeError(msg)
+        if frames.dtype != offset_dtype:
+            msg = "stream_frames should be of type int64"
+            raise RuntimeError(msg)
+        flat_frames = np.ascontiguousarray(frames).reshape((-1,))
+
+    return (
+        output_shape, n_stream, flat_starts, flat_nbytes, seg_size, flat_segments,
+        frame_size, flat_frames, flat_streams
+    )
+
+
+def verify_flac(
+    compressed,
+    starts,
+    nbytes,
+    stream_aux,
+    int64_t first_sample=-1,
+    int64_t last_sample=-1,
+    bint use_threads=False,
+    streams=None,
+):
+    """Check compressed streams against their checksums.
+
+    The checksums are computed by `encode_flac` when requested, and are stored in
+    the auxiliary arrays.  If a slice of samples is given and the streams are
+    encoded in segments, only the segments overlapping the slice are checked.  If
+    `streams` is given, only the streams with those flat indices are checked.
+
+    Args:
+        compressed (numpy.ndarray):  The array of compressed bytes.
+        starts (numpy.ndarray):  The array of starting bytes in the bytestream.
+        nbytes (numpy.ndarray):  The array of number of bytes in the bytestream.
+        stream_aux (dict):  The auxiliary per-stream arrays returned by
+            `encode_flac`.
+        first_sample (int):  The first sample of the slice to check, or negative
+            to check whole streams.
+        last_sample (int):  The last sample (exclusive) of the slice to check, or
+            negative to check whole streams.
+        use_threads (bool):  If True, use OpenMP threads to check the streams.
+        streams (array):  If not None, the flat indices of the streams to check.
+
+    Returns:
+        None
+
+    Raises:
+        RuntimeError:  If there are no checksums, or the bytes of any checked stream
+            (or segment) do not match.
+
+    """
+    if stream_aux is None or "stream_checksums" not in stream_aux:
+        msg = "The compressed data does not contain checksums"
+        raise RuntimeError(msg)
+    if stream_aux["checksum_type"] != checksum_crc32c:
+        msg = f"Unsupported checksum type {stream_aux['checksum_type']}"
+        raise RuntimeError(msg)
+    if compressed.dtype != compressed_dtype or len(compressed.shape) != 1:
+        msg = "Compressed data should be a one dimensional array of type uint8"
+        raise RuntimeError(msg)
+    sums = stream_aux["stream_checksums"]
+    if sums.shape[:-1] != starts.shape or sums.dtype != checksum_dtype:
+        msg = "stream_checksums should be uint32 with the leading shape of starts"
+        raise RuntimeError(msg)
+
+    cdef cnp.ndarray cbytes = np.ascontiguousarray(compressed)
+    cdef cnp.ndarray flat_starts = np.ascontiguousarray(
+        starts, dtype=offset_dtype
+    ).reshape((-1,))
+    cdef cnp.ndarray flat_nbytes = np.ascontiguousarray(
+        nbytes, dtype=offset_dtype
+    ).reshape((-1,))
+    cdef cnp.ndarray flat_sums = np.ascontiguousarray(sums).reshape((-1,))
+    cdef int64_t n_stream = len(flat_starts)
+    cdef int64_t n_seg = sums.shape[-1]
+
+    cdef cnp.ndarray flat_streams = None
+    cdef int64_t * sel = NULL
+    if streams is not None:
+        flat_streams = np.ascontiguousarray(streams, dtype=offset_dtype).reshape((-1,))
+        _check_streams(flat_streams, len(flat_streams), n_stream)
+        n_stream = len(flat_streams)
+        sel = <int64_t *>flat_streams.data
+
+    cdef cnp.ndarray flat_segments = None
+    cdef int64_t * seg_starts = NULL
+    cdef int64_t seg_first = 0
+    cdef int64_t seg_last = n_seg
+    if n_seg > 1:
+        if "stream_segments" not in stream_aux:
+            msg = "Checksums of segments require the segment starts"
+            raise RuntimeError(msg)
+        flat_segments = np.ascontiguousarray(
+            stream_aux["stream_segments"], dtype=offset_dtype
+        ).reshape((-1,))
+        seg_starts = <int64_t *>flat_segments.data
+        if first_sample >= 0 and last_sample > first_sample:
+            seg_size = stream_aux["segment_size"]
+            seg_first = min(first_sample // seg_size, n_seg - 1)
+            seg_last = min((last_sample - 1) // seg_size + 1, n_seg)
+
+    cdef int errcode = 0
+    with nogil:
+        errcode = verify_checksums(
+            <unsigned char *>cbytes.data,
+            <int64_t *>flat_starts.data,
+            <int64_t *>flat_nbytes.data,
+            n_stream,
+            sel,
+            n_seg,
+            seg_starts,
+            <uint32_t *>flat_sums.data,
+            seg_first,
+            seg_last,
+            use_threads,
+        )
+    if errcode != 0:
+        msg = "Compressed bytes do not match their checksums"
+        raise RuntimeError(msg)
+
+
+def decode_flac(
+    compressed,
+    starts,
+    nbytes,
+    int stream_size,
+    int first_sample=-1,
+    int last_sample=-1,
+    bint use_threads=False,
+    bint is_int64=False,
+    stream_aux=None,
+    out=None,
+    bint verify=False,
+    streams=None,
+):
+    """Decompress a FLAC compressed bytestream.
+
+    The shape of the input `starts` is used to determine the leading dimensions of
+    the output array.  The `stream_size` is the decompressed size of the final
+    dimension.
+
+    Even if there is only one stream, the starts and nbytes arrays should be 1D.
+
+    Args:
+        compressed (numpy.ndarray):  The array of compressed bytes.
+        starts (numpy.ndarray):  The array of starting bytes in the bytestream.
+        nbytes (numpy.ndarray):  The array of number of bytes in the bytestream.
+        stream_size (int):  The length of the decompressed final dimension.
+        first_sample (int):  The first sample to decode along the final dimension.
+            Negative value indicates this parameter is unused and the whole stream
+            should be decoded.
+        last_sample (int):  The last sample to decode along the final dimension
+            (exclusive).  Negative value indicates this parameter is unused and the
+            whole stream should be decoded.
+        use_threads (bool):  If True, use OpenMP threads to parallelize decoding.
+            This is only beneficial for large arrays.
+        is_int64 (bool):  If True, the compressed stream contains 64bit integers
+            encoded as 2 channels (or 1 channel for streams whose values all fit
+            in 32 bits).
+        stream_aux (dict):  The auxiliary per-stream arrays returned by
+            `encode_flac`, or None.  This is required if the data was encoded
+            in segments.  If it contains a frame table, slices are decoded
+            starting directly at the frame containing the first sample.
+        out (numpy.ndarray):  If not None, decode into this array instead of
+            allocating a new one.  It must have the output shape and type, and the
+            samples of each stream must be contiguous, but it may be a strided view
+            such as a block of rows of a larger array.
+        verify (bool):  If True, check the compressed bytes of the decoded streams
+            (or segments) against their checksums first (see `verify_flac()`).
+        streams (numpy.ndarray):  If not None, an integer array of the flat (C
+            order) indices of the streams to decode.  Only these streams are
+            decoded, and the leading shape of the output is the shape of this
+            array.  The other per-stream arrays are not changed.
+
+    Returns:
+        (array):  The decompressed array of int32 or int64 data (`out` if given).
+
+    """
+    (
+        output_shape, n_stream, flat_starts, flat_nbytes, seg_size, flat_segments,
+        frame_size, flat_frames, flat_streams
+    ) = _decode_layout(
+        compressed,
+        starts,
+        nbytes,
+        stream_size,
+        first_sample,
+        last_sample,
+        stream_aux,
+        streams=streams,
+    )
+    if out is not None and out.shape != output_shape:
+        msg = f"The output has shape {out.shape}, expected {output_shape}"
+        raise RuntimeError(msg)
+    if verify:
+        verify_flac(
+            compressed,
+            starts,
+            nbytes,
+            stream_aux,
+            first_sample=first_sample,
+            last_sample=last_sample,
+            use_threads=use_threads,
+            streams=flat_streams,
+        )
+
     if is_int64:
         flat_output = wrap_decode_i64(
             compressed,
             flat_starts,
             flat_nbytes,
             n_stream,
-            cstream_size,
-            cfirst_sample,
-            clast_sample,
+            stream_size,
+            first_sample,
+            last_sample,
             use_threads,
+            seg_size,
+            flat_segments,
+            frame_size,
+            flat_frames,
+            out,
+            flat_streams,
         )
     else:
         flat_output = wrap_decode_i32(
@@ -813,12 +2905,157 @@ def decode_flac(
             flat_starts,
             flat_nbytes,
             n_stream,
-            cstream_size,
-            cfirst_sample,
-            clast_sample,
+            stream_size,
+            first_sample,
+            last_sample,
+            use_threads,
+            seg_size,
+            flat_segments,
+            frame_size,
+            flat_frames,
+            out,
+            flat_streams,
+        )
+
+    if out is not None:
+        return out
+    # Reshape and return
+    return flat_output.reshape(output_shape)
+
+
+def decode_flac_float(
+    compressed,
+    starts,
+    nbytes,
+    int stream_size,
+    offsets,
+    gains,
+    int first_sample=-1,
+    int last_sample=-1,
+    bint use_threads=False,
+    stream_aux=None,
+    out=None,
+    bint verify=False,
+    streams=None,
+):
+    """Decompress a FLAC compressed bytestream of quantized floating point data.
+
+    This is equivalent to decoding the integers with `decode_flac()` and restoring
+    the floating point values with `int_to_float()`, and produces identical results.
+    However, the offset and gain of each stream are applied as every frame is
+    decoded, so the full integer array is never allocated.
+
+    The type of the offsets determines the output: float32 offsets and gains are
+    used with 32bit integer streams and give float32 data, while float64 offsets
+    and gains are used with 64bit integer streams and give float64 data.  The
+    offsets and gains must have the same shape as `starts`.  See `decode_flac()`
+    for the description of the other arguments.
+
+    Args:
+        compressed (numpy.ndarray):  The array of compressed bytes.
+        starts (numpy.ndarray):  The array of starting bytes in the bytestream.
+        nbytes (numpy.ndarray):  The array of number of bytes in the bytestream.
+        stream_size (int):  The length of the decompressed final dimension.
+        offsets (numpy.ndarray):  The offset of each stream.
+        gains (numpy.ndarray):  The gain of each stream.
+        first_sample (int):  The first sample to decode along the final dimension.
+        last_sample (int):  The last sample to decode along the final dimension
+            (exclusive).
+        use_threads (bool):  If True, use OpenMP threads to parallelize decoding.
+        stream_aux (dict):  The auxiliary per-stream arrays returned by the
+            encoder, or None.
+        out (numpy.ndarray):  If not None, decode into this (possibly strided)
+            array instead of allocating a new one.
+        verify (bool):  If True, check the compressed bytes against their
+            checksums first.
+        streams (numpy.ndarray):  If not None, the flat indices of the streams to
+            decode.  The leading shape of the output is the shape of this array.
+
+    Returns:
+        (array):  The decompressed array of float32 or float64 data (`out` if
+            given).
+
+    """
+    if offsets.dtype != flac_f32_dtype and offsets.dtype != flac_f64_dtype:
+        msg = "Only 32bit or 64bit floating point offsets are supported"
+        raise RuntimeError(msg)
+    if gains.dtype != offsets.dtype:
+        msg = "offsets and gains must have the same type"
+        raise RuntimeError(msg)
+    if offsets.size != starts.size or gains.size != starts.size:
+        msg = "offsets and gains must have one element per stream"
+        raise RuntimeError(msg)
+    (
+        output_shape, n_stream, flat_starts, flat_nbytes, seg_size, flat_segments,
+        frame_size, flat_frames, flat_streams
+    ) = _decode_layout(
+        compressed,
+        starts,
+        nbytes,
+        stream_size,
+        first_sample,
+        last_sample,
+        stream_aux,
+        streams=streams,
+    )
+    if out is not None and out.shape != output_shape:
+        msg = f"The output has shape {out.shape}, expected {output_shape}"
+        raise RuntimeError(msg)
+    if verify:
+        verify_flac(
+            compressed,
+            starts,
+            nbytes,
+            stream_aux,
+            first_sample=first_sample,
+            last_sample=last_sample,
+            use_threads=use_threads,
+            streams=flat_streams,
+        )
+    flat_offsets = np.ascontiguousarray(offsets).reshape((-1,))
+    flat_gains = np.ascontiguousarray(gains).reshape((-1,))
+
+    if offsets.dtype == flac_f64_dtype:
+        flat_output = wrap_decode_f64(
+            compressed,
+            flat_starts,
+            flat_nbytes,
+            flat_offsets,
+            flat_gains,
+            n_stream,
+            stream_size,
+            first_sample,
+            last_sample,
+            use_threads,
+            seg_size,
+            flat_segments,
+            frame_size,
+            flat_frames,
+            out,
+            flat_streams,
+        )
+    else:
+        flat_output = wrap_decode_f32(
+            compressed,
+            flat_starts,
+            flat_nbytes,
+            flat_offsets,
+            flat_gains,
+            n_stream,
+            stream_size,
+            first_sample,
+            last_sample,
             use_threads,
+            seg_size,
+            flat_segments,
+            frame_size,
+            flat_frames,
+            out,
+            flat_streams,
         )
 
+    if out is not None:
+        return out
     # Reshape and return
     return flat_output.reshape(output_shape)
 
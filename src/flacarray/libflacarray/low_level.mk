@@ -6,7 +6,9 @@ LDFLAGS = -fopenmp
 #LDFLAGS =
 LIBRARIES = -L$(CONDA_PREFIX)/lib -lFLAC
 
-OBJ = test_low_level.o utils.o compress.o decompress.o verify.o
+CORE = utils.o compress.o decompress.o pool.o checksum.o
+
+OBJ = test_low_level.o verify.o $(CORE)
 
 
 all : test_low_level
@@ -14,9 +16,12 @@ all : test_low_level
 test_low_level : $(OBJ)
 	$(CC) -o $@ $(OBJ) $(LDFLAGS) $(LIBRARIES)
 
+flacarray_cbench : cbench.o $(CORE)
+	$(CC) -o $@ cbench.o $(CORE) $(LDFLAGS) $(LIBRARIES) -lm
+
 %.o : %.c flacarray.h
 	$(CC) $(CFLAGS) $(INCLUDE) -I. -c $<
 
 clean :
-	@rm -f test_low_level *.o
+	@rm -f test_low_level flacarray_cbench *.o
 
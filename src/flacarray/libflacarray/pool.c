@@ -0,0 +1,305 @@
+// Copyright (c) 2024-2025 by the parties listed in the AUTHORS file.
+// All rights reserved.  Use of this source code is governed by
+// a BSD-style license that can be found in the LICENSE file.
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include <flacarray.h>
+
+
+// Per-thread pool of FLAC encoder / decoder objects.  Creating these objects (and
+// for the decoder, initializing the stream) involves several allocations which
+// dominate the cost when processing many short streams.  Each thread (OpenMP worker
+// or otherwise) keeps one encoder and one decoder which are reused across streams
+// and across calls.  The pool for a thread is destroyed automatically when that
+// thread exits, or explicitly with pool_clear().
+
+static pthread_key_t pool_key;
+static pthread_once_t pool_key_once = PTHREAD_ONCE_INIT;
+static int pool_key_err = 0;
+
+// Whether the performance counters are recorded.  This is the only setting shared
+// by all threads, and the counters themselves are kept in the pool of each thread.
+static atomic_bool perf_on = false;
+
+
+static void pool_destroy(void * obj) {
+    flac_pool * pool = (flac_pool *)obj;
+    if (pool == NULL) {
+        return;
+    }
+    if (pool->encoder != NULL) {
+        FLAC__stream_encoder_delete(pool->encoder);
+    }
+    if (pool->decoder != NULL) {
+        // This also calls finish() if the decoder is initialized.
+        FLAC__stream_decoder_delete(pool->decoder);
+    }
+    free(pool->scratch);
+    free(pool->stats.busy);
+    free(pool->stats.items);
+    free(pool);
+    return;
+}
+
+
+static void pool_key_create() {
+    pool_key_err = pthread_key_create(&pool_key, pool_destroy);
+    return;
+}
+
+
+// Get the pool for the calling thread, creating it if needed.  Returns NULL if
+// the pool could not be allocated.
+flac_pool * pool_get() {
+    pthread_once(&pool_key_once, pool_key_create);
+    if (pool_key_err != 0) {
+        return NULL;
+    }
+    flac_pool * pool = (flac_pool *)pthread_getspecific(pool_key);
+    if (pool != NULL) {
+        return pool;
+    }
+    pool = (flac_pool *)malloc(sizeof(flac_pool));
+    if (pool == NULL) {
+        return NULL;
+    }
+    pool->encoder = NULL;
+    pool->decoder = NULL;
+    pool->decoder_init = false;
+    pool->scratch = NULL;
+    pool->scratch_size = 0;
+    pool->stats.n_thread = 0;
+    pool->stats.n_item = 0;
+    pool->stats.wall = 0.0;
+    pool->stats.busy = NULL;
+    pool->stats.items = NULL;
+    pool->stats.size = 0;
+    memset(&(pool->perf), 0, sizeof(perf_counters));
+    if (pthread_setspecific(pool_key, (void *)pool) != 0) {
+        free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+
+// Return the encoder for this pool, creating it if needed.  The encoder is in the
+// uninitialized state, and all parameters must be set before calling init.  After
+// calling FLAC__stream_encoder_finish() the encoder is ready to be used again.
+FLAC__StreamEncoder * pool_encoder(flac_pool * pool) {
+    if (pool->encoder == NULL) {
+        pool->encoder = FLAC__stream_encoder_new();
+    }
+    return pool->encoder;
+}
+
+
+// Return the decoder for this pool, creating and initializing it if needed.  The
+// decoder is initialized once with the callback data stored in the pool, so the
+// caller should update the fields of pool->dec_data for each stream and then call
+// FLAC__stream_decoder_reset() to begin decoding.
+FLAC__StreamDecoder * pool_decoder(flac_pool * pool) {
+    if (pool->decoder == NULL) {
+        pool->decoder = FLAC__stream_decoder_new();
+        if (pool->decoder == NULL) {
+            return NULL;
+        }
+        pool->decoder_init = false;
+    }
+    if (! pool->decoder_init) {
+        // The decoder will not read anything until it is reset, so the stream
+        // range is empty for now.
+        pool->dec_data.input = NULL;
+        pool->dec_data.stream_start = 0;
+        pool->dec_data.stream_end = 0;
+        pool->dec_data.stream_pos = 0;
+        pool->dec_data.err = ERROR_NONE;
+        pool->dec_data.decompressed = NULL;
+        pool->dec_data.f32 = NULL;
+        pool->dec_data.f64 = NULL;
+        pool->dec_data.perf = NULL;
+        FLAC__StreamDecoderInitStatus status = FLAC__stream_decoder_init_stream(
+            pool->decoder,
+            dec_read_callback,
+            dec_seek_callback,
+            dec_tell_callback,
+            dec_length_callback,
+            dec_eof_callback,
+            dec_write_callback,
+            NULL,
+            dec_err_callback,
+            (void *)&(pool->dec_data)
+        );
+        if (status != FLAC__STREAM_DECODER_INIT_STATUS_OK) {
+            return NULL;
+        }
+        pool->decoder_init = true;
+    }
+    return pool->decoder;
+}
+
+
+// Return a scratch buffer with space for at least n_elem 32bit integers, growing the
+// buffer if needed.  The contents are not preserved when growing.  Returns NULL if
+// the allocation fails.
+int32_t * pool_scratch(flac_pool * pool, int64_t n_elem) {
+    if (pool->scratch_size < n_elem) {
+        free(pool->scratch);
+        pool->scratch = (int32_t *)malloc(n_elem * sizeof(int32_t));
+        if (pool->scratch == NULL) {
+            pool->scratch_size = 0;
+            return NULL;
+        }
+        pool->scratch_size = n_elem;
+    }
+    return pool->scratch;
+}
+
+
+// Reset the scheduling statistics of this pool for a call with n_thread threads
+// and n_item work items.  The per-thread values are zeroed.  Returns NULL if the
+// allocation fails, in which case no statistics are recorded.
+sched_stats * pool_stats(flac_pool * pool, int32_t n_thread, int64_t n_item) {
+    sched_stats * stats = &(pool->stats);
+    if (stats->size < n_thread) {
+        free(stats->busy);
+        free(stats->items);
+        stats->busy = (double *)malloc(n_thread * sizeof(double));
+        stats->items = (int64_t *)malloc(n_thread * sizeof(int64_t));
+        if ((stats->busy == NULL) || (stats->items == NULL)) {
+            free(stats->busy);
+            free(stats->items);
+            stats->busy = NULL;
+            stats->items = NULL;
+            stats->size = 0;
+            stats->n_thread = 0;
+            return NULL;
+        }
+        stats->size = n_thread;
+    }
+    stats->n_thread = n_thread;
+    stats->n_item = n_item;
+    stats->wall = 0.0;
+    for (int32_t ithread = 0; ithread < n_thread; ++ithread) {
+        stats->busy[ithread] = 0.0;
+        stats->items[ithread] = 0;
+    }
+    return stats;
+}
+
+
+// The scheduling statistics of the last threaded encode or decode called from this
+// thread, or NULL if there are none.
+sched_stats const * pool_last_stats() {
+    pthread_once(&pool_key_once, pool_key_create);
+    if (pool_key_err != 0) {
+        return NULL;
+    }
+    flac_pool * pool = (flac_pool *)pthread_getspecific(pool_key);
+    if ((pool == NULL) || (pool->stats.n_thread == 0)) {
+        return NULL;
+    }
+    return &(pool->stats);
+}
+
+
+// Enable or disable the performance counters of all threads.  Changing this while
+// other threads are encoding or decoding only takes effect for their next call.
+void perf_enable(bool enable) {
+    atomic_store_explicit(&perf_on, enable, memory_order_relaxed);
+    return;
+}
+
+
+bool perf_enabled() {
+    return atomic_load_explicit(&perf_on, memory_order_relaxed);
+}
+
+
+// The counters of this pool, or NULL if the pool is NULL or the counters are
+// disabled.  The result is passed to the callbacks in their client data.
+perf_counters * pool_perf(flac_pool * pool) {
+    if ((pool == NULL) || !perf_enabled()) {
+        return NULL;
+    }
+    return &(pool->perf);
+}
+
+
+static void perf_add(perf_counters * total, perf_counters const * perf) {
+    total->enc_setup += perf->enc_setup;
+    total->enc_process += perf->enc_process;
+    total->enc_items += perf->enc_items;
+    total->enc_writes += perf->enc_writes;
+    total->enc_bytes += perf->enc_bytes;
+    total->enc_resizes += perf->enc_resizes;
+    total->enc_unreserved += perf->enc_unreserved;
+    total->enc_overflows += perf->enc_overflows;
+    total->dec_setup += perf->dec_setup;
+    total->dec_process += perf->dec_process;
+    total->dec_items += perf->dec_items;
+    total->dec_reads += perf->dec_reads;
+    total->dec_bytes += perf->dec_bytes;
+    total->dec_seeks += perf->dec_seeks;
+    total->convert += perf->convert;
+    return;
+}
+
+
+// Sum the counters of the calling thread and, if use_threads is true, of all
+// OpenMP threads into total.  If reset is true, the counters of those threads are
+// zeroed.  Like pool_clear(), this only reaches the threads of the calling thread's
+// OpenMP team, and the counters of a thread are lost when its pool is freed.
+void perf_collect(bool use_threads, bool reset, perf_counters * total) {
+    memset(total, 0, sizeof(perf_counters));
+    pthread_once(&pool_key_once, pool_key_create);
+    if (pool_key_err != 0) {
+        return;
+    }
+    #pragma omp parallel if(use_threads)
+    {
+        flac_pool * pool = (flac_pool *)pthread_getspecific(pool_key);
+        if (pool != NULL) {
+            #pragma omp critical (perf_collect)
+            {
+                perf_add(total, &(pool->perf));
+            }
+            if (reset) {
+                memset(&(pool->perf), 0, sizeof(perf_counters));
+            }
+        }
+    }
+    return;
+}
+
+
+// If a decode fails, the decoder may be left in a state that cannot be reset.
+// Finish the decoder so that it is re-initialized on the next use.
+void pool_decoder_discard(flac_pool * pool) {
+    if ((pool->decoder != NULL) && pool->decoder_init) {
+        FLAC__stream_decoder_finish(pool->decoder);
+        pool->decoder_init = false;
+    }
+    return;
+}
+
+
+// Free the pool of the calling thread and, if use_threads is true, the pools of
+// all OpenMP threads.
+void pool_clear(bool use_threads) {
+    pthread_once(&pool_key_once, pool_key_create);
+    if (pool_key_err != 0) {
+        return;
+    }
+    #pragma omp parallel if(use_threads)
+    {
+        flac_pool * pool = (flac_pool *)pthread_getspecific(pool_key);
+        if (pool != NULL) {
+            pthread_setspecific(pool_key, NULL);
+            pool_destroy((void *)pool);
+        }
+    }
+    return;
+}
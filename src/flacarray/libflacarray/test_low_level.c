@@ -73,11 +73,19 @@ void test_32bit() {
     // Encode to bytes
     int status = encode_i32(
         data,
+        NULL,
+        0,
         n_streams,
         stream_len,
+        0,
         level,
+        true,
+        0,
         &n_bytes,
         stream_starts,
+        NULL,
+        NULL,
+        NULL,
         &compressed);
 
     diff = clock() - start;
@@ -93,11 +101,20 @@ void test_32bit() {
     // Encode to bytes
     status = encode_i32_threaded(
         data,
+        NULL,
+        0,
         n_streams,
         stream_len,
+        0,
         level,
+        true,
+        0,
+        0,
         &n_bytes,
         stream_starts,
+        NULL,
+        NULL,
+        NULL,
         &compressed);
 
     diff = clock() - start;
@@ -139,9 +156,15 @@ void test_32bit() {
         stream_starts,
         stream_nbytes,
         n_streams,
+        NULL,
         stream_len,
+        0,
+        NULL,
+        0,
+        NULL,
         first_sample,
         last_sample,
+        NULL,
         decompressed,
         false);
     diff = clock() - start;
@@ -156,9 +179,15 @@ void test_32bit() {
         stream_starts,
         stream_nbytes,
         n_streams,
+        NULL,
         stream_len,
+        0,
+        NULL,
+        0,
+        NULL,
         first_sample,
         last_sample,
+        NULL,
         decompressed,
         true);
     diff = clock() - start;
@@ -217,9 +246,15 @@ void test_32bit() {
         stream_starts,
         stream_nbytes,
         n_streams,
+        NULL,
         stream_len,
+        0,
+        NULL,
+        0,
+        NULL,
         first_sample,
         last_sample,
+        NULL,
         decompressed,
         false);
     diff = clock() - start;
@@ -234,9 +269,15 @@ void test_32bit() {
         stream_starts,
         stream_nbytes,
         n_streams,
+        NULL,
         stream_len,
+        0,
+        NULL,
+        0,
+        NULL,
         first_sample,
         last_sample,
+        NULL,
         decompressed,
         true);
     diff = clock() - start;
@@ -328,11 +369,19 @@ void test_64bit() {
     // Encode to bytes
     int status = encode_i64(
         data,
+        NULL,
+        0,
         n_streams,
         stream_len,
+        0,
         level,
+        true,
+        0,
         &n_bytes,
         stream_starts,
+        NULL,
+        NULL,
+        NULL,
         &compressed);
 
     diff = clock() - start;
@@ -348,11 +397,20 @@ void test_64bit() {
     // Encode to bytes
     status = encode_i64_threaded(
         data,
+        NULL,
+        0,
         n_streams,
         stream_len,
+        0,
         level,
+        true,
+        0,
+        0,
         &n_bytes,
         stream_starts,
+        NULL,
+        NULL,
+        NULL,
         &compressed);
 
     diff = clock() - start;
@@ -394,9 +452,15 @@ void test_64bit() {
         stream_starts,
         stream_nbytes,
         n_streams,
+        NULL,
         stream_len,
+        0,
+        NULL,
+        0,
+        NULL,
         first_sample,
         last_sample,
+        NULL,
         decompressed,
         false);
     diff = clock() - start;
@@ -411,9 +475,15 @@ void test_64bit() {
         stream_starts,
         stream_nbytes,
         n_streams,
+        NULL,
         stream_len,
+        0,
+        NULL,
+        0,
+        NULL,
         first_sample,
         last_sample,
+        NULL,
         decompressed,
         true);
     diff = clock() - start;
@@ -478,9 +548,15 @@ void test_64bit() {
         stream_starts,
         stream_nbytes,
         n_streams,
+        NULL,
         stream_len,
+        0,
+        NULL,
+        0,
+        NULL,
         first_sample,
         last_sample,
+        NULL,
         decompressed,
         false);
     diff = clock() - start;
@@ -495,9 +571,15 @@ void test_64bit() {
         stream_starts,
         stream_nbytes,
         n_streams,
+        NULL,
         stream_len,
+        0,
+        NULL,
+        0,
+        NULL,
         first_sample,
         last_sample,
+        NULL,
         decompressed,
         true);
     diff = clock() - start;
@@ -534,8 +616,174 @@ void test_64bit() {
 }
 
 
+void test_segmented() {
+    fprintf(stderr, "============= Segmented Tests ===============\n");
+
+    int64_t n_streams = 2;
+    int64_t stream_len = 1000000;
+    int64_t segment_len = 65536;
+    int64_t n_seg = n_segments(stream_len, segment_len);
+    uint32_t level = 5;
+
+    int64_t n_bytes;
+    uint8_t *compressed;
+    int64_t *stream_starts = (int64_t *)malloc(n_streams * sizeof(int64_t));
+    int64_t *stream_nbytes = (int64_t *)malloc(n_streams * sizeof(int64_t));
+    int64_t *segment_starts = (int64_t *)malloc(n_streams * n_seg * sizeof(int64_t));
+    int64_t frame_len = encode_frame_size(level);
+    int64_t n_frame = n_stream_frames(stream_len, segment_len, frame_len);
+    int64_t *frame_starts = (int64_t *)malloc(n_streams * n_frame * sizeof(int64_t));
+    uint32_t *checksums = (uint32_t *)malloc(n_streams * n_seg * sizeof(uint32_t));
+    int32_t *data = (int32_t *)malloc(n_streams * stream_len * sizeof(int32_t));
+    if (
+        (data == NULL) || (stream_starts == NULL) || (stream_nbytes == NULL)
+        || (segment_starts == NULL) || (frame_starts == NULL) || (checksums == NULL)
+    ) {
+        fprintf(stderr, "Failed to allocate buffers\n");
+    }
+
+    // Set up random number generator
+    int64_t n_state = 64;
+    char state[n_state];
+    char *previous_state = initstate(123456, state, n_state);
+    previous_state = setstate(state);
+
+    for (int64_t elem = 0; elem < n_streams * stream_len; ++elem) {
+        data[elem] = (int32_t)(random());
+    }
+
+    // Limit the memory to a few segments at a time, so that the segments are
+    // encoded in batches.
+    int status = encode_i32_threaded(
+        data,
+        NULL,
+        0,
+        n_streams,
+        stream_len,
+        segment_len,
+        level,
+        false,
+        0,
+        4 * segment_len * sizeof(int32_t),
+        &n_bytes,
+        stream_starts,
+        segment_starts,
+        frame_starts,
+        checksums,
+        &compressed);
+    fprintf(stderr, "Encoded %ld streams in %ld segments (%ld frames) into %ld bytes, status = %d\n", n_streams, n_seg, n_frame, n_bytes, status);
+
+    for (int64_t istream = 0; istream < n_streams - 1; ++istream) {
+        stream_nbytes[istream] = stream_starts[istream + 1] - stream_starts[istream];
+    }
+    stream_nbytes[n_streams - 1] = n_bytes - stream_starts[n_streams - 1];
+
+    // The checksums of all segments should match, and a corrupted byte in the
+    // second segment should only be found when checking that segment.
+    status = verify_checksums(
+        compressed, stream_starts, stream_nbytes, n_streams, NULL, n_seg, segment_starts,
+        checksums, 0, n_seg, true
+    );
+    if (status != ERROR_NONE) {
+        fprintf(stderr, "FAIL checksums of the segments, status = %d\n", status);
+    }
+    compressed[stream_starts[1] + segment_starts[n_seg + 1] + 100] ^= 0x01;
+    if (
+        (verify_checksums(
+            compressed, stream_starts, stream_nbytes, n_streams, NULL, n_seg,
+            segment_starts, checksums, 1, 2, false
+        ) != ERROR_CHECKSUM) || (verify_checksums(
+            compressed, stream_starts, stream_nbytes, n_streams, NULL, n_seg,
+            segment_starts, checksums, 2, n_seg, false
+        ) != ERROR_NONE)
+    ) {
+        fprintf(stderr, "FAIL checksum of a corrupted segment\n");
+    }
+    compressed[stream_starts[1] + segment_starts[n_seg + 1] + 100] ^= 0x01;
+
+    // Decode a slice which spans several segments.
+    int64_t first_sample = segment_len / 2;
+    int64_t last_sample = 3 * segment_len + 5;
+    int64_t n_decode = last_sample - first_sample;
+    int32_t *decompressed = (int32_t *)malloc(n_streams * n_decode * sizeof(int32_t));
+    int32_t *framed = (int32_t *)malloc(n_streams * n_decode * sizeof(int32_t));
+
+    status = decode_i32(
+        compressed,
+        stream_starts,
+        stream_nbytes,
+        n_streams,
+        NULL,
+        stream_len,
+        segment_len,
+        segment_starts,
+        0,
+        NULL,
+        first_sample,
+        last_sample,
+        NULL,
+        decompressed,
+        true);
+    fprintf(stderr, "Decoded (with threads) %ld streams with slice of %ld integers, status = %d\n", n_streams, n_decode, status);
+
+    // Decode the same slice, starting from the frame table.
+    status = decode_i32(
+        compressed,
+        stream_starts,
+        stream_nbytes,
+        n_streams,
+        NULL,
+        stream_len,
+        segment_len,
+        segment_starts,
+        frame_len,
+        frame_starts,
+        first_sample,
+        last_sample,
+        NULL,
+        framed,
+        true);
+    fprintf(stderr, "Decoded (with frame table) %ld streams with slice of %ld integers, status = %d\n", n_streams, n_decode, status);
+
+    int64_t input_elem;
+    int64_t output_elem;
+    for (int64_t istream = 0; istream < n_streams; ++istream) {
+        for (int64_t isamp = first_sample; isamp < last_sample; ++isamp) {
+            input_elem = istream * stream_len + isamp;
+            output_elem = istream * n_decode + (isamp - first_sample);
+            if (data[input_elem] != decompressed[output_elem]) {
+                fprintf(stderr,
+                    "FAIL stream %ld, sample %ld:  %d != %d\n",
+                    istream, isamp, decompressed[output_elem], data[input_elem]);
+            }
+            if (data[input_elem] != framed[output_elem]) {
+                fprintf(stderr,
+                    "FAIL (frame table) stream %ld, sample %ld:  %d != %d\n",
+                    istream, isamp, framed[output_elem], data[input_elem]);
+            }
+        }
+    }
+    fprintf(stderr, "SUCCESS\n");
+
+    free(framed);
+    free(decompressed);
+    free(compressed);
+    free(checksums);
+    free(frame_starts);
+    free(segment_starts);
+    free(stream_starts);
+    free(stream_nbytes);
+    free(data);
+
+    return;
+}
+
+
 int main(int argc, char *argv[]) {
     test_32bit();
     test_64bit();
+    test_segmented();
+    // Free the pooled encoders / decoders so that leak checkers are quiet.
+    pool_clear(true);
     return 0;
 }
@@ -4,6 +4,10 @@
 
 #include <flacarray.h>
 #include <stdio.h>
+#include <time.h>
+
+// The number of samples in each block of work when converting full arrays.
+#define CONVERT_BLOCK 65536
 
 
 ArrayUint8 * create_array_uint8(int64_t start_size) {
@@ -15,7 +19,10 @@ ArrayUint8 * create_array_uint8(int64_t start_size) {
     ret->n_elem = 0;
     ret->data = NULL;
     if (start_size > 0) {
-        resize_array_uint8(ret, start_size);
+        if (resize_array_uint8(ret, start_size) != ERROR_NONE) {
+            free(ret);
+            return NULL;
+        }
     }
     return ret;
 }
@@ -41,6 +48,7 @@ int resize_array_uint8(ArrayUint8 * obj, int64_t new_size) {
                 // Allocation failed, set size to zero.
                 obj->size = 0;
                 obj->n_elem = 0;
+                return ERROR_ALLOC;
             } else {
                 // Allocation worked.
                 obj->size = new_size;
@@ -62,12 +70,13 @@ int resize_array_uint8(ArrayUint8 * obj, int64_t new_size) {
                     (void*)(obj->data),
                     try_size * sizeof(unsigned char)
                 );
-                if (temp_ptr != NULL) {
-                    // Realloc success
-                    obj->data = temp_ptr;
-                    obj->size = try_size;
-                    obj->n_elem = new_size;
+                if (temp_ptr == NULL) {
+                    // Realloc failed, the original buffer is unchanged.
+                    return ERROR_ALLOC;
                 }
+                obj->data = temp_ptr;
+                obj->size = try_size;
+                obj->n_elem = new_size;
             }
         }
     } else {
@@ -157,88 +166,287 @@ void free_interleaved(int32_t * interleaved) {
     return;
 }
 
-int float32_to_int32(
-    float const * input,
-    int64_t n_stream,
-    int64_t stream_size,
+// Helpers for the conversion of floating point streams to integers.  The offset and
+// gain of each stream are computed from the range of its values (and optionally a
+// fixed quanta).  Each value is then shifted by the offset, scaled by the gain, and
+// rounded to the nearest integer.  These pieces are used by the conversion functions
+// below and by the encoders, which quantize data in small blocks while encoding.
+//
+// The helpers are serial, with SIMD loops.  The rounding selects the +/- 0.5 rather
+// than branching, so that the compiler can vectorize it for whatever instruction set
+// the library is built for.  The results are identical to the scalar expressions.
+
+void float32_range(float const * input, int64_t n_samp, float * smin, float * smax) {
+    float vmin = input[0];
+    float vmax = input[0];
+    #pragma omp simd reduction(min:vmin) reduction(max:vmax)
+    for (int64_t isamp = 1; isamp < n_samp; ++isamp) {
+        vmin = (input[isamp] < vmin) ? input[isamp] : vmin;
+        vmax = (input[isamp] > vmax) ? input[isamp] : vmax;
+    }
+    (*smin) = vmin;
+    (*smax) = vmax;
+    return;
+}
+
+void float32_params(
+    float smin,
+    float smax,
     float const * quanta,
-    int32_t * output,
-    float * offsets,
-    float * gains
+    float * offset,
+    float * gain
 ) {
     // FLAC uses signed integers so the max positive value is 2^31 - 1.
     int32_t flac_max = 2147483647;
 
-    float smin;
-    float smax;
-    int64_t sindx;
-    float sval;
-    float stemp;
     float squanta;
     float min_quanta;
     float amp;
     int64_t nquant;
-    for (int64_t istream = 0; istream < n_stream; ++istream) {
-        smin = input[istream * stream_size];
-        smax = input[istream * stream_size];
-        for (int64_t isamp = 1; isamp < stream_size; ++isamp) {
-            sindx = istream * stream_size + isamp;
-            sval = input[sindx];
-            if (sval < smin) {
-                smin = sval;
-            }
-            if (sval > smax) {
-                smax = sval;
-            }
-        }
-        offsets[istream] = 0.5 * (smin + smax);
 
-        // Check the minimum quanta size that can be used without the resulting data
-        // overflowing the bit limit.
-        if ((smin - offsets[istream]) > (smax - offsets[istream])) {
-            amp = 1.01 * (smin - offsets[istream]);
-        } else {
-            amp = 1.01 * (smax - offsets[istream]);
-        }
-        min_quanta = amp / flac_max;
+    (*offset) = 0.5 * (smin + smax);
 
-        if (quanta == NULL) {
-            // We are computing the quanta based on the range of the data.
-            squanta = min_quanta;
-        } else {
-            // We are using a pre-defined quanta per stream.
-            squanta = quanta[istream];
-            // Commented out, since there might be times when the
-            // user wants to truncate the peaks of the data.
-            //-----------------------------------------------------
-            // if (squanta < min_quanta) {
-            //     // The requested quanta is too small
-            //     return ERROR_CONVERT_TYPE;
-            // }
+    // Check the minimum quanta size that can be used without the resulting data
+    // overflowing the bit limit.
+    if ((smin - (*offset)) > (smax - (*offset))) {
+        amp = 1.01 * (smin - (*offset));
+    } else {
+        amp = 1.01 * (smax - (*offset));
+    }
+    min_quanta = amp / flac_max;
+
+    if (quanta == NULL) {
+        // We are computing the quanta based on the range of the data.
+        squanta = min_quanta;
+    } else {
+        // We are using a pre-defined quanta per stream.
+        squanta = (*quanta);
+        // Commented out, since there might be times when the
+        // user wants to truncate the peaks of the data.
+        //-----------------------------------------------------
+        // if (squanta < min_quanta) {
+        //     // The requested quanta is too small
+        //     return ERROR_CONVERT_TYPE;
+        // }
+    }
+
+    // Adjust final offset so that it is a whole number of quanta.
+    nquant = (int64_t)((double)(*offset) / (double)squanta);
+    (*offset) = (float)((double)squanta * (double)nquant);
+
+    if (squanta == 0) {
+        // This happens if all data is zero and we are computing the quanta
+        // from the data.
+        (*gain) = 1.0;
+    } else {
+        (*gain) = 1.0 / squanta;
+    }
+    return;
+}
+
+int32_t float32_quantize_value(float value, float offset, float gain) {
+    float stemp = value - offset;
+    return (int32_t)(gain * stemp + ((stemp >= 0) ? 0.5 : -0.5));
+}
+
+void float32_quantize(
+    float const * input,
+    int64_t n_samp,
+    float offset,
+    float gain,
+    int32_t * output
+) {
+    #pragma omp simd
+    for (int64_t isamp = 0; isamp < n_samp; ++isamp) {
+        output[isamp] = float32_quantize_value(input[isamp], offset, gain);
+    }
+    return;
+}
+
+void float64_range(double const * input, int64_t n_samp, double * smin, double * smax) {
+    double vmin = input[0];
+    double vmax = input[0];
+    #pragma omp simd reduction(min:vmin) reduction(max:vmax)
+    for (int64_t isamp = 1; isamp < n_samp; ++isamp) {
+        vmin = (input[isamp] < vmin) ? input[isamp] : vmin;
+        vmax = (input[isamp] > vmax) ? input[isamp] : vmax;
+    }
+    (*smin) = vmin;
+    (*smax) = vmax;
+    return;
+}
+
+void float64_params(
+    double smin,
+    double smax,
+    double const * quanta,
+    double * offset,
+    double * gain
+) {
+    // FLAC uses signed integers so the max positive value is 2^63 - 1.
+    int64_t flac_max = 9223372036854775807;
+
+    double squanta;
+    double min_quanta;
+    double amp;
+    int64_t nquant;
+
+    (*offset) = 0.5 * (smin + smax);
+
+    // Check the minimum quanta size that can be used without the resulting data
+    // overflowing the bit limit.
+    if ((smin - (*offset)) > (smax - (*offset))) {
+        amp = 1.01 * (smin - (*offset));
+    } else {
+        amp = 1.01 * (smax - (*offset));
+    }
+    min_quanta = amp / flac_max;
+
+    if (quanta == NULL) {
+        // We are computing the quanta based on the range of the data.
+        squanta = min_quanta;
+    } else {
+        // We are using a pre-defined quanta per stream.
+        squanta = (*quanta);
+        // Commented out, since there might be times when the
+        // user wants to truncate the peaks of the data.
+        //-----------------------------------------------------
+        // if (squanta < min_quanta) {
+        //     // The requested quanta is too small
+        //     return ERROR_CONVERT_TYPE;
+        // }
+    }
+
+    // Adjust final offset so that it is a whole number of quanta.
+    nquant = (int64_t)((*offset) / squanta);
+    (*offset) = squanta * (double)nquant;
+
+    if (squanta == 0) {
+        // This happens if all data is zero and we are computing the quanta
+        // from the data.
+        (*gain) = 1.0;
+    } else {
+        (*gain) = 1.0 / squanta;
+    }
+    return;
+}
+
+int64_t float64_quantize_value(double value, double offset, double gain) {
+    double stemp = value - offset;
+    return (int64_t)(gain * stemp + ((stemp >= 0) ? 0.5 : -0.5));
+}
+
+// Quantize 64bit floats into the interleaved 32bit channels used by the FLAC
+// encoder.  With 2 channels these are the low and high words of each 64bit value.
+// With 1 channel, the caller must ensure that all values fit in 32 bits.
+void float64_quantize(
+    double const * input,
+    int64_t n_samp,
+    double offset,
+    double gain,
+    uint32_t n_channels,
+    int32_t * output
+) {
+    int64_t value;
+    if (n_channels == 1) {
+        #pragma omp simd
+        for (int64_t isamp = 0; isamp < n_samp; ++isamp) {
+            output[isamp] = (int32_t)float64_quantize_value(input[isamp], offset, gain);
         }
+    } else {
+        #pragma omp simd private(value)
+        for (int64_t isamp = 0; isamp < n_samp; ++isamp) {
+            value = float64_quantize_value(input[isamp], offset, gain);
+            output[2 * isamp] = (int32_t)(uint32_t)((uint64_t)value & 0xFFFFFFFF);
+            output[2 * isamp + 1] = (int32_t)(value >> 32);
+        }
+    }
+    return;
+}
 
-        // Adjust final offset so that it is a whole number of quanta.
-        nquant = (int64_t)((double)offsets[istream] / (double)squanta);
-        offsets[istream] = (float)((double)squanta * (double)nquant);
+// The full array conversions split every stream into blocks of CONVERT_BLOCK
+// samples and spread these over OpenMP threads, so that a few long streams use all
+// threads.  The per-block ranges are combined into the range of each stream before
+// computing its parameters.  Arrays with a single block are converted serially.
 
-        if (squanta == 0) {
-            // This happens if all data is zero and we are computing the quanta
-            // from the data.
-            gains[istream] = 1.0;
-        } else {
-            gains[istream] = 1.0 / squanta;
+int float32_to_int32(
+    float const * input,
+    int64_t n_stream,
+    int64_t stream_size,
+    float const * quanta,
+    int32_t * output,
+    float * offsets,
+    float * gains
+) {
+    int64_t n_block = (stream_size + CONVERT_BLOCK - 1) / CONVERT_BLOCK;
+    int64_t n_work = n_stream * n_block;
+    if (n_work == 0) {
+        return ERROR_NONE;
+    }
+    float * block_range = (float *)malloc(2 * n_work * sizeof(float));
+    if (block_range == NULL) {
+        return ERROR_ALLOC;
+    }
+
+    #pragma omp parallel if(n_work > 1)
+    {
+        #pragma omp for schedule(static)
+        for (int64_t iwork = 0; iwork < n_work; ++iwork) {
+            int64_t istream = iwork / n_block;
+            int64_t first = (iwork % n_block) * CONVERT_BLOCK;
+            int64_t n_samp = stream_size - first;
+            if (n_samp > CONVERT_BLOCK) {
+                n_samp = CONVERT_BLOCK;
+            }
+            float32_range(
+                input + istream * stream_size + first,
+                n_samp,
+                &(block_range[2 * iwork]),
+                &(block_range[2 * iwork + 1])
+            );
         }
 
-        for (int64_t isamp = 0; isamp < stream_size; ++isamp) {
-            sindx = istream * stream_size + isamp;
-            stemp = input[sindx] - offsets[istream];
-            if (stemp >= 0) {
-                output[sindx] = (int32_t)(gains[istream] * stemp + 0.5);
-            } else {
-                output[sindx] = (int32_t)(gains[istream] * stemp - 0.5);
+        #pragma omp for schedule(static)
+        for (int64_t istream = 0; istream < n_stream; ++istream) {
+            float * srange = block_range + 2 * istream * n_block;
+            float smin = srange[0];
+            float smax = srange[1];
+            for (int64_t iblock = 1; iblock < n_block; ++iblock) {
+                if (srange[2 * iblock] < smin) {
+                    smin = srange[2 * iblock];
+                }
+                if (srange[2 * iblock + 1] > smax) {
+                    smax = srange[2 * iblock + 1];
+                }
+            }
+            float32_params(
+                smin,
+                smax,
+                (quanta == NULL) ? NULL : &(quanta[istream]),
+                &(offsets[istream]),
+                &(gains[istream])
+            );
+        }
+
+        #pragma omp for schedule(static)
+        for (int64_t iwork = 0; iwork < n_work; ++iwork) {
+            int64_t istream = iwork / n_block;
+            int64_t first = (iwork % n_block) * CONVERT_BLOCK;
+            int64_t n_samp = stream_size - first;
+            if (n_samp > CONVERT_BLOCK) {
+                n_samp = CONVERT_BLOCK;
             }
+            float32_quantize(
+                input + istream * stream_size + first,
+                n_samp,
+                offsets[istream],
+                gains[istream],
+                output + istream * stream_size + first
+            );
         }
     }
+
+    free(block_range);
     return ERROR_NONE;
 }
 
@@ -251,79 +459,76 @@ int float64_to_int64(
     double * offsets,
     double * gains
 ) {
-    // FLAC uses signed integers so the max positive value is 2^63 - 1.
-    int64_t flac_max = 9223372036854775807;
+    int64_t n_block = (stream_size + CONVERT_BLOCK - 1) / CONVERT_BLOCK;
+    int64_t n_work = n_stream * n_block;
+    if (n_work == 0) {
+        return ERROR_NONE;
+    }
+    double * block_range = (double *)malloc(2 * n_work * sizeof(double));
+    if (block_range == NULL) {
+        return ERROR_ALLOC;
+    }
 
-    double smin;
-    double smax;
-    int64_t sindx;
-    double sval;
-    double stemp;
-    double squanta;
-    double min_quanta;
-    double amp;
-    int64_t nquant;
-    for (int64_t istream = 0; istream < n_stream; ++istream) {
-        smin = input[istream * stream_size];
-        smax = input[istream * stream_size];
-        for (int64_t isamp = 1; isamp < stream_size; ++isamp) {
-            sindx = istream * stream_size + isamp;
-            sval = input[sindx];
-            if (sval < smin) {
-                smin = sval;
-            }
-            if (sval > smax) {
-                smax = sval;
+    #pragma omp parallel if(n_work > 1)
+    {
+        #pragma omp for schedule(static)
+        for (int64_t iwork = 0; iwork < n_work; ++iwork) {
+            int64_t istream = iwork / n_block;
+            int64_t first = (iwork % n_block) * CONVERT_BLOCK;
+            int64_t n_samp = stream_size - first;
+            if (n_samp > CONVERT_BLOCK) {
+                n_samp = CONVERT_BLOCK;
             }
-        }
-        offsets[istream] = 0.5 * (smin + smax);
-
-        // Check the minimum quanta size that can be used without the resulting data
-        // overflowing the bit limit.
-        if ((smin - offsets[istream]) > (smax - offsets[istream])) {
-            amp = 1.01 * (smin - offsets[istream]);
-        } else {
-            amp = 1.01 * (smax - offsets[istream]);
-        }
-        min_quanta = amp / flac_max;
-
-        if (quanta == NULL) {
-            // We are computing the quanta based on the range of the data.
-            squanta = min_quanta;
-        } else {
-            // We are using a pre-defined quanta per stream.
-            squanta = quanta[istream];
-            // Commented out, since there might be times when the
-            // user wants to truncate the peaks of the data.
-            //-----------------------------------------------------
-            // if (squanta < min_quanta) {
-            //     // The requested quanta is too small
-            //     return ERROR_CONVERT_TYPE;
-            // }
+            float64_range(
+                input + istream * stream_size + first,
+                n_samp,
+                &(block_range[2 * iwork]),
+                &(block_range[2 * iwork + 1])
+            );
         }
 
-        // Adjust final offset so that it is a whole number of quanta.
-        nquant = (int64_t)(offsets[istream] / squanta);
-        offsets[istream] = squanta * (double)nquant;
-
-        if (squanta == 0) {
-            // This happens if all data is zero and we are computing the quanta
-            // from the data.
-            gains[istream] = 1.0;
-        } else {
-            gains[istream] = 1.0 / squanta;
+        #pragma omp for schedule(static)
+        for (int64_t istream = 0; istream < n_stream; ++istream) {
+            double * srange = block_range + 2 * istream * n_block;
+            double smin = srange[0];
+            double smax = srange[1];
+            for (int64_t iblock = 1; iblock < n_block; ++iblock) {
+                if (srange[2 * iblock] < smin) {
+                    smin = srange[2 * iblock];
+                }
+                if (srange[2 * iblock + 1] > smax) {
+                    smax = srange[2 * iblock + 1];
+                }
+            }
+            float64_params(
+                smin,
+                smax,
+                (quanta == NULL) ? NULL : &(quanta[istream]),
+                &(offsets[istream]),
+                &(gains[istream])
+            );
         }
 
-        for (int64_t isamp = 0; isamp < stream_size; ++isamp) {
-            sindx = istream * stream_size + isamp;
-            stemp = input[sindx] - offsets[istream];
-            if (stemp >= 0) {
-                output[sindx] = (int64_t)(gains[istream] * stemp + 0.5);
-            } else {
-                output[sindx] = (int64_t)(gains[istream] * stemp - 0.5);
+        #pragma omp for schedule(static)
+        for (int64_t iwork = 0; iwork < n_work; ++iwork) {
+            int64_t istream = iwork / n_block;
+            int64_t first = (iwork % n_block) * CONVERT_BLOCK;
+            int64_t n_samp = stream_size - first;
+            if (n_samp > CONVERT_BLOCK) {
+                n_samp = CONVERT_BLOCK;
+            }
+            double const * sinput = input + istream * stream_size + first;
+            int64_t * soutput = output + istream * stream_size + first;
+            double offset = offsets[istream];
+            double gain = gains[istream];
+            #pragma omp simd
+            for (int64_t isamp = 0; isamp < n_samp; ++isamp) {
+                soutput[isamp] = float64_quantize_value(sinput[isamp], offset, gain);
             }
         }
     }
+
+    free(block_range);
     return ERROR_NONE;
 }
 
@@ -335,13 +540,24 @@ void int64_to_float64(
     double const * gains,
     double * output
 ) {
-    int64_t sindx;
-    double coeff;
-    for (int64_t istream = 0; istream < n_stream; ++istream) {
-        coeff = 1.0 / gains[istream];
-        for (int64_t isamp = 0; isamp < stream_size; ++isamp) {
-            sindx = istream * stream_size + isamp;
-            output[sindx] = offsets[istream] + coeff * (double)input[sindx];
+    int64_t n_block = (stream_size + CONVERT_BLOCK - 1) / CONVERT_BLOCK;
+    int64_t n_work = n_stream * n_block;
+
+    #pragma omp parallel for schedule(static) if(n_work > 1)
+    for (int64_t iwork = 0; iwork < n_work; ++iwork) {
+        int64_t istream = iwork / n_block;
+        int64_t first = (iwork % n_block) * CONVERT_BLOCK;
+        int64_t n_samp = stream_size - first;
+        if (n_samp > CONVERT_BLOCK) {
+            n_samp = CONVERT_BLOCK;
+        }
+        int64_t const * sinput = input + istream * stream_size + first;
+        double * soutput = output + istream * stream_size + first;
+        double offset = offsets[istream];
+        double coeff = 1.0 / gains[istream];
+        #pragma omp simd
+        for (int64_t isamp = 0; isamp < n_samp; ++isamp) {
+            soutput[isamp] = offset + coeff * (double)sinput[isamp];
         }
     }
     return;
@@ -355,14 +571,82 @@ void int32_to_float32(
     float const * gains,
     float * output
 ) {
-    int64_t sindx;
-    float coeff;
-    for (int64_t istream = 0; istream < n_stream; ++istream) {
-        coeff = 1.0 / gains[istream];
-        for (int64_t isamp = 0; isamp < stream_size; ++isamp) {
-            sindx = istream * stream_size + isamp;
-            output[sindx] = offsets[istream] + coeff * (float)input[sindx];
+    int64_t n_block = (stream_size + CONVERT_BLOCK - 1) / CONVERT_BLOCK;
+    int64_t n_work = n_stream * n_block;
+
+    #pragma omp parallel for schedule(static) if(n_work > 1)
+    for (int64_t iwork = 0; iwork < n_work; ++iwork) {
+        int64_t istream = iwork / n_block;
+        int64_t first = (iwork % n_block) * CONVERT_BLOCK;
+        int64_t n_samp = stream_size - first;
+        if (n_samp > CONVERT_BLOCK) {
+            n_samp = CONVERT_BLOCK;
+        }
+        int32_t const * sinput = input + istream * stream_size + first;
+        float * soutput = output + istream * stream_size + first;
+        float offset = offsets[istream];
+        float coeff = 1.0 / gains[istream];
+        #pragma omp simd
+        for (int64_t isamp = 0; isamp < n_samp; ++isamp) {
+            soutput[isamp] = offset + coeff * (float)sinput[isamp];
         }
     }
     return;
 }
+
+// Work scheduling
+
+// Wall clock time in seconds.
+double sched_time() {
+    #ifdef _OPENMP
+    return omp_get_wtime();
+    #else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + 1.0e-9 * (double)now.tv_nsec;
+    #endif
+}
+
+typedef struct {
+    double cost;
+    int64_t item;
+} sched_entry;
+
+// Sort by decreasing cost, and by item for equal costs so that the order is
+// reproducible.
+static int sched_compare(void const * a, void const * b) {
+    sched_entry const * ea = (sched_entry const *)a;
+    sched_entry const * eb = (sched_entry const *)b;
+    if (ea->cost > eb->cost) {
+        return -1;
+    }
+    if (ea->cost < eb->cost) {
+        return 1;
+    }
+    return (ea->item > eb->item) - (ea->item < eb->item);
+}
+
+// Return the work items ordered by decreasing estimated cost.  When the items are
+// then handed out dynamically, the expensive ones start first and the cheap ones
+// fill in the gaps at the end, so threads do not sit idle while one of them
+// finishes a large item.  The caller frees the result.  Returns NULL if the
+// allocation fails.
+int64_t * sched_order(int64_t n_item, double const * cost) {
+    int64_t * order = (int64_t *)malloc(n_item * sizeof(int64_t));
+    sched_entry * entries = (sched_entry *)malloc(n_item * sizeof(sched_entry));
+    if ((order == NULL) || (entries == NULL)) {
+        free(order);
+        free(entries);
+        return NULL;
+    }
+    for (int64_t item = 0; item < n_item; ++item) {
+        entries[item].cost = cost[item];
+        entries[item].item = item;
+    }
+    qsort(entries, n_item, sizeof(sched_entry), sched_compare);
+    for (int64_t item = 0; item < n_item; ++item) {
+        order[item] = entries[item].item;
+    }
+    free(entries);
+    return order;
+}
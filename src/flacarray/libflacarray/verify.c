@@ -50,6 +50,7 @@ int verify(
     callback_data.n_decode = n_decode;
     callback_data.n_channels = n_channels;
     callback_data.err = ERROR_NONE;
+    callback_data.perf = NULL;
 
     // Allocate a temporary data buffer
     int32_t * decompressed = (int32_t *)malloc(
@@ -74,6 +75,9 @@ int verify(
         callback_data.stream_end = starts[istream] + nbytes[istream];
         callback_data.stream_pos = starts[istream];
         callback_data.decomp_nelem = 0;
+        callback_data.skip = 0;
+        callback_data.f32 = NULL;
+        callback_data.f64 = NULL;
         // Set the output buffer to the address of the beginning of this stream.
         callback_data.decompressed = decompressed + istream * n_decode * n_channels;
 
@@ -2,23 +2,49 @@
 # All rights reserved.  Use of this source code is governed by
 # a BSD-style license that can be found in the LICENSE file.
 
+"""Benchmarks of compression, decompression and I/O.
+
+The `flacarray_benchmark` command runs a set of cases on fake data and writes a
+JSON report of the timings.  A report can be compared against a saved baseline
+report, and the command exits with a non-zero status if any case is slower than
+the baseline by more than a tolerance.
+
+"""
+
 import argparse
+import datetime
+import json
 import os
+import platform
+import sys
 import time
 
 import numpy as np
-import zarr
 
+from .. import __version__ as flacarray_version
 from ..array import FlacArray
 from ..demo import create_fake_data
 from ..hdf5 import write_array as hdf5_write_array
 from ..hdf5 import read_array as hdf5_read_array
-from ..hdf5_utils import H5File
+from ..hdf5_utils import H5File, have_hdf5
+from ..libflacarray import have_flac_threads
 from ..mpi import use_mpi, MPI, distribute_and_verify
 from ..utils import print_timers
 from ..zarr import write_array as zarr_write_array
 from ..zarr import read_array as zarr_read_array
-from ..zarr import ZarrGroup
+from ..zarr import ZarrGroup, have_zarr
+
+
+# The format version of the JSON report
+report_version = 1
+
+# The compression increments used for fake data with unit variance
+bench_quanta = {
+    np.dtype(np.float32): 1.0e-6,
+    np.dtype(np.float64): 1.0e-15,
+}
+
+bench_types = ["float64", "float32", "int64", "int32"]
 
 
 def dump_debug_text(arr, dir):
@@ -95,23 +121,138 @@ def dump_debug_text(arr, dir):
         os.rename(dbgfile, outfile)
 
 
+def case_key(name, params):
+    """The unique string identifying a benchmark case in a report."""
+    pstr = ",".join([f"{k}={params[k]}" for k in sorted(params.keys())])
+    return f"{name}[{pstr}]"
+
+
+def time_case(report, name, func, params, mpi_comm=None, repeat=1, nbytes=None):
+    """Time a benchmark case and append the result to the report.
+
+    The function is called `repeat` times and the median time is reported.  With
+    MPI, all processes are synchronized before and after each call, so the time is
+    that of the slowest process.
+
+    Args:
+        report (dict):  The report to update.
+        name (str):  The name of the case.
+        func (callable):  The function to time, called with no arguments.
+        params (dict):  The parameters of this case.
+        mpi_comm (MPI.Comm):  The MPI communicator or None.
+        repeat (int):  The number of calls to time.
+        nbytes (int):  If not None, the number of uncompressed bytes processed by
+            each call (across all processes), used to compute the throughput.
+
+    Returns:
+        (object):  The return value of the last call.
+
+    """
+    rank = 0
+    if mpi_comm is not None:
+        rank = mpi_comm.rank
+    times = list()
+    result = None
+    for _ in range(repeat):
+        del result
+        if mpi_comm is not None:
+            mpi_comm.barrier()
+        start = time.perf_counter()
+        result = func()
+        if mpi_comm is not None:
+            mpi_comm.barrier()
+        stop = time.perf_counter()
+        times.append(stop - start)
+    seconds = float(np.median(times))
+    entry = {
+        "key": case_key(name, params),
+        "name": name,
+        "params": dict(params),
+        "seconds": seconds,
+        "min_seconds": float(np.min(times)),
+        "max_seconds": float(np.max(times)),
+        "repeat": repeat,
+    }
+    msg = f"  {entry['key']}:  {seconds:0.4f} s"
+    if nbytes is not None and seconds > 0:
+        entry["mbps"] = nbytes / seconds / 1.0e6
+        msg += f" ({entry['mbps']:0.1f} MB/s)"
+    report["results"].append(entry)
+    if rank == 0:
+        print(msg, flush=True)
+    return result
+
+
+def bench_data(local_shape, dtype, mpi_comm=None):
+    """Create fake data of the given type for the benchmarks.
+
+    The integer data is the quantized floating point data, and the 64bit integer
+    data has a large offset so that it does not fit in 32 bits.
+
+    """
+    data, mpi_dist = create_fake_data(local_shape, comm=mpi_comm)
+    dtype = np.dtype(dtype)
+    if dtype == np.dtype(np.float64):
+        return data, mpi_dist
+    elif dtype == np.dtype(np.float32):
+        return data.astype(np.float32), mpi_dist
+    elif dtype == np.dtype(np.int32):
+        return np.round(data * 1.0e4).astype(np.int32), mpi_dist
+    elif dtype == np.dtype(np.int64):
+        return np.round(data * 1.0e4).astype(np.int64) + 2**40, mpi_dist
+    else:
+        raise ValueError(f"Unsupported benchmark data type '{dtype}'")
+
+
 def benchmark(
     global_shape,
     dir=".",
-    keep=None,
-    stream_slice=None,
+    dtype=np.float64,
+    threads=(1,),
+    level=5,
+    slice_size=100,
+    n_access=100,
+    repeat=3,
+    io=True,
     mpi_comm=None,
-    use_threads=False,
+    report=None,
 ):
     """Run benchmarks.
 
-    This will create some fake data with the specified shape and then test different
-    writing and reading patterns.
+    This will create some fake data with the specified shape and type and then test
+    different compression, decompression, writing and reading patterns.  The cases
+    are:
+
+        - Compression, and decompression of the full array, of a keep mask of every
+          other stream, of a slice of samples, and of both, for each thread count.
+        - Random access (`__getitem__`) to single streams and to slices of single
+          streams.
+        - Writing and reading with HDF5 and Zarr, both as a FlacArray and directly
+          with `write_array` / `read_array`.
+
+    Args:
+        global_shape (tuple):  The global shape of the data.
+        dir (str):  The directory for output files.
+        dtype (np.dtype):  The type of the data.
+        threads (list):  The numbers of threads to test.  With one thread, OpenMP
+            is not used.  Decompression with threads uses all OpenMP threads.
+        level (int):  The compression level.
+        slice_size (int):  The number of samples in sliced reads.
+        n_access (int):  The number of random accesses to time.
+        repeat (int):  The number of times to repeat each case.
+        io (bool):  If True, run the I/O cases.
+        mpi_comm (MPI.Comm):  The MPI communicator or None.
+        report (dict):  The report to update, or None to create a new one.
+
+    Returns:
+        (dict):  The report.
 
     """
     rank = 0
     if mpi_comm is not None:
         rank = mpi_comm.rank
+    if report is None:
+        report = create_report(global_shape, mpi_comm=mpi_comm)
 
     if rank == 0:
         os.makedirs(dir, exist_ok=True)
@@ -124,172 +265,322 @@ def benchmark(
     local_shape.extend(global_shape[1:])
     local_shape = tuple(local_shape)
 
-    arr, mpi_dist = create_fake_data(local_shape, comm=mpi_comm)
+    dtype = np.dtype(dtype)
+    arr, mpi_dist = bench_data(local_shape, dtype, mpi_comm=mpi_comm)
+    quanta = bench_quanta.get(dtype, None)
     shpstr = "x".join([f"{x}" for x in global_shape])
-
-    # Run HDF5 tests
-
-    start = time.perf_counter()
-    flcarr = FlacArray.from_array(
-        arr, quanta=1.0e-15, mpi_comm=mpi_comm, use_threads=use_threads
-    )
+    typestr = dtype.name
+    global_bytes = arr.nbytes
     if mpi_comm is not None:
-        mpi_comm.barrier()
-    stop = time.perf_counter()
-    if rank == 0:
-        print(f"  FlacArray compress in {stop - start:0.3f} seconds", flush=True)
-
-    # dump_debug_text(flcarr, dir)
-
-    out_file = os.path.join(dir, f"io_bench_{shpstr}.h5")
-    start = time.perf_counter()
-    with H5File(out_file, "w", comm=mpi_comm) as hf:
-        flcarr.write_hdf5(hf.handle)
-    if mpi_comm is not None:
-        mpi_comm.barrier()
-    stop = time.perf_counter()
-    if rank == 0:
-        print(f"  FlacArray write HDF5 in {stop - start:0.3f} seconds", flush=True)
-
-    check = None
-    start = time.perf_counter()
-    with H5File(out_file, "r", comm=mpi_comm) as hf:
-        check = FlacArray.read_hdf5(
-            hf.handle, keep=keep, mpi_comm=mpi_comm, mpi_dist=mpi_dist
+        global_bytes = mpi_comm.allreduce(arr.nbytes)
+
+    stream_size = global_shape[-1]
+    slice_size = min(slice_size, stream_size)
+    mid = stream_size // 2
+    samp_slice = slice(mid - slice_size // 2, mid - slice_size // 2 + slice_size, 1)
+    keep = np.zeros(local_shape[:-1], dtype=bool)
+    keep.flat[::2] = True
+    keep_frac = np.count_nonzero(keep) / keep.size
+
+    base = {"dtype": typestr, "shape": shpstr, "level": level}
+
+    # Compression and decompression
+
+    flcarr = None
+    for n_thread in threads:
+        use_threads = n_thread > 1
+        params = dict(base)
+        params["threads"] = n_thread
+        del flcarr
+        flcarr = time_case(
+            report,
+            "compress",
+            lambda: FlacArray.from_array(
+                arr,
+                level=level,
+                quanta=quanta,
+                mpi_comm=mpi_comm,
+                use_threads=use_threads,
+                n_threads=n_thread,
+            ),
+            params,
+            mpi_comm=mpi_comm,
+            repeat=repeat,
+            nbytes=global_bytes,
         )
-    if mpi_comm is not None:
-        mpi_comm.barrier()
-    stop = time.perf_counter()
-    if rank == 0:
-        print(f"  FlacArray read HDF5 in {stop - start:0.3f} seconds", flush=True)
-
-    del flcarr
-    del check
-
-    return
-
-    # Run Zarr tests
-
-    flcarr = FlacArray.from_array(
-        arr, quanta=1.0e-15, mpi_comm=mpi_comm, use_threads=use_threads
-    )
-
-    out_file = os.path.join(dir, f"io_bench_{shpstr}.zarr")
-    start = time.perf_counter()
-    with ZarrGroup(out_file, mode="w", comm=mpi_comm) as zf:
-        flcarr.write_zarr(zf)
-    if mpi_comm is not None:
-        mpi_comm.barrier()
-    stop = time.perf_counter()
-    if rank == 0:
-        print(f"  FlacArray write Zarr in {stop - start:0.3f} seconds", flush=True)
-
-    check = None
-    start = time.perf_counter()
-    with ZarrGroup(out_file, mode="r", comm=mpi_comm) as zf:
-        check = FlacArray.read_zarr(zf, keep=keep, mpi_comm=mpi_comm, mpi_dist=mpi_dist)
-    if mpi_comm is not None:
-        mpi_comm.barrier()
-    stop = time.perf_counter()
-    if rank == 0:
-        print(f"  FlacArray read Zarr in {stop - start:0.3f} seconds", flush=True)
-
-    del flcarr
-    del check
-
-    # Direct I/O
-
-    # HDF5
-
-    out_file = os.path.join(dir, f"io_bench_direct_{shpstr}.h5")
-    start = time.perf_counter()
-    with H5File(out_file, "w", comm=mpi_comm) as hf:
-        hdf5_write_array(
-            arr,
-            hf.handle,
-            level=5,
-            quanta=1.0e-15,
+        if rank == 0:
+            ratio = global_bytes / flcarr.global_nbytes
+            report["ratios"][case_key("compress", params)] = ratio
+        time_case(
+            report,
+            "to_array",
+            lambda: flcarr.to_array(use_threads=use_threads),
+            params,
             mpi_comm=mpi_comm,
-            use_threads=use_threads,
-            mpi_dist=mpi_dist,
+            repeat=repeat,
+            nbytes=global_bytes,
         )
-    if mpi_comm is not None:
-        mpi_comm.barrier()
-    stop = time.perf_counter()
-    if rank == 0:
-        print(
-            f"  Direct compress and write HDF5 in {stop - start:0.3f} seconds",
-            flush=True,
+        time_case(
+            report,
+            "to_array_keep",
+            lambda: flcarr.to_array(keep=keep, use_threads=use_threads),
+            params,
+            mpi_comm=mpi_comm,
+            repeat=repeat,
+            nbytes=int(global_bytes * keep_frac),
         )
-
-    check = None
-    start = time.perf_counter()
-    with H5File(out_file, "r", comm=mpi_comm) as hf:
-        check = hdf5_read_array(
-            hf.handle,
-            keep=keep,
-            stream_slice=stream_slice,
+        time_case(
+            report,
+            "to_array_slice",
+            lambda: flcarr.to_array(stream_slice=samp_slice, use_threads=use_threads),
+            params,
             mpi_comm=mpi_comm,
-            use_threads=use_threads,
-            mpi_dist=mpi_dist,
+            repeat=repeat,
+            nbytes=global_bytes * slice_size // stream_size,
         )
-    if mpi_comm is not None:
-        mpi_comm.barrier()
-    stop = time.perf_counter()
-    if rank == 0:
-        print(
-            f"  Direct read HDF5 and decompress in {stop - start:0.3f} seconds",
-            flush=True,
+        time_case(
+            report,
+            "to_array_keep_slice",
+            lambda: flcarr.to_array(
+                keep=keep, stream_slice=samp_slice, use_threads=use_threads
+            ),
+            params,
+            mpi_comm=mpi_comm,
+            repeat=repeat,
+            nbytes=int(global_bytes * keep_frac) * slice_size // stream_size,
         )
 
-    # Zarr
+    # Random access to single streams and slices.  The time is that of all accesses.
+
+    rng = np.random.default_rng(seed=123456 + rank)
+    stream_keys = list()
+    slice_keys = list()
+    for _ in range(n_access):
+        idx = tuple([int(rng.integers(0, x)) for x in local_shape[:-1]])
+        first = int(rng.integers(0, stream_size - slice_size + 1))
+        stream_keys.append(idx)
+        slice_keys.append(idx + (slice(first, first + slice_size),))
+    params = dict(base)
+    params["n_access"] = n_access
+    time_case(
+        report,
+        "getitem_stream",
+        lambda: [flcarr[x] for x in stream_keys],
+        params,
+        mpi_comm=mpi_comm,
+        repeat=repeat,
+    )
+    time_case(
+        report,
+        "getitem_slice",
+        lambda: [flcarr[x] for x in slice_keys],
+        params,
+        mpi_comm=mpi_comm,
+        repeat=repeat,
+    )
 
-    out_file = os.path.join(dir, f"io_bench_direct_{shpstr}.zarr")
-    start = time.perf_counter()
-    with ZarrGroup(out_file, mode="w", comm=mpi_comm) as zf:
-        zarr_write_array(
-            arr,
-            zf,
-            level=5,
-            quanta=1.0e-15,
+    if not io:
+        del flcarr
+        return report
+
+    # I/O, using threads if they were requested
+
+    n_thread = max(threads)
+    use_threads = n_thread > 1
+    params = dict(base)
+    params["threads"] = n_thread
+    formats = list()
+    if have_hdf5:
+        formats.append("hdf5")
+    if have_zarr:
+        formats.append("zarr")
+
+    for fmt in formats:
+        if fmt == "hdf5":
+            ext = "h5"
+
+            def open_file(path, mode):
+                return H5File(path, mode, comm=mpi_comm)
+
+            def handle(f):
+                return f.handle
+
+            write_method = FlacArray.write_hdf5
+            read_method = FlacArray.read_hdf5
+            write_array = hdf5_write_array
+            read_array = hdf5_read_array
+        else:
+            ext = "zarr"
+
+            def open_file(path, mode):
+                return ZarrGroup(path, mode, comm=mpi_comm)
+
+            def handle(f):
+                return f
+
+            write_method = FlacArray.write_zarr
+            read_method = FlacArray.read_zarr
+            write_array = zarr_write_array
+            read_array = zarr_read_array
+
+        out_file = os.path.join(dir, f"io_bench_{typestr}_{shpstr}.{ext}")
+
+        def write_flacarray():
+            with open_file(out_file, "w") as f:
+                write_method(flcarr, handle(f))
+
+        def read_flacarray(keep=None):
+            with open_file(out_file, "r") as f:
+                return read_method(
+                    handle(f), keep=keep, mpi_comm=mpi_comm, mpi_dist=mpi_dist
+                )
+
+        time_case(
+            report,
+            f"{fmt}_write",
+            write_flacarray,
+            params,
             mpi_comm=mpi_comm,
-            use_threads=use_threads,
-            mpi_dist=mpi_dist,
+            repeat=repeat,
+            nbytes=global_bytes,
         )
-    if mpi_comm is not None:
-        mpi_comm.barrier()
-    stop = time.perf_counter()
-    if rank == 0:
-        print(
-            f"  Direct compress and write Zarr in {stop - start:0.3f} seconds",
-            flush=True,
+        time_case(
+            report,
+            f"{fmt}_read",
+            read_flacarray,
+            params,
+            mpi_comm=mpi_comm,
+            repeat=repeat,
+            nbytes=global_bytes,
+        )
+        time_case(
+            report,
+            f"{fmt}_read_keep",
+            lambda: read_flacarray(keep=keep),
+            params,
+            mpi_comm=mpi_comm,
+            repeat=repeat,
+            nbytes=int(global_bytes * keep_frac),
         )
 
-    check = None
-    start = time.perf_counter()
-    with ZarrGroup(out_file, mode="r", comm=mpi_comm) as zf:
-        check = zarr_read_array(
-            zf,
-            keep=keep,
-            stream_slice=stream_slice,
+        # Direct I/O
+
+        direct_file = os.path.join(dir, f"io_bench_direct_{typestr}_{shpstr}.{ext}")
+
+        def write_direct():
+            with open_file(direct_file, "w") as f:
+                write_array(
+                    arr,
+                    handle(f),
+                    level=level,
+                    quanta=quanta,
+                    mpi_comm=mpi_comm,
+                    use_threads=use_threads,
+                    n_threads=n_thread,
+                )
+
+        def read_direct(keep=None, stream_slice=None):
+            with open_file(direct_file, "r") as f:
+                return read_array(
+                    handle(f),
+                    keep=keep,
+                    stream_slice=stream_slice,
+                    mpi_comm=mpi_comm,
+                    use_threads=use_threads,
+                    mpi_dist=mpi_dist,
+                )
+
+        time_case(
+            report,
+            f"{fmt}_write_array",
+            write_direct,
+            params,
             mpi_comm=mpi_comm,
-            use_threads=use_threads,
-            mpi_dist=mpi_dist,
+            repeat=repeat,
+            nbytes=global_bytes,
         )
-    if mpi_comm is not None:
-        mpi_comm.barrier()
-    stop = time.perf_counter()
-    if rank == 0:
-        print(
-            f"  Direct read Zarr and decompress in {stop - start:0.3f} seconds",
-            flush=True,
+        time_case(
+            report,
+            f"{fmt}_read_array",
+            read_direct,
+            params,
+            mpi_comm=mpi_comm,
+            repeat=repeat,
+            nbytes=global_bytes,
+        )
+        time_case(
+            report,
+            f"{fmt}_read_array_keep_slice",
+            lambda: read_direct(keep=keep, stream_slice=samp_slice),
+            params,
+            mpi_comm=mpi_comm,
+            repeat=repeat,
+            nbytes=int(global_bytes * keep_frac) * slice_size // stream_size,
         )
 
-    del check
+    del flcarr
     del arr
+    return report
 
-    if rank == 0:
-        print_timers()
+
+def create_report(global_shape, mpi_comm=None):
+    """Create an empty benchmark report with a description of the environment."""
+    nproc = 1
+    if mpi_comm is not None:
+        nproc = mpi_comm.size
+    return {
+        "report_version": report_version,
+        "flacarray_version": flacarray_version,
+        "numpy_version": np.__version__,
+        "python_version": platform.python_version(),
+        "host": platform.node(),
+        "date": datetime.datetime.now(datetime.timezone.utc).isoformat(),
+        "global_shape": [int(x) for x in global_shape],
+        "mpi_processes": nproc,
+        "omp_num_threads": os.environ.get("OMP_NUM_THREADS", None),
+        "flac_native_threads": bool(have_flac_threads()),
+        "ratios": dict(),
+        "results": list(),
+    }
+
+
+def compare_reports(report, baseline, tolerance=0.2, min_seconds=1.0e-3):
+    """Compare the times of a report with a baseline report.
+
+    Cases are matched by their key (the name and parameters).  Cases which are only
+    in one of the reports are ignored, as are cases where both times are below
+    `min_seconds`, since those are dominated by noise.
+
+    Args:
+        report (dict):  The new report.
+        baseline (dict):  The baseline report.
+        tolerance (float):  The fractional slowdown above which a case is flagged.
+        min_seconds (float):  The time below which cases are not compared.
+
+    Returns:
+        (tuple):  The list of (key, baseline seconds, seconds, ratio) for all
+            compared cases, and the list of keys which are slower than the
+            baseline by more than the tolerance.
+
+    """
+    base_times = dict()
+    for entry in baseline["results"]:
+        base_times[entry["key"]] = entry["seconds"]
+    compared = list()
+    regressions = list()
+    for entry in report["results"]:
+        key = entry["key"]
+        if key not in base_times:
+            continue
+        base_sec = base_times[key]
+        sec = entry["seconds"]
+        if base_sec < min_seconds and sec < min_seconds:
+            continue
+        ratio = sec / base_sec if base_sec > 0 else float("inf")
+        compared.append((key, base_sec, sec, ratio))
+        if ratio > 1.0 + tolerance:
+            regressions.append(key)
+    return compared, regressions
 
 
 def cli():
@@ -306,12 +597,78 @@ def cli():
         default="(4,3,100000)",
         help="Global data shape (as a string)",
     )
+    parser.add_argument(
+        "--types",
+        required=False,
+        default=",".join(bench_types),
+        help="Comma separated list of data types",
+    )
+    parser.add_argument(
+        "--threads",
+        required=False,
+        default=None,
+        help="Comma separated list of thread counts (default is 1 and the maximum)",
+    )
     parser.add_argument(
         "--use_threads",
         required=False,
         default=False,
         action="store_true",
-        help="Use OpenMP threads",
+        help="Only use the maximum number of OpenMP threads",
+    )
+    parser.add_argument(
+        "--level",
+        required=False,
+        type=int,
+        default=5,
+        help="Compression level",
+    )
+    parser.add_argument(
+        "--slice_size",
+        required=False,
+        type=int,
+        default=100,
+        help="Number of samples in sliced reads",
+    )
+    parser.add_argument(
+        "--n_access",
+        required=False,
+        type=int,
+        default=100,
+        help="Number of random accesses",
+    )
+    parser.add_argument(
+        "--repeat",
+        required=False,
+        type=int,
+        default=3,
+        help="Number of times to repeat each case",
+    )
+    parser.add_argument(
+        "--no_io",
+        required=False,
+        default=False,
+        action="store_true",
+        help="Skip the HDF5 and Zarr cases",
+    )
+    parser.add_argument(
+        "--report",
+        required=False,
+        default=None,
+        help="Output JSON report (default is benchmark.json in the output directory)",
+    )
+    parser.add_argument(
+        "--baseline",
+        required=False,
+        default=None,
+        help="Baseline JSON report to compare against",
+    )
+    parser.add_argument(
+        "--tolerance",
+        required=False,
+        type=float,
+        default=0.2,
+        help="Fractional slowdown relative to the baseline which is a regression",
     )
     args = parser.parse_args()
 
@@ -324,30 +681,68 @@ def cli():
         comm = None
         rank = 0
 
-    if rank == 0:
-        print("Full Data Tests:", flush=True)
-    out = os.path.join(args.out_dir, "full")
-    benchmark(shape, dir=out, use_threads=args.use_threads, mpi_comm=comm)
-
-    # Now try with a keep mask and sample slice
-    keep = np.zeros(shape[:-1], dtype=bool)
-    for row in range(shape[0]):
-        if row % 2 == 0:
-            keep[row] = True
-    mid = shape[-1] // 2
-    samp_slice = slice(mid - 50, mid + 50, 1)
+    max_threads = os.cpu_count()
+    if "OMP_NUM_THREADS" in os.environ:
+        max_threads = int(os.environ["OMP_NUM_THREADS"])
+    if args.threads is not None:
+        threads = [int(x) for x in args.threads.split(",")]
+    elif args.use_threads:
+        threads = [max_threads]
+    else:
+        threads = sorted(set([1, max_threads]))
+
+    report = create_report(shape, mpi_comm=comm)
+    for typestr in args.types.split(","):
+        if rank == 0:
+            print(f"{typestr} data:", flush=True)
+        benchmark(
+            shape,
+            dir=args.out_dir,
+            dtype=np.dtype(typestr),
+            threads=threads,
+            level=args.level,
+            slice_size=args.slice_size,
+            n_access=args.n_access,
+            repeat=args.repeat,
+            io=(not args.no_io),
+            mpi_comm=comm,
+            report=report,
+        )
 
+    n_regress = 0
     if rank == 0:
-        print("Sliced Data Tests (100 samples from even stream indices):", flush=True)
-    out = os.path.join(args.out_dir, "sliced")
-    benchmark(
-        shape,
-        dir=out,
-        keep=keep,
-        stream_slice=samp_slice,
-        use_threads=args.use_threads,
-        mpi_comm=comm,
-    )
+        print_timers()
+        report_file = args.report
+        if report_file is None:
+            report_file = os.path.join(args.out_dir, "benchmark.json")
+        with open(report_file, "w") as f:
+            json.dump(report, f, indent=2)
+        print(f"Wrote report to {report_file}", flush=True)
+
+        if args.baseline is not None:
+            with open(args.baseline, "r") as f:
+                baseline = json.load(f)
+            compared, regressions = compare_reports(
+                report, baseline, tolerance=args.tolerance
+            )
+            print(f"Comparison with {args.baseline}:", flush=True)
+            for key, base_sec, sec, ratio in compared:
+                flag = "  SLOWER" if key in regressions else ""
+                print(
+                    f"  {key}:  {base_sec:0.4f} s -> {sec:0.4f} s ({ratio:0.2f}x){flag}",
+                    flush=True,
+                )
+            n_regress = len(regressions)
+            if n_regress > 0:
+                print(
+                    f"{n_regress} cases are more than {100 * args.tolerance:0.0f}% "
+                    "slower than the baseline",
+                    flush=True,
+                )
+    if comm is not None:
+        n_regress = comm.bcast(n_regress, root=0)
+    if n_regress > 0:
+        sys.exit(1)
 
 
 if __name__ == "__main__":
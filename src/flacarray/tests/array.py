@@ -4,15 +4,16 @@
 
 import os
 import unittest
+from concurrent.futures import ThreadPoolExecutor
 
 import numpy as np
 
 from ..array import FlacArray
 from ..compress import array_compress
-from ..decompress import array_decompress
+from ..decompress import array_decompress, array_decompress_slice
 from ..demo import create_fake_data
 from ..mpi import use_mpi, MPI
-from ..utils import float_to_int, int_to_float
+from ..utils import float_to_int, int_to_float, keep_select, select_keep_indices
 
 
 class ArrayTest(unittest.TestCase):
@@ -281,3 +282,332 @@ class ArrayTest(unittest.TestCase):
                     msg += f" and data range ({q_err})"
                     print(msg, flush=True)
                     self.assertTrue(False)
+
+    def test_seek_table(self):
+        data_shape = (4, 3, 20000)
+        for dt, dtstr, sigma, quant in [
+            (np.dtype(np.int32), "i32", None, None),
+            (np.dtype(np.float64), "f64", 1.0, 1.0e-15),
+        ]:
+            input, _ = create_fake_data(data_shape, sigma=sigma, dtype=dt, comm=None)
+            farray = FlacArray.from_array(input, quanta=quant, seek_table=True)
+            if farray.frame_size is None or farray.stream_frames is None:
+                print(f"FAIL on {dtstr} missing seek table")
+                self.assertTrue(False)
+            if farray != FlacArray(farray):
+                print(f"FAIL on {dtstr} seek table array copy")
+                self.assertTrue(False)
+            plain = FlacArray.from_array(input, quanta=quant)
+            if plain.stream_frames is not None or farray == plain:
+                print(f"FAIL on {dtstr} seek table array equal to plain array")
+                self.assertTrue(False)
+
+            for dslc in [
+                (1, slice(None), slice(4095, 4097)),
+                (slice(1, 3), 2, slice(10000, 19999)),
+                (slice(None), slice(0, 2), slice(12345, 12346)),
+            ]:
+                check = input[dslc]
+                fcheck = farray[dslc]
+                if dtstr == "f64":
+                    fail = not np.allclose(fcheck, check, atol=1e-6)
+                else:
+                    fail = not np.array_equal(fcheck, check)
+                if fail:
+                    print(f"FAIL on {dtstr} seek table slice {dslc}", flush=True)
+                    self.assertTrue(False)
+
+    def test_segmented(self):
+        data_shape = (4, 3, 20000)
+        segment_size = 3000
+        for dt, dtstr, sigma, quant in [
+            (np.dtype(np.int32), "i32", None, None),
+            (np.dtype(np.int64), "i64", None, None),
+            (np.dtype(np.float32), "f32", 1.0, 1.0e-7),
+        ]:
+            input, _ = create_fake_data(data_shape, sigma=sigma, dtype=dt, comm=None)
+            farray = FlacArray.from_array(
+                input, quanta=quant, use_threads=True, segment_size=segment_size
+            )
+            if farray.segment_size != segment_size:
+                print(f"FAIL on {dtstr} segment size {farray.segment_size}")
+                self.assertTrue(False)
+            if farray.stream_segments.shape != data_shape[:-1] + (7,):
+                print(f"FAIL on {dtstr} segments {farray.stream_segments.shape}")
+                self.assertTrue(False)
+
+            # Compare to the same data without segments
+            plain = FlacArray.from_array(input, quanta=quant)
+            if farray == plain:
+                print(f"FAIL on {dtstr} segmented array equal to plain array")
+                self.assertTrue(False)
+            if farray != FlacArray(farray):
+                print(f"FAIL on {dtstr} segmented array copy")
+                self.assertTrue(False)
+
+            for dslc in [
+                (slice(None), slice(None), slice(None)),
+                (1, slice(None), slice(2999, 6001)),
+                (slice(1, 3), 2, slice(19000, 20000)),
+                (0, 0, slice(12345, 12346)),
+            ]:
+                check = input[dslc]
+                fcheck = farray[dslc]
+                if dtstr == "f32":
+                    fail = not np.allclose(fcheck, check, atol=1e-6)
+                else:
+                    fail = not np.array_equal(fcheck, check)
+                if fail:
+                    print(f"FAIL on {dtstr} segmented slice {dslc}", flush=True)
+                    self.assertTrue(False)
+
+    def test_concurrent(self):
+        # Compress distinct arrays and decompress a shared array from several Python
+        # threads at once.  The results must match the serial ones.
+        data_shape = (4, 20000)
+        inputs = list()
+        for seed in range(4):
+            input, _ = create_fake_data(
+                data_shape, sigma=1.0, dtype=np.float64, seed=seed, comm=None
+            )
+            inputs.append(input)
+        serial = [
+            FlacArray.from_array(x, quanta=1.0e-6, segment_size=5000) for x in inputs
+        ]
+        shared = serial[0]
+        check = shared.to_array()
+        slc = (slice(1, 3), slice(1234, 15678))
+
+        def _work(indx):
+            farray = FlacArray.from_array(
+                inputs[indx % 4], quanta=1.0e-6, segment_size=5000, use_threads=True
+            )
+            return (
+                farray,
+                shared.to_array(use_threads=(indx % 2 == 0)),
+                shared[slc],
+            )
+
+        with ThreadPoolExecutor(max_workers=4) as pool:
+            results = list(pool.map(_work, range(8)))
+        for indx, (farray, full, part) in enumerate(results):
+            if farray != serial[indx % 4]:
+                print(f"FAIL on concurrent compress {indx}", flush=True)
+                self.assertTrue(False)
+            if not np.array_equal(full, check) or not np.array_equal(part, check[slc]):
+                print(f"FAIL on concurrent decompress {indx}", flush=True)
+                self.assertTrue(False)
+
+    def test_decode_out(self):
+        # Decompress into blocks of rows of a larger preallocated matrix, which are
+        # strided views.  The rest of the matrix must be left untouched.
+        data_shape = (4, 3, 5000)
+        for dt, dtstr, sigma, quant in [
+            (np.dtype(np.int32), "i32", None, None),
+            (np.dtype(np.int64), "i64", None, None),
+            (np.dtype(np.float32), "f32", 1.0, 1.0e-6),
+            (np.dtype(np.float64), "f64", 1.0, 1.0e-15),
+        ]:
+            input, _ = create_fake_data(data_shape, sigma=sigma, dtype=dt, comm=None)
+            farray = FlacArray.from_array(input, quanta=quant, segment_size=2000)
+            check = farray.to_array()
+            fill = np.array(-7, dtype=dt)
+
+            # Full streams into a block of rows, and with a keep mask
+            buffer = np.full((20, 6000), fill, dtype=dt)
+            out = buffer[2:14, 500:5500].reshape((4, 3, 5000))
+            result = farray.to_array(out=out, use_threads=True)
+            keep = np.zeros(data_shape[:-1], dtype=bool)
+            keep[1, :] = True
+            keep[3, 1] = True
+            kept = farray.to_array(keep=keep, out=buffer[15:19, 1000:6000])
+            fail = result is not out
+            fail = fail or not np.array_equal(out, check)
+            fail = fail or not np.array_equal(kept, check[keep])
+            untouched = np.ones(buffer.shape, dtype=bool)
+            untouched[2:14, 500:5500] = False
+            untouched[15:19, 1000:6000] = False
+            fail = fail or not np.all(buffer[untouched] == fill)
+            if fail:
+                print(f"FAIL on {dtstr} to_array into strided output", flush=True)
+                self.assertTrue(False)
+
+            # Slices into views with negative and non-unit stream strides
+            for dslc in [
+                (1, slice(None), slice(1999, 4001)),
+                (slice(None), 2, slice(123, 124)),
+                (slice(None), slice(None), 4321),
+            ]:
+                expected = check[dslc]
+                lead = expected.shape[:-1] if expected.ndim > 1 else ()
+                nsamp = expected.shape[-1]
+                if isinstance(dslc[-1], int):
+                    lead = expected.shape
+                    nsamp = 1
+                block = np.full((2 * int(np.prod(lead)), nsamp + 3), fill, dtype=dt)
+                view = block[::-2, 1 : nsamp + 1]
+                if isinstance(dslc[-1], int):
+                    view = view[:, 0]
+                out = view.reshape(expected.shape)
+                farray.get(dslc, out=out)
+                fail = not np.array_equal(out, expected)
+                fail = fail or np.count_nonzero(block != fill) > expected.size
+                if fail:
+                    print(f"FAIL on {dtstr} slice {dslc} into strided output")
+                    self.assertTrue(False)
+
+            # Bad outputs are rejected
+            for bad in [
+                np.zeros(data_shape, dtype=np.int16),
+                np.zeros((4, 3, 4999), dtype=dt),
+                np.zeros((4, 3, 10000), dtype=dt)[..., ::2],
+            ]:
+                with self.assertRaises((RuntimeError, ValueError)):
+                    farray.to_array(out=bad)
+
+    def test_index_arrays(self):
+        # Select streams with integer and boolean index arrays, which must match
+        # the same selection of the numpy array.
+        data_shape = (4, 3, 2000)
+        mask = np.zeros(data_shape[:-1], dtype=bool)
+        mask[0, 2] = True
+        mask[2, :2] = True
+        for dt, dtstr, sigma, quant in [
+            (np.dtype(np.int32), "i32", None, None),
+            (np.dtype(np.int64), "i64", None, None),
+            (np.dtype(np.float32), "f32", 1.0, 1.0e-6),
+        ]:
+            input, _ = create_fake_data(data_shape, sigma=sigma, dtype=dt, comm=None)
+            farray = FlacArray.from_array(
+                input, quanta=quant, segment_size=700, checksums=True
+            )
+            # Arrays which differ only in their checksums are not equal
+            plain = FlacArray.from_array(input, quanta=quant, segment_size=700)
+            other = FlacArray(farray)
+            other.stream_checksums[0, 0] ^= 1
+            if farray == plain or farray == other:
+                print(f"FAIL on {dtstr} equality of checksums", flush=True)
+                self.assertTrue(False)
+            check = farray.to_array()
+            for dslc in [
+                ([3, 0, 2],),
+                (np.array([1, 1, 0]), slice(None), slice(100, 900)),
+                (slice(None), [2, 0], 1500),
+                (np.array([[0, 3], [1, 2]]), 2),
+                ([0, 3], [2, 1], slice(650, 1450)),
+                (mask, slice(10, 20)),
+                (np.array([True, False, False, True]), 1, slice(5, 10)),
+                (1, np.array([], dtype=np.int64)),
+            ]:
+                expected = check[dslc]
+                result = farray[dslc]
+                if result.shape != expected.shape or not np.array_equal(
+                    result, expected
+                ):
+                    print(f"FAIL on {dtstr} index {dslc}", flush=True)
+                    self.assertTrue(False)
+
+            # Decode an arbitrary order of flat stream indices, with checksums
+            streams = np.array([[11, 0], [4, 4]], dtype=np.int64)
+            result, _ = array_decompress_slice(
+                farray.compressed,
+                farray.stream_size,
+                farray.stream_starts,
+                farray.stream_nbytes,
+                stream_offsets=farray.stream_offsets,
+                stream_gains=farray.stream_gains,
+                first_stream_sample=300,
+                last_stream_sample=1600,
+                is_int64=(dt == np.dtype(np.int64)),
+                use_threads=True,
+                stream_aux=farray.stream_aux,
+                verify=True,
+                streams=streams,
+            )
+            flat = check.reshape((-1, data_shape[-1]))
+            if not np.array_equal(result, flat[streams, 300:1600]):
+                print(f"FAIL on {dtstr} decode of stream indices", flush=True)
+                self.assertTrue(False)
+            with self.assertRaises(IndexError):
+                farray[np.array([0, 4]), 1]
+            with self.assertRaises(RuntimeError):
+                array_decompress_slice(
+                    farray.compressed,
+                    farray.stream_size,
+                    farray.stream_starts,
+                    farray.stream_nbytes,
+                    stream_offsets=farray.stream_offsets,
+                    stream_gains=farray.stream_gains,
+                    is_int64=(dt == np.dtype(np.int64)),
+                    stream_aux=farray.stream_aux,
+                    streams=np.array([12]),
+                )
+
+        # The vectorized keep helpers match an explicit loop over the mask
+        starts = np.arange(12, dtype=np.int64).reshape(mask.shape) * 100
+        nbytes = starts + 7
+        segments = np.arange(24, dtype=np.int64).reshape(mask.shape + (2,))
+        kstarts, knbytes, indices = keep_select(mask, starts, nbytes)
+        loop = [x for x in np.ndindex(mask.shape) if mask[x]]
+        fail = indices != loop
+        fail = fail or not np.array_equal(kstarts, [starts[x] for x in loop])
+        fail = fail or not np.array_equal(knbytes, [nbytes[x] for x in loop])
+        ksegs = select_keep_indices(segments, indices)
+        fail = fail or not np.array_equal(ksegs, [segments[x] for x in loop])
+        if fail:
+            print("FAIL on keep selection helpers", flush=True)
+            self.assertTrue(False)
+
+    def test_decode_cache(self):
+        # Overlapping slices decoded with the cache of decoded blocks must match
+        # the numpy array, whether the blocks are found, missing or evicted.
+        data_shape = (4, 3, 5000)
+        for dt, dtstr, sigma, quant in [
+            (np.dtype(np.int32), "i32", None, None),
+            (np.dtype(np.float64), "f64", 1.0, 1.0e-15),
+        ]:
+            input, _ = create_fake_data(data_shape, sigma=sigma, dtype=dt, comm=None)
+            farray = FlacArray.from_array(
+                input, quanta=quant, segment_size=1500, seek_table=True
+            )
+            check = farray.to_array()
+            if farray.decode_cache is not None:
+                print(f"FAIL on {dtstr} decode cache enabled by default", flush=True)
+                self.assertTrue(False)
+            slices = [
+                (slice(1, 3), slice(None), slice(1000, 2000)),
+                (2, 1, slice(1500, 2500)),
+                (np.array([3, 1]), 0, slice(900, 1100)),
+                (slice(None), 2, 4999),
+                (slice(1, 3), slice(None), slice(1000, 2000)),
+            ]
+            for max_bytes, block_size in [
+                (1 << 24, 256),
+                (1 << 24, None),
+                (4096, 700),
+            ]:
+                farray.set_decode_cache(max_bytes, block_size=block_size)
+                for dslc in slices:
+                    expected = check[dslc]
+                    result = farray[dslc]
+                    if result.shape != expected.shape or not np.array_equal(
+                        result, expected
+                    ):
+                        print(f"FAIL on {dtstr} cached slice {dslc}", flush=True)
+                        self.assertTrue(False)
+                out = np.zeros((2, 3, 500), dtype=dt)
+                farray.get((slice(0, 2), slice(None), slice(1800, 2300)), out=out)
+                if not np.array_equal(out, check[0:2, :, 1800:2300]):
+                    print(f"FAIL on {dtstr} cached slice into output", flush=True)
+                    self.assertTrue(False)
+                stats = farray.decode_cache.stats()
+                if stats["misses"] == 0 or stats["nbytes"] > max_bytes:
+                    print(f"FAIL on {dtstr} decode cache stats {stats}", flush=True)
+                    self.assertTrue(False)
+                if max_bytes > 4096 and stats["hits"] == 0:
+                    print(f"FAIL on {dtstr} decode cache stats {stats}", flush=True)
+                    self.assertTrue(False)
+            farray.set_decode_cache(None)
+            if farray.decode_cache is not None:
+                print(f"FAIL on {dtstr} decode cache not disabled", flush=True)
+                self.assertTrue(False)
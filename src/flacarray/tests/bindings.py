@@ -15,9 +15,18 @@ from ..libflacarray import (
     wrap_decode_i32,
     wrap_decode_i64,
     encode_flac,
+    encode_flac_float,
     decode_flac,
+    decode_flac_float,
+    verify_flac,
+    clear_pools,
+    have_flac_threads,
+    thread_stats,
+    enable_counters,
+    get_counters,
 )
 from ..demo import create_fake_data
+from ..utils import float_to_int, int_to_float
 
 
 class BindingsTest(unittest.TestCase):
@@ -228,3 +237,773 @@ class BindingsTest(unittest.TestCase):
                     print(f"input_{dtstr}_{shpstr} = {input[slc]}", flush=True)
                     print(f"FAIL on {dtstr} roundtrip slice {slc}", flush=True)
                     self.assertTrue(False)
+
+    def test_pool_reuse(self):
+        level = 5
+        data_shape = (50, 500)
+        stream_len = data_shape[-1]
+        input, _ = create_fake_data(
+            data_shape, dtype=np.dtype(np.int32), sigma=None, comm=None
+        )
+        first = stream_len // 2 - 5
+        last = stream_len // 2 + 5
+
+        # Repeated calls reuse the encoders and decoders of each thread.
+        for iter in range(4):
+            for use_threads in [False, True]:
+                (compressed, stream_starts, stream_nbytes) = encode_flac(
+                    input, level, use_threads=use_threads
+                )
+                output = decode_flac(
+                    compressed,
+                    stream_starts,
+                    stream_nbytes,
+                    stream_len,
+                    use_threads=use_threads,
+                )
+                if not np.array_equal(output, input):
+                    print(f"FAIL on pool reuse iteration {iter}", flush=True)
+                    self.assertTrue(False)
+                output = decode_flac(
+                    compressed,
+                    stream_starts,
+                    stream_nbytes,
+                    stream_len,
+                    first_sample=first,
+                    last_sample=last,
+                    use_threads=use_threads,
+                )
+                if not np.array_equal(output, input[:, first:last]):
+                    print(f"FAIL on pool reuse slice iteration {iter}", flush=True)
+                    self.assertTrue(False)
+            if iter == 1:
+                clear_pools()
+
+        # A failed decode should not leave a broken decoder in the pool.
+        corrupt = np.zeros_like(compressed)
+        with self.assertRaises(RuntimeError):
+            _ = decode_flac(corrupt, stream_starts, stream_nbytes, stream_len)
+        output = decode_flac(compressed, stream_starts, stream_nbytes, stream_len)
+        if not np.array_equal(output, input):
+            print("FAIL on decode after pool error", flush=True)
+            self.assertTrue(False)
+
+    def test_threaded_output(self):
+        # The threaded encoder compacts the streams in place.  The result should be
+        # identical to the serial encoder.
+        level = 5
+        for dt in [np.dtype(np.int32), np.dtype(np.int64)]:
+            input, _ = create_fake_data((20, 3000), dtype=dt, sigma=None, comm=None)
+            (comp_serial, starts_serial, nbytes_serial) = encode_flac(
+                input, level, use_threads=False
+            )
+            (comp_thread, starts_thread, nbytes_thread) = encode_flac(
+                input, level, use_threads=True
+            )
+            if not np.array_equal(starts_serial, starts_thread):
+                print(f"FAIL {dt} starts {starts_serial} != {starts_thread}")
+                self.assertTrue(False)
+            if not np.array_equal(nbytes_serial, nbytes_thread):
+                print(f"FAIL {dt} nbytes {nbytes_serial} != {nbytes_thread}")
+                self.assertTrue(False)
+            if not np.array_equal(comp_serial, comp_thread):
+                print(f"FAIL {dt} compressed bytes differ")
+                self.assertTrue(False)
+
+    def test_segmented(self):
+        level = 5
+        data_shape = (3, 20000)
+        stream_len = data_shape[-1]
+        segment_size = 4096
+        slices = [
+            (0, 10),
+            (100, 4096),
+            (4000, 4200),
+            (4095, 12289),
+            (stream_len - 50, stream_len),
+        ]
+        for dt in [np.dtype(np.int32), np.dtype(np.int64)]:
+            input, _ = create_fake_data(data_shape, dtype=dt, sigma=None, comm=None)
+
+            # Segments require the auxiliary data to be returned
+            with self.assertRaises(RuntimeError):
+                _ = encode_flac(input, level, segment_size=segment_size)
+
+            results = list()
+            for use_threads in [False, True]:
+                (compressed, stream_starts, stream_nbytes, stream_aux) = encode_flac(
+                    input,
+                    level,
+                    use_threads=use_threads,
+                    segment_size=segment_size,
+                    return_aux=True,
+                )
+                results.append((compressed, stream_starts, stream_aux))
+                segs = stream_aux["stream_segments"]
+                if segs.shape != (data_shape[0], 5) or np.any(segs[:, 0] != 0):
+                    print(f"FAIL on {dt} segment starts {segs}", flush=True)
+                    self.assertTrue(False)
+
+                output = decode_flac(
+                    compressed,
+                    stream_starts,
+                    stream_nbytes,
+                    stream_len,
+                    use_threads=use_threads,
+                    is_int64=(dt == np.dtype(np.int64)),
+                    stream_aux=stream_aux,
+                )
+                if not np.array_equal(output, input):
+                    print(f"FAIL on {dt} segmented roundtrip", flush=True)
+                    self.assertTrue(False)
+
+                for first, last in slices:
+                    output = decode_flac(
+                        compressed,
+                        stream_starts,
+                        stream_nbytes,
+                        stream_len,
+                        first_sample=first,
+                        last_sample=last,
+                        use_threads=use_threads,
+                        is_int64=(dt == np.dtype(np.int64)),
+                        stream_aux=stream_aux,
+                    )
+                    if not np.array_equal(output, input[:, first:last]):
+                        msg = f"FAIL on {dt} segmented slice {first}:{last}"
+                        print(msg, flush=True)
+                        self.assertTrue(False)
+
+            # Serial and threaded encoding should produce the same bytes
+            if not np.array_equal(results[0][0], results[1][0]) or not np.array_equal(
+                results[0][2]["stream_segments"], results[1][2]["stream_segments"]
+            ):
+                print(f"FAIL on {dt} segmented serial / threaded", flush=True)
+                self.assertTrue(False)
+
+    def test_seek_table(self):
+        level = 5
+        data_shape = (3, 20000)
+        stream_len = data_shape[-1]
+        slices = [
+            (0, 10),
+            (4095, 4097),
+            (8192, 8193),
+            (5000, 17000),
+            (stream_len - 50, stream_len),
+        ]
+        for dt in [np.dtype(np.int32), np.dtype(np.int64)]:
+            input, _ = create_fake_data(data_shape, dtype=dt, sigma=None, comm=None)
+
+            # The seek table requires the auxiliary data to be returned
+            with self.assertRaises(RuntimeError):
+                _ = encode_flac(input, level, seek_table=True)
+
+            for segment_size, n_frame in [(None, 5), (6000, 7)]:
+                results = list()
+                for use_threads in [False, True]:
+                    (compressed, stream_starts, stream_nbytes, stream_aux) = (
+                        encode_flac(
+                            input,
+                            level,
+                            use_threads=use_threads,
+                            segment_size=segment_size,
+                            return_aux=True,
+                            seek_table=True,
+                        )
+                    )
+                    results.append((compressed, stream_aux))
+                    frames = stream_aux["stream_frames"]
+                    if (
+                        stream_aux["frame_size"] != 4096
+                        or frames.shape != (data_shape[0], n_frame)
+                        or np.any(np.diff(frames, axis=-1) <= 0)
+                    ):
+                        msg = f"FAIL on {dt} seek table {segment_size}: {frames}"
+                        print(msg, flush=True)
+                        self.assertTrue(False)
+
+                    for first, last in slices:
+                        output = decode_flac(
+                            compressed,
+                            stream_starts,
+                            stream_nbytes,
+                            stream_len,
+                            first_sample=first,
+                            last_sample=last,
+                            use_threads=use_threads,
+                            is_int64=(dt == np.dtype(np.int64)),
+                            stream_aux=stream_aux,
+                        )
+                        if not np.array_equal(output, input[:, first:last]):
+                            msg = f"FAIL on {dt} seek table {segment_size} slice "
+                            msg += f"{first}:{last}"
+                            print(msg, flush=True)
+                            self.assertTrue(False)
+
+                # The table does not change the compressed bytes, and does not
+                # depend on threading.
+                (compressed, _, _, stream_aux) = encode_flac(
+                    input, level, segment_size=segment_size, return_aux=True
+                )
+                if not np.array_equal(results[0][0], compressed):
+                    print(f"FAIL on {dt} seek table changed bytes", flush=True)
+                    self.assertTrue(False)
+                if not np.array_equal(
+                    results[0][1]["stream_frames"], results[1][1]["stream_frames"]
+                ):
+                    print(f"FAIL on {dt} seek table serial / threaded", flush=True)
+                    self.assertTrue(False)
+
+    def test_narrow(self):
+        # Streams are encoded with their narrowest representation.  64bit streams
+        # which fit in 32 bits use a single channel, which gives the same bytes as
+        # encoding the equivalent 32bit stream.
+        level = 5
+        stream_len = 10000
+        rng = np.random.default_rng(12345)
+        small = rng.integers(-100, 100, size=(2, stream_len), dtype=np.int32)
+        wide = rng.integers(-(2**40), 2**40, size=(1, stream_len), dtype=np.int64)
+        for use_threads in [False, True]:
+            comp32, starts32, nbytes32 = encode_flac(
+                small, level, use_threads=use_threads
+            )
+            comp64, starts64, nbytes64 = encode_flac(
+                small.astype(np.int64), level, use_threads=use_threads
+            )
+            if not np.array_equal(comp32, comp64):
+                print("FAIL on narrowed int64 bytes", flush=True)
+                self.assertTrue(False)
+
+            # Mix of narrow and wide streams, including the int32 extremes.
+            mixed = np.concatenate([small.astype(np.int64), wide], axis=0)
+            mixed[0, :2] = [np.iinfo(np.int32).min, np.iinfo(np.int32).max]
+            mixed[1, 0] = np.iinfo(np.int32).max + 1
+            (compressed, stream_starts, stream_nbytes, stream_aux) = encode_flac(
+                mixed, level, use_threads=use_threads, return_aux=True, seek_table=True
+            )
+            for first, last in [(-1, -1), (10, 20), (4090, 9000)]:
+                output = decode_flac(
+                    compressed,
+                    stream_starts,
+                    stream_nbytes,
+                    stream_len,
+                    first_sample=first,
+                    last_sample=last,
+                    use_threads=use_threads,
+                    is_int64=True,
+                    stream_aux=stream_aux,
+                )
+                check = mixed if first < 0 else mixed[:, first:last]
+                if not np.array_equal(output, check):
+                    print(f"FAIL on mixed width streams {first}:{last}", flush=True)
+                    self.assertTrue(False)
+
+    def test_float_encode(self):
+        # Quantizing while encoding gives the same result as converting the whole
+        # array to integers first.
+        level = 5
+        stream_len = 20000
+        for dt in [np.dtype(np.float32), np.dtype(np.float64)]:
+            input, _ = create_fake_data((3, stream_len), dtype=dt, comm=None)
+            n_stream = input.shape[0]
+            for quanta in [None, 1.0e-3 * np.ones(n_stream, dtype=dt)]:
+                idata, ioff, igain = float_to_int(input, quanta=quanta)
+                for use_threads in [False, True]:
+                    for segment_size in [None, 6000]:
+                        check = encode_flac(
+                            idata,
+                            level,
+                            use_threads=use_threads,
+                            segment_size=segment_size,
+                            return_aux=True,
+                            seek_table=True,
+                        )
+                        result = encode_flac_float(
+                            input,
+                            level,
+                            quanta=quanta,
+                            use_threads=use_threads,
+                            segment_size=segment_size,
+                            return_aux=True,
+                            seek_table=True,
+                        )
+                        (comp, starts, nbytes, offsets, gains, aux) = result
+                        same = (
+                            np.array_equal(comp, check[0])
+                            and np.array_equal(starts, check[1])
+                            and np.array_equal(nbytes, check[2])
+                            and np.array_equal(offsets, ioff)
+                            and np.array_equal(gains, igain)
+                            and np.array_equal(
+                                aux["stream_frames"], check[3]["stream_frames"]
+                            )
+                        )
+                        if segment_size is not None:
+                            same = same and np.array_equal(
+                                aux["stream_segments"], check[3]["stream_segments"]
+                            )
+                        if not same:
+                            msg = f"FAIL on {dt} fused encode, quanta={quanta}, "
+                            msg += f"threads={use_threads}, segments={segment_size}"
+                            print(msg, flush=True)
+                            self.assertTrue(False)
+
+    def test_float_decode(self):
+        # Dequantizing while decoding gives the same result as decoding the integers
+        # and then converting the whole array.
+        level = 5
+        stream_len = 20000
+        for dt in [np.dtype(np.float32), np.dtype(np.float64)]:
+            input, _ = create_fake_data((3, stream_len), dtype=dt, comm=None)
+            # One stream with a wide range, so 64bit data uses both channels.
+            input[1, :] *= 1.0e6
+            quanta = 1.0e-3 * np.ones(3, dtype=dt)
+            is_int64 = dt == np.dtype(np.float64)
+            for segment_size in [None, 6000]:
+                (comp, starts, nbytes, offsets, gains, aux) = encode_flac_float(
+                    input,
+                    level,
+                    quanta=quanta,
+                    segment_size=segment_size,
+                    return_aux=True,
+                    seek_table=True,
+                )
+                for use_threads in [False, True]:
+                    for first, last in [(-1, -1), (10, 20), (5000, 13000)]:
+                        idata = decode_flac(
+                            comp,
+                            starts,
+                            nbytes,
+                            stream_len,
+                            first_sample=first,
+                            last_sample=last,
+                            use_threads=use_threads,
+                            is_int64=is_int64,
+                            stream_aux=aux,
+                        )
+                        check = int_to_float(idata, offsets, gains)
+                        output = decode_flac_float(
+                            comp,
+                            starts,
+                            nbytes,
+                            stream_len,
+                            offsets,
+                            gains,
+                            first_sample=first,
+                            last_sample=last,
+                            use_threads=use_threads,
+                            stream_aux=aux,
+                        )
+                        if output.dtype != dt or not np.array_equal(output, check):
+                            msg = f"FAIL on {dt} fused decode {first}:{last}, "
+                            msg += f"threads={use_threads}, segments={segment_size}"
+                            print(msg, flush=True)
+                            self.assertTrue(False)
+
+    def test_thread_stats(self):
+        # Streams with very different costs are scheduled by cost.  The output must
+        # not depend on the order, and every item is accounted for in the stats.
+        level = 5
+        stream_len = 20000
+        rng = np.random.default_rng(54321)
+        input = np.zeros((9, stream_len), dtype=np.int64)
+        input[1::3] = rng.integers(-(2**40), 2**40, size=(3, stream_len))
+        input[2::3] = rng.integers(-100, 100, size=(3, stream_len))
+        serial = encode_flac(input, level, segment_size=5000, return_aux=True)
+        for n_threads in [2, 3]:
+            result = encode_flac(
+                input,
+                level,
+                use_threads=True,
+                segment_size=5000,
+                return_aux=True,
+                n_threads=n_threads,
+            )
+            stats = thread_stats()
+            if not np.array_equal(result[0], serial[0]) or stats is None:
+                print(f"FAIL on scheduled encode with {n_threads} threads", flush=True)
+                self.assertTrue(False)
+            if stats["n_item"] != 36 or np.sum(stats["items"]) != 36:
+                print(f"FAIL on encode stats {stats}", flush=True)
+                self.assertTrue(False)
+            if stats["imbalance"] < 1.0 or stats["n_thread"] != n_threads:
+                print(f"FAIL on encode imbalance {stats}", flush=True)
+                self.assertTrue(False)
+
+        (compressed, stream_starts, stream_nbytes, stream_aux) = serial
+        for use_threads in [False, True]:
+            output = decode_flac(
+                compressed,
+                stream_starts,
+                stream_nbytes,
+                stream_len,
+                first_sample=100,
+                last_sample=12000,
+                use_threads=use_threads,
+                is_int64=True,
+                stream_aux=stream_aux,
+            )
+            stats = thread_stats()
+            if not np.array_equal(output, input[:, 100:12000]):
+                print(f"FAIL on scheduled decode threads={use_threads}", flush=True)
+                self.assertTrue(False)
+            if stats["n_item"] != 27 or np.sum(stats["items"]) != 27:
+                print(f"FAIL on decode stats {stats}", flush=True)
+                self.assertTrue(False)
+
+    def test_counters(self):
+        # Every byte written by the encoder and every item is counted, on any
+        # thread, and nothing is counted while the counters are disabled.
+        level = 5
+        stream_len = 20000
+        input, _ = create_fake_data((4, stream_len), comm=None)
+        enable_counters(True)
+        get_counters(reset=True)
+        for use_threads in [False, True]:
+            (compressed, starts, nbytes, offsets, gains, aux) = encode_flac_float(
+                input,
+                level,
+                quanta=1.0e-6,
+                use_threads=use_threads,
+                segment_size=5000,
+                return_aux=True,
+            )
+            counts = get_counters(reset=True)
+            if (
+                counts["enc_items"] != 16
+                or counts["enc_bytes"] != len(compressed)
+                or counts["enc_writes"] < 16
+                or counts["convert"] <= 0.0
+                or counts["convert"] > counts["enc_process"]
+            ):
+                print(f"FAIL on encode counters {counts}", flush=True)
+                self.assertTrue(False)
+
+            # A slice of samples within two segments, found by seeking.
+            decode_flac_float(
+                compressed,
+                starts,
+                nbytes,
+                stream_len,
+                offsets,
+                gains,
+                first_sample=4000,
+                last_sample=6000,
+                use_threads=use_threads,
+                stream_aux=aux,
+            )
+            counts = get_counters(reset=True)
+            if (
+                counts["dec_items"] != 8
+                or counts["dec_reads"] == 0
+                or counts["dec_bytes"] == 0
+                or counts["dec_seeks"] == 0
+                or counts["dec_setup"] <= 0.0
+            ):
+                print(f"FAIL on decode counters {counts}", flush=True)
+                self.assertTrue(False)
+
+        enable_counters(False)
+        encode_flac(input.astype(np.int32), level)
+        counts = get_counters(reset=True)
+        if counts["enc_items"] != 0 or counts["enc_bytes"] != 0:
+            print(f"FAIL on disabled counters {counts}", flush=True)
+            self.assertTrue(False)
+
+    def test_thread_count(self):
+        # With few streams, any extra threads are used inside the FLAC encoders
+        # (if supported), with or without OpenMP threads.  The result must not
+        # depend on the thread count.
+        level = 5
+        print(f"libFLAC native threads = {have_flac_threads()}", flush=True)
+        for dt in [np.dtype(np.int32), np.dtype(np.int64), np.dtype(np.float64)]:
+            is_float = dt.kind == "f"
+            input, _ = create_fake_data(
+                (2, 50000), dtype=dt, sigma=(1.0 if is_float else None), comm=None
+            )
+            if is_float:
+                encode = encode_flac_float
+            else:
+                encode = encode_flac
+            with self.assertRaises(RuntimeError):
+                _ = encode(input, level, use_threads=True, n_threads=0)
+            check = encode(input, level)
+            for use_threads in [False, True]:
+                for n_threads in [None, 1, 2, 5]:
+                    result = encode(
+                        input, level, use_threads=use_threads, n_threads=n_threads
+                    )
+                    if not all(np.array_equal(x, y) for x, y in zip(result, check)):
+                        msg = f"FAIL on {dt} with {n_threads} threads, "
+                        msg += f"use_threads={use_threads}"
+                        print(msg, flush=True)
+                        self.assertTrue(False)
+                if is_float:
+                    continue
+                (compressed, stream_starts, stream_nbytes) = result
+                output = decode_flac(
+                    compressed,
+                    stream_starts,
+                    stream_nbytes,
+                    input.shape[-1],
+                    is_int64=(dt == np.dtype(np.int64)),
+                )
+                if not np.array_equal(output, input):
+                    print(f"FAIL on {dt} roundtrip, use_threads={use_threads}")
+                    self.assertTrue(False)
+
+    def test_strided_encode(self):
+        # Views which are not C-contiguous are encoded in place, and give the same
+        # bytes as encoding a contiguous copy.
+        level = 5
+        stream_len = 9000
+        for dt in [
+            np.dtype(np.int32),
+            np.dtype(np.int64),
+            np.dtype(np.float32),
+            np.dtype(np.float64),
+        ]:
+            is_float = dt.kind == "f"
+            input, _ = create_fake_data(
+                (4, 3, stream_len), dtype=dt, sigma=(1.0 if is_float else None),
+                comm=None
+            )
+            if dt == np.dtype(np.int64):
+                # One stream with a wide range, so that both channels are used.
+                input[1, 2, :] *= 2**36
+            # Detector data stored as (nsamp, ndet)
+            by_sample = np.ascontiguousarray(input.reshape((12, stream_len)).T)
+            for view in [
+                by_sample.T,
+                input[:, 1:, 100:-50],
+                input[::-1, ::2],
+                input[2, :, ::3],
+                input[3, 1, ::-2],
+            ]:
+                check_data = np.ascontiguousarray(view)
+                for use_threads in [False, True]:
+                    for segment_size in [None, 2000]:
+                        opts = {
+                            "use_threads": use_threads,
+                            "segment_size": segment_size,
+                            "return_aux": True,
+                            "seek_table": True,
+                        }
+                        if is_float:
+                            result = encode_flac_float(view, level, **opts)
+                            check = encode_flac_float(check_data, level, **opts)
+                        else:
+                            result = encode_flac(view, level, **opts)
+                            check = encode_flac(check_data, level, **opts)
+                        same = all(
+                            np.array_equal(x, y)
+                            for x, y in zip(result[:-1], check[:-1])
+                        )
+                        for key, val in check[-1].items():
+                            same = same and np.array_equal(result[-1][key], val)
+                        if not same:
+                            msg = f"FAIL on {dt} strided encode {view.strides}, "
+                            msg += f"threads={use_threads}, segments={segment_size}"
+                            print(msg, flush=True)
+                            self.assertTrue(False)
+
+        # Offsets and strides which address samples outside of the data are
+        # rejected before encoding.
+        for dt, encoders in [
+            (np.dtype(np.int32), [wrap_encode_i32, wrap_encode_i32_threaded]),
+            (np.dtype(np.int64), [wrap_encode_i64, wrap_encode_i64_threaded]),
+        ]:
+            data = np.zeros(3 * stream_len, dtype=dt)
+            for encode in encoders:
+                encode(
+                    data,
+                    3,
+                    stream_len,
+                    level,
+                    stream_offsets=np.array([0, 1, 2], dtype=np.int64),
+                    sample_stride=3,
+                )
+                for offsets, stride in [
+                    ([0, stream_len, 2 * stream_len + 1], 1),
+                    ([0, 1, 2], 4),
+                    ([-1, 0, 1], 3),
+                    ([stream_len - 1, 0, 1], -1),
+                ]:
+                    with self.assertRaises(RuntimeError):
+                        encode(
+                            data,
+                            3,
+                            stream_len,
+                            level,
+                            stream_offsets=np.array(offsets, dtype=np.int64),
+                            sample_stride=stride,
+                        )
+
+    def test_max_memory(self):
+        # Limiting the memory of the threaded encoder gives the same bytes as
+        # encoding all streams at once.
+        level = 5
+        stream_len = 10000
+        for dt in [
+            np.dtype(np.int32),
+            np.dtype(np.int64),
+            np.dtype(np.float32),
+            np.dtype(np.float64),
+        ]:
+            is_float = dt.kind == "f"
+            input, _ = create_fake_data(
+                (6, stream_len), dtype=dt, sigma=(1.0 if is_float else None),
+                comm=None
+            )
+            for segment_size in [None, 1500]:
+                opts = {
+                    "use_threads": True,
+                    "segment_size": segment_size,
+                    "return_aux": True,
+                    "seek_table": True,
+                }
+                if is_float:
+                    encode = encode_flac_float
+                else:
+                    encode = encode_flac
+                check = encode(input, level, **opts)
+                for max_memory in [1, 4 * stream_len, 20 * stream_len]:
+                    result = encode(input, level, max_memory=max_memory, **opts)
+                    same = all(
+                        np.array_equal(x, y) for x, y in zip(result[:-1], check[:-1])
+                    )
+                    for key, val in check[-1].items():
+                        same = same and np.array_equal(result[-1][key], val)
+                    if not same:
+                        msg = f"FAIL on {dt} max_memory={max_memory}, "
+                        msg += f"segments={segment_size}"
+                        print(msg, flush=True)
+                        self.assertTrue(False)
+            with self.assertRaises(RuntimeError):
+                encode(input, level, use_threads=True, max_memory=0)
+
+    def test_reserve_overflow(self):
+        # Streams which compress much worse than estimated overflow their regions
+        # of the threaded output reservation, and give the same bytes as the
+        # unthreaded encoder.  The estimate only samples a few short windows of each
+        # stream, so make those quiet in some of the noisy streams.
+        level = 5
+        n_stream = 9
+        stream_len = 100000
+        rng = np.random.default_rng(12345)
+        input = rng.integers(-4096, 4096, size=(n_stream, stream_len), dtype=np.int32)
+        stride = stream_len // 16
+        for istream in [0, 4, 8]:
+            input[istream] = rng.integers(-(2**30), 2**30, size=stream_len)
+            for win in range(16):
+                input[istream, win * stride : win * stride + 32] = 0
+        enable_counters(True)
+        get_counters(reset=True)
+        for segment_size in [None, 30000]:
+            opts = {
+                "segment_size": segment_size,
+                "return_aux": True,
+                "seek_table": True,
+                "checksums": True,
+            }
+            check = encode_flac(input, level, **opts)
+            # Without a memory limit the items overflow the single reservation, and
+            # with one they overflow the regions of the batches.
+            for max_memory in [None, 200000]:
+                result = encode_flac(
+                    input, level, use_threads=True, max_memory=max_memory, **opts
+                )
+                same = all(
+                    np.array_equal(x, y) for x, y in zip(result[:-1], check[:-1])
+                )
+                for key, val in check[-1].items():
+                    same = same and np.array_equal(result[-1][key], val)
+                if not same:
+                    msg = f"FAIL on reservation overflow, segments={segment_size}, "
+                    msg += f"max_memory={max_memory}"
+                    print(msg, flush=True)
+                    self.assertTrue(False)
+        # The noisy streams really were encoded a second time.
+        counts = get_counters(use_threads=True, reset=True)
+        enable_counters(False)
+        if counts["enc_overflows"] == 0:
+            print(f"FAIL on reservation overflow counters {counts}", flush=True)
+            self.assertTrue(False)
+
+    def test_checksums(self):
+        # The checksums of the compressed streams (or segments) match the bytes, and
+        # skipping the MD5 signature does not change the bytes.
+        level = 1
+        stream_len = 10000
+        segment_size = 3000
+        for dt in [np.dtype(np.int32), np.dtype(np.float64)]:
+            is_float = dt.kind == "f"
+            input, _ = create_fake_data(
+                (3, 2, stream_len), dtype=dt, sigma=(1.0 if is_float else None),
+                comm=None
+            )
+            encode = encode_flac_float if is_float else encode_flac
+            for use_threads in [False, True]:
+                for seg in [None, segment_size]:
+                    result = encode(
+                        input,
+                        level,
+                        use_threads=use_threads,
+                        segment_size=seg,
+                        return_aux=True,
+                        checksums=True,
+                        md5=False,
+                    )
+                    check = encode(
+                        input,
+                        level,
+                        use_threads=use_threads,
+                        segment_size=seg,
+                        return_aux=True,
+                    )
+                    compressed, starts, nbytes = result[:3]
+                    stream_aux = result[-1]
+                    n_seg = 1 if seg is None else 4
+                    sums = stream_aux["stream_checksums"]
+                    if sums.shape != (3, 2, n_seg) or not np.array_equal(
+                        compressed, check[0]
+                    ):
+                        print(f"FAIL on {dt} checksum encode", flush=True)
+                        self.assertTrue(False)
+                    verify_flac(
+                        compressed, starts, nbytes, stream_aux, use_threads=use_threads
+                    )
+
+                    # Corrupt one byte of the last segment of one stream.
+                    bad = compressed.copy()
+                    bad[starts[1, 0] + nbytes[1, 0] - 10] ^= 1
+                    with self.assertRaises(RuntimeError):
+                        verify_flac(bad, starts, nbytes, stream_aux)
+                    if seg is not None:
+                        # A slice before the last segment is not affected.
+                        verify_flac(
+                            bad, starts, nbytes, stream_aux, first_sample=100,
+                            last_sample=2 * segment_size
+                        )
+                    if is_float:
+                        with self.assertRaises(RuntimeError):
+                            decode_flac_float(
+                                bad, starts, nbytes, stream_len, result[3],
+                                result[4], stream_aux=stream_aux, verify=True
+                            )
+                    else:
+                        with self.assertRaises(RuntimeError):
+                            decode_flac(
+                                bad, starts, nbytes, stream_len,
+                                stream_aux=stream_aux, verify=True
+                            )
+                        output = decode_flac(
+                            compressed, starts, nbytes, stream_len,
+                            stream_aux=stream_aux, verify=True
+                        )
+                        if not np.array_equal(output, input):
+                            print(f"FAIL on {dt} verified decode", flush=True)
+                            self.assertTrue(False)
+            with self.assertRaises(RuntimeError):
+                encode(input, level, checksums=True)
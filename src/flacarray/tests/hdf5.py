@@ -10,8 +10,8 @@ import numpy as np
 
 from ..array import FlacArray
 from ..demo import create_fake_data
-from ..hdf5 import write_array, read_array
-from ..hdf5_utils import H5File, have_hdf5
+from ..hdf5 import write_array, read_array, read_compressed
+from ..hdf5_utils import H5File, have_hdf5, hdf5_map_bytes
 from ..mpi import use_mpi, MPI
 
 if have_hdf5:
@@ -48,6 +48,7 @@ class HDF5Test(unittest.TestCase):
             for dt, dtstr, sigma, quant in [
                 (np.dtype(np.int32), "i32", None, None),
                 (np.dtype(np.int64), "i64", None, None),
+                (np.dtype(np.int64), "i64s", None, None),
                 (np.dtype(np.float32), "f32", 1.0, 1.0e-7),
                 (np.dtype(np.float64), "f64", 1.0, 1.0e-15),
             ]:
@@ -78,7 +79,7 @@ class HDF5Test(unittest.TestCase):
                         mpi_dist=mpi_dist,
                         use_threads=True,
                     )
-                if dtstr == "i32" or dtstr == "i64":
+                if dtstr in ("i32", "i64", "i64s"):
                     local_fail = not np.array_equal(check, input)
                 else:
                     local_fail = not np.allclose(check, input, atol=1e-6)
@@ -125,6 +126,9 @@ class HDF5Test(unittest.TestCase):
                 input, mpi_dist = create_fake_data(
                     local_shape, sigma=sigma, dtype=dt, comm=self.comm
                 )
+                if dtstr == "i64s":
+                    # 64bit values which fit in 32 bits, so every stream is narrowed
+                    input = input >> 40
                 flcarr = FlacArray.from_array(
                     input, quanta=quant, mpi_comm=self.comm, use_threads=True
                 )
@@ -139,7 +143,13 @@ class HDF5Test(unittest.TestCase):
                         hf.handle, mpi_comm=self.comm, mpi_dist=mpi_dist
                     )
 
-                local_fail = check != flcarr
+                local_fail = int(check != flcarr)
+                # Narrowed 64bit streams are written as format version 2
+                if rank == 0:
+                    with h5py.File(filename, "r") as hf:
+                        version = hf.attrs["flacarray_format_version"]
+                    expected = "2" if dtstr == "i64s" else "1"
+                    local_fail += int(version != expected)
                 if self.comm is not None:
                     fail = self.comm.allreduce(local_fail, op=MPI.SUM)
                 else:
@@ -171,3 +181,317 @@ class HDF5Test(unittest.TestCase):
         if tmpdir is not None:
             tmpdir.cleanup()
             del tmpdir
+
+    def test_segmented_write_read(self):
+        if not have_hdf5:
+            print("h5py not available, skipping tests", flush=True)
+            return
+        if self.comm is None:
+            rank = 0
+        else:
+            rank = self.comm.rank
+
+        tmpdir = None
+        tmppath = None
+        if rank == 0:
+            tmpdir = tempfile.TemporaryDirectory()
+            tmppath = tmpdir.name
+        if self.comm is not None:
+            tmppath = self.comm.bcast(tmppath, root=0)
+
+        local_shape = (4, 3, 10000)
+        segment_size = 2048
+        slc = slice(3000, 7000)
+
+        for dt, dtstr, sigma, quant in [
+            (np.dtype(np.int32), "i32", None, None),
+            (np.dtype(np.float64), "f64", 1.0, 1.0e-15),
+        ]:
+            input, mpi_dist = create_fake_data(
+                local_shape, sigma=sigma, dtype=dt, comm=self.comm
+            )
+            flcarr = FlacArray.from_array(
+                input,
+                quanta=quant,
+                mpi_comm=self.comm,
+                use_threads=True,
+                segment_size=segment_size,
+                seek_table=True,
+                checksums=True,
+            )
+
+            filename = os.path.join(tmppath, f"data_seg_{dtstr}.h5")
+            with H5File(filename, "w", comm=self.comm) as hf:
+                flcarr.write_hdf5(hf.handle)
+            if self.comm is not None:
+                self.comm.barrier()
+            with H5File(filename, "r", comm=self.comm) as hf:
+                check = FlacArray.read_hdf5(
+                    hf.handle, mpi_comm=self.comm, mpi_dist=mpi_dist
+                )
+            with H5File(filename, "r", comm=self.comm) as hf:
+                output = read_array(
+                    hf.handle,
+                    stream_slice=slc,
+                    mpi_comm=self.comm,
+                    mpi_dist=mpi_dist,
+                    use_threads=True,
+                    verify=True,
+                )
+            # A subset of streams, read with one call for each run of them
+            keep = np.zeros(local_shape[:-1], dtype=bool)
+            keep[1:3, ::2] = True
+            kept = None
+            if self.comm is None:
+                with H5File(filename, "r") as hf:
+                    kept = read_array(hf.handle, keep=keep, read_gap=0, verify=True)
+
+            # Segmented streams are written as format version 2
+            version = "2"
+            if rank == 0:
+                with h5py.File(filename, "r") as hf:
+                    version = hf.attrs["flacarray_format_version"]
+
+            local_fail = int(check != flcarr)
+            if version != "2":
+                local_fail = 1
+            if kept is not None:
+                local_fail += int(not np.allclose(kept, input[keep], atol=1e-6))
+            if check.segment_size != segment_size:
+                local_fail = 1
+            if check.stream_frames is None:
+                local_fail = 1
+            if not np.array_equal(check.stream_checksums, flcarr.stream_checksums):
+                local_fail = 1
+            if dtstr == "i32":
+                local_fail += int(not np.array_equal(output, input[..., slc]))
+            else:
+                local_fail += int(not np.allclose(output, input[..., slc], atol=1e-6))
+            if self.comm is not None:
+                fail = self.comm.allreduce(local_fail, op=MPI.SUM)
+            else:
+                fail = local_fail
+            if fail:
+                print(f"check_{dtstr}[{rank}] = {check}", flush=True)
+                print(f"flcarr_{dtstr}[{rank}] = {flcarr}", flush=True)
+                print(f"FAIL on {dtstr} segmented roundtrip to hdf5", flush=True)
+                self.assertTrue(False)
+
+        if self.comm is not None:
+            self.comm.barrier()
+        if tmpdir is not None:
+            tmpdir.cleanup()
+            del tmpdir
+
+    def test_optional_aux(self):
+        if not have_hdf5:
+            print("h5py not available, skipping tests", flush=True)
+            return
+        if self.comm is None:
+            rank = 0
+        else:
+            rank = self.comm.rank
+
+        tmpdir = None
+        tmppath = None
+        if rank == 0:
+            tmpdir = tempfile.TemporaryDirectory()
+            tmppath = tmpdir.name
+        if self.comm is not None:
+            tmppath = self.comm.bcast(tmppath, root=0)
+
+        local_shape = (4, 3, 1000)
+        input, mpi_dist = create_fake_data(
+            local_shape, sigma=None, dtype=np.dtype(np.int32), comm=self.comm
+        )
+
+        # The seek table and checksums are not needed to decode the data
+        flcarr = FlacArray.from_array(
+            input, mpi_comm=self.comm, seek_table=True, checksums=True
+        )
+        filename = os.path.join(tmppath, "data_hints.h5")
+        with H5File(filename, "w", comm=self.comm) as hf:
+            flcarr.write_hdf5(hf.handle)
+        if self.comm is not None:
+            self.comm.barrier()
+        with H5File(filename, "r", comm=self.comm) as hf:
+            result = read_compressed(hf.handle, mpi_comm=self.comm, mpi_dist=mpi_dist)
+        local_fail = int(len(result) != 10)
+        local_fail += int(not np.array_equal(result[2], flcarr.compressed))
+        if self.comm is not None:
+            fail = self.comm.allreduce(local_fail, op=MPI.SUM)
+        else:
+            fail = local_fail
+        if fail:
+            print("FAIL on reading hdf5 without the optional arrays", flush=True)
+            self.assertTrue(False)
+
+        # Segmented streams cannot be decoded without the segments
+        flcarr = FlacArray.from_array(input, mpi_comm=self.comm, segment_size=256)
+        filename = os.path.join(tmppath, "data_segments.h5")
+        with H5File(filename, "w", comm=self.comm) as hf:
+            flcarr.write_hdf5(hf.handle)
+        if self.comm is not None:
+            self.comm.barrier()
+        with H5File(filename, "r", comm=self.comm) as hf:
+            with self.assertRaises(RuntimeError):
+                read_compressed(hf.handle, mpi_comm=self.comm, mpi_dist=mpi_dist)
+
+        if self.comm is not None:
+            self.comm.barrier()
+        if tmpdir is not None:
+            tmpdir.cleanup()
+            del tmpdir
+
+    def test_mmap_read(self):
+        if not have_hdf5:
+            print("h5py not available, skipping tests", flush=True)
+            return
+        if self.comm is None:
+            rank = 0
+        else:
+            rank = self.comm.rank
+
+        tmpdir = None
+        tmppath = None
+        if rank == 0:
+            tmpdir = tempfile.TemporaryDirectory()
+            tmppath = tmpdir.name
+        if self.comm is not None:
+            tmppath = self.comm.bcast(tmppath, root=0)
+
+        local_shape = (4, 3, 1000)
+        input, mpi_dist = create_fake_data(
+            local_shape, sigma=None, dtype=np.dtype(np.int32), comm=self.comm
+        )
+        flcarr = FlacArray.from_array(input, mpi_comm=self.comm)
+
+        filename = os.path.join(tmppath, "data_mmap.h5")
+        with H5File(filename, "w", comm=self.comm) as hf:
+            flcarr.write_hdf5(hf.handle)
+            if hf.handle is not None:
+                hf.handle.create_dataset(
+                    "chunked", data=flcarr.compressed, chunks=(128,)
+                )
+        if self.comm is not None:
+            self.comm.barrier()
+        with H5File(filename, "r", comm=self.comm) as hf:
+            check = FlacArray.read_hdf5(
+                hf.handle, mpi_comm=self.comm, mpi_dist=mpi_dist, mmap=True
+            )
+        local_fail = int(check != flcarr)
+        local_fail += int(not np.array_equal(check[:], input))
+        if rank == 0:
+            # The bytes on the reading process are a view of the file
+            local_fail += int(not isinstance(check.compressed, np.memmap))
+            local_fail += int(check.compressed.flags.writeable)
+        del check
+
+        if self.comm is None:
+            with H5File(filename, "r") as hf:
+                # Streams which are contiguous in the file are mapped, others are
+                # read into memory.
+                keep = np.zeros(local_shape[:-1], dtype=bool)
+                keep[1:3] = True
+                contiguous = FlacArray.read_hdf5(hf.handle, keep=keep, mmap=True)
+                keep[1:3, 1] = False
+                scattered = FlacArray.read_hdf5(hf.handle, keep=keep, mmap=True)
+                # Chunked datasets cannot be mapped
+                chunked = hdf5_map_bytes(hf.handle["chunked"], 0, 16)
+            local_fail += int(not isinstance(contiguous.compressed, np.memmap))
+            local_fail += int(
+                not np.array_equal(contiguous[:], input[1:3].reshape((6, -1)))
+            )
+            local_fail += int(isinstance(scattered.compressed, np.memmap))
+            local_fail += int(not np.array_equal(scattered[:], input[keep]))
+            local_fail += int(chunked is not None)
+            del contiguous
+            del scattered
+
+        if self.comm is not None:
+            fail = self.comm.allreduce(local_fail, op=MPI.SUM)
+        else:
+            fail = local_fail
+        if fail:
+            print("FAIL on memory mapped read from hdf5", flush=True)
+            self.assertTrue(False)
+
+        if self.comm is not None:
+            self.comm.barrier()
+        if tmpdir is not None:
+            tmpdir.cleanup()
+            del tmpdir
+
+    def test_lazy_read(self):
+        if not have_hdf5:
+            print("h5py not available, skipping tests", flush=True)
+            return
+        if self.comm is None:
+            rank = 0
+        else:
+            rank = self.comm.rank
+
+        tmpdir = None
+        tmppath = None
+        if rank == 0:
+            tmpdir = tempfile.TemporaryDirectory()
+            tmppath = tmpdir.name
+        if self.comm is not None:
+            tmppath = self.comm.bcast(tmppath, root=0)
+
+        local_shape = (4, 3, 1000)
+        input, mpi_dist = create_fake_data(
+            local_shape, sigma=None, dtype=np.dtype(np.int32), comm=self.comm
+        )
+        flcarr = FlacArray.from_array(
+            input, mpi_comm=self.comm, segment_size=256, seek_table=True, checksums=True
+        )
+        local_fail = int(flcarr.byte_cache is not None)
+
+        filename = os.path.join(tmppath, "data_lazy.h5")
+        with H5File(filename, "w", comm=self.comm) as hf:
+            flcarr.write_hdf5(hf.handle)
+        if self.comm is not None:
+            self.comm.barrier()
+        with H5File(filename, "r", comm=self.comm) as hf:
+            check = FlacArray.read_hdf5(
+                hf.handle,
+                mpi_comm=self.comm,
+                mpi_dist=mpi_dist,
+                lazy=True,
+                cache_bytes=1048576,
+            )
+            # With serial HDF5, only the process reading the file loads lazily
+            cache = check.byte_cache
+            if cache is not None:
+                local_fail += int(cache.nbytes != 0)
+            output = check[1:3, ::2, 100:200]
+            local_fail += int(not np.array_equal(output, input[1:3, ::2, 100:200]))
+            output = check.get((2, 0, slice(150, 300)), verify=True)
+            local_fail += int(not np.array_equal(output, input[2, 0, 150:300]))
+            if cache is not None:
+                # The second slice is a stream which was read for the first one
+                stats = cache.stats()
+                local_fail += int(stats["misses"] != 4 or stats["hits"] != 1)
+            local_fail += int(not np.array_equal(check.to_array(), input))
+            keep = np.zeros(local_shape[:-1], dtype=bool)
+            keep[0, 1] = True
+            keep[3, 2] = True
+            output = check.to_array(keep=keep)
+            local_fail += int(not np.array_equal(output, input[keep]))
+            local_fail += int(check != flcarr)
+            del check
+
+        if self.comm is not None:
+            fail = self.comm.allreduce(local_fail, op=MPI.SUM)
+        else:
+            fail = local_fail
+        if fail:
+            print("FAIL on lazy read from h5py", flush=True)
+            self.assertTrue(False)
+
+        if self.comm is not None:
+            self.comm.barrier()
+        if tmpdir is not None:
+            tmpdir.cleanup()
+            del tmpdir
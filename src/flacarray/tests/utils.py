@@ -2,16 +2,29 @@
 # All rights reserved.  Use of this source code is governed by
 # a BSD-style license that can be found in the LICENSE file.
 
+import json
 import os
+import tempfile
+import threading
 import unittest
 
 import numpy as np
 
 from ..demo import create_fake_data
+from ..io_common import read_compressed_dataset_slice
 
 from ..utils import (
+    _all_thread_timers,
     int_to_float,
     float_to_int,
+    clear_timers,
+    enable_timing,
+    function_timer,
+    get_timer_calls,
+    get_timers,
+    timing_region,
+    use_function_timers,
+    write_trace,
 )
 
 
@@ -106,3 +119,168 @@ class UtilsTest(unittest.TestCase):
             print("Failed float32 quanta roundtrip")
             print(f"{check} != {data}", flush=True)
             self.assertTrue(False)
+
+    def test_blocks(self):
+        # Long streams are converted in blocks spread over threads.  Check against
+        # the same arithmetic done with numpy.
+        data_shape = (2, 150001)
+        quanta = 1.0e-4
+        data, _ = create_fake_data(data_shape, 1.0)
+        data[1, 140000] = 50.0
+        data[0, 70000] = -50.0
+
+        idata, offsets, gains = float_to_int(data, quanta=quanta, precision=None)
+        off = 0.5 * (np.amin(data, axis=-1) + np.amax(data, axis=-1))
+        off = quanta * np.trunc(off / quanta)
+        stemp = data - off[:, np.newaxis]
+        check = np.trunc((1.0 / quanta) * stemp + np.where(stemp >= 0, 0.5, -0.5))
+        if not np.array_equal(offsets, off) or not np.array_equal(idata, check):
+            print("Failed float64 block conversion", flush=True)
+            self.assertTrue(False)
+
+        output = int_to_float(idata, offsets, gains)
+        expected = off[:, np.newaxis] + (1.0 / gains[:, np.newaxis]) * idata
+        if not np.array_equal(output, expected):
+            print("Failed int64 block conversion", flush=True)
+            self.assertTrue(False)
+
+        fdata = data.astype(np.float32)
+        idata, offsets, gains = float_to_int(fdata, quanta=None, precision=None)
+        check = int_to_float(idata, offsets, gains)
+        if not np.allclose(check, fdata, rtol=1e-5, atol=1e-5):
+            print("Failed float32 block roundtrip", flush=True)
+            self.assertTrue(False)
+
+    def test_timing_regions(self):
+        # Regions are named by the active regions of their own thread, and each
+        # thread is a separate track of the trace.
+        was_enabled = use_function_timers()
+        enable_timing(True, trace=True)
+        clear_timers()
+
+        def work():
+            with timing_region("outer"):
+                for _ in range(3):
+                    with timing_region("inner"):
+                        pass
+
+        work()
+        thread = threading.Thread(target=work, name="worker")
+        thread.start()
+        thread.join()
+
+        timers = get_timers()
+        calls = get_timer_calls()
+        if calls.get("outer", 0) != 2 or calls.get("outer|inner", 0) != 6:
+            print(f"Failed region calls {calls}", flush=True)
+            self.assertTrue(False)
+        if timers["outer"] < timers["outer|inner"] / 2:
+            print(f"Failed region times {timers}", flush=True)
+            self.assertTrue(False)
+
+        with tempfile.TemporaryDirectory() as tempdir:
+            path = os.path.join(tempdir, "trace.json")
+            write_trace(path)
+            with open(path, "r") as f:
+                trace = json.load(f)
+        events = [x for x in trace["traceEvents"] if x["ph"] == "X"]
+        threads = [x for x in trace["traceEvents"] if x["ph"] == "M"]
+        tids = set([x["tid"] for x in events])
+        if len(events) != 8 or len(tids) != 2:
+            print(f"Failed trace events {events}", flush=True)
+            self.assertTrue(False)
+        if "worker" not in [x["args"]["name"] for x in threads]:
+            print(f"Failed trace threads {threads}", flush=True)
+            self.assertTrue(False)
+        for ev in events:
+            if ev["name"] == "inner" and ev["args"]["timer"] != "outer|inner":
+                print(f"Failed trace event {ev}", flush=True)
+                self.assertTrue(False)
+
+        # Disabling the timers also stops functions decorated while enabled
+        @function_timer
+        def timed():
+            pass
+
+        clear_timers()
+        enable_timing(False)
+        timed()
+        if len(get_timer_calls()) != 0:
+            print(f"Failed disabled timers {get_timer_calls()}", flush=True)
+            self.assertTrue(False)
+        enable_timing(True)
+        timed()
+        if list(get_timer_calls().values()) != [1]:
+            print(f"Failed enabled timers {get_timer_calls()}", flush=True)
+            self.assertTrue(False)
+
+        # The timers of finished threads are still counted, but not kept
+        clear_timers()
+        for _ in range(10):
+            thread = threading.Thread(target=work, name="finished")
+            thread.start()
+            thread.join()
+        calls = get_timer_calls()
+        kept = [x for x in _all_thread_timers if x.name == "finished"]
+        if calls.get("outer", 0) != 10 or len(kept) > 0:
+            msg = f"Failed finished thread timers {calls}, {len(kept)} kept"
+            print(msg, flush=True)
+            self.assertTrue(False)
+
+        clear_timers()
+        enable_timing(was_enabled)
+
+    def test_coalesced_reads(self):
+        # A flat byte array behaves like a Zarr dataset.  Count the reads of it.
+        class CountingDataset:
+            def __init__(self, raw):
+                self.raw = raw
+                self.reads = 0
+                self.largest = 0
+
+            def __getitem__(self, key):
+                self.reads += 1
+                self.largest = max(self.largest, key[0].stop - key[0].start)
+                return self.raw[key]
+
+        rng = np.random.default_rng(12345)
+        nbytes = rng.integers(low=0, high=200, size=(6, 5), dtype=np.int64)
+        starts = np.zeros_like(nbytes)
+        starts.flat[1:] = np.cumsum(nbytes.flat)[:-1]
+        raw = rng.integers(low=0, high=256, size=np.sum(nbytes), dtype=np.uint8)
+        keep = np.zeros(nbytes.shape, dtype=bool)
+        keep[::2, 1:4] = True
+        keep[3, :] = True
+        keep[5, 4] = True
+        # Contiguous runs of kept streams, ignoring empty streams between them
+        kept = np.flatnonzero(keep)
+        runs = 1 + np.count_nonzero(
+            [np.sum(nbytes.flat[x + 1 : y]) > 0 for x, y in zip(kept[:-1], kept[1:])]
+        )
+
+        # The last case merges all streams, but splits the reads at a small size.
+        for read_gap, n_reads, max_read in [
+            (-1, None, None),
+            (0, runs, None),
+            (1 << 20, 1, None),
+            (1 << 20, None, 1000),
+        ]:
+            dset = CountingDataset(raw)
+            data, rel_starts, indices = read_compressed_dataset_slice(
+                dset, keep, starts, nbytes, read_gap=read_gap, max_read=max_read
+            )
+            fail = len(data) != np.sum(nbytes[keep])
+            for rel, idx in zip(rel_starts, indices):
+                stream = raw[starts[idx] : starts[idx] + nbytes[idx]]
+                fail = fail or not np.array_equal(
+                    data[rel : rel + nbytes[idx]], stream
+                )
+            if n_reads is not None:
+                fail = fail or dset.reads != n_reads
+            if max_read is not None:
+                fail = fail or dset.reads < 2 or dset.largest > max_read
+            if fail:
+                msg = f"FAIL on coalesced reads with gap {read_gap}, "
+                msg += f"max_read {max_read}"
+                print(msg, flush=True)
+                self.assertTrue(False)
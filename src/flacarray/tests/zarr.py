@@ -47,6 +47,7 @@ class ZarrTest(unittest.TestCase):
         for dt, dtstr, sigma, quant in [
             (np.dtype(np.int32), "i32", None, None),
             (np.dtype(np.int64), "i64", None, None),
+            (np.dtype(np.int64), "i64s", None, None),
             (np.dtype(np.float32), "f32", 1.0, 1.0e-7),
             (np.dtype(np.float64), "f64", 1.0, 1.0e-15),
         ]:
@@ -77,7 +78,7 @@ class ZarrTest(unittest.TestCase):
                     mpi_dist=mpi_dist,
                     use_threads=True,
                 )
-            if dtstr == "i32" or dtstr == "i64":
+            if dtstr in ("i32", "i64", "i64s"):
                 local_fail = not np.array_equal(check, input)
             else:
                 local_fail = not np.allclose(check, input, atol=1e-6)
@@ -124,6 +125,9 @@ class ZarrTest(unittest.TestCase):
             input, mpi_dist = create_fake_data(
                 local_shape, sigma=sigma, dtype=dt, comm=self.comm
             )
+            if dtstr == "i64s":
+                # 64bit values which fit in 32 bits, so every stream is narrowed
+                input = input >> 40
             flcarr = FlacArray.from_array(
                 input, quanta=quant, mpi_comm=self.comm, use_threads=True
             )
@@ -138,6 +142,12 @@ class ZarrTest(unittest.TestCase):
 
             # Check array equality
             local_fail = int(check != flcarr)
+            # Narrowed 64bit streams are written as format version 2
+            if rank == 0:
+                zgrp = zarr.open_group(filename, mode="r")
+                version = zgrp.attrs["flacarray_format_version"]
+                expected = "2" if dtstr == "i64s" else "1"
+                local_fail += int(version != expected)
             if self.comm is not None:
                 fail = self.comm.allreduce(local_fail, op=MPI.SUM)
             else:
@@ -168,3 +178,245 @@ class ZarrTest(unittest.TestCase):
         if tmpdir is not None:
             tmpdir.cleanup()
             del tmpdir
+
+    def test_segmented_write_read(self):
+        if not have_zarr:
+            print("zarr not available, skipping tests", flush=True)
+            return
+        if self.comm is None:
+            rank = 0
+        else:
+            rank = self.comm.rank
+
+        tmpdir = None
+        tmppath = None
+        if rank == 0:
+            tmpdir = tempfile.TemporaryDirectory()
+            tmppath = tmpdir.name
+        if self.comm is not None:
+            tmppath = self.comm.bcast(tmppath, root=0)
+
+        local_shape = (4, 3, 10000)
+        segment_size = 2048
+        slc = slice(3000, 7000)
+
+        for dt, dtstr, sigma, quant in [
+            (np.dtype(np.int32), "i32", None, None),
+            (np.dtype(np.float64), "f64", 1.0, 1.0e-15),
+        ]:
+            input, mpi_dist = create_fake_data(
+                local_shape, sigma=sigma, dtype=dt, comm=self.comm
+            )
+            flcarr = FlacArray.from_array(
+                input,
+                quanta=quant,
+                mpi_comm=self.comm,
+                use_threads=True,
+                segment_size=segment_size,
+                seek_table=True,
+                checksums=True,
+            )
+
+            filename = os.path.join(tmppath, f"data_seg_{dtstr}.zarr")
+            with ZarrGroup(filename, mode="w", comm=self.comm) as zf:
+                flcarr.write_zarr(zf)
+            if self.comm is not None:
+                self.comm.barrier()
+            with ZarrGroup(filename, mode="r", comm=self.comm) as zf:
+                check = FlacArray.read_zarr(
+                    zf, mpi_comm=self.comm, mpi_dist=mpi_dist
+                )
+            with ZarrGroup(filename, mode="r", comm=self.comm) as zf:
+                output = read_array(
+                    zf,
+                    stream_slice=slc,
+                    mpi_comm=self.comm,
+                    mpi_dist=mpi_dist,
+                    use_threads=True,
+                    verify=True,
+                )
+
+            # Segmented streams are written as format version 2
+            version = "2"
+            if rank == 0:
+                zgrp = zarr.open_group(filename, mode="r")
+                version = zgrp.attrs["flacarray_format_version"]
+
+            local_fail = int(check != flcarr)
+            if version != "2":
+                local_fail = 1
+            if check.segment_size != segment_size:
+                local_fail = 1
+            if check.stream_frames is None:
+                local_fail = 1
+            if not np.array_equal(check.stream_checksums, flcarr.stream_checksums):
+                local_fail = 1
+            if dtstr == "i32":
+                local_fail += int(not np.array_equal(output, input[..., slc]))
+            else:
+                local_fail += int(not np.allclose(output, input[..., slc], atol=1e-6))
+            if self.comm is not None:
+                fail = self.comm.allreduce(local_fail, op=MPI.SUM)
+            else:
+                fail = local_fail
+            if fail:
+                print(f"check_{dtstr}[{rank}] = {check}", flush=True)
+                print(f"flcarr_{dtstr}[{rank}] = {flcarr}", flush=True)
+                print(f"FAIL on {dtstr} segmented roundtrip to zarr", flush=True)
+                self.assertTrue(False)
+
+        if self.comm is not None:
+            self.comm.barrier()
+        if tmpdir is not None:
+            tmpdir.cleanup()
+            del tmpdir
+
+    def test_lazy_read(self):
+        if not have_zarr:
+            print("zarr not available, skipping tests", flush=True)
+            return
+        if self.comm is None:
+            rank = 0
+        else:
+            rank = self.comm.rank
+
+        tmpdir = None
+        tmppath = None
+        if rank == 0:
+            tmpdir = tempfile.TemporaryDirectory()
+            tmppath = tmpdir.name
+        if self.comm is not None:
+            tmppath = self.comm.bcast(tmppath, root=0)
+
+        local_shape = (4, 3, 1000)
+        input, mpi_dist = create_fake_data(
+            local_shape, sigma=None, dtype=np.dtype(np.int32), comm=self.comm
+        )
+        flcarr = FlacArray.from_array(
+            input, mpi_comm=self.comm, segment_size=256, seek_table=True, checksums=True
+        )
+        local_fail = int(flcarr.byte_cache is not None)
+
+        filename = os.path.join(tmppath, "data_lazy.zarr")
+        with ZarrGroup(filename, mode="w", comm=self.comm) as zf:
+            flcarr.write_zarr(zf)
+        if self.comm is not None:
+            self.comm.barrier()
+        with ZarrGroup(filename, mode="r", comm=self.comm) as zf:
+            check = FlacArray.read_zarr(
+                zf,
+                mpi_comm=self.comm,
+                mpi_dist=mpi_dist,
+                lazy=True,
+                cache_bytes=1048576,
+            )
+            # Only the process reading the group loads lazily
+            cache = check.byte_cache
+            if cache is not None:
+                local_fail += int(cache.nbytes != 0)
+            output = check[1:3, ::2, 100:200]
+            local_fail += int(not np.array_equal(output, input[1:3, ::2, 100:200]))
+            output = check.get((2, 0, slice(150, 300)), verify=True)
+            local_fail += int(not np.array_equal(output, input[2, 0, 150:300]))
+            if cache is not None:
+                # The second slice is a stream which was read for the first one
+                stats = cache.stats()
+                local_fail += int(stats["misses"] != 4 or stats["hits"] != 1)
+            local_fail += int(not np.array_equal(check.to_array(), input))
+            keep = np.zeros(local_shape[:-1], dtype=bool)
+            keep[0, 1] = True
+            keep[3, 2] = True
+            output = check.to_array(keep=keep)
+            local_fail += int(not np.array_equal(output, input[keep]))
+            local_fail += int(check != flcarr)
+            del check
+
+        if self.comm is not None:
+            fail = self.comm.allreduce(local_fail, op=MPI.SUM)
+        else:
+            fail = local_fail
+        if fail:
+            print("FAIL on lazy read from zarr", flush=True)
+            self.assertTrue(False)
+
+        if self.comm is not None:
+            self.comm.barrier()
+        if tmpdir is not None:
+            tmpdir.cleanup()
+            del tmpdir
+
+    def test_aligned_chunks(self):
+        if not have_zarr:
+            print("zarr not available, skipping tests", flush=True)
+            return
+        if self.comm is None:
+            rank = 0
+        else:
+            rank = self.comm.rank
+
+        tmpdir = None
+        tmppath = None
+        if rank == 0:
+            tmpdir = tempfile.TemporaryDirectory()
+            tmppath = tmpdir.name
+        if self.comm is not None:
+            tmppath = self.comm.bcast(tmppath, root=0)
+
+        local_shape = (4, 3, 1000)
+        input, mpi_dist = create_fake_data(
+            local_shape, sigma=None, dtype=np.dtype(np.int32), comm=self.comm
+        )
+        flcarr = FlacArray.from_array(input, mpi_comm=self.comm, seek_table=True)
+        keep = np.zeros(local_shape[:-1], dtype=bool)
+        keep[0, 1] = True
+        keep[2, :] = True
+
+        # Chunks holding a few streams each, and chunks smaller than one stream
+        max_nbytes = int(np.max(flcarr.stream_nbytes))
+        layouts = [(3 * max_nbytes, None), (max_nbytes // 2, None)]
+        if hasattr(zarr, "create_array"):
+            layouts.append((2 * max_nbytes, 3))
+        for chunk_bytes, shard_chunks in layouts:
+            filename = os.path.join(tmppath, f"data_aligned_{chunk_bytes}.zarr")
+            with ZarrGroup(filename, mode="w", comm=self.comm) as zf:
+                flcarr.write_zarr(
+                    zf, chunk_bytes=chunk_bytes, shard_chunks=shard_chunks
+                )
+            if self.comm is not None:
+                self.comm.barrier()
+            with ZarrGroup(filename, mode="r", comm=self.comm) as zf:
+                check = FlacArray.read_zarr(zf, mpi_comm=self.comm, mpi_dist=mpi_dist)
+                lazy = FlacArray.read_zarr(
+                    zf, mpi_comm=self.comm, mpi_dist=mpi_dist, lazy=True
+                )
+                local_fail = int(check != flcarr)
+                output = lazy[2, 1:, 10:20]
+                local_fail += int(not np.array_equal(output, input[2, 1:, 10:20]))
+                if self.comm is None:
+                    kept = read_array(zf, keep=keep)
+                    local_fail += int(not np.array_equal(kept, input[keep]))
+                    # Older readers must refuse the gaps between streams
+                    version = zf.attrs["flacarray_format_version"]
+                    local_fail += int(version != "2")
+                    # No stream which fits in a chunk may straddle chunks
+                    starts = np.array(zf["stream_starts"]).reshape((-1,))
+                    nbytes = np.array(zf["stream_bytes"]).reshape((-1,))
+                    stops = starts + np.minimum(nbytes, chunk_bytes) - 1
+                    local_fail += int(
+                        np.any(starts // chunk_bytes != stops // chunk_bytes)
+                    )
+                del lazy
+
+            if self.comm is not None:
+                fail = self.comm.allreduce(local_fail, op=MPI.SUM)
+            else:
+                fail = local_fail
+            if fail:
+                print(f"FAIL on zarr chunks of {chunk_bytes} bytes", flush=True)
+                self.assertTrue(False)
+
+        if self.comm is not None:
+            self.comm.barrier()
+        if tmpdir is not None:
+            tmpdir.cleanup()
+            del tmpdir
@@ -2,15 +2,23 @@
 # All rights reserved.  Use of this source code is governed by
 # a BSD-style license that can be found in the LICENSE file.
 
+import atexit
 import inspect
+import json
 import logging
 import os
+import threading
 import time
+import weakref
+from collections import OrderedDict
 from functools import wraps
 
 import numpy as np
 
 from .libflacarray import (
+    counters_enabled,
+    enable_counters,
+    get_counters,
     wrap_float32_to_int32,
     wrap_float64_to_int64,
     wrap_int32_to_float32,
@@ -31,55 +39,322 @@ for env_key in env_keys:
             raise RuntimeError(msg)
 
 
-_use_function_timers = None
+# Function timers.  If the FLACARRAY_TIMING environment variable is set when the
+# package is imported, the functions decorated with `function_timer` are timed.  By
+# default each timer is named by the timed functions which are active in the
+# calling thread, for example "FlacArray.to_array|array_decompress_slice".  These
+# names are cached, so the cost of a timed call is two clock reads and a few
+# dictionary lookups.  Setting FLACARRAY_TIMING=stack instead names each timer by
+# the full Python call stack, which is much slower.
+#
+# Each thread accumulates its own timers, which are combined when read.  If the
+# FLACARRAY_TRACE environment variable is set to a file name, every timed call is
+# also recorded and written to that file in the Chrome trace format (viewable with
+# chrome://tracing or https://ui.perfetto.dev) when the process exits.  The file
+# name may contain "{pid}", which is replaced by the process ID.
+
 _function_timer_env_var = "FLACARRAY_TIMING"
+_trace_env_var = "FLACARRAY_TRACE"
+
+
+def _env_timing_mode():
+    valstr = os.environ.get(_function_timer_env_var, None)
+    if valstr == "1" or valstr == "true" or valstr == "yes":
+        return "fast"
+    if valstr == "stack":
+        return "stack"
+    if _trace_env_var in os.environ:
+        return "fast"
+    return None
+
+
+_timing_mode = _env_timing_mode()
+_trace_on = _trace_env_var in os.environ
+
+# The maximum number of trace events kept by each thread.  Later events are dropped.
+_trace_max_events = 1000000
 
 
 def use_function_timers():
-    global _use_function_timers
-    if _use_function_timers is not None:
-        # Already checked
-        return _use_function_timers
-
-    if _function_timer_env_var in os.environ:
-        valstr = os.environ[_function_timer_env_var]
-        if valstr == "1" or valstr == "true" or valstr == "yes":
-            _use_function_timers = True
+    return _timing_mode is not None
+
+
+def enable_timing(enable=True, trace=False):
+    """Enable or disable timers at runtime.
+
+    This affects `timing_region` blocks and functions decorated after this call.
+    Functions decorated with `function_timer` when the package was imported are only
+    timed if FLACARRAY_TIMING was set at that time.  Disabling the timers stops all
+    of them, including those functions, until the timers are enabled again.
+
+    Args:
+        enable (bool):  If True, enable the timers.
+        trace (bool):  If True, also record every timed call for `write_trace()`.
+
+    Returns:
+        None
+
+    """
+    global _timing_mode, _trace_on
+    if enable:
+        if _timing_mode is None:
+            _timing_mode = "fast"
+    else:
+        _timing_mode = None
+    _trace_on = enable and trace
+
+
+class _ThreadTimers(object):
+    """The timers of one thread."""
+
+    def __init__(self):
+        self.tid = threading.get_native_id()
+        self.name = threading.current_thread().name
+        # The thread, to find out when it has finished.
+        self.thread = weakref.ref(threading.current_thread())
+        # The names of the active timers, innermost last.
+        self.stack = list()
+        # The cached name of each (parent name, timer) pair.
+        self.names = dict()
+        # The total nanoseconds and number of calls of each timer.
+        self.totals = dict()
+        # The (name, start, duration) of each call, in nanoseconds, when tracing.
+        self.events = list()
+
+
+_thread_timers = threading.local()
+_all_thread_timers = list()
+_all_thread_timers_lock = threading.Lock()
+# The [nanoseconds, calls] of each timer, summed over the threads which finished.
+_finished_totals = dict()
+
+
+def _local_timers():
+    try:
+        return _thread_timers.timers
+    except AttributeError:
+        timers = _ThreadTimers()
+        _thread_timers.timers = timers
+        with _all_thread_timers_lock:
+            _all_thread_timers.append(timers)
+        return timers
+
+
+def _add_totals(totals, other):
+    for name, (elapsed, calls) in list(other.items()):
+        if name not in totals:
+            totals[name] = [0, 0]
+        totals[name][0] += elapsed
+        totals[name][1] += calls
+
+
+def _collect_timers():
+    """Get the timers of all threads, after pruning the finished threads.
+
+    The totals of each finished thread are moved to `_finished_totals`, and its
+    timers are dropped unless they hold trace events.  This must be called with
+    `_all_thread_timers_lock` held.
+
+    """
+    live = list()
+    for timers in _all_thread_timers:
+        thread = timers.thread()
+        if (thread is not None and thread.is_alive()) or len(timers.events) > 0:
+            live.append(timers)
         else:
-            _use_function_timers = False
+            _add_totals(_finished_totals, timers.totals)
+    _all_thread_timers[:] = live
+    return live
+
+
+def _record_timer(timers, name, start, elapsed):
+    total = timers.totals.get(name, None)
+    if total is None:
+        timers.totals[name] = [elapsed, 1]
     else:
-        _use_function_timers = False
-    return _use_function_timers
+        total[0] += elapsed
+        total[1] += 1
+    if _trace_on and len(timers.events) < _trace_max_events:
+        timers.events.append((name, start, elapsed))
 
 
-_global_timers = None
+def _timer_totals():
+    totals = dict()
+    with _all_thread_timers_lock:
+        all_timers = _collect_timers()
+        _add_totals(totals, _finished_totals)
+    for timers in all_timers:
+        _add_totals(totals, timers.totals)
+    return totals
 
 
 def get_timers():
-    global _global_timers
-    if _global_timers is None:
-        _global_timers = dict()
-    return _global_timers
+    """The total seconds of each timer, summed over all threads."""
+    return {k: 1.0e-9 * v[0] for k, v in _timer_totals().items()}
+
+
+def get_timer_calls():
+    """The number of calls of each timer, summed over all threads."""
+    return {k: v[1] for k, v in _timer_totals().items()}
 
 
 def update_timer(name, elapsed):
-    tmrs = get_timers()
-    if name not in tmrs:
-        tmrs[name] = 0.0
-    tmrs[name] += elapsed
+    """Add elapsed seconds to a timer of the calling thread."""
+    elapsed_ns = int(1.0e9 * elapsed)
+    _record_timer(
+        _local_timers(), name, time.perf_counter_ns() - elapsed_ns, elapsed_ns
+    )
 
 
 def clear_timers():
-    global _global_timers
-    if _global_timers is None:
-        _global_timers = dict()
-    _global_timers.clear()
+    with _all_thread_timers_lock:
+        for timers in _all_thread_timers:
+            timers.totals.clear()
+            timers.events.clear()
+        _finished_totals.clear()
+        _collect_timers()
 
 
 def print_timers():
-    timers = get_timers()
-    for k, v in timers.items():
-        print(f"{k}:  {v} seconds", flush=True)
+    for k, v in _timer_totals().items():
+        print(f"{k}:  {1.0e-9 * v[0]} seconds ({v[1]} calls)", flush=True)
+    if counters_enabled():
+        for k, v in get_native_counters().items():
+            print(f"native {k}:  {v}", flush=True)
+
+
+def write_trace(path):
+    """Write the recorded calls of all threads in the Chrome trace format.
+
+    Calls are recorded when the FLACARRAY_TRACE environment variable is set, or
+    after `enable_timing(trace=True)`.  Each thread is a separate track, and the
+    nested calls of a thread are shown nested.
+
+    Args:
+        path (str):  The output JSON file.
+
+    Returns:
+        None
+
+    """
+    with _all_thread_timers_lock:
+        all_timers = _collect_timers()
+    pid = os.getpid()
+    events = list()
+    for timers in all_timers:
+        events.append(
+            {
+                "name": "thread_name",
+                "ph": "M",
+                "pid": pid,
+                "tid": timers.tid,
+                "args": {"name": timers.name},
+            }
+        )
+        for name, start, elapsed in list(timers.events):
+            events.append(
+                {
+                    "name": name.rsplit("|", 1)[-1],
+                    "cat": "flacarray",
+                    "ph": "X",
+                    "ts": 1.0e-3 * start,
+                    "dur": 1.0e-3 * elapsed,
+                    "pid": pid,
+                    "tid": timers.tid,
+                    "args": {"timer": name},
+                }
+            )
+    with open(path, "w") as f:
+        json.dump({"traceEvents": events, "displayTimeUnit": "ms"}, f)
+
+
+def _write_env_trace():
+    write_trace(os.environ[_trace_env_var].format(pid=os.getpid()))
+
+
+if _trace_on:
+    atexit.register(_write_env_trace)
+
+
+class timing_region(object):
+    """Context manager which times a named region of code.
+
+    The region is timed like a function decorated with `function_timer`, and its
+    name is nested within the active timers of the calling thread.  This does
+    nothing unless timers are enabled.
+
+    Args:
+        name (str):  The name of the region.
+
+    """
+
+    __slots__ = ("name", "timers", "full_name", "start")
+
+    def __init__(self, name):
+        self.name = name
+        self.timers = None
+
+    def __enter__(self):
+        if _timing_mode is None:
+            return self
+        self.timers = _local_timers()
+        self.full_name = _push_timer(self.timers, self.name)
+        self.start = time.perf_counter_ns()
+        return self
+
+    def __exit__(self, *args):
+        if self.timers is not None:
+            elapsed = time.perf_counter_ns() - self.start
+            self.timers.stack.pop()
+            _record_timer(self.timers, self.full_name, self.start, elapsed)
+            self.timers = None
+        return False
+
+
+def _push_timer(timers, name):
+    # Find the full name of a timer within the active timers, and make it active.
+    stack = timers.stack
+    parent = stack[-1] if len(stack) > 0 else None
+    full_name = timers.names.get((parent, name), None)
+    if full_name is None:
+        full_name = name if parent is None else f"{parent}|{name}"
+        timers.names[(parent, name)] = full_name
+    stack.append(full_name)
+    return full_name
+
+
+def enable_native_counters(enable=True):
+    """Enable or disable the counters kept by the compiled encoder and decoder.
+
+    These are enabled automatically when function timers are enabled with the
+    FLACARRAY_TIMING environment variable.
+
+    """
+    enable_counters(enable)
+
+
+def get_native_counters(reset=False):
+    """Get the counters of the compiled encoder and decoder.
+
+    The counters are summed over the calling thread and all OpenMP threads.  See
+    `libflacarray.get_counters()` for their meaning.
+
+    Args:
+        reset (bool):  If True, zero the counters after reading them.
+
+    Returns:
+        (dict):  The counters.
+
+    """
+    return get_counters(use_threads=True, reset=reset)
+
+
+def clear_native_counters():
+    get_counters(use_threads=True, reset=True)
+
+
+if use_function_timers():
+    enable_native_counters()
 
 
 # Global list of functions to ignore in our simplified timing stacktrace.
@@ -96,15 +371,17 @@ def function_timer(f):
     """Simple decorator for function timing.
 
     If the FLACARRAY_TIMING environment variable is set, enable function timers
-    within the package.
+    within the package.  Otherwise the function is returned unchanged.
 
     """
-    if use_function_timers():
+    if _timing_mode == "stack":
         fname = f"{f.__qualname__}"
 
         @wraps(f)
         def df(*args, **kwargs):
             global _timing_stack_skip
+            if _timing_mode is None:
+                return f(*args, **kwargs)
             # Build a name from the current function and the call trace.
             tnm = ""
             fnmlist = list()
@@ -135,24 +412,44 @@ def function_timer(f):
             # Make sure the final frame handle is released
             del frm
             tnm += fname
-            start = time.perf_counter()
+            start = time.perf_counter_ns()
             result = f(*args, **kwargs)
-            stop = time.perf_counter()
-            elapsed = stop - start
-            update_timer(tnm, elapsed)
+            elapsed = time.perf_counter_ns() - start
+            _record_timer(_local_timers(), tnm, start, elapsed)
             return result
 
-    else:
+        return df
+
+    elif _timing_mode == "fast":
+        fname = f"{f.__qualname__}"
 
         @wraps(f)
         def df(*args, **kwargs):
-            return f(*args, **kwargs)
+            if _timing_mode is None:
+                return f(*args, **kwargs)
+            timers = _local_timers()
+            full_name = _push_timer(timers, fname)
+            start = time.perf_counter_ns()
+            try:
+                return f(*args, **kwargs)
+            finally:
+                elapsed = time.perf_counter_ns() - start
+                timers.stack.pop()
+                _record_timer(timers, full_name, start, elapsed)
+
+        return df
 
-    return df
+    else:
+        return f
 
 
 def function_timer_stackskip(f):
-    if use_function_timers():
+    """Exclude a function from the timer names built from the call stack.
+
+    This only has an effect with FLACARRAY_TIMING=stack.
+
+    """
+    if _timing_mode == "stack":
 
         @wraps(f)
         def df(*args, **kwargs):
@@ -166,13 +463,10 @@ def function_timer_stackskip(f):
                 _timing_stack_skip.add(funcname)
             return f(*args, **kwargs)
 
-    else:
-
-        @wraps(f)
-        def df(*args, **kwargs):
-            return f(*args, **kwargs)
+        return df
 
-    return df
+    else:
+        return f
 
 
 def ensure_one_element(input, dtype=None):
@@ -242,42 +536,29 @@ def compressed_dtype(n_channel, offsets, gains):
             return np.dtype(np.float32)
 
 
-@function_timer
-def float_to_int(data, quanta=None, precision=None):
-    """Convert floating point data to integers.
+def resolve_quanta(data, quanta=None, precision=None):
+    """Compute the flat-packed quanta for each stream of floating point data.
 
-    This function subtracts the mean and rescales data before rounding to 32bit
-    or 64bit integer values.  32bit floats are converted to 32bit integers and
-    64bit floats are converted to 64bit integers.
-
-    See discussion in the `FlacArray` class documentation about how the offsets and
-    gains are computed for a given quanta.
+    A scalar quanta (or precision) is applied to all streams.  An array must have
+    the shape of the leading dimensions of the data.  If both are None, the
+    returned array is empty, which indicates that the quanta should be computed
+    from the dynamic range of each stream during conversion.
 
     Args:
         data (array):  The floating point data.
-        quanta (float):  The floating point quantity corresponding to one integer
-            resolution amount in the output.  If `None`, quanta will be
-            based on the full dynamic range of the data.
-        precision (int):  Number of significant digits to preserve.  If
+        quanta (float, array):  The floating point quantity corresponding to one
+            integer resolution amount.
+        precision (int, array):  Number of significant digits to preserve.  If
             provided, `quanta` will be estimated accordingly.
 
     Returns:
-        (tuple):  The (integer data, offset array, gain array)
+        (array):  The flat-packed quanta, with the same dtype as the data.
 
     """
-    if np.any(np.isnan(data)):
-        raise RuntimeError("Cannot convert data with NaNs to integers")
     if quanta is not None and precision is not None:
         raise RuntimeError("Cannot specify both quanta and precision")
-    if data.dtype != np.dtype(np.float32) and data.dtype != np.dtype(np.float64):
-        raise ValueError("Only float32 and float64 data are supported")
 
     leading_shape = data.shape[:-1]
-    if len(leading_shape) == 0:
-        n_stream = 1
-    else:
-        n_stream = np.prod(leading_shape)
-    stream_size = data.shape[-1]
 
     if precision is not None:
         # Convert precision into quanta array
@@ -311,19 +592,60 @@ def float_to_int(data, quanta=None, precision=None):
         except TypeError:
             quanta = quanta * np.ones(leading_shape, dtype=data.dtype)
 
+    return np.ascontiguousarray(quanta.reshape((-1,)), dtype=data.dtype)
+
+
+@function_timer
+def float_to_int(data, quanta=None, precision=None):
+    """Convert floating point data to integers.
+
+    This function subtracts the mean and rescales data before rounding to 32bit
+    or 64bit integer values.  32bit floats are converted to 32bit integers and
+    64bit floats are converted to 64bit integers.
+
+    See discussion in the `FlacArray` class documentation about how the offsets and
+    gains are computed for a given quanta.
+
+    Args:
+        data (array):  The floating point data.
+        quanta (float):  The floating point quantity corresponding to one integer
+            resolution amount in the output.  If `None`, quanta will be
+            based on the full dynamic range of the data.
+        precision (int):  Number of significant digits to preserve.  If
+            provided, `quanta` will be estimated accordingly.
+
+    Returns:
+        (tuple):  The (integer data, offset array, gain array)
+
+    """
+    if np.any(np.isnan(data)):
+        raise RuntimeError("Cannot convert data with NaNs to integers")
+    if quanta is not None and precision is not None:
+        raise RuntimeError("Cannot specify both quanta and precision")
+    if data.dtype != np.dtype(np.float32) and data.dtype != np.dtype(np.float64):
+        raise ValueError("Only float32 and float64 data are supported")
+
+    leading_shape = data.shape[:-1]
+    if len(leading_shape) == 0:
+        n_stream = 1
+    else:
+        n_stream = np.prod(leading_shape)
+    stream_size = data.shape[-1]
+    quanta = resolve_quanta(data, quanta=quanta, precision=precision)
+
     if data.dtype == np.dtype(np.float32):
         output, offsets, gains = wrap_float32_to_int32(
             data.reshape((-1,)),
             n_stream,
             stream_size,
-            quanta.reshape((-1,)).astype(data.dtype),
+            quanta,
         )
     else:
         output, offsets, gains = wrap_float64_to_int64(
             data.reshape((-1,)),
             n_stream,
             stream_size,
-            quanta.reshape((-1,)).astype(data.dtype),
+            quanta,
         )
 
     if len(leading_shape) == 0:
@@ -412,7 +734,8 @@ def keep_select(keep, stream_starts, stream_nbytes):
     """Filter out a subset of streams.
 
     Given a keep mask, return the selected stream starts / nbytes as well as the
-    array of selected indices.
+    list of selected indices.  The selection is done with vectorized numpy
+    operations, so this is fast even for a very large number of streams.
 
     Args:
         keep (array):  Bool array of streams to keep in the decompression.
@@ -429,31 +752,172 @@ def keep_select(keep, stream_starts, stream_nbytes):
         raise RuntimeError("The keep array should have the same shape as stream_starts")
     if keep.shape != stream_nbytes.shape:
         raise RuntimeError("The keep array should have the same shape as stream_starts")
-    starts = list()
-    nbytes = list()
-    indices = list()
-    it = np.nditer(keep, order="C", flags=["multi_index"])
-    for st in it:
-        idx = it.multi_index
-        if st:
-            # We are keeping this stream
-            starts.append(stream_starts[idx])
-            nbytes.append(stream_nbytes[idx])
-            indices.append(idx)
-    it.close()
-    del it
+    streams = keep_streams(keep)
     return (
-        np.array(starts, dtype=np.int64),
-        np.array(nbytes, dtype=np.int64),
-        indices,
+        stream_starts.reshape((-1,))[streams].astype(np.int64, copy=False),
+        stream_nbytes.reshape((-1,))[streams].astype(np.int64, copy=False),
+        stream_indices(streams, keep.shape),
     )
 
 
+def keep_streams(keep):
+    """Get the flat indices of the streams selected by a keep mask.
+
+    Args:
+        keep (array):  Bool array of streams to keep.
+
+    Returns:
+        (array):  The int64 indices of the True elements, in C order of the mask.
+
+    """
+    return np.flatnonzero(keep).astype(np.int64, copy=False)
+
+
+def stream_indices(streams, leading_shape):
+    """Convert flat stream indices to a list of index tuples.
+
+    Args:
+        streams (array):  The flat (C order) stream indices.
+        leading_shape (tuple):  The leading shape of the array of streams.
+
+    Returns:
+        (list):  The tuple of indices of each stream into the leading dimensions.
+
+    """
+    per_axis = np.unravel_index(streams, leading_shape)
+    return list(zip(*[x.tolist() for x in per_axis]))
+
+
 def select_keep_indices(arr, indices):
-    """Helper function to extract array elements with a list of indices."""
+    """Helper function to extract array elements with a list of indices.
+
+    Each index is a tuple into the leading dimensions of the array, such as those
+    returned by `keep_select()`.  Any trailing dimensions are kept.
+    """
     if arr is None:
         return None
     if indices is None:
         return arr
-    dt = arr.dtype
-    return np.array([arr[x] for x in indices], dtype=dt)
+    if len(indices) == 0:
+        return np.array([], dtype=arr.dtype)
+    idx = np.array(indices, dtype=np.int64).reshape((len(indices), -1))
+    n_lead = idx.shape[1]
+    flat = np.ravel_multi_index(tuple(idx.T), arr.shape[:n_lead])
+    return arr.reshape((-1,) + arr.shape[n_lead:])[flat]
+
+
+def select_keep_aux(stream_aux, indices):
+    """Helper function to extract the kept streams from auxiliary arrays.
+
+    The dictionary of optional per-stream auxiliary data contains arrays, whose
+    leading dimensions match the stream starts, and scalar parameters.  The arrays
+    are reduced to the kept streams and the scalars are unchanged.
+
+    Args:
+        stream_aux (dict):  The auxiliary data or None.
+        indices (list):  The indices of the kept streams or None.
+
+    Returns:
+        (dict):  The selected auxiliary data.
+
+    """
+    if stream_aux is None or indices is None:
+        return stream_aux
+    result = dict()
+    for key, val in stream_aux.items():
+        if isinstance(val, np.ndarray):
+            result[key] = select_keep_indices(val, indices)
+        else:
+            result[key] = val
+    return result
+
+
+class LRUCache(object):
+    """A cache of arrays with a bound on their total size in bytes.
+
+    When adding an array would exceed `max_bytes`, the least recently used arrays
+    are evicted.  An array larger than `max_bytes` is never cached.  The number of
+    lookups which were found (hits) and not found (misses) are counted.  The cache
+    may be used from several threads.
+
+    Args:
+        max_bytes (int):  The largest total number of bytes of the cached arrays.
+
+    """
+
+    def __init__(self, max_bytes):
+        self.max_bytes = int(max_bytes)
+        self.nbytes = 0
+        self.hits = 0
+        self.misses = 0
+        self._entries = OrderedDict()
+        self._lock = threading.Lock()
+
+    def __len__(self):
+        return len(self._entries)
+
+    def get(self, key):
+        """Look up an array, marking it as the most recently used.
+
+        Args:
+            key (object):  The hashable key.
+
+        Returns:
+            (array):  The cached array, or None.
+
+        """
+        with self._lock:
+            value = self._entries.get(key, None)
+            if value is None:
+                self.misses += 1
+            else:
+                self.hits += 1
+                self._entries.move_to_end(key)
+            return value
+
+    def put(self, key, value):
+        """Add an array, evicting the least recently used arrays if needed.
+
+        Args:
+            key (object):  The hashable key.
+            value (array):  The array to cache.
+
+        Returns:
+            None
+
+        """
+        if value.nbytes > self.max_bytes:
+            return
+        with self._lock:
+            old = self._entries.pop(key, None)
+            if old is not None:
+                self.nbytes -= old.nbytes
+            self._entries[key] = value
+            self.nbytes += value.nbytes
+            while self.nbytes > self.max_bytes:
+                _, evicted = self._entries.popitem(last=False)
+                self.nbytes -= evicted.nbytes
+
+    def clear(self):
+        """Remove all arrays and reset the counts."""
+        with self._lock:
+            self._entries.clear()
+            self.nbytes = 0
+            self.hits = 0
+            self.misses = 0
+
+    def stats(self):
+        """Get the current state of the cache.
+
+        Returns:
+            (dict):  The number of hits and misses and the entries and bytes cached.
+
+        """
+        with self._lock:
+            return {
+                "hits": self.hits,
+                "misses": self.misses,
+                "entries": len(self._entries),
+                "nbytes": self.nbytes,
+                "max_bytes": self.max_bytes,
+            }
@@ -22,7 +22,14 @@ except ImportError:
 
 from . import __version__ as flacarray_version
 from .compress import array_compress
-from .io_common import receive_write_compressed
+from .io_common import (
+    aligned_stream_starts,
+    receive_write_compressed,
+    split_stream_aux,
+    stream_aux_params,
+    streams_narrowed,
+    writer_format_version,
+)
 from .mpi import global_array_properties, global_bytes
 from .utils import function_timer
 
@@ -77,6 +84,9 @@ class WriterZarr:
         dataset_comp,
         dataset_offsets,
         dataset_gains,
+        stream_aux=None,
+        dataset_aux=None,
+        layout=None,
     ):
         self._starts = global_stream_starts
         self._nbytes = stream_nbytes
@@ -88,6 +98,11 @@ class WriterZarr:
         self._dcomp = dataset_comp
         self._doffsets = dataset_offsets
         self._dgains = dataset_gains
+        self._aux = stream_aux if stream_aux is not None else dict()
+        self._daux = dataset_aux if dataset_aux is not None else dict()
+        # If the streams are aligned to chunks, the (dataset starts with the global
+        # leading shape, contiguous starts, groups and nbytes) of all streams.
+        self._layout = layout
 
     @property
     def starts(self):
@@ -109,6 +124,10 @@ class WriterZarr:
     def gains(self):
         return self._gains
 
+    @property
+    def aux(self):
+        return self._aux
+
     @property
     def have_offsets(self):
         return self._doffsets is not None
@@ -126,6 +145,9 @@ class WriterZarr:
         dset[fslc] = buf[dslc]
 
     def save_starts(self, buf, mpi_comm, dslc, fslc):
+        if self._layout is not None:
+            # Save the aligned starts of the same streams
+            return self.save(self._dstarts, self._layout[0], mpi_comm, fslc, fslc)
         return self.save(self._dstarts, buf, mpi_comm, dslc, fslc)
 
     def save_nbytes(self, buf, mpi_comm, dslc, fslc):
@@ -137,8 +159,32 @@ class WriterZarr:
     def save_gains(self, buf, mpi_comm, dslc, fslc):
         return self.save(self._dgains, buf, mpi_comm, dslc, fslc)
 
+    def save_aux(self, name, buf, mpi_comm, dslc, fslc):
+        return self.save(self._daux.get(name, None), buf, mpi_comm, dslc, fslc)
+
     def save_compressed(self, buf, mpi_comm, dslc, fslc):
-        return self.save(self._dcomp, buf, mpi_comm, dslc, fslc)
+        if self._layout is None:
+            return self.save(self._dcomp, buf, mpi_comm, dslc, fslc)
+        rank = 0
+        if mpi_comm is not None:
+            rank = mpi_comm.rank
+        if self._dcomp is None or rank != 0:
+            return
+        # The buffer holds the contiguous bytes fslc[0] of consecutive streams.
+        # Write each run of these streams which is in one group of chunks.
+        aligned, packed, groups, nbytes = self._layout
+        aligned = aligned.reshape((-1,))
+        first = int(np.searchsorted(packed, fslc[0].start, side="left"))
+        last = int(np.searchsorted(packed, fslc[0].stop, side="left"))
+        stream_bufs = buf[dslc]
+        run_first = np.flatnonzero(np.diff(groups[first:last], prepend=-1)) + first
+        run_last = np.append(run_first[1:], last)
+        for rfirst, rlast in zip(run_first.tolist(), run_last.tolist()):
+            buf_start = packed[rfirst] - fslc[0].start
+            run_bytes = packed[rlast - 1] + nbytes[rlast - 1] - packed[rfirst]
+            self._dcomp[aligned[rfirst] : aligned[rfirst] + run_bytes] = stream_bufs[
+                buf_start : buf_start + run_bytes
+            ]
 
 
 @function_timer
@@ -159,6 +205,9 @@ def write_compressed(
     global_process_nbytes,
     mpi_comm,
     mpi_dist,
+    stream_aux=None,
+    chunk_bytes=None,
+    shard_chunks=None,
 ):
     """Write compressed data to a Zarr group.
 
@@ -172,6 +221,18 @@ def write_compressed(
     intentionally write the "flacarray_format_version" attribute to the top level
     group so that we can parse that and call the correct version of the read function.
 
+    Optional per-stream arrays (for example the segment starting bytes) are written
+    to their own datasets, with the describing parameter as an attribute.
+
+    By default the compressed bytes are written contiguously with the default
+    chunking of Zarr, so a stream may straddle chunks.  If `chunk_bytes` is given,
+    consecutive streams are instead grouped into chunks of this size and each group
+    starts on a chunk boundary, with zero padding at the end of each chunk (see
+    `io_common.aligned_stream_starts()`).  Reading a subset of streams then only
+    fetches the chunks of those streams, and the chunks of different processes or
+    streams can be fetched in parallel.  With Zarr 3 the chunks may also be stored
+    in shards of `shard_chunks` chunks, to reduce the number of stored objects.
+
     Args:
         zgrp (zarr.Group):  The Group to use.
         leading_shape (tuple):  Shape of the local leading dimensions.
@@ -189,6 +250,13 @@ def write_compressed(
         global_process_nbytes (list):  The number of compressed bytes on each process.
         mpi_comm (MPI.Comm):  The MPI communicator.
         mpi_dist (list):  The range of the leading dimension on each process.
+        stream_aux (dict):  The optional auxiliary per-stream arrays and their
+            parameters.
+        chunk_bytes (int):  If not None, the target size in bytes of the chunks of
+            the compressed bytes.  Whole streams are grouped into chunks, so that
+            no stream straddles a chunk boundary.
+        shard_chunks (int):  If not None, the number of chunks in each shard of the
+            compressed bytes.  This requires Zarr 3 and `chunk_bytes`.
 
     Returns:
         None
@@ -196,8 +264,10 @@ def write_compressed(
     """
     if not have_zarr:
         raise RuntimeError("zarr is not importable, cannot write to a zarr.Group")
+    if shard_chunks is not None and chunk_bytes is None:
+        raise RuntimeError("Writing shards requires chunk_bytes")
 
-    # Writer is currently using version 1
+    # Versions 1 and 2 share the dataset and attribute names
     from .zarr_load_v1 import zarr_names as znames
 
     comm = mpi_comm
@@ -211,11 +281,34 @@ def write_compressed(
     dcomp = None
     dsoff = None
     dsgain = None
+    daux = dict()
+
+    # Optional arrays keep any trailing dimensions after the leading shape
+    aux_arrays, aux_params = split_stream_aux(stream_aux)
+
+    # The number of bytes of all streams is needed to align them to chunks
+    all_nbytes = None
+    if chunk_bytes is not None:
+        flat_nbytes = stream_nbytes.reshape((-1,)).astype(np.int64)
+        if comm is None:
+            all_nbytes = flat_nbytes
+        else:
+            all_nbytes = comm.gather(flat_nbytes, root=0)
+            if rank == 0:
+                all_nbytes = np.concatenate(all_nbytes)
+    layout = None
+
+    # Every process takes part in checking for narrowed streams
+    narrowed = streams_narrowed(
+        compressed, stream_starts, stream_nbytes, n_channels, stream_aux, comm
+    )
 
     if rank == 0:
         # This process is participating.  Write the format version string
         # to the top-level group.
-        zgrp.attrs["flacarray_format_version"] = "1"
+        zgrp.attrs["flacarray_format_version"] = writer_format_version(
+            stream_aux=stream_aux, narrowed=narrowed, chunk_bytes=chunk_bytes
+        )
         zgrp.attrs["flacarray_software_version"] = flacarray_version
         zgrp.attrs[znames["flac_channels"]] = f"{n_channels}"
 
@@ -240,6 +333,20 @@ def write_compressed(
             # Zarr-2
             create_func = zgrp.create_dataset
 
+        comp_kw = dict()
+        if chunk_bytes is not None:
+            aligned, groups, total = aligned_stream_starts(all_nbytes, chunk_bytes)
+            packed = np.zeros_like(all_nbytes)
+            packed[1:] = np.cumsum(all_nbytes)[:-1]
+            aligned = aligned.reshape(z_global_leading_shape)
+            layout = (aligned, packed, groups, all_nbytes)
+            z_global_nbytes = (int(total),)
+            comp_kw["chunks"] = (int(chunk_bytes),)
+            if shard_chunks is not None:
+                if not hasattr(zgrp, "create_array"):
+                    raise RuntimeError("Writing shards requires Zarr 3")
+                comp_kw["shards"] = (int(chunk_bytes) * int(shard_chunks),)
+
         # The starting bytes of each stream
         dstarts = create_func(
             znames["stream_starts"],
@@ -274,12 +381,26 @@ def write_compressed(
         else:
             dsgain = None
 
+        # Optional per-stream arrays
+        for name, arr in aux_arrays.items():
+            trailing = tuple([int(x) for x in arr.shape[len(leading_shape) :]])
+            daux[name] = create_func(
+                znames[name],
+                shape=z_global_leading_shape + trailing,
+                dtype=arr.dtype,
+            )
+            param = stream_aux_params[name]
+            daux[name].attrs[znames[param]] = int(aux_params[param])
+
         # Always have compressed bytes
         dcomp = create_func(
             znames["compressed"],
             shape=z_global_nbytes,
             dtype=np.uint8,
+            **comp_kw,
         )
+        if chunk_bytes is not None:
+            dcomp.attrs[znames["chunk_bytes"]] = int(chunk_bytes)
 
     # Use the common writing function
     writer = WriterZarr(
@@ -293,6 +414,9 @@ def write_compressed(
         dcomp,
         dsoff,
         dsgain,
+        stream_aux=aux_arrays,
+        dataset_aux=daux,
+        layout=layout,
     )
     receive_write_compressed(
         writer,
@@ -306,7 +430,21 @@ def write_compressed(
 
 @function_timer
 def write_array(
-    arr, zgrp, level=5, quanta=None, precision=None, mpi_comm=None, use_threads=False
+    arr,
+    zgrp,
+    level=5,
+    quanta=None,
+    precision=None,
+    mpi_comm=None,
+    use_threads=False,
+    segment_size=None,
+    n_threads=None,
+    seek_table=False,
+    max_memory=None,
+    checksums=False,
+    md5=True,
+    chunk_bytes=None,
+    shard_chunks=None,
 ):
     """Compress a numpy array and write to an Zarr group.
 
@@ -336,6 +474,22 @@ def write_array(
             local piece of the array is passed in on each process.
         use_threads (bool):  If True, use OpenMP threads to parallelize decoding.
             This is only beneficial for large arrays.
+        segment_size (int):  If not None, compress each stream in independent
+            segments of this many samples.
+        n_threads (int):  If not None, the total number of threads to use.  See
+            `encode_flac()`.
+        seek_table (bool):  If True, also write the starting byte of every FLAC
+            frame, so that reading a slice of samples can decode it directly.
+        max_memory (int):  If not None, the limit in bytes on the memory used for
+            the streams being compressed when `use_threads` is True.
+        checksums (bool):  If True, also write a checksum of the compressed bytes of
+            every stream (or segment), which can be checked when reading.
+        md5 (bool):  If False, skip the unused MD5 signature of the input.
+        chunk_bytes (int):  If not None, the target size in bytes of the chunks of
+            the compressed bytes.  Whole streams are grouped into chunks, so that
+            no stream straddles a chunk boundary.  See `write_compressed()`.
+        shard_chunks (int):  If not None, the number of chunks in each shard of the
+            compressed bytes.  This requires Zarr 3 and `chunk_bytes`.
 
     Returns:
         None
@@ -356,8 +510,19 @@ def write_array(
         n_channels = 1
 
     # Compress our local piece of the array
-    compressed, starts, nbytes, offsets, gains = array_compress(
-        arr, level=level, quanta=quanta, precision=precision, use_threads=use_threads
+    compressed, starts, nbytes, offsets, gains, stream_aux = array_compress(
+        arr,
+        level=level,
+        quanta=quanta,
+        precision=precision,
+        use_threads=use_threads,
+        segment_size=segment_size,
+        return_aux=True,
+        n_threads=n_threads,
+        seek_table=seek_table,
+        max_memory=max_memory,
+        checksums=checksums,
+        md5=md5,
     )
 
     local_nbytes = compressed.nbytes
@@ -389,11 +554,22 @@ def write_array(
         global_proc_bytes,
         mpi_comm,
         mpi_dist,
+        stream_aux=stream_aux,
+        chunk_bytes=chunk_bytes,
+        shard_chunks=shard_chunks,
     )
 
 
 @function_timer
-def read_compressed(zgrp, keep=None, mpi_comm=None, mpi_dist=None):
+def read_compressed(
+    zgrp,
+    keep=None,
+    mpi_comm=None,
+    mpi_dist=None,
+    return_aux=False,
+    read_gap=None,
+    lazy=False,
+):
     """Load compressed data from a Zarr Group.
 
     This function acts as a dispatch to the correct version of the reading
@@ -415,6 +591,15 @@ def read_compressed(zgrp, keep=None, mpi_comm=None, mpi_dist=None):
             the leading dimension of the array.
         mpi_dist (list):  The optional list of tuples specifying the first / last
             element of the leading dimension to assign to each process.
+        return_aux (bool):  If True, also return the dictionary of optional
+            auxiliary per-stream arrays.  This is required if the data contains
+            segmented streams.  Otherwise the optional arrays are not loaded.
+        read_gap (int):  The largest gap in bytes between kept streams which are
+            read together.  If None, the default in `io_common` is used.
+        lazy (bool):  If True, the local compressed bytes are not read.  Instead
+            an `io_common.DatasetBytes` instance is returned in their place, which
+            reads the bytes of streams as they are needed.  The group must remain
+            open while it is used.
 
     Returns:
         (tuple):  The compressed data and metadata.
@@ -440,6 +625,9 @@ def read_compressed(zgrp, keep=None, mpi_comm=None, mpi_dist=None):
         keep=keep,
         mpi_comm=mpi_comm,
         mpi_dist=mpi_dist,
+        return_aux=return_aux,
+        read_gap=read_gap,
+        lazy=lazy,
     )
 
 
@@ -453,6 +641,8 @@ def read_array(
     mpi_dist=None,
     use_threads=False,
     no_flatten=False,
+    verify=False,
+    read_gap=None,
 ):
     """Load a numpy array from a compressed Zarr group.
 
@@ -492,6 +682,10 @@ def read_array(
             This is only beneficial for large arrays.
         no_flatten (bool):  If True, for single-stream arrays, leave the leading
             dimension of (1,) in the result.
+        verify (bool):  If True, check the compressed bytes of each stream against
+            the checksums written with the data before decoding.
+        read_gap (int):  The largest gap in bytes between kept streams which are
+            read together.  If None, the default in `io_common` is used.
 
     Returns:
         (array):  The loaded and decompressed data OR the array and the kept indices.
@@ -521,4 +715,6 @@ def read_array(
         mpi_dist=mpi_dist,
         use_threads=use_threads,
         no_flatten=False,
+        verify=verify,
+        read_gap=read_gap,
     )
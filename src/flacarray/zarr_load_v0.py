@@ -61,6 +61,11 @@ class ReaderZarr:
     def stream_gain_dtype(self):
         return self._gains_dtype
 
+    @property
+    def aux_shapes(self):
+        # Version 0 data has no auxiliary arrays
+        return dict()
+
     def load(self, dset, mpi_comm, fslc, dslc):
         rank = 0
         if mpi_comm is not None:
@@ -84,9 +89,20 @@ class ReaderZarr:
     def load_gains(self, mpi_comm, fslc, dslc):
         return self.load(self._gains, mpi_comm, fslc, dslc)
 
+    def load_aux(self, name, mpi_comm, fslc, dslc):
+        return None
+
 
 @function_timer
-def read_compressed(zgrp, keep=None, mpi_comm=None, mpi_dist=None):
+def read_compressed(
+    zgrp,
+    keep=None,
+    mpi_comm=None,
+    mpi_dist=None,
+    return_aux=False,
+    read_gap=None,
+    lazy=False,
+):
     """Load compressed data from an Zarr Group.
 
     If `keep` is specified, this should be a boolean array with the same shape
@@ -104,6 +120,14 @@ def read_compressed(zgrp, keep=None, mpi_comm=None, mpi_dist=None):
             the leading dimension of the array.
         mpi_dist (list):  The optional list of tuples specifying the first / last
             element of the leading dimension to assign to each process.
+        return_aux (bool):  If True, also return the (always empty) dictionary of
+            auxiliary per-stream arrays.
+        read_gap (int):  The largest gap in bytes between kept streams which are
+            read together.  If None, the default in `io_common` is used.
+        lazy (bool):  If True, the local compressed bytes are not read.  Instead
+            an `io_common.DatasetBytes` instance is returned in their place, which
+            reads the bytes of streams as they are needed.  The group must remain
+            open while it is used.
 
     Returns:
         (tuple):  The compressed data and metadata.
@@ -178,6 +202,7 @@ def read_compressed(zgrp, keep=None, mpi_comm=None, mpi_dist=None):
         stream_offsets,
         stream_gains,
         keep_indices,
+        _,
     ) = read_send_compressed(
         reader,
         global_shape,
@@ -185,12 +210,14 @@ def read_compressed(zgrp, keep=None, mpi_comm=None, mpi_dist=None):
         keep=keep,
         mpi_comm=mpi_comm,
         mpi_dist=mpi_dist,
+        read_gap=read_gap,
+        lazy=lazy,
     )
 
     # For version 0, the number of channels is always "1", since int64 flac encoding
     # was not yet supported.  We handle the int64 case in the read_array() function.
 
-    return (
+    result = (
         local_shape,
         global_shape,
         compressed,
@@ -202,6 +229,9 @@ def read_compressed(zgrp, keep=None, mpi_comm=None, mpi_dist=None):
         mpi_dist,
         keep_indices,
     )
+    if return_aux:
+        result += (dict(),)
+    return result
 
 
 @function_timer
@@ -214,6 +244,8 @@ def read_array(
     mpi_dist=None,
     use_threads=False,
     no_flatten=False,
+    verify=False,
+    read_gap=None,
 ):
     """Read compressed data directly into an array.
 
@@ -250,11 +282,17 @@ def read_array(
             This is only beneficial for large arrays.
         no_flatten (bool):  If True, for single-stream arrays, leave the leading
             dimension of (1,) in the result.
+        verify (bool):  If True, check the compressed bytes of each stream against
+            the checksums written with the data before decoding.
+        read_gap (int):  The largest gap in bytes between kept streams which are
+            read together.  If None, the default in `io_common` is used.
 
     Returns:
         (array):  The loaded and decompressed data.  Or the array and the kept indices.
 
     """
+    if verify:
+        raise RuntimeError("Format version 0 data does not contain checksums")
     (
         local_shape,
         global_shape,
@@ -271,6 +309,7 @@ def read_array(
         keep=keep,
         mpi_comm=mpi_comm,
         mpi_dist=mpi_dist,
+        read_gap=read_gap,
     )
 
     first_samp = None
@@ -13,7 +13,7 @@ import zarr
 
 from .decompress import array_decompress
 from .mpi import distribute_and_verify
-from .io_common import read_send_compressed
+from .io_common import read_send_compressed, stream_aux_params
 from .utils import function_timer
 
 
@@ -26,6 +26,13 @@ zarr_names = {
     "stream_offsets": "stream_offsets",
     "stream_gains": "stream_gains",
     "flac_channels": "flac_channels",
+    "stream_segments": "stream_segments",
+    "segment_size": "segment_size",
+    "stream_frames": "stream_frames",
+    "frame_size": "frame_size",
+    "stream_checksums": "stream_checksums",
+    "checksum_type": "checksum_type",
+    "chunk_bytes": "chunk_bytes",
 }
 
 
@@ -41,6 +48,8 @@ class ReaderZarr:
         dataset_gains,
         offsets_dtype,
         gains_dtype,
+        aux_shapes=None,
+        dataset_aux=None,
     ):
         self._starts = dataset_starts
         self._nbytes = dataset_nbytes
@@ -49,6 +58,8 @@ class ReaderZarr:
         self._gains = dataset_gains
         self._offsets_dtype = offsets_dtype
         self._gains_dtype = gains_dtype
+        self._aux_shapes = aux_shapes if aux_shapes is not None else dict()
+        self._aux = dataset_aux if dataset_aux is not None else dict()
 
     @property
     def compressed_dataset(self):
@@ -62,6 +73,10 @@ class ReaderZarr:
     def stream_gain_dtype(self):
         return self._gains_dtype
 
+    @property
+    def aux_shapes(self):
+        return self._aux_shapes
+
     def load(self, dset, mpi_comm, fslc, dslc):
         rank = 0
         if mpi_comm is not None:
@@ -85,9 +100,20 @@ class ReaderZarr:
     def load_gains(self, mpi_comm, fslc, dslc):
         return self.load(self._gains, mpi_comm, fslc, dslc)
 
+    def load_aux(self, name, mpi_comm, fslc, dslc):
+        return self.load(self._aux.get(name, None), mpi_comm, fslc, dslc)
+
 
 @function_timer
-def read_compressed(zgrp, keep=None, mpi_comm=None, mpi_dist=None):
+def read_compressed(
+    zgrp,
+    keep=None,
+    mpi_comm=None,
+    mpi_dist=None,
+    return_aux=False,
+    read_gap=None,
+    lazy=False,
+):
     """Load compressed data from an Zarr Group.
 
     If `keep` is specified, this should be a boolean array with the same shape
@@ -105,6 +131,16 @@ def read_compressed(zgrp, keep=None, mpi_comm=None, mpi_dist=None):
             the leading dimension of the array.
         mpi_dist (list):  The optional list of tuples specifying the first / last
             element of the leading dimension to assign to each process.
+        return_aux (bool):  If True, also return the dictionary of optional
+            auxiliary per-stream arrays.  This is required if the data contains
+            segmented streams.  Otherwise the optional arrays are not loaded.
+        read_gap (int):  The largest gap in bytes between kept streams which are
+            read together.  If None, the default in `io_common` is used, or the
+            chunk size if the streams were written aligned to chunks.
+        lazy (bool):  If True, the local compressed bytes are not read.  Instead
+            an `io_common.DatasetBytes` instance is returned in their place, which
+            reads the bytes of streams as they are needed.  The group must remain
+            open while it is used.
 
     Returns:
         (tuple):  The compressed data and metadata.
@@ -124,6 +160,8 @@ def read_compressed(zgrp, keep=None, mpi_comm=None, mpi_dist=None):
     stream_off_dtype = None
     stream_gain_dtype = None
     n_channel = None
+    aux_shapes = dict()
+    aux_params = dict()
 
     # Dataset handles (only valding on reading processes)
     dstarts = None
@@ -131,12 +169,13 @@ def read_compressed(zgrp, keep=None, mpi_comm=None, mpi_dist=None):
     dsoff = None
     dsgain = None
     dcomp = None
+    daux = dict()
 
     if rank == 0:
         # This process is participating.
         # Double check that we can load this format.
         ver = int(zgrp.attrs["flacarray_format_version"])
-        if ver != 1:
+        if ver not in (1, 2):
             msg = f"Version 1 loader called with version {ver} data"
             raise RuntimeError(msg)
 
@@ -156,6 +195,17 @@ def read_compressed(zgrp, keep=None, mpi_comm=None, mpi_dist=None):
             stream_gain_dtype = np.dtype(dsgain.dtype)
         dcomp = zgrp[zarr_names["compressed"]]
         global_nbytes = dcomp.size
+        if read_gap is None and zarr_names["chunk_bytes"] in dcomp.attrs:
+            # The streams are aligned to chunks, which are always read whole.
+            # Merge the reads of kept streams across the padding and across less
+            # than one chunk of other streams.
+            read_gap = int(dcomp.attrs[zarr_names["chunk_bytes"]])
+        # Optional per-stream arrays and their parameters
+        for name, param in stream_aux_params.items():
+            if zarr_names[name] in zgrp:
+                daux[name] = zgrp[zarr_names[name]]
+                aux_shapes[name] = daux[name].shape[len(dstarts.shape) :]
+                aux_params[param] = int(daux[name].attrs[zarr_names[param]])
 
     if nproc > 1:
         # Not every process is reading- communicate some of the metadata loaded
@@ -166,13 +216,33 @@ def read_compressed(zgrp, keep=None, mpi_comm=None, mpi_dist=None):
         stream_gain_dtype = mpi_comm.bcast(stream_gain_dtype, root=0)
         stream_off_dtype = mpi_comm.bcast(stream_off_dtype, root=0)
         n_channel = mpi_comm.bcast(n_channel, root=0)
+        aux_shapes = mpi_comm.bcast(aux_shapes, root=0)
+        aux_params = mpi_comm.bcast(aux_params, root=0)
+
+    if not return_aux:
+        # The segments are needed to decode the streams.  The other arrays are
+        # optional hints, and are not loaded.
+        if "stream_segments" in aux_shapes:
+            msg = "Data contains segmented streams, use return_aux=True to load these."
+            raise RuntimeError(msg)
+        aux_shapes = dict()
+        aux_params = dict()
+        daux = dict()
 
     # Compute or verify the MPI distribution for the global leading dimension
     mpi_dist = distribute_and_verify(mpi_comm, global_shape[0], mpi_dist=mpi_dist)
 
     # Use the common reader function
     reader = ReaderZarr(
-        dstarts, dbytes, dcomp, dsoff, dsgain, stream_off_dtype, stream_gain_dtype
+        dstarts,
+        dbytes,
+        dcomp,
+        dsoff,
+        dsgain,
+        stream_off_dtype,
+        stream_gain_dtype,
+        aux_shapes=aux_shapes,
+        dataset_aux=daux,
     )
     (
         local_shape,
@@ -182,6 +252,7 @@ def read_compressed(zgrp, keep=None, mpi_comm=None, mpi_dist=None):
         stream_offsets,
         stream_gains,
         keep_indices,
+        stream_aux,
     ) = read_send_compressed(
         reader,
         global_shape,
@@ -189,9 +260,11 @@ def read_compressed(zgrp, keep=None, mpi_comm=None, mpi_dist=None):
         keep=keep,
         mpi_comm=mpi_comm,
         mpi_dist=mpi_dist,
+        read_gap=read_gap,
+        lazy=lazy,
     )
 
-    return (
+    result = (
         local_shape,
         global_shape,
         compressed,
@@ -203,6 +276,11 @@ def read_compressed(zgrp, keep=None, mpi_comm=None, mpi_dist=None):
         mpi_dist,
         keep_indices,
     )
+    if return_aux:
+        if local_shape is not None:
+            stream_aux.update(aux_params)
+        result += (stream_aux,)
+    return result
 
 
 @function_timer
@@ -215,6 +293,8 @@ def read_array(
     mpi_dist=None,
     use_threads=False,
     no_flatten=False,
+    verify=False,
+    read_gap=None,
 ):
     """Read compressed data directly into an array.
 
@@ -251,6 +331,10 @@ def read_array(
             This is only beneficial for large arrays.
         no_flatten (bool):  If True, for single-stream arrays, leave the leading
             dimension of (1,) in the result.
+        verify (bool):  If True, check the compressed bytes of each stream against
+            the checksums written with the data before decoding.
+        read_gap (int):  The largest gap in bytes between kept streams which are
+            read together.  If None, the default in `io_common` is used.
 
     Returns:
         (array):  The loaded and decompressed data.  Or the array and the kept indices.
@@ -267,11 +351,14 @@ def read_array(
         stream_gains,
         mpi_dist,
         indices,
+        stream_aux,
     ) = read_compressed(
         zgrp,
         keep=keep,
         mpi_comm=mpi_comm,
         mpi_dist=mpi_dist,
+        read_gap=read_gap,
+        return_aux=True,
     )
 
     first_samp = None
@@ -294,6 +381,8 @@ def read_array(
         is_int64=(n_channel == 2),
         use_threads=use_threads,
         no_flatten=no_flatten,
+        stream_aux=stream_aux,
+        verify=verify,
     )
     if keep_indices:
         return arr, indices
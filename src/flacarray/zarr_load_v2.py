@@ -0,0 +1,14 @@
+# Copyright (c) 2024-2025 by the parties listed in the AUTHORS file.
+# All rights reserved.  Use of this source code is governed by
+# a BSD-style license that can be found in the LICENSE file.
+"""Loading functions for Zarr format version 2.
+
+Version 2 has the same layout as version 1, and is written for data which older
+version 1 loaders would decode incorrectly.  The version 1 loader handles both.
+
+This module should only be imported on-demand by the higher-level read / write
+functions.
+
+"""
+
+from .zarr_load_v1 import zarr_names, read_compressed, read_array